@@ -0,0 +1,157 @@
+// Runs a game headless for a fixed number of cycles and prints the results as
+// JSON, so runs can be compared across commits. Budgets are in emulated cycles,
+// never in wall time, so the same ROM always does the same work.
+// Usage: n64tkp_bench <ipl> <rom> [--cycles N | --frames N] [--mode interpreter|cached|recompiler|functional]
+//                    [--rsp synchronous|threaded] [--hle off|gfx|audio|gfx,audio]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+#include "core/n64_impl.hxx"
+
+using TKPEmu::N64::N64;
+using TKPEmu::N64::Devices::CPUMode;
+using TKPEmu::N64::Devices::RSPMode;
+
+namespace {
+    struct ModeName {
+        const char* name;
+        CPUMode mode;
+    };
+    constexpr ModeName MODES[] = {
+        { "interpreter", CPUMode::Interpreter },
+        { "cached", CPUMode::CachedInterpreter },
+        { "recompiler", CPUMode::Recompiler },
+        { "functional", CPUMode::Functional },
+    };
+
+    int usage(const char* name) {
+        std::fprintf(stderr, "Usage: %s <ipl> <rom> [--cycles N | --frames N] "
+            "[--mode interpreter|cached|recompiler|functional] [--rsp synchronous|threaded] [--hle off|gfx|audio|gfx,audio]\n", name);
+        return 1;
+    }
+
+    // Paths end up in the output as is, escape what JSON needs escaped
+    std::string json_string(const char* str) {
+        std::string result = "\"";
+        for (; *str; ++str) {
+            if (*str == '"' || *str == '\\') {
+                result += '\\';
+                result += *str;
+            } else if (static_cast<unsigned char>(*str) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", *str);
+                result += escaped;
+            } else {
+                result += *str;
+            }
+        }
+        return result + "\"";
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        return usage(argv[0]);
+    }
+    uint64_t cycles = 60 * N64::CYCLES_PER_FRAME;
+    const ModeName* mode = &MODES[1];
+    bool rsp_threaded = false;
+    bool graphics_hle = false;
+    bool audio_hle = false;
+    for (int i = 3; i < argc; i++) {
+        if (i + 1 == argc) {
+            return usage(argv[0]);
+        }
+        if (std::strcmp(argv[i], "--cycles") == 0) {
+            cycles = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "--frames") == 0) {
+            cycles = std::strtoull(argv[++i], nullptr, 0) * N64::CYCLES_PER_FRAME;
+        } else if (std::strcmp(argv[i], "--mode") == 0) {
+            ++i;
+            mode = nullptr;
+            for (const auto& candidate : MODES) {
+                if (std::strcmp(argv[i], candidate.name) == 0) {
+                    mode = &candidate;
+                }
+            }
+            if (!mode) {
+                return usage(argv[0]);
+            }
+        } else if (std::strcmp(argv[i], "--rsp") == 0) {
+            ++i;
+            if (std::strcmp(argv[i], "threaded") == 0) {
+                rsp_threaded = true;
+            } else if (std::strcmp(argv[i], "synchronous") != 0) {
+                return usage(argv[0]);
+            }
+        } else if (std::strcmp(argv[i], "--hle") == 0) {
+            ++i;
+            if (std::strcmp(argv[i], "gfx") == 0 || std::strcmp(argv[i], "gfx,audio") == 0) {
+                graphics_hle = true;
+            }
+            if (std::strcmp(argv[i], "audio") == 0 || std::strcmp(argv[i], "gfx,audio") == 0) {
+                audio_hle = true;
+            }
+            if (!graphics_hle && !audio_hle && std::strcmp(argv[i], "off") != 0) {
+                return usage(argv[0]);
+            }
+        } else {
+            return usage(argv[0]);
+        }
+    }
+
+    auto n64 = std::make_unique<N64>();
+    if (!n64->LoadIPL(argv[1]) || !n64->LoadCartridge(argv[2])) {
+        std::fprintf(stderr, "Could not load %s or %s\n", argv[1], argv[2]);
+        return 1;
+    }
+    n64->SetCPUMode(mode->mode);
+    n64->SetRSPMode(rsp_threaded ? RSPMode::Threaded : RSPMode::Synchronous);
+    n64->SetGraphicsHLE(graphics_hle);
+    n64->SetAudioHLE(audio_hle);
+    n64->Reset();
+    auto start = std::chrono::steady_clock::now();
+#if defined(__x86_64__)
+    uint64_t start_tsc = __rdtsc();
+#endif
+    auto result = n64->RunCycles(cycles);
+#if defined(__x86_64__)
+    uint64_t tsc = __rdtsc() - start_tsc;
+#endif
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (result.reason == TKPEmu::N64::StopReason::Exception || result.reason == TKPEmu::N64::StopReason::Fault) {
+        std::fprintf(stderr, "Stopped after %llu cycles: %s\n", static_cast<unsigned long long>(result.cycles),
+            n64->GetLastError().c_str());
+        return 1;
+    }
+    // Every cycle that wasn't fast forwarded retires an instruction or stalls
+    uint64_t instructions = result.cycles - n64->GetIdleSkippedCycles();
+    std::printf("{\n");
+    std::printf("  \"ipl\": %s,\n", json_string(argv[1]).c_str());
+    std::printf("  \"rom\": %s,\n", json_string(argv[2]).c_str());
+    std::printf("  \"mode\": \"%s\",\n", mode->name);
+    std::printf("  \"rsp_mode\": \"%s\",\n", rsp_threaded ? "threaded" : "synchronous");
+    std::printf("  \"hle\": \"%s\",\n", graphics_hle ? (audio_hle ? "gfx,audio" : "gfx") : (audio_hle ? "audio" : "off"));
+    std::printf("  \"cycles\": %llu,\n", static_cast<unsigned long long>(result.cycles));
+    std::printf("  \"instructions\": %llu,\n", static_cast<unsigned long long>(instructions));
+    std::printf("  \"idle_skipped_cycles\": %llu,\n", static_cast<unsigned long long>(n64->GetIdleSkippedCycles()));
+    std::printf("  \"scheduler_events\": %llu,\n", static_cast<unsigned long long>(n64->GetEventCount()));
+    std::printf("  \"wall_seconds\": %.6f,\n", seconds);
+    std::printf("  \"mips\": %.3f,\n", instructions / seconds / 1e6);
+#if defined(__x86_64__)
+    std::printf("  \"host_cycles_per_instruction\": %.3f,\n", instructions ? static_cast<double>(tsc) / instructions : 0.0);
+#else
+    // No time stamp counter to read
+    std::printf("  \"host_cycles_per_instruction\": null,\n");
+#endif
+    std::printf("  \"state_hash\": \"%016llx\"\n", static_cast<unsigned long long>(n64->GetStateHash()));
+    std::printf("}\n");
+    return 0;
+}
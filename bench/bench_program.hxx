@@ -0,0 +1,106 @@
+#pragma once
+#ifndef TKP_N64_BENCH_PROGRAM_H
+#define TKP_N64_BENCH_PROGRAM_H
+// Helpers shared by the benchmarks that run small hand assembled programs
+// as the IPL, through the public N64 interface only
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include "core/n64_impl.hxx"
+
+namespace TKPEmu::N64::Bench {
+    enum Reg { zero = 0, t0 = 8, t1, t2, t3, t4, t5, t6, t7, s0 = 16, s1, s2, s3, s4, s5, s6, s7 };
+
+    // A tiny assembler, only what the benchmarks use. Programs run from 0xBFC00000
+    class Program {
+    public:
+        void i_type(int op, int rs, int rt, int imm) {
+            words_.push_back((op << 26) | (rs << 21) | (rt << 16) | (imm & 0xFFFF));
+        }
+        void r_type(int rs, int rt, int rd, int sa, int func) {
+            words_.push_back((rs << 21) | (rt << 16) | (rd << 11) | (sa << 6) | func);
+        }
+        void lui(int rt, int imm) { i_type(0b001111, 0, rt, imm); }
+        void addiu(int rt, int rs, int imm) { i_type(0b001001, rs, rt, imm); }
+        void andi(int rt, int rs, int imm) { i_type(0b001100, rs, rt, imm); }
+        void addu(int rd, int rs, int rt) { r_type(rs, rt, rd, 0, 0b100001); }
+        void lbu(int rt, int offset, int base) { i_type(0b100100, base, rt, offset); }
+        void lw(int rt, int offset, int base) { i_type(0b100011, base, rt, offset); }
+        void sb(int rt, int offset, int base) { i_type(0b101000, base, rt, offset); }
+        void sw(int rt, int offset, int base) { i_type(0b101011, base, rt, offset); }
+        // Branch to an instruction index
+        void bne(int rs, int rt, size_t target) {
+            i_type(0b000101, rs, rt, static_cast<int>(target) - static_cast<int>(words_.size()) - 1);
+        }
+        void j(size_t target) { words_.push_back((0b000010 << 26) | (((0x1FC0'0000 + target * 4) >> 2) & 0x3FF'FFFF)); }
+        void nop() { words_.push_back(0); }
+        size_t here() const { return words_.size(); }
+        const std::vector<uint32_t>& words() const { return words_; }
+        // Big endian, like a real IPL dump
+        void save(const std::filesystem::path& path) const {
+            std::ofstream ofs(path, std::ios::binary);
+            for (uint32_t word : words_) {
+                uint32_t be = __builtin_bswap32(word);
+                ofs.write(reinterpret_cast<const char*>(&be), sizeof(be));
+            }
+        }
+    private:
+        std::vector<uint32_t> words_;
+    };
+
+    /**
+        Loads the program as the IPL of n64, with an empty 4KB cartridge. The
+        IPL is cached for the whole process, so only the first program a
+        process loads is actually used
+    */
+    inline bool load_program(N64& n64, const Program& program) {
+        auto dir = std::filesystem::temp_directory_path();
+        auto ipl_path = dir / "n64tkp_bench_ipl.bin";
+        auto rom_path = dir / "n64tkp_bench_rom.z64";
+        program.save(ipl_path);
+        std::ofstream(rom_path, std::ios::binary).write(std::vector<char>(0x1000).data(), 0x1000);
+        bool loaded = n64.LoadIPL(ipl_path.string()) && n64.LoadCartridge(rom_path.string());
+        std::filesystem::remove(ipl_path);
+        std::filesystem::remove(rom_path);
+        if (!loaded) {
+            std::fprintf(stderr, "Could not load the generated IPL\n");
+        }
+        return loaded;
+    }
+
+    /**
+        Runs the program for the given number of cycles in every CPU mode and
+        prints the time each took. Returns false if the program couldn't be
+        loaded or a mode stopped on a fault
+    */
+    inline bool run_all_modes(const Program& program, uint64_t cycles) {
+        using Devices::CPUMode;
+        const char* names[] = { "interpreter", "cached", "recompiler", "functional" };
+        CPUMode modes[] = { CPUMode::Interpreter, CPUMode::CachedInterpreter, CPUMode::Recompiler, CPUMode::Functional };
+        bool completed = true;
+        for (int i = 0; i < 4; i++) {
+            auto n64 = std::make_unique<N64>();
+            if (!load_program(*n64, program)) {
+                return false;
+            }
+            n64->SetCPUMode(modes[i]);
+            n64->Reset();
+            auto start = std::chrono::steady_clock::now();
+            auto result = n64->RunCycles(cycles);
+            auto end = std::chrono::steady_clock::now();
+            if (result.reason == StopReason::Exception || result.reason == StopReason::Fault) {
+                std::printf("%-12s stopped after %llu cycles: %s\n", names[i],
+                    static_cast<unsigned long long>(result.cycles), n64->GetLastError().c_str());
+                completed = false;
+                continue;
+            }
+            double ms = std::chrono::duration<double, std::milli>(end - start).count();
+            std::printf("%-12s %10.3f ms %8.2f Mcycles/s\n", names[i], ms, result.cycles / ms / 1000.0);
+        }
+        return completed;
+    }
+}
+#endif
@@ -0,0 +1,48 @@
+// Runs a loop dominated by LW, SW, LBU and SB to RDRAM in every CPU mode,
+// for comparing memory access paths. Usage: n64tkp_memory_bench [cycles]
+#include <cstdlib>
+#include "bench/bench_program.hxx"
+
+using namespace TKPEmu::N64::Bench;
+
+namespace {
+    // Checksums a 4KB buffer by words and by bytes and writes both back, over and over
+    Program memory_loop() {
+        Program p;
+        p.lui(s0, 0x8000);
+        p.addiu(s0, s0, 0x1000);
+        size_t outer = p.here();
+        p.addiu(s1, s0, 0);
+        p.addiu(s2, zero, 0x400);
+        size_t words = p.here();
+        p.lw(t0, 0, s1);
+        p.lw(t1, 4, s1);
+        p.addu(t2, t2, t0);
+        p.addu(t2, t2, t1);
+        p.sw(t2, 0, s1);
+        p.sw(t0, 4, s1);
+        p.addiu(s2, s2, -2);
+        p.bne(s2, zero, words);
+        p.addiu(s1, s1, 8);
+        p.addiu(s1, s0, 0);
+        p.addiu(s2, zero, 0x1000);
+        size_t bytes = p.here();
+        p.lbu(t0, 0, s1);
+        p.lbu(t1, 1, s1);
+        p.addu(t3, t3, t0);
+        p.addu(t3, t3, t1);
+        p.sb(t3, 0, s1);
+        p.sb(t0, 1, s1);
+        p.addiu(s2, s2, -2);
+        p.bne(s2, zero, bytes);
+        p.addiu(s1, s1, 2);
+        p.j(outer);
+        p.nop();
+        return p;
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t cycles = argc > 1 ? std::strtoull(argv[1], nullptr, 0) : 50'000'000;
+    return run_all_modes(memory_loop(), cycles) ? 0 : 1;
+}
@@ -0,0 +1,239 @@
+// Times the CPU's hot paths one at a time: address redirection, loads and
+// stores of every size, the instruction handlers, address translation,
+// scheduler churn and memory mapped register side effects. Instructions are
+// put straight into the pipeline latches, so no ROM is needed.
+// Usage: n64tkp_microbench [filter] [iterations]
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include "bench/bench_program.hxx"
+#include "core/n64_addresses.hxx"
+
+namespace TKPEmu::N64 {
+    class MicroBench {
+    public:
+        MicroBench(const char* filter, uint64_t iterations) :
+            filter_(filter), iterations_(iterations), n64_(std::make_unique<N64>()) {}
+
+        bool Run() {
+            using namespace Bench;
+            // Spins at the reset vector, the CPU is never run anyway
+            Program program;
+            program.j(0);
+            program.nop();
+            if (!load_program(*n64_, program)) {
+                return false;
+            }
+            n64_->Reset();
+            redirect_paddress();
+            load_store();
+            handlers();
+            translate();
+            scheduler();
+            invalidate_hwio();
+            return true;
+        }
+    private:
+        static constexpr int REPEATS = 5;
+        static constexpr uint32_t s0 = 16, t0 = 8, t1 = 9, t2 = 10;
+
+        static constexpr uint32_t i_type(uint32_t op, uint32_t rs, uint32_t rt, uint32_t imm) {
+            return (op << 26) | (rs << 21) | (rt << 16) | (imm & 0xFFFF);
+        }
+        static constexpr uint32_t r_type(uint32_t rs, uint32_t rt, uint32_t rd, uint32_t sa, uint32_t func) {
+            return (rs << 21) | (rt << 16) | (rd << 11) | (sa << 6) | func;
+        }
+        // Keeps the compiler from throwing away results nothing reads
+        template<class T>
+        static void keep(const T& value) {
+            asm volatile("" : : "g"(value) : "memory");
+        }
+
+        // Prints the best time per call out of REPEATS runs, timings are noisy
+        template<class Func>
+        void time(const char* group, const char* name, Func&& func) {
+            char label[64];
+            std::snprintf(label, sizeof(label), "%s %s", group, name);
+            if (filter_ && !std::strstr(label, filter_)) {
+                return;
+            }
+            // Some handlers are still unimplemented and fault
+            auto& fault = n64_->cpu_.fault_;
+            func(0);
+            if (fault.type != Devices::FaultType::None) {
+                std::printf("%-28s faulted\n", label);
+                fault = {};
+                return;
+            }
+            double best = std::numeric_limits<double>::max();
+            for (int repeat = 0; repeat < REPEATS; repeat++) {
+                auto start = std::chrono::steady_clock::now();
+                for (uint64_t i = 0; i < iterations_; i++) {
+                    func(i);
+                }
+                auto end = std::chrono::steady_clock::now();
+                best = std::min(best, std::chrono::duration<double, std::nano>(end - start).count());
+            }
+            std::printf("%-28s %8.2f ns\n", label, best / iterations_);
+        }
+
+        void redirect_paddress() {
+            auto& bus = n64_->cpubus_;
+            struct Region {
+                const char* name;
+                uint32_t paddr;
+                uint32_t stride;
+            };
+            const Region regions[] = {
+                { "rdram", 0x0000'1000, 4 },
+                { "rom", 0x1000'0000, 4 },
+                { "mmio", VI_V_CURRENT, 0 },
+                { "pif", 0x1FC0'07C4, 0 },
+            };
+            for (const auto& region : regions) {
+                time("redirect_paddress", region.name, [&](uint64_t i) {
+                    keep(bus.redirect_paddress(region.paddr + (i & 0xFF) * region.stride));
+                });
+            }
+        }
+
+        // Runs through EX, DC and WB, which is where load_memory and store_memory are called from
+        void load_store() {
+            auto& cpu = n64_->cpu_;
+            struct Access {
+                const char* name;
+                uint32_t op;
+            };
+            const Access accesses[] = {
+                { "LB", 0b100000 }, { "LBU", 0b100100 }, { "LH", 0b100001 }, { "LHU", 0b100101 },
+                { "LW", 0b100011 }, { "LWU", 0b100111 }, { "LD", 0b110111 },
+                { "SB", 0b101000 }, { "SH", 0b101001 }, { "SW", 0b101011 }, { "SD", 0b111111 },
+            };
+            for (const auto& access : accesses) {
+                uint32_t word = i_type(access.op, s0, t0, 0x10);
+                time("load_store", access.name, [&](uint64_t i) {
+                    cpu.gpr_regs_[s0].UD = 0xFFFF'FFFF'8000'1000;
+                    cpu.gpr_regs_[t0].UD = i;
+                    cpu.execute_isolated(word, 0x8000'0000);
+                    keep(cpu.gpr_regs_[t0].UD);
+                });
+            }
+        }
+
+        // Calls each handler with the instruction and operands already in the RF/EX latch
+        void handlers() {
+            auto& cpu = n64_->cpu_;
+            struct Handler {
+                const char* name;
+                uint32_t word;
+            };
+            const Handler handlers[] = {
+                { "ADDIU", i_type(0b001001, t1, t0, 0x1234) }, { "SLTI", i_type(0b001010, t1, t0, 0x1234) },
+                { "SLTIU", i_type(0b001011, t1, t0, 0x1234) }, { "ANDI", i_type(0b001100, t1, t0, 0x1234) },
+                { "ORI", i_type(0b001101, t1, t0, 0x1234) }, { "XORI", i_type(0b001110, t1, t0, 0x1234) },
+                { "LUI", i_type(0b001111, t1, t0, 0x1234) }, { "DADDIU", i_type(0b011001, t1, t0, 0x1234) },
+                { "SLL", r_type(0, t2, t0, 5, 0b000000) }, { "SRL", r_type(0, t2, t0, 5, 0b000010) },
+                { "SRA", r_type(0, t2, t0, 5, 0b000011) }, { "SLLV", r_type(t1, t2, t0, 0, 0b000100) },
+                { "SRLV", r_type(t1, t2, t0, 0, 0b000110) }, { "SRAV", r_type(t1, t2, t0, 0, 0b000111) },
+                { "DSLLV", r_type(t1, t2, t0, 0, 0b010100) }, { "DSLL", r_type(0, t2, t0, 5, 0b111000) },
+                { "DSRL", r_type(0, t2, t0, 5, 0b111010) }, { "DSRA", r_type(0, t2, t0, 5, 0b111011) },
+                { "DSLL32", r_type(0, t2, t0, 5, 0b111100) }, { "DSRL32", r_type(0, t2, t0, 5, 0b111110) },
+                { "DSRA32", r_type(0, t2, t0, 5, 0b111111) },
+                { "ADDU", r_type(t1, t2, t0, 0, 0b100001) }, { "SUBU", r_type(t1, t2, t0, 0, 0b100011) },
+                { "AND", r_type(t1, t2, t0, 0, 0b100100) }, { "OR", r_type(t1, t2, t0, 0, 0b100101) },
+                { "XOR", r_type(t1, t2, t0, 0, 0b100110) }, { "NOR", r_type(t1, t2, t0, 0, 0b100111) },
+                { "SLT", r_type(t1, t2, t0, 0, 0b101010) }, { "SLTU", r_type(t1, t2, t0, 0, 0b101011) },
+                { "DADDU", r_type(t1, t2, t0, 0, 0b101101) }, { "DSUBU", r_type(t1, t2, t0, 0, 0b101111) },
+                { "MULT", r_type(t1, t2, 0, 0, 0b011000) }, { "MULTU", r_type(t1, t2, 0, 0, 0b011001) },
+                { "DIV", r_type(t1, t2, 0, 0, 0b011010) }, { "DIVU", r_type(t1, t2, 0, 0, 0b011011) },
+                { "DMULT", r_type(t1, t2, 0, 0, 0b011100) }, { "DMULTU", r_type(t1, t2, 0, 0, 0b011101) },
+                { "DDIV", r_type(t1, t2, 0, 0, 0b011110) }, { "DDIVU", r_type(t1, t2, 0, 0, 0b011111) },
+                { "MFHI", r_type(0, 0, t0, 0, 0b010000) }, { "MFLO", r_type(0, 0, t0, 0, 0b010010) },
+                { "MTHI", r_type(t1, 0, 0, 0, 0b010001) }, { "MTLO", r_type(t1, 0, 0, 0, 0b010011) },
+            };
+            // Nonzero so the divisions don't take their divide by zero paths
+            constexpr uint64_t operands[8] = {
+                1, 7, 0x1234'5678, 0xFFFF'FFFF'FFFF'FFFF, 0x8000'0000, 0x7FFF'FFFF, 0xFFFF'FFFF'8000'0000, 0x0123'4567'89AB'CDEF,
+            };
+            for (const auto& handler : handlers) {
+                Instruction instr;
+                instr.Full = handler.word;
+                auto& latch = cpu.rfex_latch_;
+                latch.instruction = instr;
+                latch.handler = Devices::CPU::resolve_handler(instr);
+                latch.fetched_rt_i = instr.RType.rt;
+                time("handler", handler.name, [&](uint64_t i) {
+                    latch.fetched_rs.UD = operands[i & 7];
+                    latch.fetched_rt.UD = operands[(i + 3) & 7];
+                    latch.handler(&cpu);
+                    keep(cpu.exdc_latch_);
+                });
+            }
+        }
+
+        void translate() {
+            auto& cpu = n64_->cpu_;
+            // A global pair of 4KB pages at 0x00400000, backed by physical 0x1000-0x2FFF
+            cpu.cp0_regs_[CP0_PAGEMASK].UD = 0;
+            cpu.cp0_regs_[CP0_ENTRYHI].UD = 0x0040'0000;
+            cpu.cp0_regs_[CP0_ENTRYLO0].UD = (1 << 6) | 0b111;
+            cpu.cp0_regs_[CP0_ENTRYLO1].UD = (2 << 6) | 0b111;
+            cpu.tlb_write(0);
+            time("translate", "mapped", [&](uint64_t i) {
+                keep(cpu.translate_mapped(0x0040'0000 + (i & 0x1FFF), false));
+            });
+            time("translate", "tlb", [&](uint64_t i) {
+                keep(cpu.translate_tlb(0x0040'0000 + (i & 0x1FFF), false));
+            });
+        }
+
+        // Events that only raise MI interrupts, which stay masked
+        void scheduler() {
+            auto& cpu = n64_->cpu_;
+            constexpr SchedulerEventType types[] = {
+                SchedulerEventType::Sp, SchedulerEventType::Si, SchedulerEventType::Ai,
+                SchedulerEventType::Pi, SchedulerEventType::Dp,
+            };
+            cpu.cpubus_.mi_mask_ = 0;
+            time("scheduler", "queue+handle", [&](uint64_t i) {
+                cpu.queue_event(types[i % 5], static_cast<int>((i * 7) & 63) + 1);
+                cpu.handle_event();
+            });
+            cpu.scheduler_.Clear();
+        }
+
+        void invalidate_hwio() {
+            auto& cpu = n64_->cpu_;
+            struct Register {
+                const char* name;
+                uint32_t addr;
+            };
+            const Register registers[] = {
+                { "none", 0x0000'1000 },
+                { "plain", RI_SELECT },
+                { "handler", MI_MASK },
+            };
+            for (const auto& reg : registers) {
+                time("invalidate_hwio", reg.name, [&](uint64_t) {
+                    // Zero stores skip the handler, 0b10 sets the SP mask bit
+                    uint64_t data = 0b10;
+                    cpu.invalidate_hwio(reg.addr, data);
+                    keep(data);
+                });
+            }
+        }
+
+        const char* filter_;
+        uint64_t iterations_;
+        std::unique_ptr<N64> n64_;
+    };
+}
+
+int main(int argc, char** argv) {
+    const char* filter = argc > 1 ? argv[1] : nullptr;
+    uint64_t iterations = argc > 2 ? std::strtoull(argv[2], nullptr, 0) : 1'000'000;
+    TKPEmu::N64::MicroBench bench(filter, iterations);
+    return bench.Run() ? 0 : 1;
+}
@@ -0,0 +1,49 @@
+// Runs a synthetic boot sequence that sets up RI, PI and VI, polls status
+// registers and clears RDRAM, the way IPL3 and libultra init do, in every
+// CPU mode. Usage: n64tkp_mmio_bench [cycles]
+#include <cstdlib>
+#include "bench/bench_program.hxx"
+
+using namespace TKPEmu::N64::Bench;
+
+namespace {
+    Program boot_sequence() {
+        Program p;
+        p.lui(t0, 0xA470); // RI
+        p.lui(t1, 0xA460); // PI
+        p.lui(t2, 0xA480); // SI
+        p.lui(t3, 0xA440); // VI
+        p.lui(s0, 0xA000); // RDRAM, uncached
+        p.addiu(t4, zero, 1);
+        size_t outer = p.here();
+        p.sw(t4, 0x00, t0); // RI_MODE
+        p.sw(t4, 0x04, t0); // RI_CONFIG
+        p.sw(t4, 0x0C, t0); // RI_SELECT
+        p.lw(t5, 0x08, t0); // RI_CURRENT_LOAD
+        p.sw(t4, 0x14, t1); // PI_BSD_DOM1_*
+        p.sw(t4, 0x18, t1);
+        p.sw(t4, 0x1C, t1);
+        p.sw(t4, 0x20, t1);
+        p.lw(t5, 0x10, t1); // PI_STATUS
+        p.lw(t5, 0x18, t2); // SI_STATUS
+        p.sw(t4, 0x00, t3); // VI_CTRL
+        p.sw(t4, 0x14, t3); // VI_BURST
+        p.lw(t5, 0x10, t3); // VI_V_CURRENT
+        // Clear 256 bytes of RDRAM
+        p.addiu(s2, zero, 64);
+        p.addiu(s3, s0, 0);
+        size_t clear = p.here();
+        p.sw(zero, 0, s3);
+        p.addiu(s2, s2, -1);
+        p.bne(s2, zero, clear);
+        p.addiu(s3, s3, 4);
+        p.j(outer);
+        p.nop();
+        return p;
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t cycles = argc > 1 ? std::strtoull(argv[1], nullptr, 0) : 50'000'000;
+    return run_all_modes(boot_sequence(), cycles) ? 0 : 1;
+}
@@ -0,0 +1,43 @@
+// Runs a game in functional mode and prints the instruction pairs that ran
+// back to back most often, to pick which ones CPU::fuse_instructions handles.
+// Usage: n64tkp_pair_histogram <ipl> <rom> [cycles] [pairs]
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include "core/n64_impl.hxx"
+
+using TKPEmu::N64::N64;
+using TKPEmu::N64::Devices::CPUMode;
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::fprintf(stderr, "Usage: %s <ipl> <rom> [cycles] [pairs]\n", argv[0]);
+        return 1;
+    }
+    uint64_t cycles = argc > 3 ? std::strtoull(argv[3], nullptr, 0) : 500'000'000;
+    size_t pairs = argc > 4 ? std::strtoull(argv[4], nullptr, 0) : 40;
+    auto n64 = std::make_unique<N64>();
+    if (!n64->LoadIPL(argv[1]) || !n64->LoadCartridge(argv[2])) {
+        std::fprintf(stderr, "Could not load %s or %s\n", argv[1], argv[2]);
+        return 1;
+    }
+    n64->SetCPUMode(CPUMode::Functional);
+    n64->Reset();
+    auto result = n64->RunCycles(cycles);
+    if (result.reason == TKPEmu::N64::StopReason::Exception || result.reason == TKPEmu::N64::StopReason::Fault) {
+        // The pairs that ran up to that point are still worth printing
+        std::fprintf(stderr, "Stopped after %llu cycles: %s\n", static_cast<unsigned long long>(result.cycles),
+            n64->GetLastError().c_str());
+    }
+    auto histogram = n64->GetOpcodePairHistogram();
+    uint64_t total = 0;
+    for (const auto& pair : histogram) {
+        total += pair.count;
+    }
+    for (size_t i = 0; i < histogram.size() && i < pairs; i++) {
+        const auto& pair = histogram[i];
+        std::printf("%-8s %-8s %14llu %6.2f%%\n", pair.first.c_str(), pair.second.c_str(),
+            static_cast<unsigned long long>(pair.count), total ? 100.0 * pair.count / total : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+// Compares the slot scheduler against the binary heap it replaced under a
+// VI + Count + PI DMA heavy workload. Usage: n64tkp_scheduler_bench [batches]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <vector>
+#include "core/n64_scheduler.hxx"
+
+using TKPEmu::N64::Devices::Scheduler;
+
+namespace {
+    constexpr uint64_t FRAME_CYCLES = 93'750'000 / 60;
+    constexpr uint64_t BATCH_CYCLES = 1024;
+
+    class SchedulerCompare {
+    public:
+        bool operator() (SchedulerEvent eventl, SchedulerEvent eventr) {
+            return eventl.time > eventr.time;
+        }
+    };
+
+    // The old scheduler: duplicates pile up and stale Count events are skipped when popped
+    class HeapScheduler {
+    public:
+        void Schedule(SchedulerEventType type, uint64_t time) {
+            heap_.push({ type, time });
+        }
+        uint64_t GetNextDeadline() const {
+            return heap_.empty() ? Scheduler::NEVER : heap_.top().time;
+        }
+        SchedulerEvent Pop() {
+            SchedulerEvent event = heap_.top();
+            heap_.pop();
+            return event;
+        }
+    private:
+        std::priority_queue<SchedulerEvent, std::vector<SchedulerEvent>, SchedulerCompare> heap_;
+    };
+
+    struct Result {
+        uint64_t handled = 0;
+        uint64_t stale = 0;
+        double ms = 0;
+    };
+
+    template<class T>
+    Result run(uint64_t batches) {
+        T scheduler;
+        Result result;
+        uint64_t time = 0;
+        uint64_t compare = 0;
+        uint32_t rng = 0x1234'5678;
+        auto next_random = [&rng]() {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            return rng;
+        };
+        scheduler.Schedule(SchedulerEventType::Vi, FRAME_CYCLES);
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < batches; i++) {
+            uint64_t horizon = std::min(time + BATCH_CYCLES, scheduler.GetNextDeadline());
+            time = horizon;
+            while (time >= scheduler.GetNextDeadline()) {
+                SchedulerEvent event = scheduler.Pop();
+                switch (event.type) {
+                    case SchedulerEventType::Count: {
+                        if ((event.time >> 1) != compare) {
+                            ++result.stale;
+                            continue;
+                        }
+                        break;
+                    }
+                    case SchedulerEventType::Vi: {
+                        scheduler.Schedule(SchedulerEventType::Vi, time + FRAME_CYCLES);
+                        scheduler.Schedule(SchedulerEventType::Interrupt, time);
+                        break;
+                    }
+                    case SchedulerEventType::Pi: {
+                        scheduler.Schedule(SchedulerEventType::Interrupt, time);
+                        break;
+                    }
+                    default:
+                        break;
+                }
+                ++result.handled;
+            }
+            // What the guest does during the batch
+            uint32_t action = next_random();
+            if ((action & 0b11) == 0) {
+                // PI DMA, finishes after a length dependent delay
+                scheduler.Schedule(SchedulerEventType::Pi, time + 64 + ((action >> 8) & 0x3FFF));
+            }
+            if ((action & 0b1100) == 0) {
+                // MTC0 COMPARE, moves the pending Count event
+                compare = (time >> 1) + 1 + ((action >> 16) & 0xFFFF);
+                scheduler.Schedule(SchedulerEventType::Count, compare * 2);
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        result.ms = std::chrono::duration<double, std::milli>(end - start).count();
+        return result;
+    }
+
+    void print(const char* name, const Result& result, uint64_t batches) {
+        std::printf("%-6s %10.3f ms %8.2f ns/batch handled=%llu stale=%llu\n", name, result.ms,
+            result.ms * 1e6 / batches, static_cast<unsigned long long>(result.handled),
+            static_cast<unsigned long long>(result.stale));
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t batches = argc > 1 ? std::strtoull(argv[1], nullptr, 0) : 20'000'000;
+    Result heap = run<HeapScheduler>(batches);
+    Result slots = run<Scheduler>(batches);
+    print("heap", heap, batches);
+    print("slots", slots, batches);
+    return 0;
+}
@@ -0,0 +1,637 @@
+#include "n64_audio_hle.hxx"
+#include <algorithm>
+#include <cstring>
+#include "n64_log.hxx"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace TKPEmu::N64::Devices {
+    namespace {
+        // OSTask fields, at the end of DMEM
+        constexpr uint32_t TASK_TYPE = 0xFC0;
+        constexpr uint32_t TASK_UCODE_DATA = 0xFD8;
+        constexpr uint32_t TASK_DATA_PTR = 0xFF0;
+        constexpr uint32_t TASK_DATA_SIZE = 0xFF4;
+        constexpr uint32_t M_AUDTASK = 2;
+        // Command lists longer than this are cut short
+        constexpr uint32_t MAX_COMMANDS = 0x4000;
+        // Buffer offsets in commands are relative to this
+        constexpr uint32_t DMEM_BASE = 0x5C0;
+
+        enum AudioFlags : uint8_t {
+            A_INIT = 0x01,
+            A_LOOP = 0x02,
+            A_LEFT = 0x02,
+            A_VOL = 0x04,
+            A_AUX = 0x08,
+        };
+
+        // What ENVMIXER keeps in RDRAM between tasks, the game only hands out the address
+        struct EnvelopeState {
+            int16_t wet;
+            int16_t dry;
+            int32_t target[2];
+            int32_t rate[2];
+            int32_t sequence[2];
+            int32_t value[2];
+        };
+        static_assert(sizeof(EnvelopeState) % 4 == 0);
+
+        // 4 tap Catmull-Rom filter in Q15, for 64 positions between the middle two taps
+        constexpr auto RESAMPLE_TABLE = [] {
+            std::array<std::array<int16_t, 4>, 64> table {};
+            for (int i = 0; i < 64; i++) {
+                double p = i / 64.0, p2 = p * p, p3 = p2 * p;
+                double taps[4] = {
+                    (-p3 + 2 * p2 - p) / 2,
+                    (3 * p3 - 5 * p2 + 2) / 2,
+                    (-3 * p3 + 4 * p2 + p) / 2,
+                    (p3 - p2) / 2,
+                };
+                for (int t = 0; t < 4; t++) {
+                    double scaled = taps[t] * 32768.0;
+                    scaled += scaled < 0 ? -0.5 : 0.5;
+                    table[i][t] = static_cast<int16_t>(std::clamp(scaled, -32768.0, 32767.0));
+                }
+            }
+            return table;
+        }();
+
+        uint32_t read_dmem32(const uint8_t* dmem, uint32_t offset) {
+            uint32_t value;
+            std::memcpy(&value, dmem + offset, sizeof(value));
+            return value;
+        }
+
+        uint32_t buffer_address(uint32_t offset) {
+            return (offset + DMEM_BASE) & 0xFFF;
+        }
+
+        constexpr uint32_t align(uint32_t value, uint32_t alignment) {
+            return (value + alignment - 1) & ~(alignment - 1);
+        }
+
+        int16_t clamp16(int32_t value) {
+            return static_cast<int16_t>(std::clamp<int32_t>(value, -0x8000, 0x7FFF));
+        }
+
+        // Moves value a step towards target, the volume is the top half
+        int16_t ramp(int32_t& value, int32_t target, int32_t& step) {
+            value = static_cast<int32_t>(static_cast<int64_t>(value) + step);
+            if (step <= 0 ? value <= target : value >= target) {
+                value = target;
+                step = 0;
+            }
+            return static_cast<int16_t>(value >> 16);
+        }
+
+#if defined(__SSE2__)
+        // sum += a * b, widened to 32 bits
+        void multiply_add(__m128i a, __m128i b, __m128i& sum_lo, __m128i& sum_hi) {
+            __m128i lo = _mm_mullo_epi16(a, b), hi = _mm_mulhi_epi16(a, b);
+            sum_lo = _mm_add_epi32(sum_lo, _mm_unpacklo_epi16(lo, hi));
+            sum_hi = _mm_add_epi32(sum_hi, _mm_unpackhi_epi16(lo, hi));
+        }
+
+        // sum += (a * b) >> 15, widened to 32 bits
+        void multiply_add_q15(__m128i a, __m128i b, __m128i& sum_lo, __m128i& sum_hi) {
+            __m128i lo = _mm_mullo_epi16(a, b), hi = _mm_mulhi_epi16(a, b);
+            sum_lo = _mm_add_epi32(sum_lo, _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15));
+            sum_hi = _mm_add_epi32(sum_hi, _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 15));
+        }
+#endif
+
+        // dst = clamp(dst + ((src * gains) >> 15)) for 8 samples
+        void mix8(uint8_t* dst, const uint8_t* src, const int16_t* gains) {
+#if defined(__SSE2__)
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst));
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+            __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gains));
+            // Sign extend dst to 32 bits
+            __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(d, d), 16);
+            __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(d, d), 16);
+            multiply_add_q15(s, g, lo, hi);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packs_epi32(lo, hi));
+#else
+            int16_t d[8], s[8];
+            std::memcpy(d, dst, sizeof(d));
+            std::memcpy(s, src, sizeof(s));
+            for (int i = 0; i < 8; i++) {
+                d[i] = clamp16(d[i] + ((s[i] * gains[i]) >> 15));
+            }
+            std::memcpy(dst, d, sizeof(d));
+#endif
+        }
+
+        /**
+         * out[i] = clamp((x[i] * gain + c1[i] * l1 + c2[i] * l2 + the sum of
+         * c3[k] * x[i - 1 - k] for k < i) >> shift) with 32-bit sums, the
+         * order 2 predictor ADPCM decoding and the pole filter share
+         */
+        void filter8(const int16_t* x, uint32_t gain, const int16_t* c1, int16_t l1, const int16_t* c2, int16_t l2,
+                const int16_t* c3, int shift, int16_t* out) {
+#if defined(__SSE2__)
+            __m128i xs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x));
+            __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+            // gain is up to 0xFFFF, halved it fits a signed multiply
+            multiply_add(xs, _mm_set1_epi16(gain >> 1), lo, hi);
+            lo = _mm_add_epi32(lo, lo);
+            hi = _mm_add_epi32(hi, hi);
+            if (gain & 1) {
+                multiply_add(xs, _mm_set1_epi16(1), lo, hi);
+            }
+            multiply_add(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c1)), _mm_set1_epi16(l1), lo, hi);
+            multiply_add(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c2)), _mm_set1_epi16(l2), lo, hi);
+            // Lane i of x shifted up by k + 1 lanes is x[i - 1 - k], zero past the start
+            multiply_add(_mm_slli_si128(xs, 2), _mm_set1_epi16(c3[0]), lo, hi);
+            multiply_add(_mm_slli_si128(xs, 4), _mm_set1_epi16(c3[1]), lo, hi);
+            multiply_add(_mm_slli_si128(xs, 6), _mm_set1_epi16(c3[2]), lo, hi);
+            multiply_add(_mm_slli_si128(xs, 8), _mm_set1_epi16(c3[3]), lo, hi);
+            multiply_add(_mm_slli_si128(xs, 10), _mm_set1_epi16(c3[4]), lo, hi);
+            multiply_add(_mm_slli_si128(xs, 12), _mm_set1_epi16(c3[5]), lo, hi);
+            multiply_add(_mm_slli_si128(xs, 14), _mm_set1_epi16(c3[6]), lo, hi);
+            __m128i count = _mm_cvtsi32_si128(shift);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packs_epi32(_mm_sra_epi32(lo, count), _mm_sra_epi32(hi, count)));
+#else
+            for (int i = 0; i < 8; i++) {
+                uint32_t sum = static_cast<uint32_t>(x[i]) * gain + c1[i] * l1 + c2[i] * l2;
+                for (int k = 0; k < i; k++) {
+                    sum += c3[k] * x[i - 1 - k];
+                }
+                out[i] = clamp16(static_cast<int32_t>(sum) >> shift);
+            }
+#endif
+        }
+
+        // out[i] = clamp of the sum of (taps[t][i] * coefficients[t][i]) >> 15 over the 4 taps
+        void resample8(const int16_t (*taps)[8], const int16_t (*coefficients)[8], int16_t* out) {
+#if defined(__SSE2__)
+            __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+            for (int t = 0; t < 4; t++) {
+                multiply_add_q15(_mm_load_si128(reinterpret_cast<const __m128i*>(taps[t])),
+                    _mm_load_si128(reinterpret_cast<const __m128i*>(coefficients[t])), lo, hi);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packs_epi32(lo, hi));
+#else
+            for (int i = 0; i < 8; i++) {
+                int32_t sum = 0;
+                for (int t = 0; t < 4; t++) {
+                    sum += (taps[t][i] * coefficients[t][i]) >> 15;
+                }
+                out[i] = clamp16(sum);
+            }
+#endif
+        }
+
+        /**
+         * 8 left and 8 right samples to 8 left/right pairs. DMEM keeps the two
+         * halfwords of a word swapped, so the pairs are written R0 L0 R1 L1
+         */
+        void interleave8(uint8_t* dst, const uint8_t* left, const uint8_t* right) {
+#if defined(__SSE2__)
+            __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left));
+            __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(right));
+            // Both inputs come as swapped pairs too, swapping the words back fixes up both
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_shuffle_epi32(_mm_unpacklo_epi16(r, l), 0xB1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_shuffle_epi32(_mm_unpackhi_epi16(r, l), 0xB1));
+#else
+            int16_t l[8], r[8], out[16];
+            std::memcpy(l, left, sizeof(l));
+            std::memcpy(r, right, sizeof(r));
+            for (int i = 0; i < 8; i += 2) {
+                out[i * 2] = r[i + 1];
+                out[i * 2 + 1] = l[i + 1];
+                out[i * 2 + 2] = r[i];
+                out[i * 2 + 3] = l[i];
+            }
+            std::memcpy(dst, out, sizeof(out));
+#endif
+        }
+    }
+
+    bool AudioHLE::Detect(std::span<const uint8_t> rdram, uint32_t ucode_data) {
+        auto read = [rdram](uint32_t address) {
+            uint32_t value;
+            std::memcpy(&value, rdram.data() + (address & (rdram.size() - 1) & ~3u), sizeof(value));
+            return value;
+        };
+        // The same words identify the microcode's data in every game that uses it,
+        // the variants in GoldenEye, Blast Corps and Diddy Kong Racing differ at 0x28
+        return read(ucode_data) == 0x0000'0001 && read(ucode_data + 0x30) == 0xF000'0F00 &&
+            read(ucode_data + 0x28) == 0x1E24'138C;
+    }
+
+    bool AudioHLE::Run(const uint8_t* dmem, std::span<uint8_t> rdram) {
+        if (read_dmem32(dmem, TASK_TYPE) != M_AUDTASK || !Detect(rdram, read_dmem32(dmem, TASK_UCODE_DATA))) {
+            return false;
+        }
+        rdram_ = rdram;
+        reset();
+        uint32_t address = read_dmem32(dmem, TASK_DATA_PTR);
+        uint32_t commands = read_dmem32(dmem, TASK_DATA_SIZE) / 8;
+        if (commands > MAX_COMMANDS) [[unlikely]] {
+            N64_LOG(RSP, "Audio command list at %x is too long", address);
+            commands = MAX_COMMANDS;
+        }
+        for (uint32_t i = 0; i < commands; i++) {
+            execute(read32(address + i * 8), read32(address + i * 8 + 4));
+        }
+        return true;
+    }
+
+    void AudioHLE::reset() {
+        // The microcode starts every task from scratch, voices keep their state in RDRAM
+        buffer_.fill(0);
+        segments_.fill(0);
+        table_.fill(0);
+        in_ = out_ = count_ = 0;
+        dry_right_ = wet_left_ = wet_right_ = 0;
+        dry_ = wet_ = 0;
+        volume_ = {};
+        target_ = {};
+        rate_ = {};
+        loop_ = 0;
+        written_.clear();
+    }
+
+    void AudioHLE::execute(uint32_t w0, uint32_t w1) {
+        uint8_t flags = w0 >> 16;
+        switch ((w0 >> 24) & 0x7F) {
+            case 0x00: break; // A_SPNOOP
+            case 0x01: adpcm(flags & A_INIT, flags & A_LOOP, out_, in_, align(count_, 32), segment_address(w1)); break;
+            case 0x02: clear(buffer_address(w0), align(w1 & 0xFFF, 16)); break;
+            case 0x03: envelope_mix(flags & A_INIT, flags & A_AUX, segment_address(w1)); break;
+            case 0x04: load(in_, segment_address(w1), count_); break;
+            case 0x05: resample(flags & A_INIT, out_, in_, align(count_, 16), (w0 & 0xFFFF) << 1, segment_address(w1)); break;
+            case 0x06: save(out_, segment_address(w1), count_); break;
+            case 0x07: segments_[(w1 >> 24) & 15] = w1 & 0xFF'FFFF; break;
+            case 0x08: {
+                // A_SETBUFF, the aux flag sets the other outputs of ENVMIXER
+                if (flags & A_AUX) {
+                    dry_right_ = buffer_address(w0);
+                    wet_left_ = buffer_address(w1 >> 16);
+                    wet_right_ = buffer_address(w1);
+                } else {
+                    in_ = buffer_address(w0);
+                    out_ = buffer_address(w1 >> 16);
+                    count_ = w1 & 0xFFFF;
+                }
+                break;
+            }
+            case 0x09: {
+                // A_SETVOL
+                if (flags & A_AUX) {
+                    dry_ = static_cast<int16_t>(w0);
+                    wet_ = static_cast<int16_t>(w1);
+                    break;
+                }
+                uint32_t side = (flags & A_LEFT) ? 0 : 1;
+                if (flags & A_VOL) {
+                    volume_[side] = static_cast<int16_t>(w0);
+                } else {
+                    target_[side] = static_cast<int16_t>(w0);
+                    rate_[side] = static_cast<int32_t>(w1);
+                }
+                break;
+            }
+            case 0x0A: move(buffer_address(w1 >> 16), buffer_address(w0), align(w1 & 0xFFFF, 16)); break;
+            case 0x0B: {
+                // A_LOADADPCM
+                uint32_t address = segment_address(w1);
+                uint32_t count = std::min<uint32_t>(align(w0 & 0xFFFF, 8) / 2, table_.size());
+                for (uint32_t i = 0; i < count; i++) {
+                    table_[i] = read16(address + i * 2);
+                }
+                break;
+            }
+            case 0x0C: mix(buffer_address(w1), buffer_address(w1 >> 16), align(count_, 32), static_cast<int16_t>(w0)); break;
+            case 0x0D: interleave(out_, buffer_address(w1 >> 16), buffer_address(w1), align(count_, 16)); break;
+            case 0x0E: pole_filter(flags & A_INIT, out_, in_, align(count_, 16), static_cast<uint16_t>(w0), segment_address(w1)); break;
+            case 0x0F: loop_ = segment_address(w1); break;
+            default: {
+                N64_LOG(RSP, "Unknown audio command %08x %08x", w0, w1);
+                break;
+            }
+        }
+    }
+
+    void AudioHLE::adpcm(bool init, bool loop, uint32_t dmemo, uint32_t dmemi, uint32_t count, uint32_t address) {
+        // The last frame decoded, the next one is predicted from its last two samples
+        alignas(16) int16_t last[16] = {};
+        if (!init) {
+            uint32_t from = loop ? loop_ : address;
+            for (uint32_t i = 0; i < 16; i++) {
+                last[i] = read16(from + i * 2);
+            }
+        }
+        for (uint32_t i = 0; i < 16; i++) {
+            set_sample(dmemo + i * 2, last[i]);
+        }
+        dmemo += 32;
+        // A frame is a header byte and 16 4-bit samples, decoded to 16 samples
+        for (; count != 0; count -= 32) {
+            uint8_t header = get_byte(dmemi);
+            uint32_t scale = header >> 4;
+            uint32_t shift = scale < 12 ? 12 - scale : 0;
+            const int16_t* book = table_.data() + ((header & 0xF) << 4);
+            alignas(16) int16_t frame[16];
+            for (uint32_t i = 0; i < 8; i++) {
+                uint8_t byte = get_byte(dmemi + 1 + i);
+                frame[i * 2] = static_cast<int16_t>((byte & 0xF0) << 8) >> shift;
+                frame[i * 2 + 1] = static_cast<int16_t>((byte & 0x0F) << 12) >> shift;
+            }
+            dmemi += 9;
+            filter8(frame, 1 << 11, book, last[14], book + 8, last[15], book + 8, 11, last);
+            filter8(frame + 8, 1 << 11, book, last[6], book + 8, last[7], book + 8, 11, last + 8);
+            for (uint32_t i = 0; i < 16; i++) {
+                set_sample(dmemo + i * 2, last[i]);
+            }
+            dmemo += 32;
+        }
+        for (uint32_t i = 0; i < 16; i++) {
+            write16(address + i * 2, last[i]);
+        }
+    }
+
+    void AudioHLE::envelope_mix(bool init, bool aux, uint32_t address) {
+        EnvelopeState state;
+        if (init) {
+            state.wet = wet_;
+            state.dry = dry_;
+            for (int side = 0; side < 2; side++) {
+                state.value[side] = volume_[side] << 16;
+                state.target[side] = target_[side] << 16;
+                state.rate[side] = rate_[side];
+                state.sequence[side] = static_cast<int32_t>(static_cast<int64_t>(volume_[side]) * rate_[side]);
+            }
+        } else {
+            read_state(address, &state, sizeof(state));
+        }
+        // A side whose volume reached its target stays there
+        int32_t step[2];
+        for (int side = 0; side < 2; side++) {
+            step[side] = static_cast<int32_t>(static_cast<int64_t>(state.target[side]) - state.value[side]);
+        }
+        // Left and right dry outputs, then left and right wet (aux) outputs
+        const uint32_t outputs[4] = { out_, dry_right_, wet_left_, wet_right_ };
+        uint32_t output_count = aux ? 4 : 2;
+        uint32_t count = align(count_, 16);
+        for (uint32_t offset = 0; offset < count; offset += 16) {
+            // The volume heads for the target on an exponential curve, 8 samples at a time
+            for (int side = 0; side < 2; side++) {
+                if (step[side] != 0) {
+                    state.sequence[side] = static_cast<int32_t>((static_cast<int64_t>(state.sequence[side]) * state.rate[side]) >> 16);
+                    step[side] = static_cast<int32_t>(static_cast<int64_t>(state.sequence[side]) - state.value[side]) >> 3;
+                }
+            }
+            alignas(16) int16_t gains[4][8];
+            for (uint32_t i = 0; i < 8; i++) {
+                int16_t left = ramp(state.value[0], state.target[0], step[0]);
+                int16_t right = ramp(state.value[1], state.target[1], step[1]);
+                uint32_t lane = i ^ 1;
+                gains[0][lane] = clamp16((left * state.dry + 0x4000) >> 15);
+                gains[1][lane] = clamp16((right * state.dry + 0x4000) >> 15);
+                gains[2][lane] = clamp16((left * state.wet + 0x4000) >> 15);
+                gains[3][lane] = clamp16((right * state.wet + 0x4000) >> 15);
+            }
+            for (uint32_t i = 0; i < output_count; i++) {
+                mix_samples((outputs[i] + offset) & 0xFFF, (in_ + offset) & 0xFFF, gains[i]);
+            }
+        }
+        write_state(address, &state, sizeof(state));
+    }
+
+    void AudioHLE::resample(bool init, uint32_t dmemo, uint32_t dmemi, uint32_t count, uint32_t pitch, uint32_t address) {
+        // Positions in samples, the 4 samples before the input are the last ones of the previous task
+        uint32_t ipos = (dmemi >> 1) - 4;
+        uint32_t opos = dmemo >> 1;
+        for (uint32_t i = 0; i < 4; i++) {
+            set_sample((ipos + i) * 2, init ? 0 : read16(address + i * 2));
+        }
+        // Position between two input samples in Q16, the top 6 bits pick the filter
+        uint32_t fraction = init ? 0 : static_cast<uint16_t>(read16(address + 8));
+        count >>= 1;
+        // pitch is below 2, so the input is at most twice as long as the output. Output
+        // that lands on input not read yet has to be written one sample at a time
+        uint32_t input_start = (dmemi - 8) & 0xFFF, input_end = input_start + count * 4 + 16;
+        uint32_t output_start = dmemo & 0xFFF, output_end = output_start + count * 2;
+        uint32_t batch_size = output_start < input_end && input_start < output_end ? 1 : 8;
+        while (count != 0) {
+            uint32_t batch = std::min(count, batch_size);
+            alignas(16) int16_t taps[4][8] = {};
+            alignas(16) int16_t coefficients[4][8] = {};
+            alignas(16) int16_t out[8];
+            for (uint32_t i = 0; i < batch; i++) {
+                const auto& filter = RESAMPLE_TABLE[fraction >> 10];
+                for (uint32_t t = 0; t < 4; t++) {
+                    taps[t][i] = get_sample((ipos + t) * 2);
+                    coefficients[t][i] = filter[t];
+                }
+                fraction += pitch;
+                ipos += fraction >> 16;
+                fraction &= 0xFFFF;
+            }
+            resample8(taps, coefficients, out);
+            for (uint32_t i = 0; i < batch; i++) {
+                set_sample((opos + i) * 2, out[i]);
+            }
+            opos += batch;
+            count -= batch;
+        }
+        for (uint32_t i = 0; i < 4; i++) {
+            write16(address + i * 2, get_sample((ipos + i) * 2));
+        }
+        write16(address + 8, static_cast<int16_t>(fraction));
+    }
+
+    void AudioHLE::mix(uint32_t dmemo, uint32_t dmemi, uint32_t count, int16_t gain) {
+        alignas(16) int16_t gains[8];
+        std::fill(std::begin(gains), std::end(gains), gain);
+        for (uint32_t offset = 0; offset < count; offset += 16) {
+            mix_samples((dmemo + offset) & 0xFFF, (dmemi + offset) & 0xFFF, gains);
+        }
+    }
+
+    void AudioHLE::mix_samples(uint32_t dmemo, uint32_t dmemi, const int16_t* gains) {
+        if (contiguous(dmemo, 16) && contiguous(dmemi, 16)) [[likely]] {
+            mix8(buffer_.data() + dmemo, buffer_.data() + dmemi, gains);
+            return;
+        }
+        for (uint32_t i = 0; i < 8; i++) {
+            int32_t sample = get_sample(dmemi + i * 2);
+            set_sample(dmemo + i * 2, clamp16(get_sample(dmemo + i * 2) + ((sample * gains[i ^ 1]) >> 15)));
+        }
+    }
+
+    void AudioHLE::interleave(uint32_t dmemo, uint32_t left, uint32_t right, uint32_t count) {
+        for (uint32_t offset = 0; offset < count; offset += 16) {
+            uint32_t out = (dmemo + offset * 2) & 0xFFF;
+            uint32_t l = (left + offset) & 0xFFF, r = (right + offset) & 0xFFF;
+            if (contiguous(out, 32) && contiguous(l, 16) && contiguous(r, 16)) [[likely]] {
+                interleave8(buffer_.data() + out, buffer_.data() + l, buffer_.data() + r);
+                continue;
+            }
+            for (uint32_t i = 0; i < 8; i++) {
+                int16_t left_sample = get_sample(l + i * 2), right_sample = get_sample(r + i * 2);
+                set_sample(out + i * 4, left_sample);
+                set_sample(out + i * 4 + 2, right_sample);
+            }
+        }
+    }
+
+    void AudioHLE::pole_filter(bool init, uint32_t dmemo, uint32_t dmemi, uint32_t count, uint16_t gain, uint32_t address) {
+        if (count == 0) {
+            return;
+        }
+        int16_t l1 = init ? 0 : read16(address + 4);
+        int16_t l2 = init ? 0 : read16(address + 6);
+        // The microcode scales the second row of the table in place, only the first frame sees it unscaled
+        alignas(16) int16_t h2_before[8];
+        int16_t* h2 = table_.data() + 8;
+        for (uint32_t i = 0; i < 8; i++) {
+            h2_before[i] = h2[i];
+            h2[i] = static_cast<int16_t>((static_cast<int32_t>(h2[i]) * gain) >> 14);
+        }
+        alignas(16) int16_t frame[8];
+        alignas(16) int16_t out[8];
+        for (; count != 0; count -= 16) {
+            for (uint32_t i = 0; i < 8; i++) {
+                frame[i] = get_sample(dmemi + i * 2);
+            }
+            filter8(frame, gain, table_.data(), l1, h2_before, l2, h2, 14, out);
+            for (uint32_t i = 0; i < 8; i++) {
+                set_sample(dmemo + i * 2, out[i]);
+            }
+            l1 = out[6];
+            l2 = out[7];
+            dmemi += 16;
+            dmemo += 16;
+        }
+        for (uint32_t i = 0; i < 4; i++) {
+            write16(address + i * 2, out[4 + i]);
+        }
+    }
+
+    void AudioHLE::clear(uint32_t dmem, uint32_t count) {
+        if (contiguous(dmem, count)) [[likely]] {
+            std::memset(buffer_.data() + dmem, 0, count);
+            return;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            buffer_[((dmem + i) ^ 3) & 0xFFF] = 0;
+        }
+    }
+
+    void AudioHLE::move(uint32_t dmemo, uint32_t dmemi, uint32_t count) {
+        // The microcode copies forwards, an overlapping copy to a higher address repeats the data
+        bool repeats = dmemo > dmemi && dmemo < dmemi + count;
+        if (!repeats && contiguous(dmemo, count) && contiguous(dmemi, count)) [[likely]] {
+            std::memmove(buffer_.data() + dmemo, buffer_.data() + dmemi, count);
+            return;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            buffer_[((dmemo + i) ^ 3) & 0xFFF] = get_byte(dmemi + i);
+        }
+    }
+
+    void AudioHLE::load(uint32_t dmem, uint32_t address, uint32_t count) {
+        // Like the DMA the microcode does
+        dmem &= ~3u;
+        address &= ~7u;
+        count = align(count, 8);
+        if (contiguous(dmem, count) && address + count <= rdram_.size()) [[likely]] {
+            std::memcpy(buffer_.data() + dmem, rdram_.data() + address, count);
+            return;
+        }
+        for (uint32_t i = 0; i < count; i += 4) {
+            std::memcpy(buffer_.data() + ((dmem + i) & 0xFFF), rdram_.data() + ((address + i) & (rdram_.size() - 1)), 4);
+        }
+    }
+
+    void AudioHLE::save(uint32_t dmem, uint32_t address, uint32_t count) {
+        dmem &= ~3u;
+        address &= ~7u;
+        count = align(count, 8);
+        if (count == 0) {
+            return;
+        }
+        mark_written(address, count);
+        if (contiguous(dmem, count) && address + count <= rdram_.size()) [[likely]] {
+            std::memcpy(rdram_.data() + address, buffer_.data() + dmem, count);
+            return;
+        }
+        for (uint32_t i = 0; i < count; i += 4) {
+            std::memcpy(rdram_.data() + ((address + i) & (rdram_.size() - 1)), buffer_.data() + ((dmem + i) & 0xFFF), 4);
+        }
+    }
+
+    int16_t AudioHLE::get_sample(uint32_t address) const {
+        int16_t value;
+        std::memcpy(&value, buffer_.data() + ((address ^ 2) & 0xFFE), sizeof(value));
+        return value;
+    }
+
+    void AudioHLE::set_sample(uint32_t address, int16_t value) {
+        std::memcpy(buffer_.data() + ((address ^ 2) & 0xFFE), &value, sizeof(value));
+    }
+
+    uint8_t AudioHLE::get_byte(uint32_t address) const {
+        return buffer_[(address ^ 3) & 0xFFF];
+    }
+
+    bool AudioHLE::contiguous(uint32_t address, uint32_t count) {
+        return ((address | count) & 3) == 0 && address + count <= 0x1000;
+    }
+
+    uint32_t AudioHLE::segment_address(uint32_t address) const {
+        return (segments_[(address >> 24) & 15] + (address & 0xFF'FFFF)) & (rdram_.size() - 1);
+    }
+
+    int16_t AudioHLE::read16(uint32_t address) const {
+        uint32_t word = read32(address);
+        return static_cast<int16_t>((address & 2) ? word : word >> 16);
+    }
+
+    uint32_t AudioHLE::read32(uint32_t address) const {
+        uint32_t value;
+        std::memcpy(&value, rdram_.data() + (address & (rdram_.size() - 1) & ~3u), sizeof(value));
+        return value;
+    }
+
+    void AudioHLE::write16(uint32_t address, int16_t value) {
+        address &= rdram_.size() - 1;
+        mark_written(address, 2);
+        // The halfword at the lower address is the upper half of the word
+        std::memcpy(rdram_.data() + (address ^ 2), &value, sizeof(value));
+    }
+
+    void AudioHLE::read_state(uint32_t address, void* state, uint32_t size) const {
+        for (uint32_t i = 0; i < size; i += 4) {
+            std::memcpy(static_cast<uint8_t*>(state) + i, rdram_.data() + ((address + i) & (rdram_.size() - 1) & ~3u), 4);
+        }
+    }
+
+    void AudioHLE::write_state(uint32_t address, const void* state, uint32_t size) {
+        address &= (rdram_.size() - 1) & ~3u;
+        mark_written(address, size);
+        for (uint32_t i = 0; i < size; i += 4) {
+            std::memcpy(rdram_.data() + ((address + i) & (rdram_.size() - 1)), static_cast<const uint8_t*>(state) + i, 4);
+        }
+    }
+
+    void AudioHLE::mark_written(uint32_t address, uint32_t size) {
+        address &= rdram_.size() - 1;
+        size = std::min<uint32_t>(size, rdram_.size() - address);
+        if (!written_.empty()) {
+            RDRAMRange& last = written_.back();
+            if (address <= last.start + last.size && last.start <= address + size) {
+                uint32_t end = std::max(last.start + last.size, address + size);
+                last.start = std::min(last.start, address);
+                last.size = end - last.start;
+                return;
+            }
+        }
+        written_.push_back({ address, size });
+    }
+}
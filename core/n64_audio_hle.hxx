@@ -0,0 +1,97 @@
+#pragma once
+#ifndef TKP_N64_AUDIO_HLE_H
+#define TKP_N64_AUDIO_HLE_H
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace TKPEmu::N64::Devices {
+    struct RDRAMRange {
+        uint32_t start;
+        uint32_t size;
+    };
+
+    /**
+        Runs audio tasks for the standard libultra audio microcode (ABI 1) on
+        the host instead of on the RSP.
+
+        The command list works on a 4KB buffer that stands in for DMEM, laid
+        out like DMEM (host endian words) so loads and saves are plain copies.
+        ADPCM decoding, the pole filter, resampling, envelope mixing, mixing
+        and interleaving run 8 samples at a time with SSE2 where available.
+        The output and the state each voice keeps between tasks are written
+        back to RDRAM like the microcode does, the state in a layout of its own.
+        The resampler uses a generated cubic filter, not the microcode's own
+        table, so resampled voices aren't bit exact with the RSP
+    */
+    class AudioHLE {
+    public:
+        /**
+         * Runs the task described by the OSTask at the end of DMEM. Returns
+         * false without touching anything if it isn't an audio task for the
+         * standard ABI, the RSP has to run it then
+         */
+        bool Run(const uint8_t* dmem, std::span<uint8_t> rdram);
+        // Checks the start of the microcode's data section
+        static bool Detect(std::span<const uint8_t> rdram, uint32_t ucode_data);
+        // RDRAM the last task wrote to, neighbouring writes are merged
+        const std::vector<RDRAMRange>& GetWrittenRanges() const {
+            return written_;
+        }
+    private:
+        void reset();
+        void execute(uint32_t w0, uint32_t w1);
+
+        void adpcm(bool init, bool loop, uint32_t dmemo, uint32_t dmemi, uint32_t count, uint32_t address);
+        void envelope_mix(bool init, bool aux, uint32_t address);
+        void resample(bool init, uint32_t dmemo, uint32_t dmemi, uint32_t count, uint32_t pitch, uint32_t address);
+        void mix(uint32_t dmemo, uint32_t dmemi, uint32_t count, int16_t gain);
+        void interleave(uint32_t dmemo, uint32_t left, uint32_t right, uint32_t count);
+        void pole_filter(bool init, uint32_t dmemo, uint32_t dmemi, uint32_t count, uint16_t gain, uint32_t address);
+        void clear(uint32_t dmem, uint32_t count);
+        void move(uint32_t dmemo, uint32_t dmemi, uint32_t count);
+        void load(uint32_t dmem, uint32_t address, uint32_t count);
+        void save(uint32_t dmem, uint32_t address, uint32_t count);
+        // dst = clamp(dst + ((src * gain) >> 15)) for 8 samples, gains in the order DMEM keeps halfwords
+        void mix_samples(uint32_t dmemo, uint32_t dmemi, const int16_t* gains);
+
+        // Buffer addresses are DMEM addresses, samples are big endian halfwords
+        int16_t get_sample(uint32_t address) const;
+        void set_sample(uint32_t address, int16_t value);
+        uint8_t get_byte(uint32_t address) const;
+        // True if count bytes at address are whole words that don't wrap, the layout the SIMD kernels need
+        static bool contiguous(uint32_t address, uint32_t count);
+
+        uint32_t segment_address(uint32_t address) const;
+        int16_t read16(uint32_t address) const;
+        uint32_t read32(uint32_t address) const;
+        void write16(uint32_t address, int16_t value);
+        // For state only the HLE reads back, copied as host words
+        void read_state(uint32_t address, void* state, uint32_t size) const;
+        void write_state(uint32_t address, const void* state, uint32_t size);
+        void mark_written(uint32_t address, uint32_t size);
+
+        std::span<uint8_t> rdram_;
+        alignas(16) std::array<uint8_t, 0x1000> buffer_ {};
+        std::array<uint32_t, 16> segments_ {};
+        // ADPCM codebook of up to 16 predictors, the first one is also the pole filter's
+        std::array<int16_t, 256> table_ {};
+        // Set by SETBUFF
+        uint32_t in_ = 0;
+        uint32_t out_ = 0;
+        uint32_t count_ = 0;
+        uint32_t dry_right_ = 0;
+        uint32_t wet_left_ = 0;
+        uint32_t wet_right_ = 0;
+        // Set by SETVOL, left then right
+        int16_t dry_ = 0;
+        int16_t wet_ = 0;
+        std::array<int16_t, 2> volume_ {};
+        std::array<int16_t, 2> target_ {};
+        std::array<int32_t, 2> rate_ {};
+        uint32_t loop_ = 0;
+        std::vector<RDRAMRange> written_;
+    };
+}
+#endif
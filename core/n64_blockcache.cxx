@@ -0,0 +1,70 @@
+#include <algorithm>
+#include "n64_blockcache.hxx"
+
+namespace TKPEmu::N64::Devices {
+    BlockCache::BlockCache() : code_pages_(1u << (32 - PAGE_SHIFT)) {}
+
+    DecodedBlock* BlockCache::find_slow(uint32_t paddr) {
+        auto it = blocks_.find(paddr);
+        if (it == blocks_.end()) {
+            return nullptr;
+        }
+        DecodedBlock* block = it->second.get();
+        lookup_[lookup_index(paddr)] = block;
+        return block;
+    }
+
+    DecodedBlock* BlockCache::Insert(uint32_t paddr, std::vector<DecodedInstruction>&& instructions) {
+        auto block = std::make_unique<DecodedBlock>(paddr, std::move(instructions));
+        uint32_t first_page = paddr >> PAGE_SHIFT;
+        uint32_t last_page = (paddr + block->instructions.size() * 4 - 1) >> PAGE_SHIFT;
+        for (uint32_t page = first_page; page <= last_page; page++) {
+            page_blocks_[page].push_back(paddr);
+            code_pages_[page] = 1;
+        }
+        DecodedBlock* ret = block.get();
+        blocks_[paddr] = std::move(block);
+        lookup_[lookup_index(paddr)] = ret;
+        return ret;
+    }
+
+    void BlockCache::InvalidateRange(uint32_t paddr, uint32_t size) {
+        if (size == 0) {
+            return;
+        }
+        uint32_t first_page = paddr >> PAGE_SHIFT;
+        uint32_t last_page = (paddr + size - 1) >> PAGE_SHIFT;
+        for (uint32_t page = first_page; page <= last_page; page++) {
+            if (code_pages_[page]) {
+                invalidate_page(page);
+            }
+        }
+    }
+
+    void BlockCache::invalidate_page(uint32_t page) {
+        auto it = page_blocks_.find(page);
+        if (it != page_blocks_.end()) {
+            for (uint32_t block_paddr : it->second) {
+                auto block_it = blocks_.find(block_paddr);
+                if (block_it == blocks_.end()) {
+                    // Already dropped through another page it spans
+                    continue;
+                }
+                auto& slot = lookup_[lookup_index(block_paddr)];
+                if (slot == block_it->second.get()) {
+                    slot = nullptr;
+                }
+                blocks_.erase(block_it);
+            }
+            page_blocks_.erase(it);
+        }
+        code_pages_[page] = 0;
+    }
+
+    void BlockCache::Clear() {
+        blocks_.clear();
+        page_blocks_.clear();
+        std::fill(code_pages_.begin(), code_pages_.end(), 0);
+        lookup_.fill(nullptr);
+    }
+}
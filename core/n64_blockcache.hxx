@@ -0,0 +1,111 @@
+#pragma once
+#ifndef TKP_N64_BLOCKCACHE_H
+#define TKP_N64_BLOCKCACHE_H
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include "n64_types.hxx"
+
+namespace TKPEmu::N64::Devices {
+    class CPU;
+    using InstructionHandler = void (*)(CPU*);
+    // Recompiled block, returns the number of instructions it executed
+    using CompiledBlock = int (*)(CPU*);
+    struct DecodedInstruction;
+    // Runs an instruction straight on the registers in functional mode, false if it has to go through EX instead
+    using DirectHandler = bool (*)(CPU*, const DecodedInstruction& instr, uint32_t vaddr);
+    // Runs two adjacent instructions in one dispatch, vaddr is the address of the first
+    using FusedHandler = bool (*)(CPU*, const DecodedInstruction& first, const DecodedInstruction& second, uint32_t vaddr);
+    /**
+        A guest instruction decoded once, with the second level table hop
+        (SPECIAL/REGIMM/COP1) already resolved
+    */
+    struct DecodedInstruction {
+        InstructionHandler handler;
+        Instruction        instruction;
+        int64_t            seimm;     // sign extended immediate
+        uint8_t            rs;
+        uint8_t            rt;
+        uint8_t            rd;
+        bool               is_branch; // block ends after this instruction's delay slot
+        DirectHandler      direct = nullptr;
+        // Set when this and the next instruction can run as one, used in functional mode
+        FusedHandler       fused = nullptr;
+    };
+    enum class IdleLoop : uint8_t {
+        None,
+        // Branches to itself without touching memory, nothing changes until the next event
+        Pure,
+        // Only loads and register math, a load might be polling VI_V_CURRENT
+        Polling,
+    };
+    struct CompiledCode {
+        uint32_t vaddr;
+        CompiledBlock code;
+    };
+    /**
+        A run of guest instructions starting at a physical address. Blocks end
+        on the delay slot of a branch/jump, on ERET or at a 4KB page boundary
+    */
+    struct DecodedBlock {
+        uint32_t paddr;
+        std::vector<DecodedInstruction> instructions;
+        // Recompiled code has the pc baked in, so there's one for each virtual
+        // address the block was entered from (usually its kseg0 and kseg1 aliases)
+        std::vector<CompiledCode> compiled;
+        // Set when looping back to the start of the block can't change any state
+        IdleLoop idle_loop = IdleLoop::None;
+        // Times the block was entered from the top, for the opcode pair histogram
+        uint64_t entries = 0;
+    };
+    /**
+        Pre-decoded instruction storage for the cached interpreter and the
+        recompiler, indexed by physical address. Blocks are dropped when a store
+        or a DMA touches a page that holds decoded code.
+    */
+    class BlockCache {
+    public:
+        static constexpr uint32_t PAGE_SHIFT = 12;
+        BlockCache();
+        DecodedBlock* Find(uint32_t paddr) {
+            DecodedBlock* block = lookup_[lookup_index(paddr)];
+            if (block && block->paddr == paddr) [[likely]] {
+                return block;
+            }
+            return find_slow(paddr);
+        }
+        DecodedBlock* Insert(uint32_t paddr, std::vector<DecodedInstruction>&& instructions);
+        bool IsCode(uint32_t paddr) {
+            return code_pages_[paddr >> PAGE_SHIFT];
+        }
+        // One byte per 4KB page, non zero when the page holds decoded code
+        const uint8_t* GetCodePageTable() const {
+            return code_pages_.data();
+        }
+        // Drops every block that overlaps [paddr, paddr + size)
+        void InvalidateRange(uint32_t paddr, uint32_t size);
+        void Clear();
+        template<class Func>
+        void ForEach(Func&& func) const {
+            for (const auto& [paddr, block] : blocks_) {
+                func(*block);
+            }
+        }
+    private:
+        static constexpr size_t LOOKUP_SIZE = 0x4000;
+        static size_t lookup_index(uint32_t paddr) {
+            return (paddr >> 2) & (LOOKUP_SIZE - 1);
+        }
+        DecodedBlock* find_slow(uint32_t paddr);
+        void invalidate_page(uint32_t page);
+
+        std::unordered_map<uint32_t, std::unique_ptr<DecodedBlock>> blocks_;
+        // Start addresses of every block that has code in a given page
+        std::unordered_map<uint32_t, std::vector<uint32_t>> page_blocks_;
+        std::vector<uint8_t> code_pages_;
+        std::array<DecodedBlock*, LOOKUP_SIZE> lookup_ {};
+    };
+}
+#endif
@@ -2,19 +2,17 @@
 #include <cstring>
 #include <cassert>
 #include <iostream>
-#include <bitset>
 #include <limits>
-#include <sstream>
+#include <utility>
+#include <algorithm>
+#include <bit>
+#include <map>
 #include "n64_addresses.hxx"
-#include "error_factory.hxx"
 #include "utils.hxx"
 
 #define SKIPDEBUGSTUFF 1
 #define TKP_INSTR_FUNC void
 #define IS_PC_EX(target_pc) ((pc_ - 8) == (target_pc))
-constexpr uint64_t LUT[] = {
-    0, 0xFF, 0xFFFF, 0, 0xFFFFFFFF, 0, 0, 0, 0xFFFFFFFFFFFFFFFF,
-};
 
 namespace TKPEmu::N64::Devices {
     CPU::CPU(CPUBus& cpubus, RCP& rcp) :
@@ -23,23 +21,49 @@ namespace TKPEmu::N64::Devices {
         instr_cache_(KB(16)),
         data_cache_(KB(8)),
         cpubus_(cpubus),
-        rcp_(rcp)
+        rcp_(rcp),
+        rsp_(*this)
     {
+        fetch_fault_block_.instructions.push_back({ .handler = &lut_wrapper<&CPU::fetch_fault> });
+        cpubus_.cpu_ = this;
+        flush_tlb_cache();
     }
 
     void CPU::Reset() {
         pc_ = 0xBFC0'0000;
         ldi_ = false;
+        batch_count_ = 0;
+        batch_cycles_ = 0;
+        events_handled_ = 0;
+        idle_skips_ = 0;
+        idle_skipped_cycles_ = 0;
+        #if N64TKP_HAS_PROFILER
+        profiler_.Reset();
+        #endif
+        horizon_ = 0;
+        scheduler_.Clear();
+        flush_tlb_cache();
+        exception_raised_ = false;
+        fault_ = {};
         clear_registers();
+        rsp_.Reset();
+        block_cache_.Clear();
+        if (recompiler_) {
+            recompiler_->Flush();
+        }
+        set_mode(mode_);
         cpubus_.Reset();
-        if (cpubus_.IsEverythingLoaded()) {
+        in_delay_slot_ = false;
+        load_destination_ = -1;
+        // Compiled blocks and functional mode don't go through the pipeline
+        if (cpubus_.IsEverythingLoaded() && mode_ != CPUMode::Recompiler && mode_ != CPUMode::Functional) {
             // memcpy(cpubus_.redirect_paddress(0x1000), cpubus_.redirect_paddress(0x10001000), 0x100000);
             fill_pipeline();
         }
     }
 
     TKP_INSTR_FUNC CPU::ERROR() {
-        throw ErrorFactory::generate_exception("ERROR opcode reached");
+        unimplemented_opcode();
     }
 
     /**
@@ -51,7 +75,6 @@ namespace TKPEmu::N64::Devices {
         int32_t sedata = rfex_latch_.fetched_rt.D >> rfex_latch_.instruction.RType.sa;
 		exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = sedata;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
 	}
 
@@ -64,7 +87,6 @@ namespace TKPEmu::N64::Devices {
 		exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         int64_t sedata = static_cast<int32_t>(rfex_latch_.fetched_rt.UW._0 << (rfex_latch_.fetched_rs.UD & 0b111111));
         exdc_latch_.data = sedata;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
 	}
 
@@ -77,7 +99,6 @@ namespace TKPEmu::N64::Devices {
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         int64_t sedata = static_cast<int64_t>(static_cast<int32_t>(rfex_latch_.fetched_rt.UW._0 >> (rfex_latch_.fetched_rs.UD & 0b111111)));
         exdc_latch_.data = sedata;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
 	}
     
@@ -85,16 +106,15 @@ namespace TKPEmu::N64::Devices {
 		int32_t sedata = rfex_latch_.fetched_rt.D >> (rfex_latch_.fetched_rs.UD & 0b11111);
 		exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = sedata;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
 	}
     
     TKP_INSTR_FUNC CPU::s_SYSCALL() {
-		throw ErrorFactory::generate_exception("s_SYSCALL opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_BREAK() {
-		throw ErrorFactory::generate_exception("s_BREAK opcode reached");
+		unimplemented_opcode();
 	}
 
     TKP_INSTR_FUNC CPU::s_SYNC() {
@@ -104,7 +124,6 @@ namespace TKPEmu::N64::Devices {
     TKP_INSTR_FUNC CPU::s_MFHI() {
 		exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = hi_;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
 	}
     
@@ -115,16 +134,15 @@ namespace TKPEmu::N64::Devices {
     TKP_INSTR_FUNC CPU::s_MFLO() {
 		exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = lo_;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
 	}
     
     TKP_INSTR_FUNC CPU::s_DSRLV() {
-		throw ErrorFactory::generate_exception("s_DSRLV opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_DSRAV() {
-		throw ErrorFactory::generate_exception("s_DSRAV opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_MULT() {
@@ -168,36 +186,34 @@ namespace TKPEmu::N64::Devices {
 	}
     
     TKP_INSTR_FUNC CPU::s_DMULT() {
-		throw ErrorFactory::generate_exception("s_DMULT opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_DMULTU() {
-		throw ErrorFactory::generate_exception("s_DMULTU opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_DDIV() {
-		throw ErrorFactory::generate_exception("s_DDIV opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_DDIVU() {
-		throw ErrorFactory::generate_exception("s_DDIVU opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_SUB() {
 		int32_t result = 0;
 		bool overflow = __builtin_sub_overflow(rfex_latch_.fetched_rs.W._0, rfex_latch_.fetched_rt.W._0, &result);
-		exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
-        exdc_latch_.data = static_cast<int64_t>(result);
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
-		bypass_register();
-        #if SKIPEXCEPTIONS == 0
-        if (overflow) {
+        if (overflow) [[unlikely]] {
             // An integer overflow exception occurs if carries out of bits 30 and 31 differ (2’s
-            // complement overflow). The contents of destination register rt is not modified
+            // complement overflow). The contents of destination register rd is not modified
             // when an integer overflow exception occurs.
-            throw IntegerOverflowException();
+            raise_exception(ExceptionType::IntegerOverflow);
+            return;
         }
-        #endif
+		exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
+        exdc_latch_.data = static_cast<int64_t>(result);
+		bypass_register();
 	}
     
     TKP_INSTR_FUNC CPU::s_SUBU() {
@@ -205,7 +221,6 @@ namespace TKPEmu::N64::Devices {
 		bool overflow = __builtin_sub_overflow(rfex_latch_.fetched_rs.UW._0, rfex_latch_.fetched_rt.UW._0, &result);
 		exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = static_cast<int64_t>(static_cast<int32_t>(result));
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
 	}
     
@@ -217,51 +232,49 @@ namespace TKPEmu::N64::Devices {
     TKP_INSTR_FUNC CPU::s_OR() {
 		exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = rfex_latch_.fetched_rs.UD | rfex_latch_.fetched_rt.UD;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
 	}
     
     TKP_INSTR_FUNC CPU::s_XOR() {
 		exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = rfex_latch_.fetched_rs.UD ^ rfex_latch_.fetched_rt.UD;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
 	}
     
     TKP_INSTR_FUNC CPU::s_DADD() {
-		throw ErrorFactory::generate_exception("s_DADD opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_DADDU() {
-		throw ErrorFactory::generate_exception("s_DADDU opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_DSUB() {
-		throw ErrorFactory::generate_exception("s_DSUB opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_DSUBU() {
-		throw ErrorFactory::generate_exception("s_DSUBU opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_TGEU() {
-		throw ErrorFactory::generate_exception("s_TGEU opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_TLT() {
-		throw ErrorFactory::generate_exception("s_TLT opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_TLTU() {
-		throw ErrorFactory::generate_exception("s_TLTU opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_TEQ() {
-		throw ErrorFactory::generate_exception("s_TEQ opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_TNE() {
-		throw ErrorFactory::generate_exception("s_TNE opcode reached");
+		unimplemented_opcode();
 	}
     
     /**
@@ -272,20 +285,19 @@ namespace TKPEmu::N64::Devices {
     TKP_INSTR_FUNC CPU::s_DSLL() {
 		exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = rfex_latch_.fetched_rt.UD << rfex_latch_.instruction.RType.sa;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
 	}
     
     TKP_INSTR_FUNC CPU::s_DSRL() {
-		throw ErrorFactory::generate_exception("s_DSRL opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_DSRA() {
-		throw ErrorFactory::generate_exception("s_DSRA opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_DSRL32() {
-		throw ErrorFactory::generate_exception("s_DSRL32 opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::SPECIAL() {
@@ -302,7 +314,6 @@ namespace TKPEmu::N64::Devices {
         if (rfex_latch_.fetched_rs.D <= 0) {
             exdc_latch_.data = pc_ - 4 + seoffset;
             exdc_latch_.dest = reinterpret_cast<uint8_t*>(&pc_);
-            exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		    bypass_register();
         }
         exdc_latch_.was_branch = true;
@@ -317,14 +328,12 @@ namespace TKPEmu::N64::Devices {
         int64_t seimm = static_cast<int16_t>(rfex_latch_.instruction.IType.immediate);
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
         exdc_latch_.data = rfex_latch_.fetched_rs.D < seimm;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
 	}
     
     TKP_INSTR_FUNC CPU::XORI() {
 		exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
         exdc_latch_.data = rfex_latch_.fetched_rs.UD ^ rfex_latch_.instruction.IType.immediate;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
 	}
     
@@ -333,11 +342,11 @@ namespace TKPEmu::N64::Devices {
 	}
     
     TKP_INSTR_FUNC CPU::COP2() {
-		throw ErrorFactory::generate_exception("COP2 opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::BGTZL() {
-		throw ErrorFactory::generate_exception("BGTZL opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::DADDIU() {
@@ -346,28 +355,30 @@ namespace TKPEmu::N64::Devices {
         bool overflow = __builtin_add_overflow(rfex_latch_.fetched_rs.D, seimm, &result);
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
         exdc_latch_.data = result;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
 	}
     
     TKP_INSTR_FUNC CPU::LDL() {
-		throw ErrorFactory::generate_exception("LDL opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::LDR() {
-		throw ErrorFactory::generate_exception("LDR opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::LWL() {
         int16_t offset = rfex_latch_.instruction.IType.immediate;
         int32_t seoffset = offset;
         exdc_latch_.vaddr = seoffset + rfex_latch_.fetched_rs.UW._0;
-        auto paddr = translate_vaddr(exdc_latch_.vaddr);
+        auto paddr = translate_data(exdc_latch_.vaddr, false);
+        if (exception_raised_) [[unlikely]] {
+            return;
+        }
         uint64_t data;
         uint64_t address = seoffset + rfex_latch_.fetched_rs.UW._0;
         uint32_t shift = 8 * ((address ^ 0) & 3);
         uint32_t mask = 0xFFFFFFFF << shift;
-        load_memory(false, paddr.paddr & ~3, data, 4);
+        load_memory<AccessType::UWORD, false>(false, paddr.paddr & ~3, data);
         gpr_regs_[rfex_latch_.instruction.IType.rt].UD = static_cast<int64_t>(static_cast<int32_t>((gpr_regs_[rfex_latch_.instruction.IType.rt].UW._0 & ~mask) | (data << shift)));
         // exdc_latch_.write_type = WriteType::LATEREGISTER;
         // exdc_latch_.access_type = AccessType::UWORD;
@@ -378,25 +389,20 @@ namespace TKPEmu::N64::Devices {
 		int16_t offset = rfex_latch_.instruction.IType.immediate;
         int32_t seoffset = offset;
         exdc_latch_.vaddr = seoffset + rfex_latch_.fetched_rs.UW._0;
-        auto paddr = translate_vaddr(exdc_latch_.vaddr);
+        auto paddr = translate_data(exdc_latch_.vaddr, false);
+        if (exception_raised_) [[unlikely]] {
+            return;
+        }
         uint64_t data;
         uint64_t address = seoffset + rfex_latch_.fetched_rs.UW._0;
         uint32_t shift = 8 * ((address ^ 3) & 3);
         uint32_t mask = 0xFFFFFFFF >> shift;
-        load_memory(false, paddr.paddr & ~3, data, 4);
+        load_memory<AccessType::UWORD, false>(false, paddr.paddr & ~3, data);
         gpr_regs_[rfex_latch_.instruction.IType.rt].UD = static_cast<int64_t>(static_cast<int32_t>((gpr_regs_[rfex_latch_.instruction.IType.rt].UW._0 & ~mask) | data >> shift));
 	}
     
     TKP_INSTR_FUNC CPU::SB() {
-		int16_t offset = rfex_latch_.instruction.IType.immediate;
-        int32_t seoffset = offset;
-        auto write_vaddr = seoffset + rfex_latch_.fetched_rs.UW._0;
-        auto paddr_s = translate_vaddr(write_vaddr);
-        exdc_latch_.paddr = paddr_s.paddr;
-        exdc_latch_.cached = paddr_s.cached;
-        exdc_latch_.data = rfex_latch_.fetched_rt.UB._0;
-        exdc_latch_.write_type = WriteType::MMU;
-        exdc_latch_.access_type = AccessType::UBYTE;
+        store_instruction<AccessType::UBYTE>();
 	}
     
     TKP_INSTR_FUNC CPU::SWL() {
@@ -406,15 +412,18 @@ namespace TKPEmu::N64::Devices {
         int32_t seoffset = offset;
         auto write_vaddr = (static_cast<uint32_t>(seoffset) & ~0b11) + rfex_latch_.fetched_rs.UW._0;
         auto addr_off = rfex_latch_.instruction.IType.immediate & 0b11;
-        auto paddr_s = translate_vaddr(write_vaddr);
+        auto paddr_s = translate_data(write_vaddr, true);
+        if (exception_raised_) [[unlikely]] {
+            return;
+        }
         exdc_latch_.paddr = paddr_s.paddr;
         exdc_latch_.cached = paddr_s.cached;
         // TODO: Fix this hack, dont load_memory
-        load_memory(exdc_latch_.cached, exdc_latch_.paddr, exdc_latch_.data, 4);
+        load_memory<AccessType::UWORD, false>(exdc_latch_.cached, exdc_latch_.paddr, exdc_latch_.data);
         exdc_latch_.data &= mask[addr_off];
         exdc_latch_.data |= rfex_latch_.fetched_rt.UW._0 >> shift[addr_off];
         exdc_latch_.write_type = WriteType::MMU;
-        exdc_latch_.access_type = AccessType::UWORD;
+        exdc_latch_.memory_handler = &store_handler<AccessType::UWORD>;
 	}
     
     TKP_INSTR_FUNC CPU::SDL() {
@@ -424,60 +433,67 @@ namespace TKPEmu::N64::Devices {
         int32_t seoffset = offset;
         auto write_vaddr = (static_cast<uint32_t>(seoffset) & ~0b111) + rfex_latch_.fetched_rs.UW._0;
         auto addr_off = rfex_latch_.instruction.IType.immediate & 0b111;
-        auto paddr_s = translate_vaddr(write_vaddr);
+        auto paddr_s = translate_data(write_vaddr, true);
+        if (exception_raised_) [[unlikely]] {
+            return;
+        }
         exdc_latch_.paddr = paddr_s.paddr;
         exdc_latch_.cached = paddr_s.cached;
         // TODO: Fix this hack, dont load_memory
-        load_memory(exdc_latch_.cached, exdc_latch_.paddr, exdc_latch_.data, 8);
+        load_memory<AccessType::UDOUBLEWORD, false>(exdc_latch_.cached, exdc_latch_.paddr, exdc_latch_.data);
         exdc_latch_.data &= mask[addr_off];
         exdc_latch_.data |= rfex_latch_.fetched_rt.UD >> shift[addr_off];
         exdc_latch_.write_type = WriteType::MMU;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
+        exdc_latch_.memory_handler = &store_handler<AccessType::UDOUBLEWORD>;
 	}
     
     TKP_INSTR_FUNC CPU::CACHE() {
-		// throw ErrorFactory::generate_exception("CACHE opcode reached");
+		// unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::LWC1() {
-		VERBOSE(std::cout << "LWC1 is unimplemented" << std::endl;)
+		N64_LOG(CPU, "LWC1 not implemented");
 	}
     
     TKP_INSTR_FUNC CPU::LWC2() {
-		throw ErrorFactory::generate_exception("LWC2 opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::LLD() {
-		throw ErrorFactory::generate_exception("LLD opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::LDC1() {
 		int16_t offset = rfex_latch_.instruction.IType.immediate;
         int32_t seoffset = offset;
         uint32_t vaddr = seoffset + rfex_latch_.fetched_rs.UW._0;
+        auto paddr_s = translate_data(vaddr, false);
+        if (exception_raised_) [[unlikely]] {
+            return;
+        }
         uint64_t data;
-        load_memory(false, translate_vaddr(vaddr).paddr, data, 8);
+        load_memory<AccessType::UDOUBLEWORD, false>(false, paddr_s.paddr, data);
         fpr_regs_[rfex_latch_.instruction.FType.ft] = *reinterpret_cast<double*>(&data);
 	}
     
     TKP_INSTR_FUNC CPU::LDC2() {
-		throw ErrorFactory::generate_exception("LDC2 opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::SC() {
-		throw ErrorFactory::generate_exception("SC opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::SWC1() {
-		// throw ErrorFactory::generate_exception("SWC1 opcode reached");
+		// unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::SWC2() {
-		throw ErrorFactory::generate_exception("SWC2 opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::SCD() {
-		throw ErrorFactory::generate_exception("SCD opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::SDC1() {
@@ -485,18 +501,21 @@ namespace TKPEmu::N64::Devices {
         int32_t seoffset = offset;
         uint32_t vaddr = seoffset + rfex_latch_.fetched_rs.UW._0;
         uint64_t data = *reinterpret_cast<uint64_t*>(&fpr_regs_[rfex_latch_.instruction.FType.ft]);
-        store_memory(false, translate_vaddr(vaddr).paddr, data, 8);
+        auto paddr_s = translate_data(vaddr, true);
+        if (exception_raised_) [[unlikely]] {
+            return;
+        }
+        store_memory<AccessType::UDOUBLEWORD>(false, paddr_s.paddr, data);
 	}
     
     TKP_INSTR_FUNC CPU::SDC2() {
-		throw ErrorFactory::generate_exception("SDC2 opcode reached");
+		unimplemented_opcode();
 	}
 
     TKP_INSTR_FUNC CPU::SLTIU() {
         int64_t seimm = static_cast<int16_t>(rfex_latch_.instruction.IType.immediate);
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
         exdc_latch_.data = rfex_latch_.fetched_rs.UD < seimm;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
 	}
     
@@ -507,15 +526,18 @@ namespace TKPEmu::N64::Devices {
         int32_t seoffset = offset;
         auto write_vaddr = (static_cast<uint32_t>(seoffset) & ~0b111) + rfex_latch_.fetched_rs.UW._0;
         auto addr_off = rfex_latch_.instruction.IType.immediate & 0b111;
-        auto paddr_s = translate_vaddr(write_vaddr);
+        auto paddr_s = translate_data(write_vaddr, true);
+        if (exception_raised_) [[unlikely]] {
+            return;
+        }
         exdc_latch_.paddr = paddr_s.paddr;
         exdc_latch_.cached = paddr_s.cached;
         // TODO: Fix this hack, dont load_memory
-        load_memory(exdc_latch_.cached, exdc_latch_.paddr, exdc_latch_.data, 8);
+        load_memory<AccessType::UDOUBLEWORD, false>(exdc_latch_.cached, exdc_latch_.paddr, exdc_latch_.data);
         exdc_latch_.data &= mask[addr_off];
         exdc_latch_.data |= rfex_latch_.fetched_rt.UD << shift[addr_off];
         exdc_latch_.write_type = WriteType::MMU;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
+        exdc_latch_.memory_handler = &store_handler<AccessType::UDOUBLEWORD>;
 	}
     
     TKP_INSTR_FUNC CPU::SWR() {
@@ -525,19 +547,22 @@ namespace TKPEmu::N64::Devices {
         int32_t seoffset = offset;
         auto write_vaddr = (static_cast<uint32_t>(seoffset) & ~0b11) + rfex_latch_.fetched_rs.UW._0;
         auto addr_off = rfex_latch_.instruction.IType.immediate & 0b11;
-        auto paddr_s = translate_vaddr(write_vaddr);
+        auto paddr_s = translate_data(write_vaddr, true);
+        if (exception_raised_) [[unlikely]] {
+            return;
+        }
         exdc_latch_.paddr = paddr_s.paddr;
         exdc_latch_.cached = paddr_s.cached;
         // TODO: Fix this hack, dont load_memory
-        load_memory(exdc_latch_.cached, exdc_latch_.paddr, exdc_latch_.data, 4);
+        load_memory<AccessType::UWORD, false>(exdc_latch_.cached, exdc_latch_.paddr, exdc_latch_.data);
         exdc_latch_.data &= mask[addr_off];
         exdc_latch_.data |= rfex_latch_.fetched_rt.UW._0 << shift[addr_off];
         exdc_latch_.write_type = WriteType::MMU;
-        exdc_latch_.access_type = AccessType::UWORD;
+        exdc_latch_.memory_handler = &store_handler<AccessType::UWORD>;
 	}
     
     TKP_INSTR_FUNC CPU::LL() {
-		throw ErrorFactory::generate_exception("LL opcode reached");
+		unimplemented_opcode();
 	}
     
     TKP_INSTR_FUNC CPU::s_MTLO() {
@@ -555,25 +580,22 @@ namespace TKPEmu::N64::Devices {
         bool overflow = __builtin_add_overflow(rfex_latch_.fetched_rs.W._0, seimm, &result);
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
         exdc_latch_.data = static_cast<int64_t>(result);
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
     }
     TKP_INSTR_FUNC CPU::ADDI() {
         int32_t seimm = static_cast<int16_t>(rfex_latch_.instruction.IType.immediate);
         int32_t result = 0;
         bool overflow = __builtin_add_overflow(rfex_latch_.fetched_rs.W._0, seimm, &result);
-        exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
-        exdc_latch_.data = result;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
-		bypass_register();
-        #if SKIPEXCEPTIONS == 0
-        if (overflow) {
+        if (overflow) [[unlikely]] {
             // An integer overflow exception occurs if carries out of bits 30 and 31 differ (2’s
             // complement overflow). The contents of destination register rt is not modified
             // when an integer overflow exception occurs.
-            throw IntegerOverflowException();
+            raise_exception(ExceptionType::IntegerOverflow);
+            return;
         }
-        #endif
+        exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
+        exdc_latch_.data = result;
+		bypass_register();
     }
     /**
      * DADDI
@@ -585,18 +607,16 @@ namespace TKPEmu::N64::Devices {
         int64_t seimm = static_cast<int16_t>(rfex_latch_.instruction.IType.immediate);
         int64_t result = 0;
         bool overflow = __builtin_add_overflow(rfex_latch_.fetched_rs.D, seimm, &result);
-        exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
-        exdc_latch_.data = result;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
-		bypass_register();
-        #if SKIPEXCEPTIONS == 0
-        if (overflow) {
+        if (overflow) [[unlikely]] {
             // An integer overflow exception occurs if carries out of bits 30 and 31 differ (2’s
             // complement overflow). The contents of destination register rt is not modified
             // when an integer overflow exception occurs.
-            throw IntegerOverflowException();
+            raise_exception(ExceptionType::IntegerOverflow);
+            return;
         }
-        #endif
+        exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
+        exdc_latch_.data = result;
+		bypass_register();
     }
     /**
      * J, JAL
@@ -613,7 +633,6 @@ namespace TKPEmu::N64::Devices {
         // combine first 3 bits of pc and jump_addr shifted left by 2
         exdc_latch_.data = (pc_ & 0xF000'0000) | (jump_addr << 2);
         exdc_latch_.dest = reinterpret_cast<uint8_t*>(&pc_);
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
         exdc_latch_.was_branch = true;
     }
@@ -627,7 +646,6 @@ namespace TKPEmu::N64::Devices {
         uint64_t seimm = static_cast<int64_t>(imm);
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
         exdc_latch_.data = seimm;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
     }
     /**
@@ -644,7 +662,6 @@ namespace TKPEmu::N64::Devices {
     TKP_INSTR_FUNC CPU::ORI() {
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
         exdc_latch_.data = rfex_latch_.fetched_rs.UD | rfex_latch_.instruction.IType.immediate;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
     }
     /**
@@ -655,9 +672,46 @@ namespace TKPEmu::N64::Devices {
     TKP_INSTR_FUNC CPU::s_AND() {
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = rfex_latch_.fetched_rs.UD & rfex_latch_.fetched_rt.UD;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
     }
+    template<AccessType Size>
+    void CPU::store_instruction() {
+        int16_t offset = rfex_latch_.instruction.IType.immediate;
+        int32_t seoffset = offset;
+        auto write_vaddr = seoffset + rfex_latch_.fetched_rs.UW._0;
+        if ((write_vaddr & (Size - 1)) != 0) [[unlikely]] {
+            // From manual:
+            // If either of the loworder two bits of the address are not zero, an address error exception occurs.
+            raise_exception(ExceptionType::AddressErrorStore, write_vaddr);
+            return;
+        }
+        auto paddr_s = translate_data(write_vaddr, true);
+        exdc_latch_.paddr = paddr_s.paddr;
+        exdc_latch_.cached = paddr_s.cached;
+        // store_memory only writes the low Size bytes
+        exdc_latch_.data = rfex_latch_.fetched_rt.UD;
+        exdc_latch_.write_type = WriteType::MMU;
+        exdc_latch_.memory_handler = &store_handler<Size>;
+    }
+    template<AccessType Size, bool SignExtend>
+    void CPU::load_instruction() {
+        int16_t offset = rfex_latch_.instruction.IType.immediate;
+        int32_t seoffset = offset;
+        exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
+        exdc_latch_.vaddr = seoffset + rfex_latch_.fetched_rs.UW._0;
+        if ((exdc_latch_.vaddr & (Size - 1)) != 0) [[unlikely]] {
+            // From manual:
+            // If either of the loworder two bits of the address are not zero, an address error exception occurs.
+            raise_exception(ExceptionType::AddressErrorLoad, exdc_latch_.vaddr);
+            return;
+        }
+        auto paddr_s = translate_data(exdc_latch_.vaddr, false);
+        exdc_latch_.paddr = paddr_s.paddr;
+        exdc_latch_.cached = paddr_s.cached;
+        exdc_latch_.write_type = WriteType::LATEREGISTER;
+        exdc_latch_.memory_handler = &load_handler<Size, SignExtend>;
+        detect_ldi();
+    }
     /**
      * SD
      * 
@@ -669,29 +723,14 @@ namespace TKPEmu::N64::Devices {
      *        Reserved instruction exception (32-bit User or Supervisor mode)
      */
     TKP_INSTR_FUNC CPU::SD() {
-        int16_t offset = rfex_latch_.instruction.IType.immediate;
-        int32_t seoffset = offset;
-        auto write_vaddr = seoffset + rfex_latch_.fetched_rs.UW._0;
-        auto paddr_s = translate_vaddr(write_vaddr);
-        exdc_latch_.paddr = paddr_s.paddr;
-        exdc_latch_.cached = paddr_s.cached;
-        exdc_latch_.data = rfex_latch_.fetched_rt.UD;
-        exdc_latch_.write_type = WriteType::MMU;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
-        #if SKIPEXCEPTIONS == 0
-        if ((exdc_latch_.vaddr & 0b111) != 0) { 
-            // From manual:
-            // If either of the loworder two bits of the address are not zero, an address error exception occurs.
-            throw InstructionAddressErrorException();
-        }
-        if (!mode64_ && opmode_ != OperatingMode::Kernel) {
+        store_instruction<AccessType::UDOUBLEWORD>();
+        if (!mode64_ && opmode_ != OperatingMode::Kernel) [[unlikely]] {
             // From manual:
             // This operation is defined for the VR4300 operating in 64-bit mode and in 32-bit
             // Kernel mode. Execution of this instruction in 32-bit User or Supervisor mode
             // causes a reserved instruction exception.
-            throw ReservedInstructionException();
+            raise_exception(ExceptionType::ReservedInstruction);
         }
-        #endif
     }
     /**
      * SW
@@ -703,22 +742,7 @@ namespace TKPEmu::N64::Devices {
      *        Address error exception
      */
     TKP_INSTR_FUNC CPU::SW() {
-        int16_t offset = rfex_latch_.instruction.IType.immediate;
-        int32_t seoffset = offset;
-        auto write_vaddr = seoffset + rfex_latch_.fetched_rs.UW._0;
-        auto paddr_s = translate_vaddr(write_vaddr);
-        exdc_latch_.paddr = paddr_s.paddr;
-        exdc_latch_.cached = paddr_s.cached;
-        exdc_latch_.data = rfex_latch_.fetched_rt.UW._0;
-        exdc_latch_.write_type = WriteType::MMU;
-        exdc_latch_.access_type = AccessType::UWORD;
-        #if SKIPEXCEPTIONS == 0
-        if ((exdc_latch_.dest & 0b11) != 0) {
-            // From manual:
-            // If either of the loworder two bits of the address are not zero, an address error exception occurs.
-            throw InstructionAddressErrorException();
-        }
-        #endif
+        store_instruction<AccessType::UWORD>();
     }
     /**
      * SH
@@ -730,22 +754,7 @@ namespace TKPEmu::N64::Devices {
      *        Address error exception
      */
     TKP_INSTR_FUNC CPU::SH() {
-        int16_t offset = rfex_latch_.instruction.IType.immediate;
-        int32_t seoffset = offset;
-        auto write_vaddr = seoffset + rfex_latch_.fetched_rs.UW._0;
-        auto paddr_s = translate_vaddr(write_vaddr);
-        exdc_latch_.paddr = paddr_s.paddr;
-        exdc_latch_.cached = paddr_s.cached;
-        exdc_latch_.data = rfex_latch_.fetched_rt.UH._0;
-        exdc_latch_.write_type = WriteType::MMU;
-        exdc_latch_.access_type = AccessType::UHALFWORD;
-        #if SKIPEXCEPTIONS == 0
-        if ((exdc_latch_.dest & 0b11) != 0) {
-            // From manual:
-            // If either of the loworder two bits of the address are not zero, an address error exception occurs.
-            throw InstructionAddressErrorException();
-        }
-        #endif
+        store_instruction<AccessType::UHALFWORD>();
     }
     /**
      * LB, LBU
@@ -756,17 +765,10 @@ namespace TKPEmu::N64::Devices {
      *        Address error exception (?)
      */
     TKP_INSTR_FUNC CPU::LB() {
-        LBU();
-        exdc_latch_.sign_extend = true;
+        load_instruction<AccessType::BYTE, true>();
     }
     TKP_INSTR_FUNC CPU::LBU() {
-        int16_t offset = rfex_latch_.instruction.IType.immediate;
-        int32_t seoffset = offset;
-        exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
-        exdc_latch_.vaddr = seoffset + rfex_latch_.fetched_rs.UW._0;
-        exdc_latch_.write_type = WriteType::LATEREGISTER;
-        exdc_latch_.access_type = AccessType::UBYTE;
-        detect_ldi();
+        load_instruction<AccessType::UBYTE, false>();
     }
     /**
      * LD
@@ -777,27 +779,14 @@ namespace TKPEmu::N64::Devices {
      *        Address error exception
      */
     TKP_INSTR_FUNC CPU::LD() {
-        int16_t offset = rfex_latch_.instruction.IType.immediate;
-        int32_t seoffset = offset;
-        exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
-        exdc_latch_.vaddr = seoffset + rfex_latch_.fetched_rs.UW._0;
-        exdc_latch_.write_type = WriteType::LATEREGISTER;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
-        detect_ldi();
-        #if SKIPEXCEPTIONS == 0
-        if ((exdc_latch_.vaddr & 0b111) != 0) { 
-            // From manual:
-            // If either of the loworder two bits of the address are not zero, an address error exception occurs.
-            throw InstructionAddressErrorException();
-        }
-        if (!mode64_ && opmode_ != OperatingMode::Kernel) {
+        load_instruction<AccessType::UDOUBLEWORD, false>();
+        if (!mode64_ && opmode_ != OperatingMode::Kernel) [[unlikely]] {
             // From manual:
             // This operation is defined for the VR4300 operating in 64-bit mode and in 32-bit
             // Kernel mode. Execution of this instruction in 32-bit User or Supervisor mode
             // causes a reserved instruction exception.
-            throw ReservedInstructionException();
+            raise_exception(ExceptionType::ReservedInstruction);
         }
-        #endif
     }
     /**
      * LH, LHU
@@ -808,24 +797,10 @@ namespace TKPEmu::N64::Devices {
      *        Address error exception
      */
     TKP_INSTR_FUNC CPU::LHU() {
-        int16_t offset = rfex_latch_.instruction.IType.immediate;
-        int32_t seoffset = offset;
-        exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
-        exdc_latch_.vaddr = seoffset + rfex_latch_.fetched_rs.UW._0;
-        exdc_latch_.write_type = WriteType::LATEREGISTER;
-        exdc_latch_.access_type = AccessType::UHALFWORD;
-        detect_ldi();
+        load_instruction<AccessType::UHALFWORD, false>();
     }
     TKP_INSTR_FUNC CPU::LH() {
-        LHU();
-        exdc_latch_.sign_extend = true;
-        #if SKIPEXCEPTIONS == 0
-        if ((exdc_latch_.vaddr & 0b1) != 0) {
-            // From manual:
-            // If the least-significant bit of the address is not zero, an address error exception occurs.
-            throw InstructionAddressErrorException();
-        }
-        #endif
+        load_instruction<AccessType::HALFWORD, true>();
     }
     /**
      * LW, LWU
@@ -836,24 +811,10 @@ namespace TKPEmu::N64::Devices {
      *        Address error exception
      */
     TKP_INSTR_FUNC CPU::LWU() {
-        int16_t offset = rfex_latch_.instruction.IType.immediate;
-        int32_t seoffset = offset;
-        exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
-        exdc_latch_.vaddr = seoffset + rfex_latch_.fetched_rs.UW._0;
-        exdc_latch_.write_type = WriteType::LATEREGISTER;
-        exdc_latch_.access_type = AccessType::UWORD;
-        detect_ldi();
+        load_instruction<AccessType::UWORD, false>();
     }
     TKP_INSTR_FUNC CPU::LW() {
-        LWU();
-        exdc_latch_.sign_extend = true;
-        #if SKIPEXCEPTIONS == 0
-        if ((exdc_latch_.vaddr & 0b11) != 0) {
-            // From manual:
-            // If either of the loworder two bits of the address are not zero, an address error exception occurs.
-            throw InstructionAddressErrorException();
-        }
-        #endif
+        load_instruction<AccessType::WORD, true>();
     }
     /**
      * ANDI
@@ -863,7 +824,6 @@ namespace TKPEmu::N64::Devices {
     TKP_INSTR_FUNC CPU::ANDI() {
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.IType.rt].UB._0;
         exdc_latch_.data = rfex_latch_.fetched_rs.UD & rfex_latch_.instruction.IType.immediate;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
     }
     /**
@@ -877,7 +837,6 @@ namespace TKPEmu::N64::Devices {
         if (rfex_latch_.fetched_rs.UD == rfex_latch_.fetched_rt.UD) {
             exdc_latch_.data = pc_ - 4 + seoffset;
             exdc_latch_.dest = reinterpret_cast<uint8_t*>(&pc_);
-            exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		    bypass_register();
         }
         exdc_latch_.was_branch = true;
@@ -893,11 +852,10 @@ namespace TKPEmu::N64::Devices {
         if (rfex_latch_.fetched_rs.UD == rfex_latch_.fetched_rt.UD) {
             exdc_latch_.data = pc_ - 4 + seoffset;
             exdc_latch_.dest = reinterpret_cast<uint8_t*>(&pc_);
-            exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		    bypass_register();
         } else {
             // Discard delay slot instruction
-            icrf_latch_.instruction.Full = 0;
+            discard_delay_slot();
             was_ldi_ = true; // don't log next instruction
         }
         exdc_latch_.was_branch = true;
@@ -913,7 +871,6 @@ namespace TKPEmu::N64::Devices {
         if (rfex_latch_.fetched_rs.UD != rfex_latch_.fetched_rt.UD) {
             exdc_latch_.data = pc_ - 4 + seoffset;
             exdc_latch_.dest = reinterpret_cast<uint8_t*>(&pc_);
-            exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		    bypass_register();
         }
         exdc_latch_.was_branch = true;
@@ -929,11 +886,10 @@ namespace TKPEmu::N64::Devices {
         if (rfex_latch_.fetched_rs.UD != rfex_latch_.fetched_rt.UD) {
             exdc_latch_.data = pc_ - 4 + seoffset;
             exdc_latch_.dest = reinterpret_cast<uint8_t*>(&pc_);
-            exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		    bypass_register();
         } else {
             // Discard delay slot instruction
-            icrf_latch_.instruction.Full = 0;
+            discard_delay_slot();
             was_ldi_ = true; // don't log next instruction
         }
         exdc_latch_.was_branch = true;
@@ -949,11 +905,10 @@ namespace TKPEmu::N64::Devices {
         if (rfex_latch_.fetched_rs.D <= 0) {
             exdc_latch_.data = pc_ - 4 + seoffset;
             exdc_latch_.dest = reinterpret_cast<uint8_t*>(&pc_);
-            exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		    bypass_register();
         } else {
             // Discard delay slot instruction
-            icrf_latch_.instruction.Full = 0;
+            discard_delay_slot();
             was_ldi_ = true; // don't log next instruction
         }
         exdc_latch_.was_branch = true;
@@ -969,7 +924,6 @@ namespace TKPEmu::N64::Devices {
         if (rfex_latch_.fetched_rs.D > 0) {
             exdc_latch_.data = pc_ - 4 + seoffset;
             exdc_latch_.dest = reinterpret_cast<uint8_t*>(&pc_);
-            exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		    bypass_register();
         }
         exdc_latch_.was_branch = true;
@@ -981,7 +935,7 @@ namespace TKPEmu::N64::Devices {
      */
     TKP_INSTR_FUNC CPU::s_TGE() {
         if (rfex_latch_.fetched_rs.UD >= rfex_latch_.fetched_rt.UD)
-            throw 0; //ErrorFactory::generate_exception("TrapException was thrown");static_assert(false);
+            raise_exception(ExceptionType::Trap);
     }
     /**
      * s_ADD, s_ADDU
@@ -991,25 +945,22 @@ namespace TKPEmu::N64::Devices {
     TKP_INSTR_FUNC CPU::s_ADD() {
         int32_t result = 0;
         bool overflow = __builtin_add_overflow(rfex_latch_.fetched_rt.W._0, rfex_latch_.fetched_rs.W._0, &result);
-        exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
-        exdc_latch_.data = static_cast<int64_t>(result);
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
-		bypass_register();
-        #if SKIPEXCEPTIONS == 0
-        if (overflow) {
+        if (overflow) [[unlikely]] {
             // An integer overflow exception occurs if carries out of bits 30 and 31 differ (2’s
             // complement overflow). The contents of destination register rd is not modified
             // when an integer overflow exception occurs.
-            throw IntegerOverflowException();
+            raise_exception(ExceptionType::IntegerOverflow);
+            return;
         }
-        #endif
+        exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
+        exdc_latch_.data = static_cast<int64_t>(result);
+		bypass_register();
     }
     TKP_INSTR_FUNC CPU::s_ADDU() {
         int32_t result = 0;
         bool overflow = __builtin_add_overflow(rfex_latch_.fetched_rt.W._0, rfex_latch_.fetched_rs.W._0, &result);
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = static_cast<int64_t>(result);
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
     }
     /**
@@ -1021,34 +972,25 @@ namespace TKPEmu::N64::Devices {
         auto reg = (rfex_latch_.instruction.RType.rd == 0) ? 31 : rfex_latch_.instruction.RType.rd;
         gpr_regs_[reg].UD = pc_; // By the time this instruction is executed, pc is already incremented by 8
                                     // so there's no need to increment here
-        #if SKIPEXCEPTIONS == 0
         // From manual:
         // Register numbers rs and rd should not be equal, because such an instruction does
         // not have the same effect when re-executed. If they are equal, the contents of rs
         // are destroyed by storing link address. However, if an attempt is made to execute
         // this instruction, an exception will not occur, and the result of executing such an
         // instruction is undefined.
-        assert(rfex_latch_.instruction.RType.rd != rfex_latch_.instruction.RType.rs);
-        #endif
         s_JR();
     }
     TKP_INSTR_FUNC CPU::s_JR() {
         auto jump_addr = rfex_latch_.fetched_rs.UD;
         exdc_latch_.data = jump_addr;
         exdc_latch_.dest = reinterpret_cast<uint8_t*>(&pc_);
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
-        #if SKIPEXCEPTIONS == 0
-        if ((jump_addr & 0b11) != 0) {
-            // From manual:
-            // Since instructions must be word-aligned, a Jump Register instruction must
-            // specify a target register (rs) which contains an address whose low-order two bits
-            // are zero. If these low-order two bits are not zero, an address exception will occur
-            // when the jump target instruction is fetched.
-            // TODO: when the jump target instruction is *fetched*. Does it matter that the exc is thrown here?
-            throw InstructionAddressErrorException();
-        }
-        #endif
+        // From manual:
+        // Since instructions must be word-aligned, a Jump Register instruction must
+        // specify a target register (rs) which contains an address whose low-order two bits
+        // are zero. If these low-order two bits are not zero, an address exception will occur
+        // when the jump target instruction is fetched.
+        // See can_fetch
         exdc_latch_.was_branch = true;
     }
     /**
@@ -1059,7 +1001,6 @@ namespace TKPEmu::N64::Devices {
     TKP_INSTR_FUNC CPU::s_DSLL32() {
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = rfex_latch_.fetched_rt.UD << (rfex_latch_.instruction.RType.sa + 32);
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
     }
     /**
@@ -1070,7 +1011,6 @@ namespace TKPEmu::N64::Devices {
     TKP_INSTR_FUNC CPU::s_DSLLV() {
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = rfex_latch_.fetched_rt.UD << (rfex_latch_.fetched_rs.UD & 0b111111);
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
     }
     /**
@@ -1082,7 +1022,6 @@ namespace TKPEmu::N64::Devices {
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         int32_t sedata = rfex_latch_.fetched_rt.UW._0 << rfex_latch_.instruction.RType.sa;
         exdc_latch_.data = static_cast<int64_t>(sedata);
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
     }
     /**
@@ -1094,7 +1033,6 @@ namespace TKPEmu::N64::Devices {
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         int64_t sedata = static_cast<int64_t>(static_cast<int32_t>(rfex_latch_.fetched_rt.UW._0 >> rfex_latch_.instruction.RType.sa));
         exdc_latch_.data = sedata;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
     }
     /**
@@ -1106,7 +1044,6 @@ namespace TKPEmu::N64::Devices {
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         int64_t sedata = rfex_latch_.fetched_rt.D >> (rfex_latch_.instruction.RType.sa + 32);
         exdc_latch_.data = sedata;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
     }
     /**
@@ -1117,7 +1054,6 @@ namespace TKPEmu::N64::Devices {
     TKP_INSTR_FUNC CPU::s_SLT() {
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = rfex_latch_.fetched_rs.D < rfex_latch_.fetched_rt.D;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
     }
     /**
@@ -1128,7 +1064,6 @@ namespace TKPEmu::N64::Devices {
     TKP_INSTR_FUNC CPU::s_SLTU() {
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = rfex_latch_.fetched_rs.UD < rfex_latch_.fetched_rt.UD;
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
     }
     /**
@@ -1139,12 +1074,11 @@ namespace TKPEmu::N64::Devices {
     TKP_INSTR_FUNC CPU::s_NOR() {
         exdc_latch_.dest = &gpr_regs_[rfex_latch_.instruction.RType.rd].UB._0;
         exdc_latch_.data = ~(rfex_latch_.fetched_rs.UD | rfex_latch_.fetched_rt.UD);
-        exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		bypass_register();
     }
 
     TKP_INSTR_FUNC CPU::r_BLTZ() {
-		throw ErrorFactory::generate_exception("r_BLTZ opcode reached");
+		unimplemented_opcode();
     }
     
     TKP_INSTR_FUNC CPU::r_BGEZ() {
@@ -1153,14 +1087,13 @@ namespace TKPEmu::N64::Devices {
         if (rfex_latch_.fetched_rs.W._0 >= 0) {
             exdc_latch_.data = pc_ - 4 + seoffset;
             exdc_latch_.dest = reinterpret_cast<uint8_t*>(&pc_);
-            exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		    bypass_register();
         }
         exdc_latch_.was_branch = true;
     }
     
     TKP_INSTR_FUNC CPU::r_BLTZL() {
-        throw ErrorFactory::generate_exception("r_BLTZL opcode reached");
+        unimplemented_opcode();
     }
     
     TKP_INSTR_FUNC CPU::r_BGEZL() {
@@ -1169,40 +1102,39 @@ namespace TKPEmu::N64::Devices {
         if (rfex_latch_.fetched_rs.W._0 >= 0) {
             exdc_latch_.data = pc_ - 4 + seoffset;
             exdc_latch_.dest = reinterpret_cast<uint8_t*>(&pc_);
-            exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		    bypass_register();
         } else {
-            icrf_latch_.instruction.Full = 0;
+            discard_delay_slot();
         }
         exdc_latch_.was_branch = true;
     }
     
     TKP_INSTR_FUNC CPU::r_TGEI() {
-        throw ErrorFactory::generate_exception("r_TGEI opcode reached");
+        unimplemented_opcode();
     }
     
     TKP_INSTR_FUNC CPU::r_TGEIU() {
-        throw ErrorFactory::generate_exception("r_TGEIU opcode reached");
+        unimplemented_opcode();
     }
     
     TKP_INSTR_FUNC CPU::r_TLTI() {
-        throw ErrorFactory::generate_exception("r_TLTI opcode reached");
+        unimplemented_opcode();
     }
     
     TKP_INSTR_FUNC CPU::r_TLTIU() {
-        throw ErrorFactory::generate_exception("r_TLTIU opcode reached");
+        unimplemented_opcode();
     }
     
     TKP_INSTR_FUNC CPU::r_TEQI() {
-        throw ErrorFactory::generate_exception("r_TEQI opcode reached");
+        unimplemented_opcode();
     }
     
     TKP_INSTR_FUNC CPU::r_TNEI() {
-        throw ErrorFactory::generate_exception("r_TNEI opcode reached");
+        unimplemented_opcode();
     }
     
     TKP_INSTR_FUNC CPU::r_BLTZAL() {
-        throw ErrorFactory::generate_exception("r_BLTZAL opcode reached");
+        unimplemented_opcode();
     }
     
     TKP_INSTR_FUNC CPU::r_BGEZAL() {
@@ -1212,18 +1144,17 @@ namespace TKPEmu::N64::Devices {
         if (rfex_latch_.fetched_rs.D >= 0) {
             exdc_latch_.data = pc_ - 4 + seoffset;
             exdc_latch_.dest = reinterpret_cast<uint8_t*>(&pc_);
-            exdc_latch_.access_type = AccessType::UDOUBLEWORD;
 		    bypass_register();
         }
         exdc_latch_.was_branch = true;
     }
     
     TKP_INSTR_FUNC CPU::r_BLTZALL() {
-        throw ErrorFactory::generate_exception("r_BLTZALL opcode reached");
+        unimplemented_opcode();
     }
     
     TKP_INSTR_FUNC CPU::r_BGEZALL() {
-        throw ErrorFactory::generate_exception("r_BGEZALL opcode reached");
+        unimplemented_opcode();
     }
 
     #define fpu_instr bool is_double = (rfex_latch_.instruction.FType.fmt == 17)
@@ -1236,157 +1167,168 @@ namespace TKPEmu::N64::Devices {
     }
     
     TKP_INSTR_FUNC CPU::f_SUB() {
-        // VERBOSE(std::cout << "f_SUB not implemented" << std::endl;)
-        VERBOSE(std::cout << "f_SUB not implemented" << std::endl;)
+        N64_LOG(CPU, "f_SUB not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_MUL() {
-        VERBOSE(std::cout << "f_MUL not implemented" << std::endl;)
+        N64_LOG(CPU, "f_MUL not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_DIV() {
-        // VERBOSE(std::cout << "f_DIV not implemented" << std::endl;)
-        VERBOSE(std::cout << "f_DIV not implemented" << std::endl;)
+        N64_LOG(CPU, "f_DIV not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_SQRT() {
-        VERBOSE(std::cout << "f_SQRT not implemented" << std::endl;)
+        N64_LOG(CPU, "f_SQRT not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_ABS() {
-        VERBOSE(std::cout << "f_ABS not implemented" << std::endl;)
+        N64_LOG(CPU, "f_ABS not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_MOV() {
-        // VERBOSE(std::cout << "f_MOV not implemented" << std::endl;)
-        VERBOSE(std::cout << "f_MOV not implemented" << std::endl;)
+        N64_LOG(CPU, "f_MOV not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_NEG() {
-        VERBOSE(std::cout << "f_NEG not implemented" << std::endl;)
+        N64_LOG(CPU, "f_NEG not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_ROUNDL() {
-        VERBOSE(std::cout << "f_ROUNDL not implemented" << std::endl;)
+        N64_LOG(CPU, "f_ROUNDL not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_TRUNCL() {
-        VERBOSE(std::cout << "f_TRUNCL not implemented" << std::endl;)
+        N64_LOG(CPU, "f_TRUNCL not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CEILL() {
-        VERBOSE(std::cout << "f_CEILL not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CEILL not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_FLOORL() {
-        VERBOSE(std::cout << "f_FLOORL not implemented" << std::endl;)
+        N64_LOG(CPU, "f_FLOORL not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_ROUNDW() {
-        VERBOSE(std::cout << "f_ROUNDW not implemented" << std::endl;)
+        N64_LOG(CPU, "f_ROUNDW not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_TRUNCW() {
-        VERBOSE(std::cout << "f_TRUNCW not implemented" << std::endl;)
+        N64_LOG(CPU, "f_TRUNCW not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CEILW() {
-        VERBOSE(std::cout << "f_CEILW not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CEILW not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_FLOORW() {
-        VERBOSE(std::cout << "f_FLOORW not implemented" << std::endl;)
+        N64_LOG(CPU, "f_FLOORW not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CVTS() {
-        // VERBOSE(std::cout << "f_CVTS not implemented" << std::endl;)
-        std::cout << "Warning: f_CVTS unimplemented" << std::endl;
+        N64_LOG(CPU, "f_CVTS not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CVTD() {
-        // VERBOSE(std::cout << "f_CVTD not implemented" << std::endl;)
-        std::cout << "Warning: f_CVTD unimplemented" << std::endl;
+        N64_LOG(CPU, "f_CVTD not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CVTW() {
-        VERBOSE(std::cout << "f_CVTW not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CVTW not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CVTL() {
-        VERBOSE(std::cout << "f_CVTL not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CVTL not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CF() {
-        VERBOSE(std::cout << "f_CF not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CF not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CUN() {
-        VERBOSE(std::cout << "f_CUN not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CUN not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CEQ() {
-        VERBOSE(std::cout << "f_CEQ not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CEQ not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CUEQ() {
-        VERBOSE(std::cout << "f_CUEQ not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CUEQ not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_COLT() {
-        VERBOSE(std::cout << "f_COLT not implemented" << std::endl;)
+        N64_LOG(CPU, "f_COLT not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CULT() {
-        VERBOSE(std::cout << "f_CULT not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CULT not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_COLE() {
-        VERBOSE(std::cout << "f_COLE not implemented" << std::endl;)
+        N64_LOG(CPU, "f_COLE not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CULE() {
-        VERBOSE(std::cout << "f_CULE not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CULE not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CSF() {
-        VERBOSE(std::cout << "f_CSF not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CSF not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CNGLE() {
-        VERBOSE(std::cout << "f_CNGLE not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CNGLE not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CSEQ() {
-        VERBOSE(std::cout << "f_CSEQ not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CSEQ not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CNGL() {
-        VERBOSE(std::cout << "f_CNGL not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CNGL not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CLT() {
-        VERBOSE(std::cout << "f_CLT not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CLT not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CNGE() {
-        VERBOSE(std::cout << "f_CNGE not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CNGE not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CLE() {
-        // VERBOSE(std::cout << "f_CLE not implemented" << std::endl;)
-        VERBOSE(std::cout << "f_CLE not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CLE not implemented");
     }
     
     TKP_INSTR_FUNC CPU::f_CNGT() {
-        VERBOSE(std::cout << "f_CNGT not implemented" << std::endl;)
+        N64_LOG(CPU, "f_CNGT not implemented");
     }
 
     #undef fpu_instr
 
     CPU::PipelineStageRet CPU::IC(PipelineStageArgs) {
         // Fetch the current process instruction
-        auto paddr_s = translate_vaddr(pc_);
-        icrf_latch_.instruction.Full = cpubus_.fetch_instruction_uncached(paddr_s.paddr);
+        if (mode_ == CPUMode::CachedInterpreter) {
+            if (pc_ != block_pc_ || block_index_ == cur_block_->instructions.size()) [[unlikely]] {
+                enter_block();
+            }
+            const DecodedInstruction& decoded = cur_block_->instructions[block_index_++];
+            icrf_latch_.instruction = decoded.instruction;
+            icrf_latch_.handler = decoded.handler;
+            block_pc_ += 4;
+        } else {
+            auto paddr_s = translate_vaddr(pc_);
+            if (can_fetch(pc_, paddr_s)) [[likely]] {
+                icrf_latch_.instruction.Full = cpubus_.fetch_instruction_uncached(paddr_s.paddr);
+                icrf_latch_.handler = resolve_handler(icrf_latch_.instruction);
+            } else {
+                // Raised once the instruction reaches EX, it might be discarded before that
+                icrf_latch_.instruction.Full = 0;
+                icrf_latch_.handler = &lut_wrapper<&CPU::fetch_fault>;
+            }
+        }
         pc_ += 4;
     }
 
@@ -1396,39 +1338,69 @@ namespace TKPEmu::N64::Devices {
         rfex_latch_.fetched_rs.UD = gpr_regs_[icrf_latch_.instruction.RType.rs].UD;
         rfex_latch_.fetched_rt.UD = gpr_regs_[icrf_latch_.instruction.RType.rt].UD;
         rfex_latch_.instruction = icrf_latch_.instruction;
+        rfex_latch_.handler = icrf_latch_.handler;
     }
 
     CPU::PipelineStageRet CPU::EX(PipelineStageArgs) {
+        begin_ex();
+        execute_instruction();
+        end_ex();
+    }
+
+    void CPU::begin_ex() {
         if (!was_ldi_) {
+            #if N64TKP_HAS_PROFILER
+            profiler_.RecordInstruction(rfex_latch_.instruction, pc_ - 8, rfex_latch_.fetched_rs.UD);
+            #endif
+            #if N64TKP_HAS_TRACE
+            if (tracer_.Active()) [[unlikely]] {
+                trace_begin();
+            }
+            #endif
             // printf("r0: %016x r1: %016x r2: %016x r3: %016x r4: %016x r5: %016x r6: %016x r7: %016x r8: %016x r9: %016x r10: %016x r11: %016x r12: %016x r13: %016x r14: %016x r15: %016x r16: %016x r17: %016x r18: %016x r19: %016x r20: %016x r21: %016x r22: %016x r23: %016x r24: %016x r25: %016x r26: %016x r27: %016x r28: %016x r29: %016x r30: %016x r31: %016x\n", gpr_regs_[0].UD, gpr_regs_[1].UD, gpr_regs_[2].UD, gpr_regs_[3].UD, gpr_regs_[4].UD, gpr_regs_[5].UD, gpr_regs_[6].UD, gpr_regs_[7].UD, gpr_regs_[8].UD, gpr_regs_[9].UD, gpr_regs_[10].UD, gpr_regs_[11].UD, gpr_regs_[12].UD, gpr_regs_[13].UD, gpr_regs_[14].UD, gpr_regs_[15].UD, gpr_regs_[16].UD, gpr_regs_[17].UD, gpr_regs_[18].UD, gpr_regs_[19].UD, gpr_regs_[20].UD, gpr_regs_[21].UD, gpr_regs_[22].UD, gpr_regs_[23].UD, gpr_regs_[24].UD, gpr_regs_[25].UD, gpr_regs_[26].UD, gpr_regs_[27].UD, gpr_regs_[28].UD, gpr_regs_[29].UD, gpr_regs_[30].UD, gpr_regs_[31].UD);
             // printf("%08x r0: %016x r1: %016x r2: %016x r3: %016x r4: %016x r5: %016x r6: %016x r7: %016x r8: %016x r9: %016x r10: %016x r11: %016x r12: %016x r13: %016x r14: %016x r15: %016x r16: %016x r17: %016x r18: %016x r19: %016x r20: %016x r21: %016x r22: %016x r23: %016x r24: %016x r25: %016x r26: %016x r27: %016x r28: %016x r29: %016x r30: %016x r31: %016x\n", rfex_latch_.instruction.Full, gpr_regs_[0].UD, gpr_regs_[1].UD, gpr_regs_[2].UD, gpr_regs_[3].UD, gpr_regs_[4].UD, gpr_regs_[5].UD, gpr_regs_[6].UD, gpr_regs_[7].UD, gpr_regs_[8].UD, gpr_regs_[9].UD, gpr_regs_[10].UD, gpr_regs_[11].UD, gpr_regs_[12].UD, gpr_regs_[13].UD, gpr_regs_[14].UD, gpr_regs_[15].UD, gpr_regs_[16].UD, gpr_regs_[17].UD, gpr_regs_[18].UD, gpr_regs_[19].UD, gpr_regs_[20].UD, gpr_regs_[21].UD, gpr_regs_[22].UD, gpr_regs_[23].UD, gpr_regs_[24].UD, gpr_regs_[25].UD, gpr_regs_[26].UD, gpr_regs_[27].UD, gpr_regs_[28].UD, gpr_regs_[29].UD, gpr_regs_[30].UD, gpr_regs_[31].UD);
         }
         was_ldi_ = false;
         exdc_latch_.write_type = WriteType::NONE;
-        exdc_latch_.access_type = AccessType::NONE;
+        delay_slot_ = exdc_latch_.was_branch;
         exdc_latch_.was_branch = false;
-        execute_instruction();
+    }
+
+    void CPU::end_ex() {
+        #if N64TKP_HAS_TRACE
+        if (tracer_.Open()) [[unlikely]] {
+            trace_end();
+        }
+        #endif
+        if (exception_raised_) [[unlikely]] {
+            // The instruction faulted, none of its writes happen
+            exception_raised_ = false;
+            exdc_latch_.write_type = WriteType::NONE;
+            ldi_ = false;
+        }
     }
 
     CPU::PipelineStageRet CPU::DC(PipelineStageArgs) {
         dcwb_latch_.data = 0;
-        dcwb_latch_.access_type = exdc_latch_.access_type;
+        dcwb_latch_.memory_handler = exdc_latch_.memory_handler;
         dcwb_latch_.dest = exdc_latch_.dest;
         dcwb_latch_.write_type = exdc_latch_.write_type;
         dcwb_latch_.cached = exdc_latch_.cached;
         dcwb_latch_.paddr = exdc_latch_.paddr;
         if (exdc_latch_.write_type == WriteType::LATEREGISTER) {
-            auto paddr_s = translate_vaddr(exdc_latch_.vaddr);
-            uint32_t paddr = paddr_s.paddr;
-            dcwb_latch_.cached = paddr_s.cached;
-            load_memory(dcwb_latch_.cached, paddr, dcwb_latch_.data, dcwb_latch_.access_type);
-            // Result is cast to uint64_t in order to zero extend
-            dcwb_latch_.access_type = AccessType::UDOUBLEWORD;
+            // Translated during EX, where TLB exceptions are raised
+            // Zero or sign extended to 64 bits by the handler
+            dcwb_latch_.memory_handler(this, dcwb_latch_.cached, dcwb_latch_.paddr, dcwb_latch_.data);
+            #if N64TKP_HAS_TRACE
+            if (tracer_.Active()) [[unlikely]] {
+                tracer_.SetLoadValue(dcwb_latch_.data);
+            }
+            #endif
             // if (ldi_) { // This IF can work uncommented if register bypassing would work
                 // TODO: implement register bypassing from WB to EX and remove the comment above
                 // Write early so RF fetches the correct data
                 // TODO: technically not accurate behavior but the results are as expected
-            store_register(dcwb_latch_.dest, dcwb_latch_.data, dcwb_latch_.access_type);
+            store_register(dcwb_latch_.dest, dcwb_latch_.data);
             dcwb_latch_.write_type = WriteType::NONE;
             ldi_ = false;
             // }
@@ -1440,11 +1412,11 @@ namespace TKPEmu::N64::Devices {
     CPU::PipelineStageRet CPU::WB(PipelineStageArgs) {
         switch(dcwb_latch_.write_type) {
             case WriteType::MMU: {
-                store_memory(dcwb_latch_.cached, dcwb_latch_.paddr, dcwb_latch_.data, dcwb_latch_.access_type);
+                dcwb_latch_.memory_handler(this, dcwb_latch_.cached, dcwb_latch_.paddr, dcwb_latch_.data);
                 break;
             }
             case WriteType::LATEREGISTER: {
-                store_register(dcwb_latch_.dest, dcwb_latch_.data, dcwb_latch_.access_type);
+                store_register(dcwb_latch_.dest, dcwb_latch_.data);
                 break;
             }
             default: {
@@ -1453,170 +1425,70 @@ namespace TKPEmu::N64::Devices {
         }
     }
 
-    TranslatedAddress CPU::translate_vaddr(uint32_t addr) {
-        // Fast vaddr translation
-        // TODO: broken if uses kuseg
-        return { addr - KSEG0_START - ((addr >> 29) & 1) * 0x2000'0000, false };
-    }
-    void CPU::store_register(uint8_t* dest8, uint64_t data, int size) {
-        // std::memcpy(dest, &data, size);
-        uint64_t* dest = (uint64_t*)(dest8);
-        uint64_t mask = LUT[size];
-        *dest = (*dest & ~mask) | (data & mask);
+    TranslatedAddress CPU::translate_vaddr(uint32_t addr, bool write) {
+        // kseg0 and kseg1 are unmapped, everything else goes through the TLB
+        if ((addr >> 30) == 0b10) [[likely]] {
+            return { addr - KSEG0_START - ((addr >> 29) & 1) * 0x2000'0000, false };
+        }
+        return translate_mapped(addr, write);
     }
-    void CPU::invalidate_hwio(uint32_t addr, uint64_t& data) {
-        if (data != 0)
-        switch (addr) {
-            case PI_STATUS: {
-                cpubus_.pi_status_ = 0;
-                data = 0;
-                break;
-            }
-            case PI_RD_LEN: {
-                VERBOSE(std::cout << "PI_RD_LEN!" << std::endl;)
-                // std::memcpy(&cpubus_.rdram_[__builtin_bswap32(cpubus_.pi_cart_addr_)], cpubus_.redirect_paddress(__builtin_bswap32(cpubus_.pi_dram_addr_)), data + 1);
-                break;
-            }
-            case PI_WR_LEN: {
-                VERBOSE(std::cout << "PI_WR_LEN" << std::endl;)
-                std::memcpy(&cpubus_.rdram_[__builtin_bswap32(cpubus_.pi_dram_addr_)], cpubus_.redirect_paddress(__builtin_bswap32(cpubus_.pi_cart_addr_)), data + 1);
-                break;
-            }
-            case VI_CTRL: {
-                auto format = data & 0b11;
-                if (format == 0b10) {
-                    VERBOSE(std::cout << "rgb5" << std::endl;)
-                    rcp_.bitdepth_ = GL_UNSIGNED_SHORT_5_5_5_1_;
-                } else if (format == 0b11)
-                    rcp_.bitdepth_ = GL_UNSIGNED_BYTE_;
-                break;
-            }
-            case VI_ORIGIN: {
-                rcp_.framebuffer_ptr_ = cpubus_.redirect_paddress(data & 0xFFFFFF);
-                break;
-            }
-            case VI_WIDTH: {
-                VERBOSE(std::cout << "vi_width: " << std::dec << data << std::endl;)
-                rcp_.width_ = data;
-                rcp_.height_ = (480.0f / 640.0f) * data;
-                should_resize_ = true;
-                break;
-            }
-            case VI_V_CURRENT: {
-                cpubus_.set_interrupt(Interrupt::VI, false);
-                break;
-            }
-            case VI_V_INTR: {
-                rcp_.vi_v_intr_ = data;
-                data &= 0x3ff;
-                VERBOSE(std::cout << "vi_intr: " << data << std::endl;)
-                if (data == 0x3ff || data == 0)
-                    break;
-                uint64_t mod = cpubus_.time_ % (93'750'000 / 60);
-                uint64_t time_per = (93'750'000 / 60) / rcp_.num_halflines_;
-                uint64_t cur_line = mod / time_per;
-                int lines_left = (data > cur_line) ? (data - cur_line) : (rcp_.num_halflines_ - cur_line + data);
-                std::cout << "cur line: " << cur_line << " lines_left: " << lines_left << " data: " << data << std::endl;
-                queue_event(SchedulerEventType::Vi, time_per * lines_left);
-                break;
-            }
-            case VI_V_SYNC: {
-                rcp_.num_halflines_ = data >> 1;
-                break;
-            }
-            case MI_MASK: {
-                // todo: make into a loop
-                if (data & 0b10) {
-                    cpubus_.mi_mask_ |= 1;
-                }
-                if (data & 0b1000) {
-                    cpubus_.mi_mask_ |= 1 << 1;
-                }
-                if (data & 0b100000) {
-                    cpubus_.mi_mask_ |= 1 << 2;
-                }
-                if (data & 0b10000000) {
-                    cpubus_.mi_mask_ |= 1 << 3;
-                }
-                if (data & 0b1000000000) {
-                    cpubus_.mi_mask_ |= 1 << 4;
-                }
-                if (data & 0b100000000000) {
-                    cpubus_.mi_mask_ |= 1 << 5;
-                }
-                if (data & 0b1) {
-                    cpubus_.mi_mask_ &= ~1;
-                }
-                if (data & 0b100) {
-                    cpubus_.mi_mask_ &= ~(1 << 1);
-                }
-                if (data & 0b10000) {
-                    cpubus_.mi_mask_ &= ~(1 << 2);
-                }
-                if (data & 0b1000000) {
-                    cpubus_.mi_mask_ &= ~(1 << 3);
-                }
-                if (data & 0b100000000) {
-                    cpubus_.mi_mask_ &= ~(1 << 4);
-                }
-                if (data & 0b10000000000) {
-                    cpubus_.mi_mask_ &= ~(1 << 5);
-                }
-                data = cpubus_.mi_mask_;
-                break;
-            }
-            case PIF_COMMAND: {
-                VERBOSE(std::cout << "PIF_COMMAND: " << std::bitset<8>(data) << std::endl;)
-                if (data & 0x20) {
-                    data = 0x80;
-                    cpubus_.pif_ram_[0x32] = 0;
-                    cpubus_.pif_ram_[0x33] = 0;
-                    cpubus_.pif_ram_[0x34] = 0;
-                    cpubus_.pif_ram_[0x35] = 0;
-                    cpubus_.pif_ram_[0x36] = 0;
-                    cpubus_.pif_ram_[0x37] = 0;
-                }
-                if (data & 0x40) {
-                    cpubus_.pif_ram_.fill(0);
-                    data = 0;
-                }
-                break;
-            }
+
+    TranslatedAddress CPU::translate_data(uint32_t vaddr, bool write) {
+        auto paddr_s = translate_vaddr(vaddr, write);
+        if (paddr_s.result != TLBResult::Hit) [[unlikely]] {
+            raise_tlb_exception(vaddr, paddr_s.result, write);
+        } else if (!cpubus_.is_mapped(paddr_s.paddr)) [[unlikely]] {
+            raise_exception(ExceptionType::DataBusError);
         }
+        return paddr_s;
+    }
+    void CPU::store_register(uint8_t* dest, uint64_t data) {
+        std::memcpy(dest, &data, sizeof(data));
     }
-    void CPU::store_memory(bool cached, uint32_t paddr, uint64_t& data, int size) {
-        invalidate_hwio(paddr, data);
+    template<AccessType Size>
+    void CPU::store_memory(bool cached, uint32_t paddr, uint64_t& data) {
         // if (!cached) {
-        uint8_t* loc = cpubus_.redirect_paddress(paddr);
-        uint64_t temp = __builtin_bswap64(data);
-        temp >>= 8 * (AccessType::UDOUBLEWORD - size);
-        std::memcpy(loc, &temp, size);
+        uint32_t host_paddr = swizzle_address(paddr, Size);
+        uint8_t* loc = cpubus_.page_table_[host_paddr >> 20];
+        if (loc) [[likely]] {
+            loc += host_paddr & 0xFFFFF;
+        } else {
+            // Only memory mapped registers have side effects
+            invalidate_hwio(paddr, data);
+            loc = cpubus_.redirect_paddress(host_paddr);
+        }
+        AccessData<Size> temp = data;
+        if constexpr (Size == AccessType::UDOUBLEWORD) {
+            temp = std::rotl(temp, 32);
+        }
+        std::memcpy(loc, &temp, sizeof(temp));
+        if (block_cache_.IsCode(paddr)) [[unlikely]] {
+            invalidate_code(paddr, Size);
+        }
         // } else {
         //     // currently not implemented
         // }
     }
-    void CPU::load_memory(bool cached, uint32_t paddr, uint64_t& data, int size) {
-        uint8_t* loc = cpubus_.redirect_paddress(paddr);
-        uint64_t temp = 0;
-        std::memcpy(&temp, loc, size);
-        temp = __builtin_bswap64(temp);
-        temp >>= 8 * (AccessType::UDOUBLEWORD - size);
-        // Sign extend loaded word
-        if (exdc_latch_.sign_extend) {
-            switch (size) {
-                case 1:
-                    temp = static_cast<int64_t>(static_cast<int8_t>(temp));
-                    break;
-                case 2:
-                    temp = static_cast<int64_t>(static_cast<int16_t>(temp));
-                    break;
-                case 4:
-                    temp = static_cast<int64_t>(static_cast<int32_t>(temp));
-                    break;
-            }
-            exdc_latch_.sign_extend = false;
+    template<AccessType Size, bool SignExtend>
+    void CPU::load_memory(bool cached, uint32_t paddr, uint64_t& data) {
+        uint8_t* loc = cpubus_.redirect_paddress(swizzle_address(paddr, Size));
+        AccessData<Size> temp;
+        std::memcpy(&temp, loc, sizeof(temp));
+        if constexpr (Size == AccessType::UDOUBLEWORD) {
+            data = std::rotl(temp, 32);
+        } else if constexpr (SignExtend) {
+            data = static_cast<int64_t>(static_cast<std::make_signed_t<AccessData<Size>>>(temp));
+        } else {
+            data = temp;
         }
-        data = temp;
+    }
+    template<AccessType Size, bool SignExtend>
+    void CPU::load_handler(CPU* cpu, bool cached, uint32_t paddr, uint64_t& data) {
+        cpu->load_memory<Size, SignExtend>(cached, paddr, data);
+    }
+    template<AccessType Size>
+    void CPU::store_handler(CPU* cpu, bool cached, uint32_t paddr, uint64_t& data) {
+        cpu->store_memory<Size>(cached, paddr, data);
     }
     
     void CPU::clear_registers() {
@@ -1652,9 +1524,39 @@ namespace TKPEmu::N64::Devices {
         IC();
     }
 
-    void CPU::update_pipeline() {
-        while (scheduler_.size() && cpubus_.time_ >= scheduler_.top().time) [[unlikely]]
+    uint64_t CPU::run_batch(uint64_t max_cycles) {
+        if (fault_.type != FaultType::None) [[unlikely]] {
+            return 0;
+        }
+        uint64_t start = cpubus_.time_;
+        while (cpubus_.time_ >= scheduler_.GetNextDeadline()) [[unlikely]]
             handle_event();
+        if (vblank_ && stop_on_vblank_) [[unlikely]] {
+            return 0;
+        }
+        horizon_ = std::min(start + max_cycles, scheduler_.GetNextDeadline());
+        // queue_event pulls horizon_ in if an instruction schedules something sooner
+        if (mode_ == CPUMode::Recompiler) {
+            while (cpubus_.time_ < horizon_)
+                update_recompiler();
+        } else if (mode_ == CPUMode::Functional) {
+            while (cpubus_.time_ < horizon_)
+                update_functional();
+        } else {
+            #if N64TKP_HAS_THREADED_DISPATCH
+            run_threaded();
+            #else
+            while (cpubus_.time_ < horizon_)
+                update_pipeline();
+            #endif
+        }
+        uint64_t executed = cpubus_.time_ - start;
+        ++batch_count_;
+        batch_cycles_ += executed;
+        return executed;
+    }
+
+    void CPU::update_pipeline() {
         WB();
         DC();
         EX();
@@ -1666,45 +1568,321 @@ namespace TKPEmu::N64::Devices {
         ++cpubus_.time_;
     }
 
-    void CPU::check_interrupts() {
-        if ((cpubus_.mi_interrupt_ & cpubus_.mi_mask_) != 0) {
-            bool interrupts_pending = cp0_regs_[CP0_CAUSE].UB._1 & CP0Status.IM;
-            bool interrupts_enabled = cp0_regs_[CP0_STATUS].UD & 0b1;
-            bool currently_handling_exception = cp0_regs_[CP0_STATUS].UD & 0b10 & 0;
-            bool currently_handling_error = cp0_regs_[CP0_STATUS].UD & 0b100;
-            bool should_service_interrupt = interrupts_pending
-                                    && interrupts_enabled
-                                    && !currently_handling_exception
-                                    && !currently_handling_error;
-            if (should_service_interrupt) {
-                std::cout << "Handle exception!" << std::endl;
-                handle_exception(ExceptionType::Interrupt);
-            } else {
-                std::cout << "Mask pass but can't handle exception:\nEXL: " << currently_handling_exception << "\nERL: " << currently_handling_error << "\nIE: " << interrupts_enabled << "\nIP: " << interrupts_pending << std::endl;
-                std::cout << "CP0Status.IM:" << std::bitset<8>(CP0Status.IM) << "\nCP0Cause.IP:" << std::bitset<8>(cp0_regs_[CP0_CAUSE].UH._1);
+    #if N64TKP_HAS_THREADED_DISPATCH
+    size_t CPU::threaded_index(Instruction instr) {
+        // Branchless, the sub opcode field of SPECIAL and COP1 is func, REGIMM's is rt
+        struct SubOpcode {
+            uint8_t base;
+            uint8_t shift;
+            uint8_t mask;
+        };
+        static constexpr auto sub_opcodes = [] {
+            std::array<SubOpcode, 64> table {};
+            for (uint8_t op = 0; op < 64; op++) {
+                table[op] = { op, 0, 0 };
             }
-        } else {
-            std::cout << std::bitset<8>(cpubus_.mi_interrupt_) << "\n" << std::bitset<8>(cpubus_.mi_mask_) << std::endl;
-        }
+            table[0b000000] = { 64, 0, 0x3F };
+            table[0b000001] = { 128, 16, 0x1F };
+            table[0b010001] = { 160, 0, 0x3F };
+            return table;
+        }();
+        const SubOpcode& sub = sub_opcodes[instr.IType.op];
+        return sub.base + ((instr.Full >> sub.shift) & sub.mask);
     }
 
-    void CPU::handle_exception(ExceptionType exception) {
-        if (!CP0Status.EXL) {
-            auto new_pc = pc_ - 8;
-            if (exdc_latch_.was_branch) {
-                // currently executing branch delay slot
-                new_pc -= 4;
-            }
-            CP0Cause.BD = exdc_latch_.was_branch;
-            cp0_regs_[CP0_EPC].UD = new_pc;
-        }
-        CP0Status.EXL = true;
-        switch (exception) {
-            case ExceptionType::Interrupt:
-                CP0Cause.ExCode = 0;
-                pc_ = 0x8000'0180;
-            break;
+    bool CPU::advance_threaded() {
+        end_ex();
+        if (!ldi_) [[likely]] {
+            gpr_regs_[0].UD = 0;
+            RF();
+            IC();
         }
+        ++cpubus_.time_;
+        if (cpubus_.time_ >= horizon_) [[unlikely]]
+            return false;
+        WB();
+        DC();
+        begin_ex();
+        return true;
+    }
+
+    void CPU::run_threaded() {
+        static constexpr auto flat_table = [] {
+            std::array<InstructionHandler, 224> table {};
+            std::copy(InstructionTable.begin(), InstructionTable.end(), table.begin());
+            std::copy(SpecialTable.begin(), SpecialTable.end(), table.begin() + 64);
+            std::copy(RegImmTable.begin(), RegImmTable.end(), table.begin() + 128);
+            std::copy(FloatTable.begin(), FloatTable.end(), table.begin() + 160);
+            return table;
+        }();
+        // One label per slot of flat_table, slot_1F is index 0x1F
+        #define threaded_row(X, h) X(h,0) X(h,1) X(h,2) X(h,3) X(h,4) X(h,5) X(h,6) X(h,7) \
+                                   X(h,8) X(h,9) X(h,A) X(h,B) X(h,C) X(h,D) X(h,E) X(h,F)
+        #define threaded_rows(X) threaded_row(X,0) threaded_row(X,1) threaded_row(X,2) threaded_row(X,3) \
+                                 threaded_row(X,4) threaded_row(X,5) threaded_row(X,6) threaded_row(X,7) \
+                                 threaded_row(X,8) threaded_row(X,9) threaded_row(X,A) threaded_row(X,B) \
+                                 threaded_row(X,C) threaded_row(X,D)
+        #define threaded_label(h, l) &&slot_##h##l,
+        static void* const labels[] = { threaded_rows(threaded_label) };
+        static_assert(std::size(labels) == flat_table.size());
+        // Handlers that aren't what the instruction decodes to (NOPs inserted
+        // by load interlocks, fetch faults) go through the generic slot
+        #define threaded_dispatch() { \
+            size_t index = threaded_index(rfex_latch_.instruction); \
+            goto *(rfex_latch_.handler == flat_table[index] ? labels[index] : &&generic); \
+        }
+        // Only the dispatch is copied into every slot, the rest of the cycle is shared code
+        #define threaded_next() { \
+            if (!advance_threaded()) [[unlikely]] \
+                return; \
+            threaded_dispatch(); \
+        }
+        // The table is constexpr so each slot calls its handler directly
+        #define threaded_slot(h, l) slot_##h##l: flat_table[0x##h##l](this); threaded_next();
+
+        if (cpubus_.time_ >= horizon_)
+            return;
+        WB();
+        DC();
+        begin_ex();
+        threaded_dispatch();
+        threaded_rows(threaded_slot)
+    generic:
+        rfex_latch_.handler(this);
+        threaded_next();
+
+        #undef threaded_slot
+        #undef threaded_next
+        #undef threaded_dispatch
+        #undef threaded_label
+        #undef threaded_rows
+        #undef threaded_row
+    }
+    #endif
+
+    void CPU::update_recompiler() {
+        uint32_t vaddr = pc_;
+        auto paddr_s = translate_vaddr(vaddr);
+        uint32_t paddr = paddr_s.paddr;
+        // Only addresses that can be fetched get decoded, so finding a block is enough
+        DecodedBlock* block = paddr_s.result == TLBResult::Hit ? block_cache_.Find(paddr) : nullptr;
+        if (!block) {
+            if (!can_fetch(vaddr, paddr_s)) [[unlikely]] {
+                // Blocks never start in a delay slot
+                const DecodedInstruction& fault = fetch_fault_block_.instructions[0];
+                execute_isolated(fault.instruction, fault.handler, vaddr, false);
+                return;
+            }
+            block = decode_block(paddr);
+        }
+        CompiledBlock code = nullptr;
+        for (const CompiledCode& compiled : block->compiled) {
+            if (compiled.vaddr == vaddr) [[likely]] {
+                code = compiled.code;
+                break;
+            }
+        }
+        if (!code) [[unlikely]] {
+            code = recompiler_->Compile(*block, vaddr);
+            if (!code) {
+                // Out of code space, start over
+                recompiler_->Flush();
+                block_cache_.Clear();
+                block = decode_block(paddr);
+                code = recompiler_->Compile(*block, vaddr);
+            }
+            block->compiled.push_back({ vaddr, code });
+        }
+        code_invalidated_ = false;
+        IdleLoop idle_loop = block->idle_loop;
+        // block may be gone after this, if it overwrote itself
+        cpubus_.time_ += code(this);
+        if (idle_loop != IdleLoop::None && pc_ == vaddr) [[unlikely]] {
+            fast_forward_idle(idle_loop, 0);
+        }
+    }
+
+    void CPU::update_functional() {
+        if (pc_ != block_pc_ || block_index_ == cur_block_->instructions.size()) [[unlikely]] {
+            enter_block();
+        }
+        // block may be freed by a store, then block_pc_ no longer matches pc_
+        const DecodedBlock* block = cur_block_;
+        size_t size = block->instructions.size();
+        do {
+            const DecodedInstruction& current = block->instructions[block_index_++];
+            block_pc_ += 4;
+            uint32_t vaddr = pc_;
+            bool delay_slot = in_delay_slot_;
+            if (load_destination_ != -1) {
+                // Same check as detect_ldi
+                if (load_destination_ == current.rs || load_destination_ == current.rt) {
+                    ++cpubus_.time_;
+                }
+                load_destination_ = -1;
+            }
+            // A branch in a delay slot is left to the pipeline handlers
+            bool direct = current.direct && !(delay_slot && current.is_branch);
+            #if N64TKP_HAS_TRACE
+            direct = direct && !tracer_.Active();
+            #endif
+            if (direct) [[likely]] {
+                pc_ = delay_slot ? branch_target_ : static_cast<uint64_t>(vaddr) + 4;
+                in_delay_slot_ = false;
+                // The second half can't be a branch target or a delay slot, see decode_block
+                if (current.fused && !delay_slot && cpubus_.time_ + 1 < horizon_) {
+                    const DecodedInstruction& second = block->instructions[block_index_++];
+                    block_pc_ += 4;
+                    if (!current.fused(this, current, second, vaddr)) [[unlikely]] {
+                        execute_functional(second, vaddr + 4, false);
+                        continue;
+                    }
+                    gpr_regs_[0].UD = 0;
+                    ++cpubus_.time_;
+                    continue;
+                }
+                if (current.direct(this, current, vaddr)) [[likely]] {
+                    gpr_regs_[0].UD = 0;
+                    ++cpubus_.time_;
+                    continue;
+                }
+                // Nothing changed but pc_ and in_delay_slot_, which execute_functional sets again
+            }
+            execute_functional(current, vaddr, delay_slot);
+        } while (block_index_ < size && pc_ == block_pc_ && cpubus_.time_ < horizon_);
+    }
+
+    void CPU::execute_functional(const DecodedInstruction& instr, uint32_t vaddr, bool delay_slot) {
+        // Read before a store can invalidate the block instr is in
+        uint8_t rt = instr.rt;
+        // Likely branches and ERET discard the next instruction by turning IC/RF into a NOP
+        icrf_latch_.handler = nullptr;
+        execute_isolated(instr.instruction, instr.handler, vaddr, delay_slot);
+        bool discarded = icrf_latch_.handler == NopHandler;
+        if (exdc_latch_.was_branch) {
+            // pc_ is where the pipeline would fetch after the delay slot
+            in_delay_slot_ = !discarded;
+            if (in_delay_slot_) {
+                branch_target_ = pc_;
+                pc_ = static_cast<uint64_t>(vaddr) + 4;
+            }
+        } else if (pc_ == static_cast<uint64_t>(vaddr) + 8) {
+            pc_ = delay_slot ? branch_target_ : static_cast<uint64_t>(vaddr) + 4;
+            in_delay_slot_ = false;
+            if (exdc_latch_.write_type == WriteType::LATEREGISTER) {
+                load_destination_ = rt;
+            }
+        } else {
+            // An exception or ERET moved pc_
+            in_delay_slot_ = false;
+        }
+        ++cpubus_.time_;
+    }
+
+    void CPU::check_interrupts() {
+        if ((cpubus_.mi_interrupt_ & cpubus_.mi_mask_) != 0) {
+            bool interrupts_pending = cp0_regs_[CP0_CAUSE].UB._1 & CP0Status.IM;
+            bool interrupts_enabled = cp0_regs_[CP0_STATUS].UD & 0b1;
+            bool currently_handling_exception = cp0_regs_[CP0_STATUS].UD & 0b10 & 0;
+            bool currently_handling_error = cp0_regs_[CP0_STATUS].UD & 0b100;
+            bool should_service_interrupt = interrupts_pending
+                                    && interrupts_enabled
+                                    && !currently_handling_exception
+                                    && !currently_handling_error;
+            if (should_service_interrupt) {
+                N64_LOG(CP0, "Servicing interrupt, MI_INTR: %b MI_MASK: %b", cpubus_.mi_interrupt_, cpubus_.mi_mask_);
+                handle_interrupt();
+            } else {
+                N64_LOG(CP0, "Interrupt masked, EXL: %d ERL: %d IE: %d IP: %d", currently_handling_exception,
+                    currently_handling_error, interrupts_enabled, interrupts_pending);
+                N64_LOG(CP0, "Status.IM: %b Cause.IP: %b", CP0Status.IM, cp0_regs_[CP0_CAUSE].UB._1);
+            }
+        } else {
+            N64_LOG(CP0, "No interrupt, MI_INTR: %b MI_MASK: %b", cpubus_.mi_interrupt_, cpubus_.mi_mask_);
+        }
+    }
+
+    void CPU::handle_interrupt() {
+        if (!CP0Status.EXL) {
+            if (mode_ == CPUMode::Recompiler) {
+                // Events are only handled between blocks, never in a delay slot
+                CP0Cause.BD = false;
+                cp0_regs_[CP0_EPC].UD = pc_;
+            } else if (mode_ == CPUMode::Functional) {
+                // Handled between instructions, pc_ is the next one
+                CP0Cause.BD = in_delay_slot_;
+                cp0_regs_[CP0_EPC].UD = in_delay_slot_ ? pc_ - 4 : pc_;
+            } else {
+                auto new_pc = pc_ - 8;
+                if (exdc_latch_.was_branch) {
+                    // currently executing branch delay slot
+                    new_pc -= 4;
+                }
+                CP0Cause.BD = exdc_latch_.was_branch;
+                cp0_regs_[CP0_EPC].UD = new_pc;
+            }
+        }
+        CP0Status.EXL = true;
+        // The branch is retaken by returning to it
+        in_delay_slot_ = false;
+        CP0Cause.ExCode = static_cast<uint32_t>(ExceptionType::Interrupt);
+        pc_ = 0x8000'0180;
+    }
+
+    void CPU::raise_exception(ExceptionType exception, uint32_t vaddr) {
+        if (exception == ExceptionType::AddressErrorLoad || exception == ExceptionType::AddressErrorStore) {
+            cp0_regs_[CP0_BADVADDR].D = static_cast<int32_t>(vaddr);
+        }
+        if (!CP0Status.EXL) {
+            // At EX pc_ is 8 bytes past the current instruction
+            uint64_t epc = pc_ - 8;
+            if (delay_slot_) {
+                epc -= 4;
+            }
+            CP0Cause.BD = delay_slot_;
+            cp0_regs_[CP0_EPC].UD = epc;
+        }
+        CP0Status.EXL = true;
+        CP0Cause.ExCode = static_cast<uint32_t>(exception);
+        bool bev = cp0_regs_[CP0_STATUS].UD & (1 << 22);
+        pc_ = (bev ? 0xBFC0'0200 : 0x8000'0000) + 0x180;
+        exception_raised_ = true;
+        // The instruction after this one is already fetched, turn it into a NOP
+        icrf_latch_.instruction.Full = 0;
+        icrf_latch_.handler = NopHandler;
+    }
+
+    void CPU::fetch_fault() {
+        uint32_t vaddr = pc_ - 8;
+        if ((vaddr & 0b11) != 0) {
+            raise_exception(ExceptionType::AddressErrorLoad, vaddr);
+            return;
+        }
+        auto paddr_s = translate_vaddr(vaddr);
+        if (paddr_s.result == TLBResult::Hit && !cpubus_.is_mapped(paddr_s.paddr)) {
+            raise_exception(ExceptionType::InstructionBusError);
+            return;
+        }
+        TLBResult result = paddr_s.result == TLBResult::Hit ? TLBResult::Miss : paddr_s.result;
+        raise_tlb_exception(vaddr, result, false);
+    }
+
+    bool CPU::can_fetch(uint32_t vaddr, const TranslatedAddress& paddr_s) {
+        return (vaddr & 0b11) == 0 && paddr_s.result == TLBResult::Hit && cpubus_.is_mapped(paddr_s.paddr);
+    }
+
+    void CPU::raise_fault(FaultType type, uint32_t address) {
+        // Only the first fault is interesting, the rest are usually fallout from it
+        if (fault_.type == FaultType::None) {
+            fault_ = { type, static_cast<uint32_t>(pc_ - 8), address, rfex_latch_.instruction.Full };
+        }
+        // Every run loop stops once time_ reaches horizon_
+        horizon_ = 0;
+    }
+
+    void CPU::unimplemented_opcode() {
+        raise_fault(FaultType::UnimplementedOpcode);
+        exception_raised_ = true;
     }
 
     void CPU::fire_count() {
@@ -1712,16 +1890,798 @@ namespace TKPEmu::N64::Devices {
         SetBit(flags, 15, true);
         cp0_regs_[CP0_CAUSE].UW._0 = flags;
         cp0_regs_[CP0_COUNT].UD = cp0_regs_[CP0_COMPARE].UD;
-        std::cout << "Fired count!" << std::endl;
+        N64_LOG(CP0, "Count reached Compare");
         // queue_event(SchedulerEventType::Interrupt, 1);
     }
 
     void CPU::execute_instruction() {
-        (InstructionTable[rfex_latch_.instruction.IType.op])(this);
+        rfex_latch_.handler(this);
+    }
+
+    void CPU::execute_isolated(uint32_t word, uint32_t pc, bool delay_slot) {
+        Instruction instr;
+        instr.Full = word;
+        execute_isolated(instr, resolve_handler(instr), pc, delay_slot);
+    }
+
+    void CPU::execute_isolated(Instruction instr, InstructionHandler handler, uint32_t pc, bool delay_slot) {
+        rfex_latch_.instruction = instr;
+        rfex_latch_.handler = handler;
+        rfex_latch_.fetched_rs.UD = gpr_regs_[rfex_latch_.instruction.RType.rs].UD;
+        rfex_latch_.fetched_rt.UD = gpr_regs_[rfex_latch_.instruction.RType.rt].UD;
+        rfex_latch_.fetched_rt_i = rfex_latch_.instruction.RType.rt;
+        // Handlers expect pc_ to be where it is during EX
+        pc_ = static_cast<uint64_t>(pc) + 8;
+        exdc_latch_.was_branch = delay_slot;
+        EX();
+        DC();
+        WB();
+        // The load already happened, there's no load delay to honor
+        ldi_ = false;
+        was_ldi_ = false;
+        gpr_regs_[0].UD = 0;
+    }
+
+    InstructionHandler CPU::resolve_handler(Instruction instr) {
+        switch (instr.IType.op) {
+            case 0b000000: return SpecialTable[instr.RType.func];
+            case 0b000001: return RegImmTable[instr.RType.rt];
+            case 0b010001: return FloatTable[instr.RType.func];
+            default:       return InstructionTable[instr.IType.op];
+        }
+    }
+
+    DecodedInstruction CPU::decode_instruction(Instruction instr) {
+        DecodedInstruction decoded {
+            .handler = resolve_handler(instr),
+            .instruction = instr,
+            .seimm = static_cast<int16_t>(instr.IType.immediate),
+            .rs = static_cast<uint8_t>(instr.RType.rs),
+            .rt = static_cast<uint8_t>(instr.RType.rt),
+            .rd = static_cast<uint8_t>(instr.RType.rd),
+            .is_branch = false,
+        };
+        switch (instr.IType.op) {
+            case 0b000000: {
+                // JR, JALR
+                decoded.is_branch = instr.RType.func == 0b001000 || instr.RType.func == 0b001001;
+                break;
+            }
+            case 0b000001: {
+                // BLTZ, BGEZ, BLTZL, BGEZL and their linking versions
+                decoded.is_branch = (instr.RType.rt & 0b01100) == 0;
+                break;
+            }
+            case 0b000010: case 0b000011: case 0b000100: case 0b000101:
+            case 0b000110: case 0b000111: case 0b010100: case 0b010101:
+            case 0b010110: case 0b010111: {
+                decoded.is_branch = true;
+                break;
+            }
+            case 0b010001: {
+                // BC1x
+                decoded.is_branch = instr.RType.rs == 0b01000;
+                break;
+            }
+        }
+        #if !N64TKP_HAS_PROFILER
+        // The profiler records instructions as they go through EX
+        decoded.direct = direct_handler(instr);
+        #endif
+        return decoded;
+    }
+
+    DirectHandler CPU::direct_handler(Instruction instr) {
+        // Only instructions the pipeline handlers implement, with the same results
+        switch (instr.IType.op) {
+            case 0b000000: {
+                switch (instr.RType.func) {
+                    case 0b000000: return &direct_wrapper<&CPU::direct_sll>;
+                    case 0b000010: return &direct_wrapper<&CPU::direct_srl>;
+                    case 0b000011: return &direct_wrapper<&CPU::direct_sra>;
+                    case 0b000100: return &direct_wrapper<&CPU::direct_sllv>;
+                    case 0b000110: return &direct_wrapper<&CPU::direct_srlv>;
+                    case 0b000111: return &direct_wrapper<&CPU::direct_srav>;
+                    case 0b001000: return &direct_wrapper<&CPU::direct_jr>;
+                    case 0b001001: return &direct_wrapper<&CPU::direct_jalr>;
+                    case 0b010000: return &direct_wrapper<&CPU::direct_mfhi>;
+                    case 0b010010: return &direct_wrapper<&CPU::direct_mflo>;
+                    case 0b100001: return &direct_wrapper<&CPU::direct_addu>;
+                    case 0b100011: return &direct_wrapper<&CPU::direct_subu>;
+                    case 0b100100: return &direct_wrapper<&CPU::direct_and>;
+                    case 0b100101: return &direct_wrapper<&CPU::direct_or>;
+                    case 0b100110: return &direct_wrapper<&CPU::direct_xor>;
+                    case 0b100111: return &direct_wrapper<&CPU::direct_nor>;
+                    case 0b101010: return &direct_wrapper<&CPU::direct_slt>;
+                    case 0b101011: return &direct_wrapper<&CPU::direct_sltu>;
+                }
+                return nullptr;
+            }
+            case 0b000001: {
+                switch (instr.RType.rt) {
+                    case 0b00001: return &direct_wrapper<&CPU::direct_branch<BranchCondition::GreaterEqualZero, false>>;
+                    case 0b00011: return &direct_wrapper<&CPU::direct_branch<BranchCondition::GreaterEqualZero, true>>;
+                }
+                return nullptr;
+            }
+            case 0b000010: return &direct_wrapper<&CPU::direct_j>;
+            case 0b000011: return &direct_wrapper<&CPU::direct_jal>;
+            case 0b000100: return &direct_wrapper<&CPU::direct_branch<BranchCondition::Equal, false>>;
+            case 0b000101: return &direct_wrapper<&CPU::direct_branch<BranchCondition::NotEqual, false>>;
+            case 0b000110: return &direct_wrapper<&CPU::direct_branch<BranchCondition::LessEqualZero, false>>;
+            case 0b000111: return &direct_wrapper<&CPU::direct_branch<BranchCondition::GreaterZero, false>>;
+            case 0b001001: return &direct_wrapper<&CPU::direct_addiu>;
+            case 0b001010: return &direct_wrapper<&CPU::direct_slti>;
+            case 0b001011: return &direct_wrapper<&CPU::direct_sltiu>;
+            case 0b001100: return &direct_wrapper<&CPU::direct_andi>;
+            case 0b001101: return &direct_wrapper<&CPU::direct_ori>;
+            case 0b001110: return &direct_wrapper<&CPU::direct_xori>;
+            case 0b001111: return &direct_wrapper<&CPU::direct_lui>;
+            case 0b010100: return &direct_wrapper<&CPU::direct_branch<BranchCondition::Equal, true>>;
+            case 0b010101: return &direct_wrapper<&CPU::direct_branch<BranchCondition::NotEqual, true>>;
+            case 0b010110: return &direct_wrapper<&CPU::direct_branch<BranchCondition::LessEqualZero, true>>;
+            case 0b011001: return &direct_wrapper<&CPU::direct_daddiu>;
+            case 0b100000: return &direct_wrapper<&CPU::direct_load<AccessType::BYTE, true>>;
+            case 0b100001: return &direct_wrapper<&CPU::direct_load<AccessType::HALFWORD, true>>;
+            case 0b100011: return &direct_wrapper<&CPU::direct_load<AccessType::WORD, true>>;
+            case 0b100100: return &direct_wrapper<&CPU::direct_load<AccessType::UBYTE, false>>;
+            case 0b100101: return &direct_wrapper<&CPU::direct_load<AccessType::UHALFWORD, false>>;
+            case 0b100111: return &direct_wrapper<&CPU::direct_load<AccessType::UWORD, false>>;
+            case 0b110111: return &direct_wrapper<&CPU::direct_load<AccessType::UDOUBLEWORD, false>>;
+            case 0b101000: return &direct_wrapper<&CPU::direct_store<AccessType::UBYTE>>;
+            case 0b101001: return &direct_wrapper<&CPU::direct_store<AccessType::UHALFWORD>>;
+            case 0b101011: return &direct_wrapper<&CPU::direct_store<AccessType::UWORD>>;
+            case 0b111111: return &direct_wrapper<&CPU::direct_store<AccessType::UDOUBLEWORD>>;
+        }
+        return nullptr;
+    }
+
+    DecodedBlock* CPU::decode_block(uint32_t paddr) {
+        constexpr size_t MAX_BLOCK_SIZE = 256;
+        std::vector<DecodedInstruction> instructions;
+        uint32_t cur = paddr;
+        while (true) {
+            Instruction instr;
+            instr.Full = cpubus_.fetch_instruction_uncached(cur);
+            cur += 4;
+            auto decoded = decode_instruction(instr);
+            instructions.push_back(decoded);
+            if (decoded.is_branch) {
+                // The delay slot belongs to the branch, even if it lives on the next page
+                instr.Full = cpubus_.fetch_instruction_uncached(cur);
+                instructions.push_back(decode_instruction(instr));
+                break;
+            }
+            bool is_eret = instr.IType.op == 0b010000 && (instr.RType.rs & 0b10000) && instr.RType.func == 0b011000;
+            bool is_trap = instr.IType.op == 0b000000 && (instr.RType.func == 0b001100 || instr.RType.func == 0b001101);
+            if (is_eret || is_trap || (cur & 0xFFF) == 0 || instructions.size() == MAX_BLOCK_SIZE) {
+                break;
+            }
+        }
+        // A branch into the middle of a pair starts its own block, so a pair is
+        // only ever entered from the top. Delay slots end blocks and never fuse
+        for (size_t i = 0; i + 1 < instructions.size(); i++) {
+            if (!instructions[i].is_branch) {
+                instructions[i].fused = fuse_instructions(instructions[i], instructions[i + 1]);
+            }
+        }
+        DecodedBlock* block = block_cache_.Insert(paddr, std::move(instructions));
+        detect_idle_loop(*block);
+        return block;
+    }
+
+    template<auto First, auto Second>
+    bool CPU::fused_handler(CPU* cpu, const DecodedInstruction& first, const DecodedInstruction& second, uint32_t vaddr) {
+        // The first half never declines and never writes r0
+        (cpu->*First)(first, vaddr);
+        ++cpu->cpubus_.time_;
+        cpu->pc_ = static_cast<uint64_t>(vaddr) + 8;
+        return (cpu->*Second)(second, vaddr + 4);
+    }
+
+    template<auto First>
+    FusedHandler CPU::fuse_compare_branch(const DecodedInstruction& second) {
+        switch (second.instruction.IType.op) {
+            case 0b000100: return &fused_handler<First, &CPU::direct_branch<BranchCondition::Equal, false>>;
+            case 0b000101: return &fused_handler<First, &CPU::direct_branch<BranchCondition::NotEqual, false>>;
+            case 0b010100: return &fused_handler<First, &CPU::direct_branch<BranchCondition::Equal, true>>;
+            case 0b010101: return &fused_handler<First, &CPU::direct_branch<BranchCondition::NotEqual, true>>;
+        }
+        return nullptr;
+    }
+
+    FusedHandler CPU::fuse_lui(const DecodedInstruction& second) {
+        constexpr auto lui = &CPU::direct_lui;
+        switch (second.instruction.IType.op) {
+            case 0b001001: return &fused_handler<lui, &CPU::direct_addiu>;
+            case 0b001101: return &fused_handler<lui, &CPU::direct_ori>;
+            case 0b100000: return &fused_handler<lui, &CPU::direct_load<AccessType::BYTE, true>>;
+            case 0b100001: return &fused_handler<lui, &CPU::direct_load<AccessType::HALFWORD, true>>;
+            case 0b100011: return &fused_handler<lui, &CPU::direct_load<AccessType::WORD, true>>;
+            case 0b100100: return &fused_handler<lui, &CPU::direct_load<AccessType::UBYTE, false>>;
+            case 0b100101: return &fused_handler<lui, &CPU::direct_load<AccessType::UHALFWORD, false>>;
+            case 0b100111: return &fused_handler<lui, &CPU::direct_load<AccessType::UWORD, false>>;
+            case 0b110111: return &fused_handler<lui, &CPU::direct_load<AccessType::UDOUBLEWORD, false>>;
+            case 0b101000: return &fused_handler<lui, &CPU::direct_store<AccessType::UBYTE>>;
+            case 0b101001: return &fused_handler<lui, &CPU::direct_store<AccessType::UHALFWORD>>;
+            case 0b101011: return &fused_handler<lui, &CPU::direct_store<AccessType::UWORD>>;
+            case 0b111111: return &fused_handler<lui, &CPU::direct_store<AccessType::UDOUBLEWORD>>;
+        }
+        return nullptr;
+    }
+
+    FusedHandler CPU::fuse_instructions(const DecodedInstruction& first, const DecodedInstruction& second) {
+        // Picked from the pair histogram, see N64::GetOpcodePairHistogram. Both
+        // halves need a direct handler, a declined second half runs on its own
+        if (!first.direct || !second.direct) {
+            return nullptr;
+        }
+        switch (first.instruction.IType.op) {
+            case 0b001111: return first.rt != 0 ? fuse_lui(second) : nullptr;
+            case 0b000000: {
+                if (first.rd == 0) {
+                    return nullptr;
+                }
+                if (first.instruction.RType.func == 0b101010) {
+                    return fuse_compare_branch<&CPU::direct_slt>(second);
+                } else if (first.instruction.RType.func == 0b101011) {
+                    return fuse_compare_branch<&CPU::direct_sltu>(second);
+                }
+                return nullptr;
+            }
+            case 0b001010: return first.rt != 0 ? fuse_compare_branch<&CPU::direct_slti>(second) : nullptr;
+            case 0b001011: return first.rt != 0 ? fuse_compare_branch<&CPU::direct_sltiu>(second) : nullptr;
+        }
+        return nullptr;
+    }
+
+    template<auto MemberFunc>
+    bool CPU::direct_wrapper(CPU* cpu, const DecodedInstruction& instr, uint32_t vaddr) {
+        return (cpu->*MemberFunc)(instr, vaddr);
+    }
+
+    bool CPU::direct_lui(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rt].D = instr.seimm * 0x10000;
+        return true;
+    }
+
+    bool CPU::direct_addiu(const DecodedInstruction& instr, uint32_t) {
+        int32_t result = gpr_regs_[instr.rs].UW._0 + static_cast<uint32_t>(instr.seimm);
+        gpr_regs_[instr.rt].D = result;
+        return true;
+    }
+
+    bool CPU::direct_daddiu(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rt].UD = gpr_regs_[instr.rs].UD + static_cast<uint64_t>(instr.seimm);
+        return true;
+    }
+
+    bool CPU::direct_andi(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rt].UD = gpr_regs_[instr.rs].UD & instr.instruction.IType.immediate;
+        return true;
+    }
+
+    bool CPU::direct_ori(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rt].UD = gpr_regs_[instr.rs].UD | instr.instruction.IType.immediate;
+        return true;
+    }
+
+    bool CPU::direct_xori(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rt].UD = gpr_regs_[instr.rs].UD ^ instr.instruction.IType.immediate;
+        return true;
+    }
+
+    bool CPU::direct_slti(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rt].UD = gpr_regs_[instr.rs].D < instr.seimm;
+        return true;
+    }
+
+    bool CPU::direct_sltiu(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rt].UD = gpr_regs_[instr.rs].UD < static_cast<uint64_t>(instr.seimm);
+        return true;
+    }
+
+    bool CPU::direct_addu(const DecodedInstruction& instr, uint32_t) {
+        int32_t result = gpr_regs_[instr.rs].UW._0 + gpr_regs_[instr.rt].UW._0;
+        gpr_regs_[instr.rd].D = result;
+        return true;
+    }
+
+    bool CPU::direct_subu(const DecodedInstruction& instr, uint32_t) {
+        int32_t result = gpr_regs_[instr.rs].UW._0 - gpr_regs_[instr.rt].UW._0;
+        gpr_regs_[instr.rd].D = result;
+        return true;
+    }
+
+    bool CPU::direct_and(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rd].UD = gpr_regs_[instr.rs].UD & gpr_regs_[instr.rt].UD;
+        return true;
+    }
+
+    bool CPU::direct_or(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rd].UD = gpr_regs_[instr.rs].UD | gpr_regs_[instr.rt].UD;
+        return true;
+    }
+
+    bool CPU::direct_xor(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rd].UD = gpr_regs_[instr.rs].UD ^ gpr_regs_[instr.rt].UD;
+        return true;
+    }
+
+    bool CPU::direct_nor(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rd].UD = ~(gpr_regs_[instr.rs].UD | gpr_regs_[instr.rt].UD);
+        return true;
+    }
+
+    bool CPU::direct_slt(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rd].UD = gpr_regs_[instr.rs].D < gpr_regs_[instr.rt].D;
+        return true;
+    }
+
+    bool CPU::direct_sltu(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rd].UD = gpr_regs_[instr.rs].UD < gpr_regs_[instr.rt].UD;
+        return true;
+    }
+
+    bool CPU::direct_sll(const DecodedInstruction& instr, uint32_t) {
+        int32_t result = gpr_regs_[instr.rt].UW._0 << instr.instruction.RType.sa;
+        gpr_regs_[instr.rd].D = result;
+        return true;
+    }
+
+    bool CPU::direct_srl(const DecodedInstruction& instr, uint32_t) {
+        int32_t result = gpr_regs_[instr.rt].UW._0 >> instr.instruction.RType.sa;
+        gpr_regs_[instr.rd].D = result;
+        return true;
+    }
+
+    bool CPU::direct_sra(const DecodedInstruction& instr, uint32_t) {
+        // Shifts the whole register like s_SRA, then keeps the low word
+        int32_t result = gpr_regs_[instr.rt].D >> instr.instruction.RType.sa;
+        gpr_regs_[instr.rd].D = result;
+        return true;
+    }
+
+    bool CPU::direct_sllv(const DecodedInstruction& instr, uint32_t) {
+        int32_t result = gpr_regs_[instr.rt].UW._0 << (gpr_regs_[instr.rs].UD & 0b11111);
+        gpr_regs_[instr.rd].D = result;
+        return true;
+    }
+
+    bool CPU::direct_srlv(const DecodedInstruction& instr, uint32_t) {
+        int32_t result = gpr_regs_[instr.rt].UW._0 >> (gpr_regs_[instr.rs].UD & 0b11111);
+        gpr_regs_[instr.rd].D = result;
+        return true;
+    }
+
+    bool CPU::direct_srav(const DecodedInstruction& instr, uint32_t) {
+        int32_t result = gpr_regs_[instr.rt].D >> (gpr_regs_[instr.rs].UD & 0b11111);
+        gpr_regs_[instr.rd].D = result;
+        return true;
+    }
+
+    bool CPU::direct_mfhi(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rd].UD = hi_;
+        return true;
+    }
+
+    bool CPU::direct_mflo(const DecodedInstruction& instr, uint32_t) {
+        gpr_regs_[instr.rd].UD = lo_;
+        return true;
+    }
+
+    template<AccessType Size, bool SignExtend>
+    bool CPU::direct_load(const DecodedInstruction& instr, uint32_t) {
+        if constexpr (Size == AccessType::UDOUBLEWORD) {
+            if (!mode64_ && opmode_ != OperatingMode::Kernel) [[unlikely]] {
+                return false;
+            }
+        }
+        uint32_t vaddr = gpr_regs_[instr.rs].UW._0 + static_cast<uint32_t>(instr.seimm);
+        auto paddr_s = translate_vaddr(vaddr);
+        if ((vaddr & (Size - 1)) != 0 || paddr_s.result != TLBResult::Hit) [[unlikely]] {
+            return false;
+        }
+        // Raises a bus error
+        if (!cpubus_.is_mapped(paddr_s.paddr)) [[unlikely]] {
+            return false;
+        }
+        uint64_t data;
+        load_memory<Size, SignExtend>(paddr_s.cached, paddr_s.paddr, data);
+        gpr_regs_[instr.rt].UD = data;
+        load_destination_ = instr.rt;
+        return true;
+    }
+
+    template<AccessType Size>
+    bool CPU::direct_store(const DecodedInstruction& instr, uint32_t) {
+        if constexpr (Size == AccessType::UDOUBLEWORD) {
+            if (!mode64_ && opmode_ != OperatingMode::Kernel) [[unlikely]] {
+                return false;
+            }
+        }
+        uint32_t vaddr = gpr_regs_[instr.rs].UW._0 + static_cast<uint32_t>(instr.seimm);
+        auto paddr_s = translate_vaddr(vaddr, true);
+        if ((vaddr & (Size - 1)) != 0 || paddr_s.result != TLBResult::Hit) [[unlikely]] {
+            return false;
+        }
+        if (!cpubus_.is_mapped(paddr_s.paddr)) [[unlikely]] {
+            return false;
+        }
+        uint64_t data = gpr_regs_[instr.rt].UD;
+        // Can free the block instr lives in, so it's the last thing that happens
+        store_memory<Size>(paddr_s.cached, paddr_s.paddr, data);
+        return true;
+    }
+
+    template<BranchCondition Condition, bool Likely>
+    bool CPU::direct_branch(const DecodedInstruction& instr, uint32_t vaddr) {
+        bool taken;
+        if constexpr (Condition == BranchCondition::Equal) {
+            taken = gpr_regs_[instr.rs].UD == gpr_regs_[instr.rt].UD;
+        } else if constexpr (Condition == BranchCondition::NotEqual) {
+            taken = gpr_regs_[instr.rs].UD != gpr_regs_[instr.rt].UD;
+        } else if constexpr (Condition == BranchCondition::LessEqualZero) {
+            taken = gpr_regs_[instr.rs].D <= 0;
+        } else if constexpr (Condition == BranchCondition::GreaterZero) {
+            taken = gpr_regs_[instr.rs].D > 0;
+        } else {
+            // r_BGEZ only looks at the low word
+            taken = gpr_regs_[instr.rs].W._0 >= 0;
+        }
+        if (taken) {
+            // Same offset the pipeline handlers compute
+            int16_t offset = instr.instruction.IType.immediate << 2;
+            in_delay_slot_ = true;
+            branch_target_ = static_cast<uint64_t>(vaddr) + 4 + static_cast<int32_t>(offset);
+        } else if constexpr (Likely) {
+            // The delay slot is skipped
+            pc_ = static_cast<uint64_t>(vaddr) + 8;
+        } else {
+            in_delay_slot_ = true;
+            branch_target_ = static_cast<uint64_t>(vaddr) + 8;
+        }
+        return true;
+    }
+
+    bool CPU::direct_j(const DecodedInstruction& instr, uint32_t vaddr) {
+        in_delay_slot_ = true;
+        branch_target_ = ((static_cast<uint64_t>(vaddr) + 8) & 0xF000'0000) | (instr.instruction.JType.target << 2);
+        return true;
+    }
+
+    bool CPU::direct_jal(const DecodedInstruction& instr, uint32_t vaddr) {
+        gpr_regs_[31].UD = static_cast<uint64_t>(vaddr) + 8;
+        return direct_j(instr, vaddr);
+    }
+
+    bool CPU::direct_jr(const DecodedInstruction& instr, uint32_t) {
+        // A misaligned target faults when it's fetched, see can_fetch
+        in_delay_slot_ = true;
+        branch_target_ = gpr_regs_[instr.rs].UD;
+        return true;
+    }
+
+    bool CPU::direct_jalr(const DecodedInstruction& instr, uint32_t vaddr) {
+        // rs is read before the link is written, like in s_JALR
+        uint64_t target = gpr_regs_[instr.rs].UD;
+        gpr_regs_[instr.rd == 0 ? 31 : instr.rd].UD = static_cast<uint64_t>(vaddr) + 8;
+        in_delay_slot_ = true;
+        branch_target_ = target;
+        return true;
+    }
+
+    std::string CPU::mnemonic(Instruction instr) {
+        switch (instr.IType.op) {
+            case 0b000000: return SpecialCodes[instr.RType.func];
+            case 0b000001: return RegImmCodes[instr.RType.rt];
+            default:       return OperationCodes[instr.IType.op];
+        }
+    }
+
+    int CPU::written_register(Instruction instr) {
+        switch (instr.IType.op) {
+            case 0b000000: {
+                switch (instr.RType.func) {
+                    // JR, SYSCALL, BREAK, SYNC, MTHI, MTLO
+                    case 0b001000: case 0b001100: case 0b001101: case 0b001111:
+                    case 0b010001: case 0b010011:
+                        return 0;
+                }
+                // Multiplies, divides and traps
+                bool no_rd = (instr.RType.func >> 3) == 0b011 || (instr.RType.func >> 3) == 0b110;
+                return no_rd ? 0 : instr.RType.rd;
+            }
+            // Linking REGIMM branches
+            case 0b000001: return (instr.RType.rt >> 2) == 0b100 ? 31 : 0;
+            // JAL
+            case 0b000011: return 31;
+            // MFC0, DMFC0, MFC1, DMFC1, CFC1
+            case 0b010000: return instr.RType.rs <= 0b00001 ? instr.RType.rt : 0;
+            case 0b010001: return instr.RType.rs <= 0b00010 ? instr.RType.rt : 0;
+            // ADDI to LUI, DADDI, DADDIU, LDL, LDR, loads, LL, LLD, LD, SC, SCD
+            case 0b001000: case 0b001001: case 0b001010: case 0b001011:
+            case 0b001100: case 0b001101: case 0b001110: case 0b001111:
+            case 0b011000: case 0b011001: case 0b011010: case 0b011011:
+            case 0b100000: case 0b100001: case 0b100010: case 0b100011:
+            case 0b100100: case 0b100101: case 0b100110: case 0b100111:
+            case 0b110000: case 0b110100: case 0b110111: case 0b111000:
+            case 0b111100:
+                return instr.IType.rt;
+        }
+        return 0;
+    }
+
+    #if N64TKP_HAS_TRACE
+    void CPU::trace_begin() {
+        // Discarded delay slots
+        if (rfex_latch_.handler == NopHandler && rfex_latch_.instruction.Full == 0) {
+            return;
+        }
+        // pc_ already points past the branch target when a delay slot reaches EX
+        uint32_t pc = exdc_latch_.was_branch ? tracer_.LastPC() + 4 : pc_ - 8;
+        tracer_.Begin(pc, rfex_latch_.instruction.Full);
+    }
+
+    void CPU::trace_end() {
+        if (exception_raised_) {
+            tracer_.Cancel();
+            return;
+        }
+        TraceRecord& record = tracer_.Current();
+        // The handler may have replaced rfex_latch_.instruction with a NOP
+        Instruction instr;
+        instr.Full = record.instruction;
+        int reg = written_register(instr);
+        if (exdc_latch_.write_type == WriteType::MMU) {
+            record.flags = TraceRecord::STORE;
+            record.address = exdc_latch_.paddr;
+            record.value = exdc_latch_.data;
+        } else if (exdc_latch_.write_type == WriteType::LATEREGISTER) {
+            // The value is filled in by DC
+            record.flags = TraceRecord::LOAD;
+            record.address = exdc_latch_.paddr;
+            if (reg != 0) {
+                record.reg = reg;
+                record.flags |= TraceRecord::REGISTER;
+            }
+        } else if (reg != 0) {
+            record.reg = reg;
+            record.flags = TraceRecord::REGISTER;
+            record.value = gpr_regs_[reg].UD;
+        }
+        tracer_.Commit();
+    }
+
+    void CPU::trace_direct(const DecodedInstruction& instr, uint32_t vaddr) {
+        TraceRecord& record = tracer_.Begin(vaddr, instr.instruction.Full);
+        int reg = written_register(instr.instruction);
+        if (reg != 0) {
+            record.reg = reg;
+            record.flags = TraceRecord::REGISTER;
+            record.value = gpr_regs_[reg].UD;
+        }
+        tracer_.Commit();
+    }
+    #endif
+
+    std::vector<OpcodePairCount> CPU::opcode_pair_histogram() {
+        std::map<std::pair<std::string, std::string>, uint64_t> counts;
+        block_cache_.ForEach([&](const DecodedBlock& block) {
+            if (block.entries == 0) {
+                return;
+            }
+            for (size_t i = 0; i + 1 < block.instructions.size(); i++) {
+                counts[{ mnemonic(block.instructions[i].instruction), mnemonic(block.instructions[i + 1].instruction) }] += block.entries;
+            }
+        });
+        std::vector<OpcodePairCount> histogram;
+        for (auto& [pair, count] : counts) {
+            histogram.push_back({ pair.first, pair.second, count });
+        }
+        std::sort(histogram.begin(), histogram.end(), [](const OpcodePairCount& a, const OpcodePairCount& b) {
+            return a.count > b.count;
+        });
+        return histogram;
+    }
+
+    void CPU::detect_idle_loop(DecodedBlock& block) {
+        if (idle_loop_overrides_.contains(block.paddr)) {
+            block.idle_loop = IdleLoop::Pure;
+            return;
+        }
+        auto& instructions = block.instructions;
+        // Short loops only, the point is to catch spins
+        if (instructions.size() < 2 || instructions.size() > 16) {
+            return;
+        }
+        const DecodedInstruction& branch = instructions[instructions.size() - 2];
+        if (!branch.is_branch) {
+            return;
+        }
+        uint32_t branch_paddr = block.paddr + (instructions.size() - 2) * 4;
+        uint32_t op = branch.instruction.IType.op;
+        bool relative = (op >= 0b000100 && op <= 0b000111) || (op >= 0b010100 && op <= 0b010111)
+                     || (op == 0b000001 && branch.rt <= 0b00011);
+        bool loops_back = false;
+        if (relative) {
+            loops_back = branch_paddr + 4 + (branch.seimm << 2) == block.paddr;
+        } else if (op == 0b000010) {
+            // J, kseg0/kseg1 keep the low bits of the address
+            loops_back = static_cast<uint32_t>(branch.instruction.JType.target << 2) == (block.paddr & 0x0FFF'FFFF);
+        }
+        if (!loops_back) {
+            return;
+        }
+        // Registers read by each instruction and the one it writes, 0 if none
+        struct Access {
+            uint32_t reads;
+            int write;
+        };
+        bool has_load = false;
+        std::vector<Access> accesses;
+        for (size_t i = 0; i < instructions.size(); i++) {
+            const DecodedInstruction& decoded = instructions[i];
+            uint32_t rs = 1u << decoded.rs;
+            uint32_t rt = 1u << decoded.rt;
+            if (i == instructions.size() - 2) {
+                // REGIMM keeps its sub opcode in rt, J reads nothing
+                uint32_t reads = op == 0b000001 ? rs : op == 0b000010 ? 0 : rs | rt;
+                accesses.push_back({ reads, 0 });
+                continue;
+            }
+            switch (decoded.instruction.IType.op) {
+                // LB, LH, LW, LBU, LHU, LWU, LD
+                case 0b100000: case 0b100001: case 0b100011: case 0b100100:
+                case 0b100101: case 0b100111: case 0b110111:
+                    has_load = true;
+                    accesses.push_back({ rs, decoded.rt });
+                    break;
+                // LUI
+                case 0b001111:
+                    accesses.push_back({ 0, decoded.rt });
+                    break;
+                // ADDIU, SLTI, SLTIU, ANDI, ORI, XORI, DADDIU
+                case 0b001001: case 0b001010: case 0b001011: case 0b001100:
+                case 0b001101: case 0b001110: case 0b011001:
+                    accesses.push_back({ rs, decoded.rt });
+                    break;
+                case 0b000000: {
+                    switch (decoded.instruction.RType.func) {
+                        // SLL, SRL, SRA
+                        case 0b000000: case 0b000010: case 0b000011:
+                            accesses.push_back({ rt, decoded.rd });
+                            break;
+                        // SLLV, SRLV, SRAV, ADDU, SUBU, AND, OR, XOR, NOR, SLT, SLTU, DADDU
+                        case 0b000100: case 0b000110: case 0b000111: case 0b100001:
+                        case 0b100011: case 0b100100: case 0b100101: case 0b100110:
+                        case 0b100111: case 0b101010: case 0b101011: case 0b101101:
+                            accesses.push_back({ rs | rt, decoded.rd });
+                            break;
+                        default:
+                            return;
+                    }
+                    break;
+                }
+                default:
+                    // Stores, COP0 (Count) reads, anything that can trap
+                    return;
+            }
+        }
+        uint32_t written = 0;
+        for (const Access& access : accesses) {
+            written |= 1u << access.write;
+        }
+        written &= ~1u;
+        // A register read before the loop writes it carries a value between
+        // iterations (a counter), so iterations wouldn't be identical
+        uint32_t written_so_far = 0;
+        for (const Access& access : accesses) {
+            if (access.reads & written & ~written_so_far) {
+                return;
+            }
+            written_so_far |= 1u << access.write;
+        }
+        block.idle_loop = has_load ? IdleLoop::Polling : IdleLoop::Pure;
+    }
+
+    void CPU::fast_forward_idle(IdleLoop idle_loop, uint64_t pending) {
+        uint64_t target = horizon_;
+        if (idle_loop == IdleLoop::Polling) {
+            target = std::min(target, next_vi_line_change());
+        }
+        if (target > cpubus_.time_ + pending) {
+            uint64_t skipped = target - cpubus_.time_ - pending;
+            cpubus_.time_ += skipped;
+            idle_skipped_cycles_ += skipped;
+            ++idle_skips_;
+        }
+    }
+
+    uint64_t CPU::next_vi_line_change() {
+        constexpr uint64_t frame_time = 93'750'000 / 60;
+        if (rcp_.num_halflines_ <= 0) {
+            return cpubus_.time_;
+        }
+        uint64_t time_per = frame_time / rcp_.num_halflines_;
+        uint64_t mod = cpubus_.time_ % frame_time;
+        uint64_t next_line = cpubus_.time_ + time_per - mod % time_per;
+        uint64_t next_frame = cpubus_.time_ - mod + frame_time;
+        return std::min(next_line, next_frame);
+    }
+
+    void CPU::load_idle_loop_overrides() {
+        idle_loop_overrides_.clear();
+        std::string game_code = cpubus_.GetGameCode();
+        #define X(code, vaddr) \
+            if (game_code == code) { \
+                add_idle_loop(vaddr); \
+            }
+        #include "n64_idleloops.def"
+        #undef X
+        block_cache_.Clear();
+        cur_block_ = nullptr;
+        block_pc_ = std::numeric_limits<uint64_t>::max();
+    }
+
+    void CPU::add_idle_loop(uint32_t vaddr) {
+        idle_loop_overrides_.insert(translate_vaddr(vaddr).paddr);
+    }
+
+    void CPU::enter_block() {
+        DecodedBlock* previous = cur_block_;
+        // A loop back to the start of the current block needs no lookup if it's
+        // in kseg0 or kseg1, those always translate the same way
+        bool same_block = previous && previous != &fetch_fault_block_ &&
+                          pc_ == block_pc_ - 4 * block_index_ && (static_cast<uint32_t>(pc_) >> 30) == 0b10;
+        if (!same_block) {
+            auto paddr_s = translate_vaddr(pc_);
+            // Only addresses that can be fetched get decoded, so finding a block is enough
+            cur_block_ = paddr_s.result == TLBResult::Hit ? block_cache_.Find(paddr_s.paddr) : nullptr;
+            if (!cur_block_) {
+                if (!can_fetch(pc_, paddr_s)) [[unlikely]] {
+                    cur_block_ = &fetch_fault_block_;
+                    block_index_ = 0;
+                    block_pc_ = pc_;
+                    return;
+                }
+                cur_block_ = decode_block(paddr_s.paddr);
+            }
+        }
+        ++cur_block_->entries;
+        if (cur_block_ == previous && cur_block_->idle_loop != IdleLoop::None) [[unlikely]] {
+            // update_pipeline still counts the cycle of this fetch
+            fast_forward_idle(cur_block_->idle_loop, 1);
+        }
+        block_index_ = 0;
+        block_pc_ = pc_;
+    }
+
+    void CPU::invalidate_code(uint32_t paddr, uint32_t size) {
+        block_cache_.InvalidateRange(paddr, size);
+        code_invalidated_ = true;
+        // The block IC was walking might be gone, look it up again on next fetch
+        cur_block_ = nullptr;
+        block_pc_ = std::numeric_limits<uint64_t>::max();
+    }
+
+    void CPU::set_mode(CPUMode mode) {
+        if (mode == CPUMode::Recompiler) {
+            #if N64TKP_HAS_RECOMPILER
+            if (!recompiler_) {
+                recompiler_ = std::make_unique<Recompiler>(*this);
+            }
+            #else
+            mode = CPUMode::CachedInterpreter;
+            #endif
+        }
+        mode_ = mode;
+        cur_block_ = nullptr;
+        block_pc_ = std::numeric_limits<uint64_t>::max();
     }
 
     void CPU::bypass_register() {
-        store_register(exdc_latch_.dest, exdc_latch_.data, exdc_latch_.access_type);
+        store_register(exdc_latch_.dest, exdc_latch_.data);
         exdc_latch_.write_type = WriteType::NONE;
     }
 
@@ -1729,9 +2689,15 @@ namespace TKPEmu::N64::Devices {
         ldi_ = (rfex_latch_.fetched_rt_i == icrf_latch_.instruction.RType.rt || rfex_latch_.fetched_rt_i == icrf_latch_.instruction.RType.rs);
         // Insert NOP so next EX doesn't re-execute the load in case ldi = true
         rfex_latch_.instruction.Full = 0;
+        rfex_latch_.handler = NopHandler;
         was_ldi_ = ldi_;
     }
 
+    void CPU::discard_delay_slot() {
+        icrf_latch_.instruction.Full = 0;
+        icrf_latch_.handler = NopHandler;
+    }
+
     void CPU::execute_cp0_instruction(const Instruction& instr) {
         uint32_t func = instr.RType.rs;
         if (func & 0b10000) {
@@ -1744,17 +2710,37 @@ namespace TKPEmu::N64::Devices {
                 */
                 case 0b011000: {
                     if ((gpr_regs_[CP0_STATUS].UD & 0b10) == 1) {
-                        std::cout << "error eret to : " << std::hex << cp0_regs_[CP0_EPC].UD << std::endl;
+                        N64_LOG(CP0, "ERET to ErrorEPC %x", cp0_regs_[CP0_ERROREPC].UD);
                         pc_ = cp0_regs_[CP0_ERROREPC].UD;
                         cp0_regs_[CP0_STATUS].UD &= ~0b100;
                     } else {
-                        std::cout << "eret to : " << std::hex << cp0_regs_[CP0_EPC].UD << std::endl;
+                        N64_LOG(CP0, "ERET to EPC %x", cp0_regs_[CP0_EPC].UD);
                         pc_ = cp0_regs_[CP0_EPC].UD;
                         cp0_regs_[CP0_STATUS].UD &= ~0b10;
                     }
                     // ERET doesn't run delay slot instruction
                     llbit_ = 0;
-                    icrf_latch_.instruction.Full = 0;
+                    discard_delay_slot();
+                    break;
+                }
+                // TLBR
+                case 0b000001: {
+                    tlb_read();
+                    break;
+                }
+                // TLBWI
+                case 0b000010: {
+                    tlb_write(cp0_regs_[CP0_INDEX].UD);
+                    break;
+                }
+                // TLBWR
+                case 0b000110: {
+                    tlb_write(get_random());
+                    break;
+                }
+                // TLBP
+                case 0b001000: {
+                    tlb_probe();
                     break;
                 }
                 default: {
@@ -1770,7 +2756,7 @@ namespace TKPEmu::N64::Devices {
                  */
                 case 0b0100: {
                     int64_t sedata = gpr_regs_[instr.RType.rt].W._0;
-                    VERBOSE(std::cout << "Write to CP0 reg: " << CP0String(instr.RType.rd) << " " << "data: " << std::hex << sedata << std::endl;)
+                    N64_LOG(CP0, "Write to %s: %x", CP0String(instr.RType.rd), sedata);
                     switch (instr.RType.rd) {
                         case CP0_COMPARE: {
                             if (sedata != 0) {
@@ -1779,10 +2765,16 @@ namespace TKPEmu::N64::Devices {
                             }
                             break;  
                         }
+                        case CP0_ENTRYHI: {
+                            // Cached translations of non global pages belong to the old ASID
+                            if ((sedata & 0xFF) != (cp0_regs_[CP0_ENTRYHI].UD & 0xFF)) {
+                                flush_tlb_cache();
+                            }
+                            break;
+                        }
                     }
                     exdc_latch_.dest = &cp0_regs_[instr.RType.rd].UB._0;
                     exdc_latch_.data = sedata;
-                    exdc_latch_.access_type = AccessType::UDOUBLEWORD;
                     bypass_register();
                     break;
                 }
@@ -1792,21 +2784,21 @@ namespace TKPEmu::N64::Devices {
                  * throws Coprocessor unusable exception
                  */
                 case 0b0000: {
-                    VERBOSE(std::cout << "Read from CP0 reg: " << CP0String(instr.RType.rd) << std::endl;)
+                    N64_LOG(CP0, "Read from %s", CP0String(instr.RType.rd));
                     int64_t sedata = cp0_regs_[instr.RType.rd].W._0;
                     if (instr.RType.rd == CP0_COUNT) {
                         sedata = cpubus_.time_ >> 1;
+                    } else if (instr.RType.rd == CP0_RANDOM) {
+                        sedata = get_random();
                     }
                     exdc_latch_.dest = &gpr_regs_[instr.RType.rt].UB._0;
                     exdc_latch_.data = sedata;
-                    exdc_latch_.access_type = AccessType::UDOUBLEWORD;
                     bypass_register();
                     break;
                 }
                 default: {
-                    std::stringstream ss;
-                    ss << "Unimplemented CP0 microcode:" << std::bitset<5>(func) << " - full:" << std::bitset<32>(instr.Full);
-                    throw ErrorFactory::generate_exception(ss.str());
+                    unimplemented_opcode();
+                    break;
                 }
             }
         }
@@ -6,22 +6,34 @@
 #include <array>
 #include <queue>
 #include <vector>
+#include <string>
+#include <unordered_set>
 #include <memory>
 #include <queue>
+#include <exception>
+#include <span>
 #include "n64_types.hxx"
 #include "n64_cpu_exceptions.hxx"
 #include "n64_rcp.hxx"
-#define TKP_VERBOSE
-#ifdef TKP_VERBOSE
-#define VERBOSE(x) x
-#else
-#define VERBOSE(x)
-#endif
+#include "n64_rsp.hxx"
+#include "n64_blockcache.hxx"
+#include "n64_recompiler.hxx"
+#include "n64_scheduler.hxx"
+#include "n64_fastmem.hxx"
+#include "n64_mmio.hxx"
+#include "n64_profiler.hxx"
+#include "n64_trace.hxx"
+#include "n64_log.hxx"
 
 // TODO: Move these to cmake
 #define SKIP64BITCHECK 1
-#define SKIPEXCEPTIONS 1
 #define DONTDEBUGSTUFF 0
+// Interpreter dispatch with computed goto, a GNU extension. Set by the N64TKP_THREADED_DISPATCH CMake option
+#if defined(N64TKP_THREADED_DISPATCH) && defined(__GNUC__)
+#define N64TKP_HAS_THREADED_DISPATCH 1
+#else
+#define N64TKP_HAS_THREADED_DISPATCH 0
+#endif
 #define KB(x) (static_cast<size_t>(x << 10))
 #define check_bit(x, y) ((x) & (1u << y))
 
@@ -33,29 +45,16 @@ constexpr uint32_t KSEG1_END   = 0xBFFF'FFFF;
 
 class N64Debugger;
 
-enum class SchedulerEventType {
-    Interrupt = -1,
-    Count = 0x200,
-    Si = 1,
-    Vi = 3,
-    Pi = 4,
-};
-
+// Values are the Cause.ExCode of each exception
 enum class ExceptionType {
-    Interrupt,
-};
-
-struct SchedulerEvent {
-    SchedulerEventType type;
-    uint64_t time;
-};
-
-class SchedulerCompare
-{
-public:
-    bool operator() (SchedulerEvent eventl, SchedulerEvent eventr) {
-        return eventl.time > eventr.time;
-    }
+    Interrupt = 0,
+    AddressErrorLoad = 4,
+    AddressErrorStore = 5,
+    InstructionBusError = 6,
+    DataBusError = 7,
+    ReservedInstruction = 10,
+    IntegerOverflow = 12,
+    Trap = 13,
 };
 
 #define X(name, value) constexpr auto CP0_##name = value;
@@ -109,6 +108,7 @@ namespace TKPEmu {
         class N64_TKPWrapper;
         class N64;
         class QA;
+        class MicroBench;
     }
 }
 namespace TKPEmu::N64::Devices {
@@ -134,37 +134,94 @@ namespace TKPEmu::N64::Devices {
         Supervisor,
         Kernel
     };
+    enum class CPUMode {
+        Interpreter,       // fetches and decodes every instruction from the bus
+        CachedInterpreter, // fetches pre-decoded instructions from the block cache
+        Recompiler,        // runs whole blocks as x86-64 code, CachedInterpreter on other hosts
+        Functional,        // runs each pre-decoded instruction to completion, without the pipeline latches
+    };
+    // What a conditional branch compares, for the functional mode handlers
+    enum class BranchCondition {
+        Equal,
+        NotEqual,
+        LessEqualZero,
+        GreaterZero,
+        GreaterEqualZero,
+    };
+    // How many times two instructions ran back to back, see N64::GetOpcodePairHistogram
+    struct OpcodePairCount {
+        std::string first;
+        std::string second;
+        uint64_t count;
+    };
+    // Errors of the emulator rather than the guest, see CPU::raise_fault
+    enum class FaultType : uint8_t {
+        None,
+        BadAddress,          // a DMA or the VI pointed at a physical address nothing is mapped at
+        UnimplementedOpcode,
+    };
+    struct Fault {
+        FaultType type = FaultType::None;
+        // The instruction in EX when the fault was raised. The interpreters access
+        // data in DC, so for loads and stores this is the instruction after them
+        uint32_t pc = 0;
+        uint32_t address = 0; // physical, BadAddress only
+        uint32_t instruction = 0;
+    };
     struct ICRF_latch {
-        Instruction     instruction;
+        Instruction         instruction;
+        InstructionHandler  handler;
     };
     struct RFEX_latch {
-        Instruction     instruction;
-        MemDataUnionDW  fetched_rt;
-        MemDataUnionDW  fetched_rs;
-        size_t          fetched_rt_i;
+        Instruction         instruction;
+        InstructionHandler  handler;
+        MemDataUnionDW      fetched_rt;
+        MemDataUnionDW      fetched_rs;
+        size_t              fetched_rt_i;
     };
+    /**
+     * Moves data between a register and memory for one access size, picked
+     * when the load or store executes so DC and WB don't branch on the size
+     */
+    using MemoryHandler = void (*)(CPU* cpu, bool cached, uint32_t paddr, uint64_t& data);
     struct EXDC_latch {
         WriteType       write_type;
-        AccessType      access_type;
+        MemoryHandler   memory_handler;
         uint64_t        data;
         uint8_t*        dest;
         uint32_t        vaddr;
         uint32_t        paddr;
         bool            cached;
-        bool            sign_extend;
         bool            was_branch;
     };
     struct DCWB_latch {
         WriteType       write_type;
-        AccessType      access_type;
+        MemoryHandler   memory_handler;
         uint64_t        data;
         uint8_t*        dest;
         uint32_t        paddr;
         bool            cached;
     };
+    enum class TLBResult : uint8_t {
+        Hit,
+        Miss,     // no entry matches, refill exception
+        Invalid,  // the matching entry has V cleared
+        Modified, // store to a page with D cleared
+    };
     struct TranslatedAddress {
         uint32_t paddr;
         bool cached;
+        TLBResult result = TLBResult::Hit;
+    };
+    /**
+        One 4KB virtual page worth of a TLB translation. Misses here fall back
+        to searching the 32 TLB entries
+    */
+    struct TLBCacheEntry {
+        uint32_t tag;      // vaddr >> 12, INVALID_TAG when empty
+        uint32_t paddr;    // physical address of the page
+        uint32_t writable; // D bit, stores to clean pages take the slow path
+        uint32_t cached;
     };
     /**
         32-bit address bus 
@@ -179,26 +236,48 @@ namespace TKPEmu::N64::Devices {
         bool IsEverythingLoaded() {
             return rom_loaded_ && ipl_loaded_;
         }
+        // The 4 character game code from the ROM header, empty if no ROM is loaded
+        std::string GetGameCode();
         void Reset();
     private:
         uint32_t  fetch_instruction_uncached(uint32_t paddr);
         uint32_t  fetch_instruction_cached  (uint32_t paddr);
         uint8_t*  redirect_paddress         (uint32_t paddr);
         uint8_t*  redirect_paddress_slow    (uint32_t paddr);
+        // False if nothing answers at paddr, CPU accesses there are bus errors
+        bool      is_mapped                 (uint32_t paddr) {
+            return page_table_[paddr >> 20] || is_mapped_slow(paddr);
+        }
+        bool      is_mapped_slow            (uint32_t paddr);
         void      map_direct_addresses();
+        // Converts big endian words loaded from a file to host order
+        static void swap_words(uint8_t* data, size_t size);
+        /**
+         * Copies size guest bytes between two word swapped buffers, offsets are
+         * guest addresses relative to the word aligned dst and src
+         */
+        static void copy_guest_bytes(uint8_t* dst, uint32_t dst_offset, const uint8_t* src, uint32_t src_offset, uint32_t size);
         void      set_interrupt(Interrupt, bool);
 
-        std::vector<uint8_t> cart_rom_;
+        static constexpr size_t RDRAM_SIZE = 0x800000;
+        static constexpr size_t CART_ROM_SIZE = 0xFC00000;
+        static constexpr uint32_t CART_ROM_START = 0x1000'0000;
+        // RDRAM and cartridge ROM live in the fastmem arena when there is one, in memory_ otherwise
+        Fastmem fastmem_;
+        std::vector<uint8_t> memory_;
+        std::span<uint8_t> cart_rom_;
         bool rom_loaded_ = false;
         bool ipl_loaded_ = false;
         static std::vector<uint8_t> ipl_;
-        std::vector<uint8_t> rdram_ {};
+        std::span<uint8_t> rdram_ {};
         std::array<uint8_t, 64> pif_ram_ {};
         std::array<uint8_t, 0x1000> rsp_imem_ {};
         std::array<uint8_t, 0x1000> rsp_dmem_ {};
         std::array<uint8_t, 0x100000> rdp_cmem_ {};
         std::array<uint8_t*, 0x1000> page_table_ {};
         uint8_t the_void_ = 0; // redirect unimplemented and useless addresses here
+        // Accesses to unmapped addresses go here after raising a fault
+        alignas(8) std::array<uint8_t, 8> bad_access_ {};
 
         // MIPS Interface
         uint32_t mi_mode_         = 0;
@@ -244,8 +323,14 @@ namespace TKPEmu::N64::Devices {
         uint32_t placeholder_ = 0;
 
         Devices::RCP& rcp_;
+        // Set by the CPU, faults are raised on it
+        CPU* cpu_ = nullptr;
         friend class CPU;
+        friend class Recompiler;
+        friend class RSPCore;
         friend class TKPEmu::N64::N64;
+        friend class TKPEmu::N64::MicroBench;
+        friend class TKPEmu::N64::QA;
         friend class ::N64Debugger;
     };
     template<auto MemberFunc>
@@ -263,8 +348,9 @@ namespace TKPEmu::N64::Devices {
         using PipelineStageArgs = void;
         CPUBus& cpubus_;
         RCP& rcp_;
-        ICRF_latch icrf_latch_ {};
-        RFEX_latch rfex_latch_ {};
+        RSPCore rsp_;
+        ICRF_latch icrf_latch_ { .handler = NopHandler };
+        RFEX_latch rfex_latch_ { .handler = NopHandler };
         EXDC_latch exdc_latch_ {};
         DCWB_latch dcwb_latch_ {};
         
@@ -287,6 +373,45 @@ namespace TKPEmu::N64::Devices {
         bool ldi_ = false;
         bool was_ldi_ = false;
         bool should_resize_ = false;
+        // Cached interpreter
+        CPUMode mode_ = CPUMode::Interpreter;
+        BlockCache block_cache_;
+        DecodedBlock* cur_block_ = nullptr;
+        size_t block_index_ = 0;
+        // pc_ value at which IC keeps walking cur_block_ without a lookup
+        uint64_t block_pc_ = std::numeric_limits<uint64_t>::max();
+        // Recompiler, pc_ holds the address of the next instruction instead of the fetch address
+        std::unique_ptr<Recompiler> recompiler_;
+        bool code_invalidated_ = false;
+        bool skip_delay_slot_ = false;
+        // Functional mode, pc_ holds the address of the next instruction like in the recompiler
+        bool in_delay_slot_ = false;
+        // Where to go after the delay slot
+        uint64_t branch_target_ = 0;
+        // Destination of the previous instruction if it was a load, -1 otherwise. Using it costs a stall cycle
+        int load_destination_ = -1;
+        // TLB
+        static constexpr size_t TLB_CACHE_SIZE = 0x400;
+        static constexpr uint32_t INVALID_TAG = 0xFFFF'FFFF;
+        std::array<TLBEntry, 32> tlb_ {};
+        std::array<TLBCacheEntry, TLB_CACHE_SIZE> tlb_cache_;
+        // Set by exceptions raised during EX, the instruction's writes are cancelled
+        bool exception_raised_ = false;
+        // Sticky until Reset, no more batches run once it's set
+        Fault fault_;
+        // The instruction in EX is a delay slot
+        bool delay_slot_ = false;
+        DecodedBlock fetch_fault_block_;
+        // Idle loop detection, physical addresses of loops that are idle regardless of analysis
+        std::unordered_set<uint32_t> idle_loop_overrides_;
+        uint64_t idle_skips_ = 0;
+        uint64_t idle_skipped_cycles_ = 0;
+        #if N64TKP_HAS_PROFILER
+        Profiler profiler_;
+        #endif
+        #if N64TKP_HAS_TRACE
+        Tracer tracer_;
+        #endif
         // Kernel mode addressing functions
         /**
             VR4300 manual, page 122: 
@@ -314,7 +439,31 @@ namespace TKPEmu::N64::Devices {
             @return physical address
         */
         // inline uint32_t translate_kuseg(uint32_t vaddr) noexcept;
-        inline TranslatedAddress translate_vaddr(uint32_t vaddr);
+        inline TranslatedAddress translate_vaddr(uint32_t vaddr, bool write = false);
+        /**
+         * Same as translate_vaddr but raises the TLB exception on failure,
+         * for use by instruction handlers during EX. The handler still runs to
+         * completion, EX drops its results afterwards
+         */
+        inline TranslatedAddress translate_data(uint32_t vaddr, bool write);
+        // TLB mapped segments (kuseg, ksseg, kseg3), tries tlb_cache_ before the TLB itself
+        TranslatedAddress translate_mapped(uint32_t vaddr, bool write);
+        TranslatedAddress translate_tlb(uint32_t vaddr, bool write);
+        // Raises a TLB exception for the instruction currently in EX
+        void raise_tlb_exception(uint32_t vaddr, TLBResult result, bool write);
+        void tlb_exception(uint32_t vaddr, TLBResult result, bool write, uint64_t epc, bool bd);
+        void tlb_read();
+        void tlb_write(uint32_t index);
+        void tlb_probe();
+        // Random counts down from 31 to Wired once per instruction
+        uint32_t get_random();
+        void flush_tlb_cache();
+        // Drops the cached translations of the pages an entry maps
+        void flush_tlb_cache(const TLBEntry& entry);
+        // Fed to EX in place of an instruction that can't be fetched, see can_fetch
+        void fetch_fault();
+        // False if fetching at vaddr raises an address error, a TLB exception or a bus error
+        inline bool can_fetch(uint32_t vaddr, const TranslatedAddress& paddr_s);
         /**
          * Load and store instruction common functions
          * 
@@ -340,12 +489,14 @@ namespace TKPEmu::N64::Devices {
          * a data word. The data is loaded to the cache if the cache is
          * enabled. 
          * 
+         * @tparam Size size to load
+         * @tparam SignExtend whether the result is sign extended to 64 bits
          * @param cached whether to store in cache
          * @param paddr physical address to read from
          * @param data the result is stored here
-         * @param size size to load
          */
-        __always_inline void load_memory(bool cached, uint32_t paddr, uint64_t& data, int size);
+        template<AccessType Size, bool SignExtend>
+        __always_inline void load_memory(bool cached, uint32_t paddr, uint64_t& data);
         /**
          * Searches the cache, write buffer, and main memory to store the
          * contents of a specified data length to a specified physical address.
@@ -355,21 +506,38 @@ namespace TKPEmu::N64::Devices {
          * and access type field of the address determine the data position in
          * a data word.
          * 
+         * @tparam Size size to store
          * @param cached whether to store in cache
          * @param paddr physical address to write to
          * @param data data to store
-         * @param size size to store
          */
-        __always_inline void store_memory(bool cached, uint32_t paddr, uint64_t& data, int size);
-        __always_inline void store_register(uint8_t* dest, uint64_t data, int size);
+        template<AccessType Size>
+        __always_inline void store_memory(bool cached, uint32_t paddr, uint64_t& data);
+        // Every register write is a full doubleword
+        __always_inline void store_register(uint8_t* dest, uint64_t data);
+        // MemoryHandlers for the latches
+        template<AccessType Size, bool SignExtend>
+        static void load_handler(CPU* cpu, bool cached, uint32_t paddr, uint64_t& data);
+        template<AccessType Size>
+        static void store_handler(CPU* cpu, bool cached, uint32_t paddr, uint64_t& data);
+        // The common part of LB, LBU, LH, LHU, LW, LWU, LD and SB, SH, SW, SD
+        template<AccessType Size, bool SignExtend>
+        __always_inline void load_instruction();
+        template<AccessType Size>
+        __always_inline void store_instruction();
         /**
-         * Executes memory mapped register related stuff
+         * Runs the side effects of storing data to the memory mapped register
+         * at addr, the handlers live in mmio_table_
          */
-        inline void invalidate_hwio(uint32_t addr, uint64_t& data);
+        void invalidate_hwio(uint32_t addr, uint64_t& data);
+        static const MMIOTable<MMIORegister> mmio_table_;
 
         __always_inline PipelineStageRet IC(PipelineStageArgs);
         __always_inline PipelineStageRet RF(PipelineStageArgs);
         __always_inline PipelineStageRet EX(PipelineStageArgs);
+        // The parts of EX before and after the instruction runs
+        __always_inline void begin_ex();
+        __always_inline void end_ex();
         __always_inline PipelineStageRet DC(PipelineStageArgs);
         __always_inline PipelineStageRet WB(PipelineStageArgs);
 
@@ -438,30 +606,192 @@ namespace TKPEmu::N64::Devices {
             &lut_wrapper<&CPU::r_BLTZAL>, &lut_wrapper<&CPU::r_BGEZAL>, &lut_wrapper<&CPU::r_BLTZALL>, &lut_wrapper<&CPU::r_BGEZALL>, &lut_wrapper<&CPU::ERROR>, &lut_wrapper<&CPU::ERROR>, &lut_wrapper<&CPU::ERROR>, &lut_wrapper<&CPU::ERROR>,
             &lut_wrapper<&CPU::ERROR>, &lut_wrapper<&CPU::ERROR>, &lut_wrapper<&CPU::ERROR>, &lut_wrapper<&CPU::ERROR>, &lut_wrapper<&CPU::ERROR>, &lut_wrapper<&CPU::ERROR>, &lut_wrapper<&CPU::ERROR>, &lut_wrapper<&CPU::ERROR>,
         };
+        constexpr static InstructionHandler NopHandler = &lut_wrapper<&CPU::s_SYNC>;
         __always_inline void bypass_register();
         __always_inline void detect_ldi();
+        // Turns the instruction sitting in IC/RF (a delay slot) into a NOP
+        __always_inline void discard_delay_slot();
+        /**
+         * Resolves the handler of an instruction, including the second table hop
+         * for SPECIAL, REGIMM and COP1
+         */
+        static InstructionHandler resolve_handler(Instruction instr);
+        static DecodedInstruction decode_instruction(Instruction instr);
+        /**
+         * Decodes the run of instructions starting at paddr and inserts it
+         * in the block cache
+         */
+        DecodedBlock* decode_block(uint32_t paddr);
+        /**
+         * Returns the handler that runs first and second in one dispatch, or
+         * nullptr if the pair isn't one of the fused idioms
+         */
+        static FusedHandler fuse_instructions(const DecodedInstruction& first, const DecodedInstruction& second);
+        static FusedHandler fuse_lui(const DecodedInstruction& second);
+        template<auto First>
+        static FusedHandler fuse_compare_branch(const DecodedInstruction& second);
+        // Runs both direct handlers, false if the second one declined and still has to run
+        template<auto First, auto Second>
+        static bool fused_handler(CPU* cpu, const DecodedInstruction& first, const DecodedInstruction& second, uint32_t vaddr);
+        /**
+         * Returns the handler functional mode runs the instruction with, or
+         * nullptr if it always goes through execute_isolated
+         */
+        static DirectHandler direct_handler(Instruction instr);
+        template<auto MemberFunc>
+        static bool direct_wrapper(CPU* cpu, const DecodedInstruction& instr, uint32_t vaddr);
+        /**
+         * Direct handlers work on gpr_regs_ without the pipeline latches, pc_
+         * already points to the next instruction. They return false before
+         * changing anything if the instruction needs execute_isolated, which
+         * is the case whenever it raises an exception
+         */
+        bool direct_lui(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_addiu(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_daddiu(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_andi(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_ori(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_xori(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_slti(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_sltiu(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_addu(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_subu(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_and(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_or(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_xor(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_nor(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_slt(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_sltu(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_sll(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_srl(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_sra(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_sllv(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_srlv(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_srav(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_mfhi(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_mflo(const DecodedInstruction& instr, uint32_t vaddr);
+        template<AccessType Size, bool SignExtend>
+        bool direct_load(const DecodedInstruction& instr, uint32_t vaddr);
+        template<AccessType Size>
+        bool direct_store(const DecodedInstruction& instr, uint32_t vaddr);
+        template<BranchCondition Condition, bool Likely>
+        bool direct_branch(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_j(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_jal(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_jr(const DecodedInstruction& instr, uint32_t vaddr);
+        bool direct_jalr(const DecodedInstruction& instr, uint32_t vaddr);
+        static std::string mnemonic(Instruction instr);
+        // GPR the instruction writes, 0 if none
+        static int written_register(Instruction instr);
+        #if N64TKP_HAS_TRACE
+        // Open and close the trace record of the instruction in EX
+        void trace_begin();
+        void trace_end();
+        // Records an instruction that ran without going through EX
+        void trace_direct(const DecodedInstruction& instr, uint32_t vaddr);
+        #endif
+        // Counts of adjacent instruction pairs in the cached blocks, weighted by how often each block was entered
+        std::vector<OpcodePairCount> opcode_pair_histogram();
+        // Looks up (or decodes) the block that starts at pc_
+        void enter_block();
+        // Drops decoded code in [paddr, paddr + size), called when memory gets overwritten
+        void invalidate_code(uint32_t paddr, uint32_t size);
+        void set_mode(CPUMode mode);
+        // Marks blocks that only branch back to themselves while reading memory
+        void detect_idle_loop(DecodedBlock& block);
+        /**
+         * Called when an idle block loops back to itself. Moves time_ to the
+         * point where the loop could behave differently, minus the pending
+         * cycles the caller will still add
+         */
+        void fast_forward_idle(IdleLoop idle_loop, uint64_t pending);
+        // Time at which a VI_V_CURRENT read returns a new value
+        uint64_t next_vi_line_change();
+        // Fills idle_loop_overrides_ with the n64_idleloops.def entries of the loaded game
+        void load_idle_loop_overrides();
+        void add_idle_loop(uint32_t vaddr);
         /**
          * Called during EX stage, handles the logic execution of each instruction
          */
         void execute_instruction();
         void execute_cp0_instruction(const Instruction& instr);
+        /**
+         * Runs an instruction through EX, DC and WB as if it was alone in the
+         * pipeline. Used by the recompiler for opcodes it doesn't translate
+         */
+        void execute_isolated(uint32_t word, uint32_t pc, bool delay_slot = false);
+        __always_inline void execute_isolated(Instruction instr, InstructionHandler handler, uint32_t pc, bool delay_slot);
+        /**
+         * Services due events, then runs instructions without looking at the
+         * scheduler until the next event or until max_cycles have passed.
+         * Returns the number of cycles executed, which can overshoot max_cycles
+         * by the length of a block in recompiler mode. Returns 0 without running
+         * anything if stop_on_vblank_ is set and a VI interrupt was just raised
+         */
+        uint64_t run_batch(uint64_t max_cycles);
         void update_pipeline();
+        /**
+         * Same as calling update_pipeline until horizon_, but every opcode gets its
+         * own copy of the code that finishes the cycle and jumps to the next
+         * handler, so the dispatch branch is predicted per opcode
+         */
+        void run_threaded();
+        // Finishes the cycle of the instruction in EX and runs the next one up to EX, false once horizon_ is reached
+        [[gnu::noinline]] bool advance_threaded();
+        // Index of an instruction in the flattened primary, SPECIAL, REGIMM and COP1 tables
+        __always_inline static size_t threaded_index(Instruction instr);
+        // Runs one recompiled block
+        void update_recompiler();
+        /**
+         * Runs instructions in functional mode until the block ends or is left,
+         * or horizon_ is reached. Each one is fetched, executed and written back
+         * in one step. Architectural state matches the pipeline, including
+         * delay slots and load interlock stall cycles
+         */
+        void update_functional();
+        // Runs an instruction that has no direct handler or whose handler declined it
+        [[gnu::noinline]] void execute_functional(const DecodedInstruction& instr, uint32_t vaddr, bool delay_slot);
         // Fills the pipeline with the first 5 instructions
         void fill_pipeline();
         void check_interrupts();
-        void handle_exception(ExceptionType);
+        void handle_interrupt();
+        /**
+         * Raises a guest exception for the instruction in EX, like
+         * raise_tlb_exception. vaddr goes to BadVAddr for address errors
+         */
+        void raise_exception(ExceptionType exception, uint32_t vaddr = 0);
+        /**
+         * Records a fault if there isn't one already and ends the current batch
+         * after this instruction. Faults are how the emulator gives up on
+         * something it can't emulate instead of throwing from the hot path
+         */
+        void raise_fault(FaultType type, uint32_t address = 0);
+        // Faults and cancels the instruction in EX
+        void unimplemented_opcode();
         void fire_count();
 
         void clear_registers();
         void handle_event();
 
-        std::priority_queue<SchedulerEvent, std::vector<SchedulerEvent>, SchedulerCompare> scheduler_;
+        Scheduler scheduler_;
         void queue_event(SchedulerEventType, int);
-
+        // Time at which the current batch stops to service the scheduler
+        uint64_t horizon_ = 0;
+        uint64_t batch_count_ = 0;
+        uint64_t batch_cycles_ = 0;
+        uint64_t events_handled_ = 0;
+        // Set when a VI interrupt is raised, run_batch returns early after one if stop_on_vblank_
+        bool vblank_ = false;
+        bool stop_on_vblank_ = false;
+
+        friend class Recompiler;
+        friend class CPUBus;
+        friend class RSPCore;
         friend class ::N64Debugger;
         friend class TKPEmu::N64::N64_TKPWrapper;
         friend class TKPEmu::N64::N64;
         friend class TKPEmu::N64::QA;
+        friend class TKPEmu::N64::MicroBench;
     };
 }
 #endif
\ No newline at end of file
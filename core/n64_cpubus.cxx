@@ -1,17 +1,23 @@
 #include <fstream>
-#include <sstream>
+#include <cstring>
+#include <algorithm>
 #include <iostream>
 #include "n64_cpu.hxx"
 #include "n64_addresses.hxx"
-#include "error_factory.hxx"
 #include "utils.hxx"
 
 namespace TKPEmu::N64::Devices {
     std::vector<uint8_t> CPUBus::ipl_ {};
 
     CPUBus::CPUBus(Devices::RCP& rcp) : rcp_(rcp) {
-        cart_rom_.resize(0xFC00000);
-        rdram_.resize(0x800000);
+        if (fastmem_.IsEnabled()) {
+            rdram_ = { fastmem_.Map(0, RDRAM_SIZE), RDRAM_SIZE };
+            cart_rom_ = { fastmem_.Map(CART_ROM_START, CART_ROM_SIZE), CART_ROM_SIZE };
+        } else {
+            memory_.resize(RDRAM_SIZE + CART_ROM_SIZE);
+            rdram_ = { memory_.data(), RDRAM_SIZE };
+            cart_rom_ = { memory_.data() + RDRAM_SIZE, CART_ROM_SIZE };
+        }
         map_direct_addresses();
     }
 
@@ -23,6 +29,7 @@ namespace TKPEmu::N64::Devices {
             std::streampos size = ifs.tellg();
             ifs.seekg(0, std::ios::beg);
             ifs.read(reinterpret_cast<char*>(cart_rom_.data()), size);
+            swap_words(cart_rom_.data(), size);
             rom_loaded_ = true;
             Reset();
         } else {
@@ -31,6 +38,17 @@ namespace TKPEmu::N64::Devices {
         return true;
     }
 
+    std::string CPUBus::GetGameCode() {
+        if (!rom_loaded_ || cart_rom_.size() < 0x40) {
+            return {};
+        }
+        std::string code;
+        for (uint32_t i = 0x3B; i < 0x3F; i++) {
+            code += static_cast<char>(cart_rom_[swizzle_address(i, 1)]);
+        }
+        return code;
+    }
+
     bool CPUBus::LoadIPL(std::string path) {
         std::ifstream ifs(path, std::ios::in | std::ios::binary);
         if (ifs.is_open()) {
@@ -39,8 +57,10 @@ namespace TKPEmu::N64::Devices {
                 ifs.seekg(0, std::ios::end);
                 std::streampos size = ifs.tellg();
                 ifs.seekg(0, std::ios::beg);
-                CPUBus::ipl_.resize(size);
+                // Rounded up to whole words
+                CPUBus::ipl_.resize((static_cast<size_t>(size) + 3) & ~3);
                 ifs.read(reinterpret_cast<char*>(CPUBus::ipl_.data()), size);
+                swap_words(CPUBus::ipl_.data(), CPUBus::ipl_.size());
             }
         } else {
             return false;
@@ -51,18 +71,36 @@ namespace TKPEmu::N64::Devices {
 
     void CPUBus::Reset() {
         pif_ram_.fill(0);
-        ri_mode_ = 0x0E000000;
-        ri_config_ = 0x40000000;
-        ri_select_ = 0x14000000;
+        ri_mode_ = 0x0000000E;
+        ri_config_ = 0x00000040;
+        ri_select_ = 0x00000014;
         time_ = 0;
     }
     
     uint32_t CPUBus::fetch_instruction_uncached(uint32_t paddr) {
-        // Loads in big endian
-        // should only work for .z64 files
+        // Words are already in host order
         uint8_t* ptr = redirect_paddress(paddr);
-        uint32_t ret = __builtin_bswap32(*reinterpret_cast<uint32_t*>(ptr));
-        return ret;
+        return *reinterpret_cast<uint32_t*>(ptr);
+    }
+
+    void CPUBus::swap_words(uint8_t* data, size_t size) {
+        // .z64 files are big endian, a partial last word is padded with zeroes
+        for (size_t i = 0; i < size; i += 4) {
+            uint32_t word = 0;
+            std::memcpy(&word, data + i, std::min<size_t>(4, size - i));
+            word = __builtin_bswap32(word);
+            std::memcpy(data + i, &word, std::min<size_t>(4, size - i));
+        }
+    }
+
+    void CPUBus::copy_guest_bytes(uint8_t* dst, uint32_t dst_offset, const uint8_t* src, uint32_t src_offset, uint32_t size) {
+        if (((dst_offset | src_offset | size) & 3) == 0) [[likely]] {
+            std::memcpy(dst + dst_offset, src + src_offset, size);
+            return;
+        }
+        for (uint32_t i = 0; i < size; i++) {
+            dst[swizzle_address(dst_offset + i, 1)] = src[swizzle_address(src_offset + i, 1)];
+        }
     }
 
     uint8_t* CPUBus::redirect_paddress(uint32_t paddr) {
@@ -75,96 +113,25 @@ namespace TKPEmu::N64::Devices {
             if (ptr_slow)
                 return ptr_slow;
         }
-        std::stringstream ss;
-        ss << "Tried to access bad address: 0x" << std::hex << paddr << std::endl;
-        throw ErrorFactory::generate_exception(ss.str());
+        // The run stops at the end of the batch, until then the access goes to scratch space
+        cpu_->raise_fault(FaultType::BadAddress, paddr);
+        return bad_access_.data();
     }
 
     uint8_t* CPUBus::redirect_paddress_slow(uint32_t paddr) {
-        #define redir_case(A,B) case A: return reinterpret_cast<uint8_t*>(&B)
-        switch (paddr) {
-            // RSP internal registers
-            redir_case(RSP_STATUS, rcp_.rsp_status_);
-            redir_case(RSP_DMA_BUSY, rcp_.rsp_dma_busy_);
-            redir_case(RSP_PC, rcp_.rsp_pc_);
-
-            // MIPS Interface
-            redir_case(MI_MODE, mi_mode_);
-            redir_case(MI_INTERRUPT, mi_interrupt_);
-            redir_case(MI_MASK, placeholder_);
-
-            // Video Interface
-            redir_case(VI_CTRL, rcp_.vi_ctrl_);
-            redir_case(VI_ORIGIN, rcp_.vi_origin_);
-            redir_case(VI_WIDTH, rcp_.vi_width_);
-            redir_case(VI_V_INTR, rcp_.vi_v_intr_);
-            case VI_V_CURRENT: {
-                // calculate current based on time
-                // max time per frame:
-                // 93'750'000 / 60
-                // time per halfline:
-                // 93'750'000 / 60 / num_halflines
-                uint64_t mod = time_ % (93'750'000 / 60);
-                uint64_t time_per = 93'750'000 / 60 / rcp_.num_halflines_;
-                rcp_.vi_v_current_ = mod / time_per;
-                return reinterpret_cast<uint8_t*>(&rcp_.vi_v_current_);
-            }
-            redir_case(VI_BURST, rcp_.vi_burst_);
-            redir_case(VI_V_SYNC, rcp_.vi_v_sync_);
-            redir_case(VI_H_SYNC, rcp_.vi_h_sync_);
-            redir_case(VI_H_SYNC_LEAP, rcp_.vi_h_sync_leap_);
-            redir_case(VI_H_VIDEO, rcp_.vi_h_video_);
-            redir_case(VI_V_VIDEO, rcp_.vi_v_video_);
-            redir_case(VI_V_BURST, rcp_.vi_v_burst_);
-            redir_case(VI_X_SCALE, rcp_.vi_x_scale_);
-            redir_case(VI_Y_SCALE, rcp_.vi_y_scale_);
-            redir_case(VI_TEST_ADDR, rcp_.vi_test_addr_);
-            redir_case(VI_STAGED_DATA, rcp_.vi_staged_data_);
-
-            // Audio Interface
-            redir_case(AI_DRAM_ADDR, ai_dram_addr_);
-            redir_case(AI_LEN, ai_length_);
-            redir_case(AI_CONTROL, ai_control_);
-            redir_case(AI_STATUS, ai_status_);
-            redir_case(AI_DACRATE, ai_dacrate_);
-            redir_case(AI_BITRATE, ai_bitrate_);
-
-            // Peripheral Interface
-            redir_case(PI_DRAM_ADDR, pi_dram_addr_);
-            redir_case(PI_CART_ADDR, pi_cart_addr_);
-            redir_case(PI_RD_LEN, pi_rd_len_);
-            redir_case(PI_WR_LEN, pi_wr_len_);
-            redir_case(PI_STATUS, pi_status_);
-            redir_case(PI_BSD_DOM1_LAT, pi_bsd_dom1_lat_);
-            redir_case(PI_BSD_DOM1_PWD, pi_bsd_dom1_pwd_);
-            redir_case(PI_BSD_DOM1_PGS, pi_bsd_dom1_pgs_);
-            redir_case(PI_BSD_DOM1_RLS, pi_bsd_dom1_rls_);
-            redir_case(PI_BSD_DOM2_LAT, pi_bsd_dom2_lat_);
-            redir_case(PI_BSD_DOM2_PWD, pi_bsd_dom2_pwd_);
-            redir_case(PI_BSD_DOM2_PGS, pi_bsd_dom2_pgs_);
-            redir_case(PI_BSD_DOM2_RLS, pi_bsd_dom2_rls_);
-
-            // RDRAM Interface
-            redir_case(RI_MODE, ri_mode_);
-            redir_case(RI_CONFIG, ri_config_);
-            redir_case(RI_CURRENT_LOAD, ri_current_load_);
-            redir_case(RI_SELECT, ri_select_);
-
-            // Serial Interface
-            redir_case(SI_DRAM_ADDR, si_dram_addr_);
-            redir_case(SI_PIF_AD_WR64B, si_pif_ad_wr64b_);
-            redir_case(SI_STATUS, si_status_);
-            default: {
-                break;
-            }
+        // DMEM, IMEM and the SP and DPC registers, the RSP thread can be using them
+        if (paddr - 0x0400'0000u < 0x20'0000u) {
+            cpu_->rsp_.Sync();
+        }
+        if (const MMIORegister* reg = find_mmio(CPU::mmio_table_, paddr)) {
+            return reg->read(*this);
         }
-        #undef redir_case
         if (paddr - 0x1FC00000u < 1984u) {
             return &ipl_[paddr - 0x1FC00000u];
         } else if (paddr - 0x1FC0'07C0u < 64u) {
-            VERBOSE(std::cout << "read from pif ram: " << paddr - 0x1FC0'07C0u << std::endl;)
-            pif_ram_[0x26] = 0x3F;
-            pif_ram_[0x27] = 0x3F;
+            N64_LOG(SI, "Read from PIF RAM: %x", paddr - 0x1FC0'07C0u);
+            pif_ram_[swizzle_address(0x26, 1)] = 0x3F;
+            pif_ram_[swizzle_address(0x27, 1)] = 0x3F;
             return &pif_ram_[paddr - 0x1FC0'07C0u];
         } else if (paddr - 0x04000000u < 4096u) {
             return &rsp_dmem_[paddr - 0x04000000u];
@@ -176,6 +143,14 @@ namespace TKPEmu::N64::Devices {
         return nullptr;
     }
 
+    bool CPUBus::is_mapped_slow(uint32_t paddr) {
+        // The ranges redirect_paddress_slow answers, without its side effects
+        return paddr - 0x1FC0'0000u < 0x800u ||
+               paddr - 0x0400'0000u < 0x2000u ||
+               paddr - 0x0410'0000u < 0x10'0000u ||
+               find_mmio(CPU::mmio_table_, paddr);
+    }
+
     void CPUBus::map_direct_addresses() {
         // https://wheremyfoodat.github.io/software-fastmem/
         const uint32_t PAGE_SIZE = 0x100000;
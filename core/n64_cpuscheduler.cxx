@@ -5,27 +5,43 @@
 
 namespace TKPEmu::N64::Devices {
     void CPU::handle_event() {
-        auto event_type = scheduler_.top().type;
+        // Pop first, handling an event can queue new ones
+        SchedulerEvent event = scheduler_.Pop();
+        ++events_handled_;
+        #if N64TKP_HAS_PROFILER
+        profiler_.RecordEvent(event.type, cpubus_.time_);
+        #endif
+        auto event_type = event.type;
         switch (event_type) {
             case SchedulerEventType::Interrupt: {
                 check_interrupts();
                 break;
             }
+            case SchedulerEventType::Rsp: {
+                if (rsp_.RunSlice()) {
+                    queue_event(SchedulerEventType::Rsp, RSPCore::SLICE_CPU_CYCLES);
+                }
+                break;
+            }
             case SchedulerEventType::Count: {
-                if ((scheduler_.top().time >> 1) == cp0_regs_[CP0_COMPARE].UD) {
+                if ((event.time >> 1) == cp0_regs_[CP0_COMPARE].UD) {
                     // fire_count();
                 } else
-                    VERBOSE(std::cout << "Compare changed before firing " << (scheduler_.top().time) << " " << cp0_regs_[CP0_COMPARE].UD << std::endl;)
+                    N64_LOG(Sched, "Compare changed before firing %u %x", event.time, cp0_regs_[CP0_COMPARE].UD);
                 break;
             }
             case SchedulerEventType::Vi: {
                 // queue next interrupt
                 uint64_t temp =  rcp_.vi_v_intr_;
                 invalidate_hwio(VI_V_INTR, temp);
+                vblank_ = true;
                 [[fallthrough]];
             }
+            case SchedulerEventType::Sp:
             case SchedulerEventType::Si:
-            case SchedulerEventType::Pi: {
+            case SchedulerEventType::Ai:
+            case SchedulerEventType::Pi:
+            case SchedulerEventType::Dp: {
                 cpubus_.mi_interrupt_ |= 1 << static_cast<int>(event_type);
                 bool interrupt = cpubus_.mi_interrupt_ & cpubus_.mi_mask_;
                 CP0Cause.IP2 = interrupt;
@@ -35,12 +51,14 @@ namespace TKPEmu::N64::Devices {
                 break;
             }
         }
-        scheduler_.pop();
     }
 
     void CPU::queue_event(SchedulerEventType type, int time) {
-        VERBOSE(std::cout << "queued event at: " << cpubus_.time_ + time << " current time: " << cpubus_.time_ << std::endl;)
+        N64_LOG(Sched, "Queued event %d at %u, current time %u", type, cpubus_.time_ + time, cpubus_.time_);
         SchedulerEvent event(type, cpubus_.time_ + time);
-        scheduler_.push(event);
+        scheduler_.Schedule(event.type, event.time);
+        if (event.time < horizon_) {
+            horizon_ = event.time;
+        }
     }
 }
\ No newline at end of file
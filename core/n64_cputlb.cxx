@@ -0,0 +1,160 @@
+#include "n64_cpu.hxx"
+#include <iostream>
+#include "utils.hxx"
+
+namespace TKPEmu::N64::Devices {
+    namespace {
+        // Size of one of the two pages an entry maps, PageMask 0 means 4KB
+        uint32_t page_size(const TLBEntry& entry) {
+            return ((entry.page_mask | 0x1FFF) + 1) >> 1;
+        }
+        // Bits of the virtual address compared against VPN2
+        uint32_t vpn2_mask(const TLBEntry& entry) {
+            return ~(entry.page_mask | 0x1FFF);
+        }
+    }
+
+    TranslatedAddress CPU::translate_mapped(uint32_t vaddr, bool write) {
+        TLBCacheEntry& cached = tlb_cache_[(vaddr >> 12) & (TLB_CACHE_SIZE - 1)];
+        if (cached.tag == (vaddr >> 12) && (cached.writable || !write)) [[likely]] {
+            return { cached.paddr | (vaddr & 0xFFF), static_cast<bool>(cached.cached) };
+        }
+        return translate_tlb(vaddr, write);
+    }
+
+    TranslatedAddress CPU::translate_tlb(uint32_t vaddr, bool write) {
+        uint8_t asid = cp0_regs_[CP0_ENTRYHI].UD & 0xFF;
+        for (const TLBEntry& entry : tlb_) {
+            uint32_t mask = vpn2_mask(entry);
+            if ((vaddr & mask) != (entry.entry_hi & mask)) {
+                continue;
+            }
+            if (!entry.global && (entry.entry_hi & 0xFF) != asid) {
+                continue;
+            }
+            uint32_t size = page_size(entry);
+            uint32_t entry_lo = (vaddr & size) ? entry.entry_lo1 : entry.entry_lo0;
+            if (!(entry_lo & 0b10)) {
+                return { 0, false, TLBResult::Invalid };
+            }
+            bool dirty = entry_lo & 0b100;
+            if (write && !dirty) {
+                return { 0, false, TLBResult::Modified };
+            }
+            uint32_t paddr = ((entry_lo >> 6) & 0xF'FFFF) << 12;
+            paddr = (paddr & ~(size - 1)) | (vaddr & (size - 1));
+            bool is_cached = ((entry_lo >> 3) & 0b111) != 2;
+            TLBCacheEntry& cached = tlb_cache_[(vaddr >> 12) & (TLB_CACHE_SIZE - 1)];
+            cached.tag = vaddr >> 12;
+            cached.paddr = paddr & ~0xFFF;
+            cached.writable = dirty;
+            cached.cached = is_cached;
+            return { paddr, is_cached };
+        }
+        return { 0, false, TLBResult::Miss };
+    }
+
+    void CPU::raise_tlb_exception(uint32_t vaddr, TLBResult result, bool write) {
+        // At EX pc_ is 8 bytes past the current instruction
+        uint64_t epc = pc_ - 8;
+        if (delay_slot_) {
+            epc -= 4;
+        }
+        tlb_exception(vaddr, result, write, epc, delay_slot_);
+        exception_raised_ = true;
+        // The instruction after this one is already fetched, turn it into a NOP
+        icrf_latch_.instruction.Full = 0;
+        icrf_latch_.handler = NopHandler;
+    }
+
+    void CPU::tlb_exception(uint32_t vaddr, TLBResult result, bool write, uint64_t epc, bool bd) {
+        int64_t sevaddr = static_cast<int32_t>(vaddr);
+        cp0_regs_[CP0_BADVADDR].D = sevaddr;
+        // BadVPN2 goes to Context and EntryHi so the handler can refill the TLB
+        cp0_regs_[CP0_CONTEXT].UD = (cp0_regs_[CP0_CONTEXT].UD & ~0x7F'FFF0ull) | ((vaddr >> 13) << 4);
+        cp0_regs_[CP0_XCONTEXT].UD = (cp0_regs_[CP0_XCONTEXT].UD & ~0x7'FFFF'FFF0ull) | ((vaddr >> 13) << 4);
+        cp0_regs_[CP0_ENTRYHI].D = (sevaddr & ~0x1FFFll) | (cp0_regs_[CP0_ENTRYHI].UD & 0xFF);
+        bool refill = result == TLBResult::Miss && !CP0Status.EXL;
+        if (!CP0Status.EXL) {
+            CP0Cause.BD = bd;
+            cp0_regs_[CP0_EPC].UD = epc;
+        }
+        CP0Status.EXL = true;
+        if (result == TLBResult::Modified) {
+            CP0Cause.ExCode = 1;
+        } else {
+            CP0Cause.ExCode = write ? 3 : 2;
+        }
+        // Status.BEV moves the vectors to the boot ROM
+        bool bev = cp0_regs_[CP0_STATUS].UD & (1 << 22);
+        uint32_t base = bev ? 0xBFC0'0200 : 0x8000'0000;
+        pc_ = base + (refill ? 0 : 0x180);
+    }
+
+    void CPU::tlb_read() {
+        const TLBEntry& entry = tlb_[cp0_regs_[CP0_INDEX].UD & 0x1F];
+        cp0_regs_[CP0_PAGEMASK].UD = entry.page_mask;
+        uint64_t entry_hi = static_cast<int32_t>(entry.entry_hi & ~entry.page_mask);
+        // Loading another ASID leaves cached non global translations stale, same as MTC0 EntryHi
+        if ((entry_hi & 0xFF) != (cp0_regs_[CP0_ENTRYHI].UD & 0xFF)) {
+            flush_tlb_cache();
+        }
+        cp0_regs_[CP0_ENTRYHI].UD = entry_hi;
+        cp0_regs_[CP0_ENTRYLO0].UD = entry.entry_lo0 | entry.global;
+        cp0_regs_[CP0_ENTRYLO1].UD = entry.entry_lo1 | entry.global;
+    }
+
+    void CPU::tlb_write(uint32_t index) {
+        TLBEntry& entry = tlb_[index & 0x1F];
+        flush_tlb_cache(entry);
+        entry.page_mask = cp0_regs_[CP0_PAGEMASK].UD & 0x01FF'E000;
+        entry.entry_hi = cp0_regs_[CP0_ENTRYHI].UD & ~(entry.page_mask | 0x1F00);
+        uint32_t entry_lo0 = cp0_regs_[CP0_ENTRYLO0].UD & 0x03FF'FFFF;
+        uint32_t entry_lo1 = cp0_regs_[CP0_ENTRYLO1].UD & 0x03FF'FFFF;
+        entry.global = entry_lo0 & entry_lo1 & 1;
+        entry.entry_lo0 = entry_lo0 & ~1u;
+        entry.entry_lo1 = entry_lo1 & ~1u;
+        flush_tlb_cache(entry);
+    }
+
+    void CPU::tlb_probe() {
+        uint32_t entry_hi = cp0_regs_[CP0_ENTRYHI].UD;
+        for (size_t i = 0; i < tlb_.size(); i++) {
+            const TLBEntry& entry = tlb_[i];
+            uint32_t mask = vpn2_mask(entry);
+            bool asid_match = entry.global || (entry.entry_hi & 0xFF) == (entry_hi & 0xFF);
+            if ((entry_hi & mask) == (entry.entry_hi & mask) && asid_match) {
+                cp0_regs_[CP0_INDEX].UD = i;
+                return;
+            }
+        }
+        // P bit, probe failed
+        cp0_regs_[CP0_INDEX].UD = 1u << 31;
+    }
+
+    uint32_t CPU::get_random() {
+        uint32_t wired = cp0_regs_[CP0_WIRED].UD & 0x1F;
+        return 31 - (cpubus_.time_ % (32 - wired));
+    }
+
+    void CPU::flush_tlb_cache() {
+        for (TLBCacheEntry& cached : tlb_cache_) {
+            cached.tag = INVALID_TAG;
+        }
+    }
+
+    void CPU::flush_tlb_cache(const TLBEntry& entry) {
+        uint32_t first = (entry.entry_hi & vpn2_mask(entry)) >> 12;
+        uint32_t count = (page_size(entry) * 2) >> 12;
+        if (count >= TLB_CACHE_SIZE) {
+            flush_tlb_cache();
+            return;
+        }
+        for (uint32_t page = first; page < first + count; page++) {
+            TLBCacheEntry& cached = tlb_cache_[page & (TLB_CACHE_SIZE - 1)];
+            if (cached.tag == page) {
+                cached.tag = INVALID_TAG;
+            }
+        }
+    }
+}
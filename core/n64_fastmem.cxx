@@ -0,0 +1,106 @@
+#include <array>
+#include <atomic>
+#include <mutex>
+#include "n64_fastmem.hxx"
+#include "error_factory.hxx"
+#if N64TKP_HAS_FASTMEM
+#include <csignal>
+#include <sys/mman.h>
+#include <ucontext.h>
+#endif
+
+namespace TKPEmu::N64::Devices {
+    #if N64TKP_HAS_FASTMEM
+    namespace {
+        // Every live arena, the signal handler can't take locks so this is a fixed array
+        std::array<std::atomic<Fastmem*>, 16> arenas {};
+        struct sigaction previous_action {};
+
+        void signal_handler(int sig, siginfo_t* info, void* raw_context) {
+            auto* context = static_cast<ucontext_t*>(raw_context);
+            auto fault_addr = reinterpret_cast<uintptr_t>(info->si_addr);
+            for (auto& arena : arenas) {
+                Fastmem* fastmem = arena.load(std::memory_order_acquire);
+                if (fastmem && fastmem->Contains(fault_addr)) {
+                    uintptr_t resume = fastmem->HandleFault(context->uc_mcontext.gregs[REG_RIP]);
+                    if (resume) {
+                        context->uc_mcontext.gregs[REG_RIP] = resume;
+                        return;
+                    }
+                }
+            }
+            // Not ours, let the previous handler deal with it
+            if (previous_action.sa_flags & SA_SIGINFO) {
+                previous_action.sa_sigaction(sig, info, raw_context);
+            } else if (previous_action.sa_handler == SIG_DFL || previous_action.sa_handler == SIG_IGN) {
+                // Returning retries the access, which now crashes as usual
+                signal(sig, SIG_DFL);
+            } else {
+                previous_action.sa_handler(sig);
+            }
+        }
+
+        void install_signal_handler() {
+            static std::once_flag installed;
+            std::call_once(installed, []() {
+                struct sigaction action {};
+                action.sa_sigaction = signal_handler;
+                action.sa_flags = SA_SIGINFO | SA_NODEFER;
+                sigemptyset(&action.sa_mask);
+                if (sigaction(SIGSEGV, &action, &previous_action) != 0) {
+                    throw ErrorFactory::generate_exception("Could not install the fastmem fault handler");
+                }
+            });
+        }
+    }
+
+    Fastmem::Fastmem() {
+        void* base = mmap(nullptr, ARENA_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED) {
+            return;
+        }
+        for (auto& arena : arenas) {
+            Fastmem* expected = nullptr;
+            if (arena.compare_exchange_strong(expected, this)) {
+                base_ = static_cast<uint8_t*>(base);
+                install_signal_handler();
+                return;
+            }
+        }
+        // Too many arenas, run without one
+        munmap(base, ARENA_SIZE);
+    }
+
+    Fastmem::~Fastmem() {
+        if (!base_) {
+            return;
+        }
+        for (auto& arena : arenas) {
+            Fastmem* expected = this;
+            arena.compare_exchange_strong(expected, nullptr);
+        }
+        munmap(base_, ARENA_SIZE);
+    }
+
+    uint8_t* Fastmem::Map(uint32_t paddr, size_t size) {
+        uint8_t* host = base_ + paddr;
+        if (mprotect(host, size, PROT_READ | PROT_WRITE) != 0) {
+            throw ErrorFactory::generate_exception("Could not map fastmem range");
+        }
+        return host;
+    }
+    #else
+    Fastmem::Fastmem() {}
+
+    Fastmem::~Fastmem() {}
+
+    uint8_t* Fastmem::Map(uint32_t, size_t) {
+        throw ErrorFactory::generate_exception("Fastmem is not supported on this platform");
+    }
+    #endif
+
+    void Fastmem::SetFaultHandler(FaultHandler handler, void* context) {
+        fault_context_ = context;
+        fault_handler_ = handler;
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#ifndef TKP_N64_FASTMEM_H
+#define TKP_N64_FASTMEM_H
+#include <cstdint>
+#include <cstddef>
+
+// Faults are recovered by rewriting the host instruction pointer, which is x86-64 Linux specific
+#if defined(__x86_64__) && defined(__linux__) && !defined(N64TKP_DISABLE_FASTMEM)
+#define N64TKP_HAS_FASTMEM 1
+#else
+#define N64TKP_HAS_FASTMEM 0
+#endif
+
+namespace TKPEmu::N64::Devices {
+    /**
+        A reserved 4GB host region that mirrors the N64 physical address map.
+
+        Memory that behaves like memory (RDRAM, cartridge ROM) is committed
+        at its physical address, everything else stays PROT_NONE. Any 32-bit
+        physical address can then be accessed as base + paddr without a
+        lookup, and accesses that hit memory mapped registers fault.
+
+        Faults inside the arena are passed to the fault handler along with the
+        faulting host instruction. The handler returns the host address to
+        resume from, or 0 if it doesn't know the instruction, in which case the
+        fault goes to whatever handler was installed before.
+    */
+    class Fastmem {
+    public:
+        using FaultHandler = uintptr_t(*)(void* context, uintptr_t host_pc);
+        static constexpr uint64_t ARENA_SIZE = 1ull << 32;
+
+        Fastmem();
+        ~Fastmem();
+        Fastmem(const Fastmem&) = delete;
+        Fastmem& operator=(const Fastmem&) = delete;
+        // False when the platform or the host address space doesn't allow an arena
+        bool IsEnabled() const {
+            return base_ != nullptr;
+        }
+        uint8_t* GetBase() const {
+            return base_;
+        }
+        // Commits a zero filled read/write range at a physical address and returns its host address
+        uint8_t* Map(uint32_t paddr, size_t size);
+        void SetFaultHandler(FaultHandler handler, void* context);
+        bool Contains(uintptr_t host_addr) const {
+            return host_addr - reinterpret_cast<uintptr_t>(base_) < ARENA_SIZE;
+        }
+        // Called from the SIGSEGV handler, returns where to resume or 0
+        uintptr_t HandleFault(uintptr_t host_pc) const {
+            return fault_handler_ ? fault_handler_(fault_context_, host_pc) : 0;
+        }
+    private:
+        uint8_t* base_ = nullptr;
+        FaultHandler fault_handler_ = nullptr;
+        void* fault_context_ = nullptr;
+    };
+}
+#endif
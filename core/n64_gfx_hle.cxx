@@ -0,0 +1,728 @@
+#include "n64_gfx_hle.hxx"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string_view>
+#include "n64_log.hxx"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace TKPEmu::N64::Devices {
+    namespace {
+        // OSTask fields, at the end of DMEM
+        constexpr uint32_t TASK_TYPE = 0xFC0;
+        constexpr uint32_t TASK_UCODE_DATA = 0xFD8;
+        constexpr uint32_t TASK_UCODE_DATA_SIZE = 0xFDC;
+        constexpr uint32_t TASK_DATA_PTR = 0xFF0;
+        constexpr uint32_t M_GFXTASK = 1;
+        // Display lists that loop forever stop here
+        constexpr uint32_t MAX_COMMANDS = 0x10'0000;
+
+        struct GeometryBits {
+            uint32_t lighting;
+            uint32_t cull_front;
+            uint32_t cull_back;
+        };
+        constexpr GeometryBits F3D_GEOMETRY { 0x2'0000, 0x1000, 0x2000 };
+        constexpr GeometryBits F3DEX2_GEOMETRY { 0x2'0000, 0x200, 0x400 };
+
+        enum ClipCode : uint8_t {
+            CLIP_LEFT = 1 << 0,
+            CLIP_RIGHT = 1 << 1,
+            CLIP_BOTTOM = 1 << 2,
+            CLIP_TOP = 1 << 3,
+            CLIP_NEAR = 1 << 4,
+        };
+
+        using Rows = float[4][4];
+        // Lighting works on groups of 4 vertices, the last group is padded
+        constexpr uint32_t PADDED_CACHE_SIZE = GraphicsHLE::VERTEX_CACHE_SIZE + 4;
+
+        uint32_t read_dmem32(const uint8_t* dmem, uint32_t offset) {
+            uint32_t value;
+            std::memcpy(&value, dmem + offset, sizeof(value));
+            return value;
+        }
+
+        // Row vectors like the RSP, out = a * b
+        void multiply(const Rows& a, const Rows& b, Rows& out) {
+            Rows result;
+#if defined(__SSE2__)
+            for (int i = 0; i < 4; i++) {
+                __m128 row = _mm_mul_ps(_mm_set1_ps(a[i][0]), _mm_loadu_ps(b[0]));
+                for (int k = 1; k < 4; k++) {
+                    row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i][k]), _mm_loadu_ps(b[k])));
+                }
+                _mm_storeu_ps(result[i], row);
+            }
+#else
+            for (int i = 0; i < 4; i++) {
+                for (int j = 0; j < 4; j++) {
+                    result[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j] + a[i][3] * b[3][j];
+                }
+            }
+#endif
+            std::memcpy(out, result, sizeof(result));
+        }
+
+        void identity(Rows& m) {
+            for (int i = 0; i < 4; i++) {
+                for (int j = 0; j < 4; j++) {
+                    m[i][j] = i == j;
+                }
+            }
+        }
+
+        // clip = x * m[0] + y * m[1] + z * m[2] + m[3] for every vertex in the batch
+        void transform_batch(const Rows& m, const float* x, const float* y, const float* z, float (*clip)[4], uint32_t count) {
+#if defined(__SSE2__)
+            __m128 row0 = _mm_loadu_ps(m[0]), row1 = _mm_loadu_ps(m[1]);
+            __m128 row2 = _mm_loadu_ps(m[2]), row3 = _mm_loadu_ps(m[3]);
+            for (uint32_t i = 0; i < count; i++) {
+                __m128 xy = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(x[i]), row0), _mm_mul_ps(_mm_set1_ps(y[i]), row1));
+                __m128 zw = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(z[i]), row2), row3);
+                _mm_store_ps(clip[i], _mm_add_ps(xy, zw));
+            }
+#else
+            for (uint32_t i = 0; i < count; i++) {
+                for (int j = 0; j < 4; j++) {
+                    clip[i][j] = x[i] * m[0][j] + y[i] * m[1][j] + z[i] * m[2][j] + m[3][j];
+                }
+            }
+#endif
+        }
+
+        /**
+         * color = ambient + the sum of max(0, normal . direction) * light color,
+         * normals are normalized first. Works on 4 vertices at a time, count
+         * is rounded up to a multiple of 4
+         */
+        void light_batch(const float* nx, const float* ny, const float* nz, uint32_t count,
+                const std::array<float, 3>* directions, const float (*colors)[3], uint32_t lights,
+                const float* ambient, float (*out)[PADDED_CACHE_SIZE]) {
+#if defined(__SSE2__)
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 max = _mm_set1_ps(255.0f);
+            for (uint32_t i = 0; i < count; i += 4) {
+                __m128 x = _mm_load_ps(nx + i), y = _mm_load_ps(ny + i), z = _mm_load_ps(nz + i);
+                __m128 length = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+                __m128 scale = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(_mm_max_ps(length, _mm_set1_ps(1e-12f))));
+                x = _mm_mul_ps(x, scale);
+                y = _mm_mul_ps(y, scale);
+                z = _mm_mul_ps(z, scale);
+                __m128 color[3] = { _mm_set1_ps(ambient[0]), _mm_set1_ps(ambient[1]), _mm_set1_ps(ambient[2]) };
+                for (uint32_t l = 0; l < lights; l++) {
+                    __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(directions[l][0])),
+                        _mm_mul_ps(y, _mm_set1_ps(directions[l][1]))), _mm_mul_ps(z, _mm_set1_ps(directions[l][2])));
+                    dot = _mm_max_ps(dot, zero);
+                    for (int c = 0; c < 3; c++) {
+                        color[c] = _mm_add_ps(color[c], _mm_mul_ps(dot, _mm_set1_ps(colors[l][c])));
+                    }
+                }
+                for (int c = 0; c < 3; c++) {
+                    _mm_store_ps(out[c] + i, _mm_min_ps(color[c], max));
+                }
+            }
+#else
+            for (uint32_t i = 0; i < count; i++) {
+                float length = std::sqrt(std::max(nx[i] * nx[i] + ny[i] * ny[i] + nz[i] * nz[i], 1e-12f));
+                float x = nx[i] / length, y = ny[i] / length, z = nz[i] / length;
+                float color[3] = { ambient[0], ambient[1], ambient[2] };
+                for (uint32_t l = 0; l < lights; l++) {
+                    float dot = std::max(0.0f, x * directions[l][0] + y * directions[l][1] + z * directions[l][2]);
+                    for (int c = 0; c < 3; c++) {
+                        color[c] += dot * colors[l][c];
+                    }
+                }
+                for (int c = 0; c < 3; c++) {
+                    out[c][i] = std::min(color[c], 255.0f);
+                }
+            }
+#endif
+        }
+    }
+
+    GraphicsMicrocode GraphicsHLE::Detect(std::span<const uint8_t> rdram, uint32_t ucode_data, uint32_t size) {
+        std::array<char, 0x1000> text;
+        size = std::min<uint32_t>(size, text.size());
+        for (uint32_t i = 0; i < size; i++) {
+            text[i] = rdram[((ucode_data + i) & (rdram.size() - 1)) ^ 3];
+        }
+        std::string_view view(text.data(), size);
+        if (view.find("RSP SW Version: 2.0") != std::string_view::npos) {
+            return GraphicsMicrocode::F3D;
+        }
+        // Like "RSP Gfx ucode F3DEX       fifo 2.08", the version follows the output mode
+        size_t name = view.find("RSP Gfx ucode F3D");
+        if (name == std::string_view::npos) {
+            return GraphicsMicrocode::Unknown;
+        }
+        std::string_view rest = view.substr(name, 48);
+        for (std::string_view mode : { "fifo ", "xbus ", "dram " }) {
+            size_t version = rest.find(mode);
+            if (version != std::string_view::npos && version + mode.size() < rest.size()) {
+                return rest[version + mode.size()] == '2' ? GraphicsMicrocode::F3DEX2 : GraphicsMicrocode::F3DEX;
+            }
+        }
+        return GraphicsMicrocode::Unknown;
+    }
+
+    bool GraphicsHLE::Run(const uint8_t* dmem, std::span<const uint8_t> rdram) {
+        if (read_dmem32(dmem, TASK_TYPE) != M_GFXTASK) {
+            return false;
+        }
+        GraphicsMicrocode microcode = Detect(rdram, read_dmem32(dmem, TASK_UCODE_DATA), read_dmem32(dmem, TASK_UCODE_DATA_SIZE));
+        if (microcode == GraphicsMicrocode::Unknown) {
+            return false;
+        }
+        rdram_ = rdram;
+        microcode_ = microcode;
+        reset();
+        run_display_list(read_dmem32(dmem, TASK_DATA_PTR));
+        return true;
+    }
+
+    void GraphicsHLE::reset() {
+        // The microcode starts every task from scratch
+        output_.microcode = microcode_;
+        output_.commands = 0;
+        output_.rdp_commands.clear();
+        output_.triangles.clear();
+        output_.full_sync = false;
+        dl_depth_ = 0;
+        segments_.fill(0);
+        modelview_index_ = 0;
+        identity(modelview_[0].m);
+        identity(projection_.m);
+        mvp_dirty_ = true;
+        lights_dirty_ = true;
+        lights_ = {};
+        light_count_ = 1;
+        // 320x240 until the game sets a viewport
+        viewport_scale_ = { 160.0f, 120.0f, 511.0f };
+        viewport_translate_ = { 160.0f, 120.0f, 511.0f };
+        geometry_mode_ = 0;
+        texture_scale_s_ = texture_scale_t_ = 0;
+        other_mode_h_ = other_mode_l_ = 0;
+        half_1_ = half_2_ = 0;
+        ended_ = false;
+    }
+
+    void GraphicsHLE::run_display_list(uint32_t address) {
+        pc_ = segment_address(address);
+        while (!ended_) {
+            if (output_.commands++ == MAX_COMMANDS) [[unlikely]] {
+                N64_LOG(RSP, "Display list at %x doesn't end", address);
+                break;
+            }
+            uint32_t w0 = read32(pc_);
+            uint32_t w1 = read32(pc_ + 4);
+            pc_ += 8;
+            if (microcode_ == GraphicsMicrocode::F3DEX2) {
+                execute_f3dex2(w0, w1);
+            } else {
+                execute_f3d(w0, w1);
+            }
+        }
+    }
+
+    void GraphicsHLE::execute_f3d(uint32_t w0, uint32_t w1) {
+        // F3DEX keeps F3D's opcodes but packs vertex indices differently
+        bool ex = microcode_ == GraphicsMicrocode::F3DEX;
+        switch (w0 >> 24) {
+            case 0x00: break; // G_SPNOOP
+            case 0x01: {
+                uint32_t params = (w0 >> 16) & 0xFF;
+                load_matrix(w1, params & 1, params & 2, params & 4);
+                break;
+            }
+            case 0x03: {
+                // G_MOVEMEM
+                uint32_t type = (w0 >> 16) & 0xFF;
+                if (type == 0x80) {
+                    set_viewport(w1);
+                } else if (type >= 0x86 && type <= 0x94) {
+                    load_light((type - 0x86) / 2, w1);
+                }
+                break;
+            }
+            case 0x04: {
+                if (ex) {
+                    load_vertices(w1, ((w0 >> 16) & 0xFF) / 2, (w0 >> 10) & 0x3F);
+                } else {
+                    load_vertices(w1, (w0 >> 16) & 0xF, ((w0 >> 20) & 0xF) + 1);
+                }
+                break;
+            }
+            case 0x06: call_display_list(w1, ((w0 >> 16) & 0xFF) == 0); break;
+            case 0xAF: {
+                N64_LOG(RSP, "G_LOAD_UCODE isn't supported by the graphics HLE");
+                ended_ = true;
+                break;
+            }
+            case 0xB0: branch_z((w0 & 0xFFF) / 2, static_cast<int32_t>(w1)); break;
+            case 0xB1: {
+                // G_TRI2
+                draw_triangle(((w0 >> 16) & 0xFF) / 2, ((w0 >> 8) & 0xFF) / 2, (w0 & 0xFF) / 2);
+                draw_triangle(((w1 >> 16) & 0xFF) / 2, ((w1 >> 8) & 0xFF) / 2, (w1 & 0xFF) / 2);
+                break;
+            }
+            case 0xB2: {
+                // G_MODIFYVTX in F3DEX, G_RDPHALF_CONT in F3D
+                if (ex) {
+                    modify_vertex((w0 & 0xFFFF) / 2, (w0 >> 16) & 0xFF, w1);
+                }
+                break;
+            }
+            case 0xB3: half_2_ = w1; break;
+            case 0xB4: half_1_ = w1; break;
+            case 0xB5: break; // G_LINE3D, nothing to rasterize lines with
+            case 0xB6: geometry_mode_ &= ~w1; break;
+            case 0xB7: geometry_mode_ |= w1; break;
+            case 0xB8: end_display_list(); break;
+            case 0xB9: set_other_mode(false, (w0 >> 8) & 0xFF, w0 & 0xFF, w1); break;
+            case 0xBA: set_other_mode(true, (w0 >> 8) & 0xFF, w0 & 0xFF, w1); break;
+            case 0xBB: {
+                texture_scale_s_ = (w1 >> 16) / 65536.0f;
+                texture_scale_t_ = (w1 & 0xFFFF) / 65536.0f;
+                break;
+            }
+            case 0xBC: {
+                // G_MOVEWORD
+                uint32_t index = w0 & 0xFF;
+                uint32_t offset = (w0 >> 8) & 0xFFFF;
+                if (index == 0x02) {
+                    // NUML(n) is (n + 1) * 32 + 0x80000000
+                    light_count_ = std::clamp<int32_t>(static_cast<int32_t>((w1 - 0x8000'0000) >> 5) - 1, 0, MAX_LIGHTS);
+                    lights_dirty_ = true;
+                } else if (index == 0x06) {
+                    segments_[(offset >> 2) & 15] = w1 & 0xFF'FFFF;
+                }
+                break;
+            }
+            case 0xBD: pop_matrix(1); break;
+            case 0xBE: {
+                uint32_t scale = ex ? 2 : 40;
+                if (vertices_culled((w0 & 0xFF'FFFF) / scale, w1 / scale)) {
+                    end_display_list();
+                }
+                break;
+            }
+            case 0xBF: {
+                uint32_t scale = ex ? 2 : 10;
+                draw_triangle(((w1 >> 16) & 0xFF) / scale, ((w1 >> 8) & 0xFF) / scale, (w1 & 0xFF) / scale);
+                break;
+            }
+            default: {
+                if ((w0 >> 24) >= 0xC0) {
+                    execute_rdp(w0, w1);
+                } else {
+                    N64_LOG(RSP, "Unimplemented display list command %08x %08x", w0, w1);
+                }
+                break;
+            }
+        }
+    }
+
+    void GraphicsHLE::execute_f3dex2(uint32_t w0, uint32_t w1) {
+        switch (w0 >> 24) {
+            case 0x00: break; // G_NOOP
+            case 0x01: {
+                uint32_t count = (w0 >> 12) & 0xFF;
+                uint32_t end = (w0 >> 1) & 0x7F;
+                if (count <= end) {
+                    load_vertices(w1, end - count, count);
+                }
+                break;
+            }
+            case 0x02: modify_vertex((w0 & 0xFFFF) / 2, (w0 >> 16) & 0xFF, w1); break;
+            case 0x03: {
+                if (vertices_culled((w0 & 0xFFFF) / 2, w1 / 2)) {
+                    end_display_list();
+                }
+                break;
+            }
+            case 0x04: branch_z((w0 & 0xFFF) / 2, static_cast<int32_t>(w1)); break;
+            case 0x05: draw_triangle(((w0 >> 16) & 0xFF) / 2, ((w0 >> 8) & 0xFF) / 2, (w0 & 0xFF) / 2); break;
+            // G_TRI2 and G_QUAD, a quad is sent as two triangles
+            case 0x06:
+            case 0x07: {
+                draw_triangle(((w0 >> 16) & 0xFF) / 2, ((w0 >> 8) & 0xFF) / 2, (w0 & 0xFF) / 2);
+                draw_triangle(((w1 >> 16) & 0xFF) / 2, ((w1 >> 8) & 0xFF) / 2, (w1 & 0xFF) / 2);
+                break;
+            }
+            case 0xD7: {
+                texture_scale_s_ = (w1 >> 16) / 65536.0f;
+                texture_scale_t_ = (w1 & 0xFFFF) / 65536.0f;
+                break;
+            }
+            // Pops w1 bytes off the matrix stack
+            case 0xD8: pop_matrix(w1 / 64); break;
+            case 0xD9: geometry_mode_ = (geometry_mode_ & w0 & 0xFF'FFFF) | w1; break;
+            case 0xDA: {
+                // G_MTX_PUSH is inverted in the command
+                uint32_t params = (w0 & 0xFF) ^ 1;
+                load_matrix(w1, params & 4, params & 2, params & 1);
+                break;
+            }
+            case 0xDB: {
+                uint32_t index = (w0 >> 16) & 0xFF;
+                uint32_t offset = w0 & 0xFFFF;
+                if (index == 0x02) {
+                    light_count_ = std::min<uint32_t>(w1 / 24, MAX_LIGHTS);
+                    lights_dirty_ = true;
+                } else if (index == 0x06) {
+                    segments_[(offset >> 2) & 15] = w1 & 0xFF'FFFF;
+                }
+                break;
+            }
+            case 0xDC: {
+                uint32_t index = w0 & 0xFF;
+                uint32_t offset = ((w0 >> 8) & 0xFF) * 8;
+                if (index == 0x08) {
+                    set_viewport(w1);
+                } else if (index == 0x0A && offset >= 48) {
+                    // The two lookat vectors come first
+                    load_light(offset / 24 - 2, w1);
+                }
+                break;
+            }
+            case 0xDD: {
+                N64_LOG(RSP, "G_LOAD_UCODE isn't supported by the graphics HLE");
+                ended_ = true;
+                break;
+            }
+            case 0xDE: call_display_list(w1, ((w0 >> 16) & 0xFF) == 0); break;
+            case 0xDF: end_display_list(); break;
+            case 0xE0: break; // G_SPNOOP
+            case 0xE1: half_1_ = w1; break;
+            case 0xE2: {
+                uint32_t length = (w0 & 0xFF) + 1;
+                set_other_mode(false, 32 - ((w0 >> 8) & 0xFF) - length, length, w1);
+                break;
+            }
+            case 0xE3: {
+                uint32_t length = (w0 & 0xFF) + 1;
+                set_other_mode(true, 32 - ((w0 >> 8) & 0xFF) - length, length, w1);
+                break;
+            }
+            case 0xF1: half_2_ = w1; break;
+            default: {
+                if ((w0 >> 24) >= 0xC0) {
+                    execute_rdp(w0, w1);
+                } else {
+                    N64_LOG(RSP, "Unimplemented display list command %08x %08x", w0, w1);
+                }
+                break;
+            }
+        }
+    }
+
+    void GraphicsHLE::execute_rdp(uint32_t w0, uint32_t w1) {
+        auto& commands = output_.rdp_commands;
+        switch (w0 >> 24) {
+            case 0xE4:
+            case 0xE5: {
+                // Texture rectangles take their texture coordinates from the RDPHALF commands after them
+                commands.push_back((static_cast<uint64_t>(w0) << 32) | w1);
+                commands.push_back((static_cast<uint64_t>(read32(pc_ + 4)) << 32) | read32(pc_ + 12));
+                pc_ += 16;
+                return;
+            }
+            case 0xE9: output_.full_sync = true; break;
+            case 0xEF: {
+                other_mode_h_ = w0 & 0xFF'FFFF;
+                other_mode_l_ = w1;
+                break;
+            }
+        }
+        commands.push_back((static_cast<uint64_t>(w0) << 32) | w1);
+    }
+
+    void GraphicsHLE::call_display_list(uint32_t address, bool push) {
+        if (push) {
+            if (dl_depth_ == DISPLAY_LIST_DEPTH) {
+                N64_LOG(RSP, "Display list stack overflow at %x", pc_);
+                ended_ = true;
+                return;
+            }
+            dl_stack_[dl_depth_++] = pc_;
+        }
+        pc_ = segment_address(address);
+    }
+
+    void GraphicsHLE::end_display_list() {
+        if (dl_depth_ == 0) {
+            ended_ = true;
+        } else {
+            pc_ = dl_stack_[--dl_depth_];
+        }
+    }
+
+    void GraphicsHLE::branch_z(uint32_t vertex, int32_t z) {
+        // z is a screen z in 16.16 fixed point
+        if (vertex < VERTEX_CACHE_SIZE && static_cast<int32_t>(vertices_[vertex].z * 65536.0f) <= z) {
+            call_display_list(half_1_, false);
+        }
+    }
+
+    void GraphicsHLE::load_matrix(uint32_t address, bool projection, bool load, bool push) {
+        // 16 s15 integer parts followed by 16 fractions
+        Matrix matrix;
+        uint32_t base = segment_address(address);
+        for (int i = 0; i < 16; i++) {
+            uint32_t integer = static_cast<uint16_t>(read16(base + i * 2));
+            uint32_t fraction = static_cast<uint16_t>(read16(base + 32 + i * 2));
+            matrix.m[i / 4][i % 4] = static_cast<int32_t>((integer << 16) | fraction) / 65536.0f;
+        }
+        if (projection) {
+            if (load) {
+                projection_ = matrix;
+            } else {
+                multiply(matrix.m, projection_.m, projection_.m);
+            }
+        } else {
+            if (push) {
+                if (modelview_index_ + 1 < MATRIX_STACK_SIZE) {
+                    modelview_[modelview_index_ + 1] = modelview_[modelview_index_];
+                    modelview_index_++;
+                } else {
+                    N64_LOG(RSP, "Matrix stack overflow");
+                }
+            }
+            Matrix& top = modelview_[modelview_index_];
+            if (load) {
+                top = matrix;
+            } else {
+                multiply(matrix.m, top.m, top.m);
+            }
+            lights_dirty_ = true;
+        }
+        mvp_dirty_ = true;
+    }
+
+    void GraphicsHLE::pop_matrix(uint32_t count) {
+        modelview_index_ -= std::min(count, modelview_index_);
+        mvp_dirty_ = true;
+        lights_dirty_ = true;
+    }
+
+    void GraphicsHLE::update_mvp() {
+        if (mvp_dirty_) {
+            multiply(modelview_[modelview_index_].m, projection_.m, mvp_.m);
+            mvp_dirty_ = false;
+        }
+    }
+
+    void GraphicsHLE::update_lights() {
+        if (!lights_dirty_) {
+            return;
+        }
+        // n * modelview . direction is n . (modelview * direction), so the lights move instead of every normal
+        const Rows& m = modelview_[modelview_index_].m;
+        for (uint32_t l = 0; l < light_count_; l++) {
+            const float* d = lights_[l].direction;
+            auto& out = model_directions_[l];
+            for (int i = 0; i < 3; i++) {
+                out[i] = m[i][0] * d[0] + m[i][1] * d[1] + m[i][2] * d[2];
+            }
+            float length = std::sqrt(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+            if (length > 0) {
+                for (auto& component : out) {
+                    component /= length;
+                }
+            }
+        }
+        lights_dirty_ = false;
+    }
+
+    void GraphicsHLE::load_vertices(uint32_t address, uint32_t first, uint32_t count) {
+        if (first >= VERTEX_CACHE_SIZE) {
+            return;
+        }
+        count = std::min(count, VERTEX_CACHE_SIZE - first);
+        update_mvp();
+        // Unpacked into arrays first so the batch kernels can stream through them
+        alignas(16) float x[PADDED_CACHE_SIZE], y[PADDED_CACHE_SIZE], z[PADDED_CACHE_SIZE];
+        alignas(16) float nx[PADDED_CACHE_SIZE] = {}, ny[PADDED_CACHE_SIZE] = {}, nz[PADDED_CACHE_SIZE] = {};
+        alignas(16) float clip[PADDED_CACHE_SIZE][4];
+        uint32_t base = segment_address(address);
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t vertex = base + i * 16;
+            x[i] = read16(vertex);
+            y[i] = read16(vertex + 2);
+            z[i] = read16(vertex + 4);
+            Vertex& v = vertices_[first + i];
+            // s10.5 texture coordinates
+            v.s = read16(vertex + 8) * texture_scale_s_ / 32.0f;
+            v.t = read16(vertex + 10) * texture_scale_t_ / 32.0f;
+            for (int c = 0; c < 4; c++) {
+                v.color[c] = read8(vertex + 12 + c);
+            }
+            // With lighting on the color holds the normal instead
+            nx[i] = static_cast<int8_t>(v.color[0]);
+            ny[i] = static_cast<int8_t>(v.color[1]);
+            nz[i] = static_cast<int8_t>(v.color[2]);
+        }
+        transform_batch(mvp_.m, x, y, z, clip, count);
+
+        const GeometryBits& bits = microcode_ == GraphicsMicrocode::F3DEX2 ? F3DEX2_GEOMETRY : F3D_GEOMETRY;
+        if (geometry_mode_ & bits.lighting) {
+            update_lights();
+            float colors[MAX_LIGHTS][3];
+            for (uint32_t l = 0; l < light_count_; l++) {
+                std::memcpy(colors[l], lights_[l].color, sizeof(colors[l]));
+            }
+            alignas(16) float lit[3][PADDED_CACHE_SIZE];
+            light_batch(nx, ny, nz, count, model_directions_.data(), colors, light_count_,
+                lights_[light_count_].color, lit);
+            for (uint32_t i = 0; i < count; i++) {
+                for (int c = 0; c < 3; c++) {
+                    vertices_[first + i].color[c] = static_cast<uint8_t>(lit[c][i]);
+                }
+            }
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            Vertex& v = vertices_[first + i];
+            std::memcpy(v.clip, clip[i], sizeof(v.clip));
+            float w = v.clip[3];
+            v.clip_codes = 0;
+            v.clip_codes |= v.clip[0] < -w ? CLIP_LEFT : 0;
+            v.clip_codes |= v.clip[0] > w ? CLIP_RIGHT : 0;
+            v.clip_codes |= v.clip[1] < -w ? CLIP_BOTTOM : 0;
+            v.clip_codes |= v.clip[1] > w ? CLIP_TOP : 0;
+            v.clip_codes |= (w <= 0 || v.clip[2] < -w) ? CLIP_NEAR : 0;
+            if (w > 0) {
+                float inverse = 1.0f / w;
+                v.x = v.clip[0] * inverse * viewport_scale_[0] + viewport_translate_[0];
+                // Screen y grows downwards
+                v.y = -v.clip[1] * inverse * viewport_scale_[1] + viewport_translate_[1];
+                v.z = v.clip[2] * inverse * viewport_scale_[2] + viewport_translate_[2];
+            } else {
+                v.x = v.y = v.z = 0;
+            }
+        }
+    }
+
+    void GraphicsHLE::draw_triangle(uint32_t v0, uint32_t v1, uint32_t v2) {
+        if (v0 >= VERTEX_CACHE_SIZE || v1 >= VERTEX_CACHE_SIZE || v2 >= VERTEX_CACHE_SIZE) {
+            return;
+        }
+        const Vertex* vertices[3] = { &vertices_[v0], &vertices_[v1], &vertices_[v2] };
+        uint8_t all = vertices[0]->clip_codes & vertices[1]->clip_codes & vertices[2]->clip_codes;
+        uint8_t any = vertices[0]->clip_codes | vertices[1]->clip_codes | vertices[2]->clip_codes;
+        if (all || (any & CLIP_NEAR)) {
+            return;
+        }
+        // Front faces are counter clockwise with y up, so negative here
+        float area = (vertices[1]->x - vertices[0]->x) * (vertices[2]->y - vertices[0]->y) -
+            (vertices[2]->x - vertices[0]->x) * (vertices[1]->y - vertices[0]->y);
+        const GeometryBits& bits = microcode_ == GraphicsMicrocode::F3DEX2 ? F3DEX2_GEOMETRY : F3D_GEOMETRY;
+        if ((geometry_mode_ & bits.cull_back) && area >= 0) {
+            return;
+        }
+        if ((geometry_mode_ & bits.cull_front) && area <= 0) {
+            return;
+        }
+        HLETriangle& triangle = output_.triangles.emplace_back();
+        for (int i = 0; i < 3; i++) {
+            const Vertex& v = *vertices[i];
+            triangle.vertices[i] = { v.x, v.y, v.z / 0x3FF, v.clip[3], v.s, v.t, v.color };
+        }
+        triangle.rdp_command = output_.rdp_commands.size();
+    }
+
+    void GraphicsHLE::modify_vertex(uint32_t index, uint32_t where, uint32_t value) {
+        if (index >= VERTEX_CACHE_SIZE) {
+            return;
+        }
+        Vertex& v = vertices_[index];
+        switch (where) {
+            case 0x10: {
+                for (int c = 0; c < 4; c++) {
+                    v.color[c] = value >> (24 - c * 8);
+                }
+                break;
+            }
+            case 0x14: {
+                v.s = static_cast<int16_t>(value >> 16) / 32.0f;
+                v.t = static_cast<int16_t>(value) / 32.0f;
+                break;
+            }
+            case 0x18: {
+                // s13.2, the vertex is where the game says from now on
+                v.x = static_cast<int16_t>(value >> 16) / 4.0f;
+                v.y = static_cast<int16_t>(value) / 4.0f;
+                v.clip_codes = 0;
+                break;
+            }
+            case 0x1C: v.z = value / 65536.0f; break;
+        }
+    }
+
+    bool GraphicsHLE::vertices_culled(uint32_t first, uint32_t last) {
+        if (first > last || last >= VERTEX_CACHE_SIZE) {
+            return false;
+        }
+        uint8_t codes = 0xFF;
+        for (uint32_t i = first; i <= last; i++) {
+            codes &= vertices_[i].clip_codes;
+        }
+        return codes != 0;
+    }
+
+    void GraphicsHLE::set_viewport(uint32_t address) {
+        // Vp_t, x and y in quarter pixels
+        uint32_t base = segment_address(address);
+        for (int i = 0; i < 3; i++) {
+            float divider = i < 2 ? 4.0f : 1.0f;
+            viewport_scale_[i] = read16(base + i * 2) / divider;
+            viewport_translate_[i] = read16(base + 8 + i * 2) / divider;
+        }
+    }
+
+    void GraphicsHLE::load_light(uint32_t index, uint32_t address) {
+        if (index > MAX_LIGHTS) {
+            return;
+        }
+        uint32_t base = segment_address(address);
+        Light& light = lights_[index];
+        for (int i = 0; i < 3; i++) {
+            light.color[i] = read8(base + i);
+            light.direction[i] = static_cast<int8_t>(read8(base + 8 + i));
+        }
+        lights_dirty_ = true;
+    }
+
+    void GraphicsHLE::set_other_mode(bool high, uint32_t shift, uint32_t length, uint32_t data) {
+        if (shift >= 32 || length == 0 || length > 32 - shift) {
+            return;
+        }
+        uint32_t mask = static_cast<uint32_t>((1ull << length) - 1) << shift;
+        uint32_t& mode = high ? other_mode_h_ : other_mode_l_;
+        mode = (mode & ~mask) | (data & mask);
+        // The microcode sends the RDP both halves every time
+        output_.rdp_commands.push_back((static_cast<uint64_t>(0xEF00'0000 | (other_mode_h_ & 0xFF'FFFF)) << 32) | other_mode_l_);
+    }
+
+    uint32_t GraphicsHLE::segment_address(uint32_t address) const {
+        return (segments_[(address >> 24) & 15] + (address & 0xFF'FFFF)) & (rdram_.size() - 1);
+    }
+
+    uint8_t GraphicsHLE::read8(uint32_t address) const {
+        return rdram_[(address & (rdram_.size() - 1)) ^ 3];
+    }
+
+    int16_t GraphicsHLE::read16(uint32_t address) const {
+        uint32_t word = read32(address);
+        return static_cast<int16_t>((address & 2) ? word : word >> 16);
+    }
+
+    uint32_t GraphicsHLE::read32(uint32_t address) const {
+        uint32_t value;
+        std::memcpy(&value, rdram_.data() + (address & (rdram_.size() - 1) & ~3u), sizeof(value));
+        return value;
+    }
+}
@@ -0,0 +1,150 @@
+#pragma once
+#ifndef TKP_N64_GFX_HLE_H
+#define TKP_N64_GFX_HLE_H
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace TKPEmu::N64::Devices {
+    enum class GraphicsMicrocode : uint8_t {
+        Unknown,
+        F3D,
+        // F3DEX 0.95 to 1.23 and its F3DLX and F3DLP variants
+        F3DEX,
+        // F3DEX2 and F3DZEX
+        F3DEX2,
+    };
+    struct HLEVertex {
+        // x and y in pixels, z from 0 (near) to 1 (far), w in clip space
+        float x, y, z, w;
+        // In texels, with the G_TEXTURE scale applied
+        float s, t;
+        std::array<uint8_t, 4> color;
+    };
+    struct HLETriangle {
+        std::array<HLEVertex, 3> vertices;
+        // Number of RDP commands sent before this triangle, the last ones set its render state
+        uint32_t rdp_command;
+    };
+    // What the last graphics task run with HLE sent to the RDP
+    struct GraphicsTaskOutput {
+        GraphicsMicrocode microcode = GraphicsMicrocode::Unknown;
+        // Display list commands run, nested lists included
+        uint32_t commands = 0;
+        // RDP commands passed through by the display list and other modes set by it, in order
+        std::vector<uint64_t> rdp_commands;
+        // Triangles that survived culling, in screen space
+        std::vector<HLETriangle> triangles;
+        // The display list asked for a full sync, the DP interrupt is due
+        bool full_sync = false;
+    };
+
+    /**
+        Runs F3D, F3DEX and F3DEX2 graphics tasks on the host instead of on
+        the RSP.
+
+        The display list is read straight from RDRAM. Matrices are kept in
+        host floats, each G_VTX is transformed and lit as one batch with SSE2
+        where available, and triangles are culled and handed out in screen
+        space. Triangles crossing the near plane are dropped instead of
+        clipped and texture coordinate generation isn't done, the RSP stays
+        the reference for those
+    */
+    class GraphicsHLE {
+    public:
+        static constexpr uint32_t VERTEX_CACHE_SIZE = 64;
+        static constexpr uint32_t MATRIX_STACK_SIZE = 32;
+        static constexpr uint32_t MAX_LIGHTS = 8;
+        static constexpr uint32_t DISPLAY_LIST_DEPTH = 18;
+        /**
+         * Runs the task described by the OSTask at the end of DMEM. Returns
+         * false without touching anything if it isn't a graphics task or its
+         * microcode isn't one of the above, the RSP has to run it then
+         */
+        bool Run(const uint8_t* dmem, std::span<const uint8_t> rdram);
+        const GraphicsTaskOutput& GetOutput() const {
+            return output_;
+        }
+        // Looks for the version string in the microcode's data section
+        static GraphicsMicrocode Detect(std::span<const uint8_t> rdram, uint32_t ucode_data, uint32_t size);
+    private:
+        struct alignas(16) Matrix {
+            float m[4][4];
+        };
+        struct Light {
+            float color[3];
+            float direction[3];
+        };
+        struct Vertex {
+            alignas(16) float clip[4];
+            // x and y in pixels, z in screen z units (0 to 0x3FF)
+            float x, y, z;
+            float s, t;
+            std::array<uint8_t, 4> color;
+            uint8_t clip_codes;
+        };
+
+        void reset();
+        void run_display_list(uint32_t address);
+        void execute_f3d(uint32_t w0, uint32_t w1);
+        void execute_f3dex2(uint32_t w0, uint32_t w1);
+        // Commands at 0xC0 and up go to the RDP as they are
+        void execute_rdp(uint32_t w0, uint32_t w1);
+        void call_display_list(uint32_t address, bool push);
+        void end_display_list();
+        // Jumps to the address in the last RDPHALF_1 if the vertex is at least as near as z
+        void branch_z(uint32_t vertex, int32_t z);
+
+        void load_matrix(uint32_t address, bool projection, bool load, bool push);
+        void pop_matrix(uint32_t count);
+        void load_vertices(uint32_t address, uint32_t first, uint32_t count);
+        // Moves the light directions into model space after the modelview matrix changes
+        void update_lights();
+        void draw_triangle(uint32_t v0, uint32_t v1, uint32_t v2);
+        void modify_vertex(uint32_t index, uint32_t where, uint32_t value);
+        // True if every vertex in [first, last] is outside the same clip plane
+        bool vertices_culled(uint32_t first, uint32_t last);
+        void set_viewport(uint32_t address);
+        void load_light(uint32_t index, uint32_t address);
+        void set_other_mode(bool high, uint32_t shift, uint32_t length, uint32_t data);
+        void update_mvp();
+
+        uint32_t segment_address(uint32_t address) const;
+        // RDRAM holds host endian words, these take big endian addresses
+        uint8_t read8(uint32_t address) const;
+        int16_t read16(uint32_t address) const;
+        uint32_t read32(uint32_t address) const;
+
+        std::span<const uint8_t> rdram_;
+        GraphicsTaskOutput output_;
+        uint32_t pc_ = 0;
+        std::array<uint32_t, DISPLAY_LIST_DEPTH> dl_stack_ {};
+        uint32_t dl_depth_ = 0;
+        GraphicsMicrocode microcode_ = GraphicsMicrocode::Unknown;
+        std::array<uint32_t, 16> segments_ {};
+        std::array<Matrix, MATRIX_STACK_SIZE> modelview_ {};
+        uint32_t modelview_index_ = 0;
+        Matrix projection_ {};
+        Matrix mvp_ {};
+        bool mvp_dirty_ = true;
+        bool lights_dirty_ = true;
+        std::array<Vertex, VERTEX_CACHE_SIZE> vertices_ {};
+        // Directional lights followed by the ambient light
+        std::array<Light, MAX_LIGHTS + 1> lights_ {};
+        // Directional light count, the ambient light is lights_[light_count_]
+        uint32_t light_count_ = 1;
+        std::array<std::array<float, 3>, MAX_LIGHTS> model_directions_ {};
+        std::array<float, 3> viewport_scale_ {};
+        std::array<float, 3> viewport_translate_ {};
+        uint32_t geometry_mode_ = 0;
+        float texture_scale_s_ = 0;
+        float texture_scale_t_ = 0;
+        uint32_t other_mode_h_ = 0;
+        uint32_t other_mode_l_ = 0;
+        uint32_t half_1_ = 0;
+        uint32_t half_2_ = 0;
+        bool ended_ = false;
+    };
+}
+#endif
@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include "n64_impl.hxx"
 #include "utils.hxx"
@@ -10,8 +15,21 @@ namespace TKPEmu::N64 {
         Reset();
     }
 
+    N64::~N64() {
+        #if N64TKP_HAS_PROFILER
+        std::ofstream report("n64tkp_profile.txt");
+        cpu_.profiler_.WriteReport(report);
+        std::ofstream folded("n64tkp_profile.folded");
+        cpu_.profiler_.WriteFoldedStacks(folded);
+        #endif
+    }
+
     bool N64::LoadCartridge(std::string path) {
-        return cpu_.cpubus_.LoadCartridge(path);
+        bool loaded = cpu_.cpubus_.LoadCartridge(path);
+        if (loaded) {
+            cpu_.load_idle_loop_overrides();
+        }
+        return loaded;
     }
 
     bool N64::LoadIPL(std::string path) {
@@ -21,18 +39,190 @@ namespace TKPEmu::N64 {
         return false;
     }
 
-    void N64::Update() {
-        cpubus_.set_interrupt(Devices::Interrupt::AI, true);
-        bool interrupt_fired = cpubus_.mi_mask_ & cpubus_.mi_interrupt_;
-        if (interrupt_fired) [[unlikely]] {
-            uint32_t flags = cpu_.cp0_regs_[CP0_CAUSE].UW._0;
-            SetBit(flags, 0, true);
+    uint64_t N64::Update(uint64_t max_cycles) {
+        raise_ai();
+        return cpu_.run_batch(max_cycles);
+    }
+
+    RunResult N64::RunCycles(uint64_t cycles) {
+        return run(cycles, false);
+    }
+
+    RunResult N64::RunUntilVBlank(uint64_t max_cycles) {
+        return run(max_cycles, true);
+    }
+
+    void N64::raise_ai() {
+        // AI is held high until audio is emulated, only touch MI when it isn't already
+        constexpr uint32_t ai_bit = 1 << static_cast<int>(Devices::Interrupt::AI);
+        if (!(cpubus_.mi_interrupt_ & ai_bit)) [[unlikely]] {
+            cpubus_.set_interrupt(Devices::Interrupt::AI, true);
+        }
+    }
+
+    void N64::report_fault() {
+        const auto& fault = cpu_.fault_;
+        char message[96];
+        if (fault.type == Devices::FaultType::BadAddress) {
+            std::snprintf(message, sizeof(message), "Tried to access bad address: 0x%08x (pc: 0x%08x)",
+                fault.address, fault.pc);
+        } else {
+            std::snprintf(message, sizeof(message), "Unimplemented opcode 0x%08x (pc: 0x%08x)",
+                fault.instruction, fault.pc);
+        }
+        last_error_ = message;
+    }
+
+    RunResult N64::run(uint64_t max_cycles, bool stop_on_vblank) {
+        RunResult result { StopReason::CyclesDone, 0 };
+        uint64_t start = cpubus_.time_;
+        cpu_.stop_on_vblank_ = stop_on_vblank;
+        cpu_.vblank_ = false;
+        try {
+            while (result.cycles < max_cycles) {
+                // Like Update, so a guest that cleared AI sees it again after one batch and not one frame
+                raise_ai();
+                result.cycles += cpu_.run_batch(max_cycles - result.cycles);
+                if (cpu_.fault_.type != Devices::FaultType::None) [[unlikely]] {
+                    report_fault();
+                    result.reason = StopReason::Fault;
+                    break;
+                }
+                if (stop_on_vblank && cpu_.vblank_) {
+                    result.reason = StopReason::VBlank;
+                    break;
+                }
+            }
+        } catch (const std::exception& ex) {
+            last_error_ = ex.what();
+            result.reason = StopReason::Exception;
+            // The batch that threw didn't get to return its length
+            result.cycles = cpubus_.time_ - start;
         }
-        cpu_.update_pipeline();
+        cpu_.stop_on_vblank_ = false;
+        // Leaves nothing in flight for whoever looks at the state next
+        cpu_.rsp_.Sync();
+        return result;
     }
 
     void N64::Reset() {
         cpu_.Reset();
         rcp_.Reset();
     }
+
+    double N64::GetAverageBatchLength() {
+        if (cpu_.batch_count_ == 0) {
+            return 0.0;
+        }
+        return static_cast<double>(cpu_.batch_cycles_) / cpu_.batch_count_;
+    }
+
+    void N64::AddIdleLoop(uint32_t vaddr) {
+        cpu_.add_idle_loop(vaddr);
+    }
+
+    uint64_t N64::GetIdleSkippedCycles() {
+        return cpu_.idle_skipped_cycles_;
+    }
+
+    uint64_t N64::GetIdleSkipCount() {
+        return cpu_.idle_skips_;
+    }
+
+    uint64_t N64::GetEventCount() {
+        return cpu_.events_handled_;
+    }
+
+    uint64_t N64::GetStateHash() {
+        // FNV-1a over 64 bit words
+        uint64_t hash = 0xcbf2'9ce4'8422'2325;
+        auto mix = [&hash](uint64_t value) {
+            hash ^= value;
+            hash *= 0x100'0000'01b3;
+        };
+        for (const auto& reg : cpu_.gpr_regs_) {
+            mix(reg.UD);
+        }
+        mix(cpu_.hi_);
+        mix(cpu_.lo_);
+        mix(cpu_.pc_);
+        for (const auto& reg : cpu_.cp0_regs_) {
+            mix(reg.UD);
+        }
+        for (double reg : cpu_.fpr_regs_) {
+            mix(std::bit_cast<uint64_t>(reg));
+        }
+        auto rdram = cpubus_.rdram_;
+        size_t words = rdram.size() / sizeof(uint64_t);
+        for (size_t i = 0; i < words; i++) {
+            uint64_t word;
+            std::memcpy(&word, rdram.data() + i * sizeof(uint64_t), sizeof(word));
+            mix(word);
+        }
+        return hash;
+    }
+
+    std::vector<Devices::OpcodePairCount> N64::GetOpcodePairHistogram() {
+        return cpu_.opcode_pair_histogram();
+    }
+
+    bool N64::StartTrace([[maybe_unused]] const std::string& path) {
+        #if N64TKP_HAS_TRACE
+        return cpu_.tracer_.Start(path);
+        #else
+        return false;
+        #endif
+    }
+
+    void N64::StopTrace() {
+        #if N64TKP_HAS_TRACE
+        cpu_.tracer_.Stop();
+        #endif
+    }
+
+    void N64::SetCPUMode(Devices::CPUMode mode) {
+        cpu_.set_mode(mode);
+    }
+
+    void N64::SetRSPMode(Devices::RSPMode mode) {
+        cpu_.rsp_.SetMode(mode);
+    }
+
+    void* N64::GetColorData() {
+        uint8_t* framebuffer = rcp_.framebuffer_ptr_;
+        auto rdram = cpubus_.rdram_;
+        if (rcp_.bitdepth_ != GL_UNSIGNED_SHORT_5_5_5_1_ || framebuffer < rdram.data() || framebuffer >= rdram.data() + rdram.size()) {
+            return framebuffer;
+        }
+        // RDRAM holds host endian words, which swaps the two pixels in each of them
+        size_t size = std::min<size_t>(static_cast<size_t>(rcp_.width_) * rcp_.height_ * 2, rdram.data() + rdram.size() - framebuffer);
+        frame_.resize(size / 4);
+        for (size_t i = 0; i < frame_.size(); i++) {
+            uint32_t word;
+            std::memcpy(&word, framebuffer + i * 4, sizeof(word));
+            frame_[i] = std::rotl(word, 16);
+        }
+        return frame_.data();
+    }
+
+    void N64::SetGraphicsHLE(bool enabled) {
+        cpu_.rsp_.SetGraphicsHLE(enabled);
+    }
+
+    void N64::SetAudioHLE(bool enabled) {
+        cpu_.rsp_.SetAudioHLE(enabled);
+    }
+
+    const Devices::GraphicsTaskOutput& N64::GetGraphicsTaskOutput() {
+        cpu_.rsp_.Sync();
+        return cpu_.rsp_.GetGraphicsTaskOutput();
+    }
+
+    bool N64::SaveRSPProgramCache(const std::string& path) {
+        return Devices::RSPProgramCache::Get().Save(path);
+    }
+
+    bool N64::LoadRSPProgramCache(const std::string& path) {
+        return Devices::RSPProgramCache::Get().Load(path);
+    }
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #ifndef TKP_N64_H
 #define TKP_N64_H
 #include <string>
+#include <vector>
 #include "n64_cpu.hxx"
 #include "n64_rcp.hxx"
 
@@ -9,16 +10,107 @@ class N64Debugger;
 
 namespace TKPEmu::N64 {
     class N64_TKPWrapper;
+    enum class StopReason {
+        CyclesDone,
+        VBlank,
+        // An exception escaped the core, the message is in N64::GetLastError
+        Exception,
+        // The game hit a bad address or an unimplemented opcode, see N64::GetFault
+        Fault,
+    };
+    struct RunResult {
+        StopReason reason;
+        uint64_t cycles;
+    };
     class N64 {
     public:
+        // One 60Hz frame of CPU cycles
+        static constexpr uint64_t CYCLES_PER_FRAME = 93'750'000 / 60;
         N64();
+        // Writes n64tkp_profile.txt and n64tkp_profile.folded when built with N64TKP_PROFILER
+        ~N64();
         bool LoadCartridge(std::string path);
         bool LoadIPL(std::string path);
-        void Update();
-        void Reset();
-        void* GetColorData() {
-            return rcp_.framebuffer_ptr_;
+        /**
+         * Runs until the next scheduled event or until max_cycles have passed,
+         * whichever comes first. Returns the number of cycles executed, which
+         * is 0 once the CPU has faulted
+         */
+        uint64_t Update(uint64_t max_cycles = 1);
+        /**
+         * Runs for at least the given number of cycles, the last instruction can
+         * overshoot it. Faults end the run at the end of the batch they happen in.
+         * Exceptions are caught once for the whole run and reported in the result
+         * instead of being thrown
+         */
+        RunResult RunCycles(uint64_t cycles);
+        /**
+         * Same as RunCycles, but stops right after the next VI interrupt is
+         * raised. Stops after max_cycles if the game hasn't set up VI interrupts
+         */
+        RunResult RunUntilVBlank(uint64_t max_cycles = 2 * CYCLES_PER_FRAME);
+        // Why the last run that stopped with StopReason::Exception or StopReason::Fault stopped
+        const std::string& GetLastError() const {
+            return last_error_;
         }
+        // Cleared by Reset, type is FaultType::None unless the CPU has faulted
+        const Devices::Fault& GetFault() const {
+            return cpu_.fault_;
+        }
+        void Reset();
+        // Switching to or from CPUMode::Recompiler or CPUMode::Functional needs a Reset to take effect correctly
+        void SetCPUMode(Devices::CPUMode mode);
+        // Takes effect right away, Devices::RSPMode::Synchronous is the default
+        void SetRSPMode(Devices::RSPMode mode);
+        /**
+         * Decoded RSP microcode is shared by every N64 in the process. Saving
+         * it lets the next process start with the microcode decoded already.
+         * Both return false if the file can't be written or read
+         */
+        static bool SaveRSPProgramCache(const std::string& path);
+        static bool LoadRSPProgramCache(const std::string& path);
+        // Runs F3D, F3DEX and F3DEX2 graphics tasks on the host instead of on the RSP, off by default
+        void SetGraphicsHLE(bool enabled);
+        // Runs tasks for the standard audio microcode on the host instead of on the RSP, off by default
+        void SetAudioHLE(bool enabled);
+        // Triangles and RDP commands of the last graphics task run with HLE
+        const Devices::GraphicsTaskOutput& GetGraphicsTaskOutput();
+        // Average number of cycles run between two scheduler checks since the last Reset
+        double GetAverageBatchLength();
+        /**
+         * Treats the loop starting at vaddr as idle even if the detector disagrees.
+         * Takes effect for blocks decoded after the next Reset. Idle loops are
+         * only detected in CPUMode::CachedInterpreter and CPUMode::Recompiler
+         */
+        void AddIdleLoop(uint32_t vaddr);
+        // Cycles skipped by fast forwarding idle loops since the last Reset
+        uint64_t GetIdleSkippedCycles();
+        uint64_t GetIdleSkipCount();
+        // Scheduler events handled since the last Reset
+        uint64_t GetEventCount();
+        /**
+         * Hash of the architectural state: GPRs, HI/LO, PC, CP0 and FPU registers
+         * and all of RDRAM. Two runs of the same ROM for the same number of
+         * cycles in the same CPUMode should end with the same hash
+         */
+        uint64_t GetStateHash();
+        /**
+         * Adjacent instruction pairs in the decoded code, most frequent first.
+         * Counts come from how often each block was entered since it was decoded,
+         * so they're only collected in CPUMode::CachedInterpreter and
+         * CPUMode::Functional, and are lost when a block gets invalidated
+         */
+        std::vector<Devices::OpcodePairCount> GetOpcodePairHistogram();
+        /**
+         * Starts recording every retired instruction to a binary trace at path,
+         * read it with n64tkp_tracediff. Returns false if the file can't be
+         * created or if tracing wasn't compiled in with N64TKP_TRACE. Blocks run
+         * by the recompiler aren't traced, apart from the opcodes it falls back on
+         */
+        bool StartTrace(const std::string& path);
+        void StopTrace();
+        // 16bpp frames are copied with the pixels of each word put back in order
+        void* GetColorData();
         int GetWidth() {
             return rcp_.width_;
         }
@@ -29,10 +121,18 @@ namespace TKPEmu::N64 {
             return rcp_.bitdepth_;
         }
     private:
+        RunResult run(uint64_t max_cycles, bool stop_on_vblank);
+        void raise_ai();
+        void report_fault();
+
         Devices::RCP rcp_;
         Devices::CPUBus cpubus_;
         Devices::CPU cpu_;
+        std::string last_error_;
+        std::vector<uint32_t> frame_;
         friend class N64_TKPWrapper;
+        friend class MicroBench;
+        friend class QA;
         friend class ::N64Debugger;
     };
 }
@@ -0,0 +1,205 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include "n64_log.hxx"
+
+namespace TKPEmu::N64 {
+    namespace {
+        constexpr const char* CATEGORY_NAMES[] = { "cpu", "cp0", "vi", "pi", "si", "sched", "rsp" };
+        static_assert(std::size(CATEGORY_NAMES) == static_cast<size_t>(LogCategory::Count));
+
+        struct LogRecord {
+            const char* format;
+            std::array<uint64_t, Logger::MAX_ARGS> args;
+            uint8_t count;
+            LogCategory category;
+        };
+
+        /**
+            Bounded multi producer, single consumer ring. Producers claim a slot
+            with a CAS on head_, then publish it by setting its sequence to
+            position + 1. The writer frees it again with position + RING_SIZE,
+            so a slot whose sequence lags behind head_ means the ring is full
+        */
+        class LogState {
+        public:
+            LogState() {
+                for (size_t i = 0; i < ring_.size(); i++) {
+                    ring_[i].sequence.store(i, std::memory_order_relaxed);
+                }
+            }
+            ~LogState() {
+                if (writer_.joinable()) {
+                    stopping_.store(true, std::memory_order_release);
+                    writer_.join();
+                }
+            }
+            void StartWriter() {
+                if (!writer_.joinable()) {
+                    writer_ = std::thread(&LogState::writer_loop, this);
+                }
+            }
+            void Push(const LogRecord& record) {
+                size_t head = head_.load(std::memory_order_relaxed);
+                Slot* slot;
+                while (true) {
+                    slot = &ring_[head % Logger::RING_SIZE];
+                    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+                    auto lag = static_cast<std::ptrdiff_t>(sequence - head);
+                    if (lag == 0) {
+                        // On failure head is reloaded, try the next free slot
+                        if (head_.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+                            break;
+                        }
+                    } else if (lag < 0) {
+                        dropped_.fetch_add(1, std::memory_order_relaxed);
+                        return;
+                    } else {
+                        // Another producer took this slot first
+                        head = head_.load(std::memory_order_relaxed);
+                    }
+                }
+                slot->record = record;
+                slot->sequence.store(head + 1, std::memory_order_release);
+            }
+        private:
+            void writer_loop() {
+                std::string line;
+                while (true) {
+                    // Read before draining so nothing pushed before the stop is lost
+                    bool stopping = stopping_.load(std::memory_order_acquire);
+                    while (true) {
+                        Slot& slot = ring_[tail_ % Logger::RING_SIZE];
+                        if (slot.sequence.load(std::memory_order_acquire) != tail_ + 1) {
+                            break;
+                        }
+                        format(slot.record, line);
+                        std::fwrite(line.data(), 1, line.size(), stdout);
+                        slot.sequence.store(tail_ + Logger::RING_SIZE, std::memory_order_release);
+                        ++tail_;
+                    }
+                    uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+                    if (dropped != 0) {
+                        std::fprintf(stdout, "[log] %llu messages dropped\n", static_cast<unsigned long long>(dropped));
+                    }
+                    std::fflush(stdout);
+                    if (stopping) {
+                        return;
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+
+            static void format(const LogRecord& record, std::string& line) {
+                char buffer[72];
+                line.assign(1, '[');
+                line += CATEGORY_NAMES[static_cast<size_t>(record.category)];
+                line += "] ";
+                size_t arg = 0;
+                for (const char* c = record.format; *c; ++c) {
+                    if (*c != '%' || c[1] == '\0') {
+                        line += *c;
+                        continue;
+                    }
+                    ++c;
+                    if (*c == '%') {
+                        line += '%';
+                        continue;
+                    }
+                    if (arg == record.count) {
+                        line += "<missing>";
+                        continue;
+                    }
+                    uint64_t value = record.args[arg++];
+                    switch (*c) {
+                        case 'd': {
+                            std::snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(value));
+                            line += buffer;
+                            break;
+                        }
+                        case 'u': {
+                            std::snprintf(buffer, sizeof(buffer), "%llu", static_cast<unsigned long long>(value));
+                            line += buffer;
+                            break;
+                        }
+                        case 'x': {
+                            std::snprintf(buffer, sizeof(buffer), "%llx", static_cast<unsigned long long>(value));
+                            line += buffer;
+                            break;
+                        }
+                        case 'b': {
+                            for (int i = 7; i >= 0; i--) {
+                                line += (value >> i) & 1 ? '1' : '0';
+                            }
+                            break;
+                        }
+                        case 's': {
+                            line += reinterpret_cast<const char*>(static_cast<uintptr_t>(value));
+                            break;
+                        }
+                        default: {
+                            line += '%';
+                            line += *c;
+                            break;
+                        }
+                    }
+                }
+                line += '\n';
+            }
+
+            struct Slot {
+                std::atomic<size_t> sequence;
+                LogRecord record;
+            };
+
+            std::array<Slot, Logger::RING_SIZE> ring_;
+            std::atomic<size_t> head_ { 0 };
+            // Only the writer thread touches it
+            size_t tail_ = 0;
+            std::atomic<uint64_t> dropped_ { 0 };
+            std::atomic<bool> stopping_ { false };
+            std::thread writer_;
+        };
+
+        LogState& state() {
+            static LogState state;
+            return state;
+        }
+    }
+
+    bool Logger::SetCategories(std::string_view list) {
+        uint32_t mask = 0;
+        bool valid = true;
+        while (!list.empty()) {
+            size_t comma = list.find(',');
+            std::string_view name = list.substr(0, comma);
+            list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+            if (name.empty()) {
+                continue;
+            }
+            if (name == "all") {
+                mask = (1u << static_cast<uint32_t>(LogCategory::Count)) - 1;
+                continue;
+            }
+            bool found = false;
+            for (size_t i = 0; i < std::size(CATEGORY_NAMES); i++) {
+                if (name == CATEGORY_NAMES[i]) {
+                    mask |= 1u << i;
+                    found = true;
+                }
+            }
+            valid &= found;
+        }
+        if (mask != 0) {
+            state().StartWriter();
+        }
+        enabled_.store(mask, std::memory_order_relaxed);
+        return valid;
+    }
+
+    void Logger::push(LogCategory category, const char* format, std::array<uint64_t, MAX_ARGS> args, size_t count) {
+        state().Push({ format, args, static_cast<uint8_t>(count), category });
+    }
+}
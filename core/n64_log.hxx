@@ -0,0 +1,74 @@
+#pragma once
+#ifndef TKP_N64_LOG_H
+#define TKP_N64_LOG_H
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <string_view>
+#include <type_traits>
+
+namespace TKPEmu::N64 {
+    enum class LogCategory : uint8_t {
+        CPU,   // unimplemented opcodes
+        CP0,   // CP0 accesses, exceptions and interrupts
+        VI,
+        PI,
+        SI,    // SI and PIF RAM
+        Sched, // scheduler events and frame timing
+        RSP,   // unimplemented RSP opcodes
+        Count,
+    };
+    /**
+        Category filtered logger for the emulation threads.
+
+        N64_LOG only checks an atomic mask unless its category is enabled, and
+        then copies the format string pointer and up to MAX_ARGS integers into
+        a ring buffer without locking or formatting anything. A background
+        thread formats the messages and writes them to stdout. Messages are
+        dropped, and counted, if the ring is full.
+
+        Any number of threads may log, the CPU and the RSP thread of every N64
+        in the process share the ring.
+        Formats must be string literals and understand %d, %u, %x, %b (8 bit
+        binary), %s (string literals only) and %%
+    */
+    class Logger {
+    public:
+        static constexpr size_t MAX_ARGS = 4;
+        static constexpr size_t RING_SIZE = 0x1000;
+        static bool Enabled(LogCategory category) {
+            return enabled_.load(std::memory_order_relaxed) & (1u << static_cast<uint32_t>(category));
+        }
+        /**
+         * Enables the comma separated categories in list ("cpu,vi", "all" or ""
+         * for none) and disables the rest. Returns false on unknown names
+         */
+        static bool SetCategories(std::string_view list);
+        template<size_t N, class... Args>
+        static void Log(LogCategory category, const char (&format)[N], Args... args) {
+            static_assert(sizeof...(Args) <= MAX_ARGS, "Too many arguments for a log message");
+            push(category, format, { to_arg(args)... }, sizeof...(Args));
+        }
+    private:
+        template<class T>
+        static uint64_t to_arg(T arg) {
+            if constexpr (std::is_pointer_v<T>) {
+                return reinterpret_cast<uintptr_t>(arg);
+            } else if constexpr (std::is_enum_v<T>) {
+                return static_cast<uint64_t>(static_cast<std::underlying_type_t<T>>(arg));
+            } else {
+                static_assert(std::is_integral_v<T>, "Only integers and string literals can be logged");
+                return static_cast<uint64_t>(arg);
+            }
+        }
+        static void push(LogCategory category, const char* format, std::array<uint64_t, MAX_ARGS> args, size_t count);
+
+        static inline std::atomic<uint32_t> enabled_ { 0 };
+    };
+}
+
+#define N64_LOG(category, ...) do { \
+        if (::TKPEmu::N64::Logger::Enabled(::TKPEmu::N64::LogCategory::category)) [[unlikely]] \
+            ::TKPEmu::N64::Logger::Log(::TKPEmu::N64::LogCategory::category, __VA_ARGS__); \
+    } while (0)
+#endif
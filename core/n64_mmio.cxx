@@ -0,0 +1,251 @@
+#include "n64_cpu.hxx"
+#include <cstring>
+#include <iostream>
+#include "n64_addresses.hxx"
+#include "utils.hxx"
+
+namespace TKPEmu::N64::Devices {
+    #define storage(member) [](CPUBus& bus) { return reinterpret_cast<uint8_t*>(&bus.member); }
+    #define reg(A,B) MMIORegister { A, storage(B), nullptr }
+    #define reg_w(A,B,W) MMIORegister { A, storage(B), W }
+    // For registers where storing 0 has side effects too
+    #define reg_wz(A,B,W) MMIORegister { A, storage(B), W, true }
+
+    constinit const MMIOTable<MMIORegister> CPU::mmio_table_ = make_mmio_table<MMIORegister>({
+        // RSP internal registers
+        reg_w(RSP_DMA_SPADDR, rcp_.rsp_mem_addr_, [](CPU&, uint64_t& data) {
+            data &= 0x1FF8;
+        }),
+        reg_w(RSP_DMA_RAMADDR, rcp_.rsp_dram_addr_, [](CPU&, uint64_t& data) {
+            data &= 0xFF'FFF8;
+        }),
+        reg_wz(RSP_DMA_RDLEN, rcp_.rsp_rd_len_, [](CPU& cpu, uint64_t& data) {
+            cpu.rsp_.StartDMA(data, false);
+            data = cpu.rcp_.rsp_rd_len_;
+        }),
+        reg_wz(RSP_DMA_WRLEN, rcp_.rsp_wr_len_, [](CPU& cpu, uint64_t& data) {
+            cpu.rsp_.StartDMA(data, true);
+            data = cpu.rcp_.rsp_wr_len_;
+        }),
+        reg_w(RSP_STATUS, rcp_.rsp_status_, [](CPU& cpu, uint64_t& data) {
+            if (cpu.rsp_.WriteStatus(data)) {
+                cpu.queue_event(SchedulerEventType::Rsp, 0);
+            }
+            data = cpu.rcp_.rsp_status_;
+        }),
+        reg(RSP_DMA_FULL, rcp_.rsp_dma_full_),
+        reg(RSP_DMA_BUSY, rcp_.rsp_dma_busy_),
+        MMIORegister { RSP_SEMAPHORE, [](CPUBus& bus) {
+            auto& rcp = bus.rcp_;
+            if (rcp.rsp_semaphore_stored_) {
+                rcp.rsp_semaphore_stored_ = false;
+                return reinterpret_cast<uint8_t*>(&rcp.rsp_semaphore_);
+            }
+            // Loads acquire the semaphore and return what it was before
+            rcp.rsp_semaphore_read_ = rcp.rsp_semaphore_;
+            rcp.rsp_semaphore_ = 1;
+            return reinterpret_cast<uint8_t*>(&rcp.rsp_semaphore_read_);
+        }, [](CPU& cpu, uint64_t& data) {
+            // Any store releases it
+            cpu.rcp_.rsp_semaphore_stored_ = true;
+            data = 0;
+        }, true },
+        reg_wz(RSP_PC, rcp_.rsp_pc_, [](CPU& cpu, uint64_t& data) {
+            data &= 0xFFC;
+            cpu.rsp_.SetPC(data);
+        }),
+
+        // RDP command registers
+        reg_wz(DPC_START, rcp_.dpc_start_, [](CPU& cpu, uint64_t& data) {
+            cpu.rsp_.WriteDPCStart(data);
+            data = cpu.rcp_.dpc_start_;
+        }),
+        reg_wz(DPC_END, rcp_.dpc_end_, [](CPU& cpu, uint64_t& data) {
+            cpu.rsp_.WriteDPCEnd(data);
+            data = cpu.rcp_.dpc_end_;
+        }),
+        reg_wz(DPC_CURRENT, rcp_.dpc_current_, [](CPU& cpu, uint64_t& data) {
+            // Read only
+            data = cpu.rcp_.dpc_current_;
+        }),
+        reg_w(DPC_STATUS, rcp_.dpc_status_, [](CPU& cpu, uint64_t& data) {
+            cpu.rsp_.WriteDPCStatus(data);
+            data = cpu.rcp_.dpc_status_;
+        }),
+        reg(DPC_CLOCK, rcp_.dpc_clock_),
+        reg(DPC_BUFBUSY, rcp_.dpc_bufbusy_),
+        reg(DPC_PIPEBUSY, rcp_.dpc_pipebusy_),
+        reg(DPC_TMEM, rcp_.dpc_tmem_),
+
+        // MIPS Interface
+        reg(MI_MODE, mi_mode_),
+        reg(MI_INTERRUPT, mi_interrupt_),
+        reg_w(MI_MASK, placeholder_, [](CPU& cpu, uint64_t& data) {
+            auto& mi_mask = cpu.cpubus_.mi_mask_;
+            // Even bits clear a mask bit, odd bits set it
+            for (int i = 0; i < 6; i++) {
+                if (data & (0b10 << (i * 2))) {
+                    mi_mask |= 1 << i;
+                }
+            }
+            for (int i = 0; i < 6; i++) {
+                if (data & (0b1 << (i * 2))) {
+                    mi_mask &= ~(1 << i);
+                }
+            }
+            data = mi_mask;
+        }),
+
+        // Video Interface
+        reg_w(VI_CTRL, rcp_.vi_ctrl_, [](CPU& cpu, uint64_t& data) {
+            auto format = data & 0b11;
+            if (format == 0b10) {
+                N64_LOG(VI, "Format set to RGBA5551");
+                cpu.rcp_.bitdepth_ = GL_UNSIGNED_SHORT_5_5_5_1_;
+            } else if (format == 0b11)
+                cpu.rcp_.bitdepth_ = GL_UNSIGNED_INT_8_8_8_8_;
+        }),
+        reg_w(VI_ORIGIN, rcp_.vi_origin_, [](CPU& cpu, uint64_t& data) {
+            uint8_t* framebuffer = cpu.cpubus_.redirect_paddress(data & 0xFFFFFF);
+            if (cpu.fault_.type == FaultType::None) {
+                cpu.rcp_.framebuffer_ptr_ = framebuffer;
+            }
+        }),
+        reg_w(VI_WIDTH, rcp_.vi_width_, [](CPU& cpu, uint64_t& data) {
+            N64_LOG(VI, "VI_WIDTH: %u", data);
+            cpu.rcp_.width_ = data;
+            cpu.rcp_.height_ = (480.0f / 640.0f) * data;
+            cpu.should_resize_ = true;
+        }),
+        reg_w(VI_V_INTR, rcp_.vi_v_intr_, [](CPU& cpu, uint64_t& data) {
+            cpu.rcp_.vi_v_intr_ = data;
+            data &= 0x3ff;
+            N64_LOG(VI, "VI_V_INTR: %u", data);
+            if (data == 0x3ff || data == 0)
+                return;
+            uint64_t mod = cpu.cpubus_.time_ % (93'750'000 / 60);
+            uint64_t time_per = (93'750'000 / 60) / cpu.rcp_.num_halflines_;
+            uint64_t cur_line = mod / time_per;
+            int lines_left = (data > cur_line) ? (data - cur_line) : (cpu.rcp_.num_halflines_ - cur_line + data);
+            N64_LOG(VI, "Current line: %u lines left: %d", cur_line, lines_left);
+            cpu.queue_event(SchedulerEventType::Vi, time_per * lines_left);
+        }),
+        MMIORegister { VI_V_CURRENT, [](CPUBus& bus) {
+            // calculate current based on time
+            // max time per frame:
+            // 93'750'000 / 60
+            // time per halfline:
+            // 93'750'000 / 60 / num_halflines
+            uint64_t mod = bus.time_ % (93'750'000 / 60);
+            uint64_t time_per = 93'750'000 / 60 / bus.rcp_.num_halflines_;
+            bus.rcp_.vi_v_current_ = mod / time_per;
+            return reinterpret_cast<uint8_t*>(&bus.rcp_.vi_v_current_);
+        }, [](CPU& cpu, uint64_t&) {
+            cpu.cpubus_.set_interrupt(Interrupt::VI, false);
+        }},
+        reg(VI_BURST, rcp_.vi_burst_),
+        reg_w(VI_V_SYNC, rcp_.vi_v_sync_, [](CPU& cpu, uint64_t& data) {
+            cpu.rcp_.num_halflines_ = data >> 1;
+        }),
+        reg(VI_H_SYNC, rcp_.vi_h_sync_),
+        reg(VI_H_SYNC_LEAP, rcp_.vi_h_sync_leap_),
+        reg(VI_H_VIDEO, rcp_.vi_h_video_),
+        reg(VI_V_VIDEO, rcp_.vi_v_video_),
+        reg(VI_V_BURST, rcp_.vi_v_burst_),
+        reg(VI_X_SCALE, rcp_.vi_x_scale_),
+        reg(VI_Y_SCALE, rcp_.vi_y_scale_),
+        reg(VI_TEST_ADDR, rcp_.vi_test_addr_),
+        reg(VI_STAGED_DATA, rcp_.vi_staged_data_),
+
+        // Audio Interface
+        reg(AI_DRAM_ADDR, ai_dram_addr_),
+        reg(AI_LEN, ai_length_),
+        reg(AI_CONTROL, ai_control_),
+        reg(AI_STATUS, ai_status_),
+        reg(AI_DACRATE, ai_dacrate_),
+        reg(AI_BITRATE, ai_bitrate_),
+
+        // Peripheral Interface
+        reg(PI_DRAM_ADDR, pi_dram_addr_),
+        reg(PI_CART_ADDR, pi_cart_addr_),
+        reg_w(PI_RD_LEN, pi_rd_len_, [](CPU&, uint64_t& data) {
+            N64_LOG(PI, "PI_RD_LEN: %x", data);
+        }),
+        reg_w(PI_WR_LEN, pi_wr_len_, [](CPU& cpu, uint64_t& data) {
+            N64_LOG(PI, "DMA of %x bytes from cart %x to RDRAM %x", data + 1, cpu.cpubus_.pi_cart_addr_, cpu.cpubus_.pi_dram_addr_);
+            auto& bus = cpu.cpubus_;
+            uint32_t cart = bus.pi_cart_addr_;
+            uint8_t* src = bus.redirect_paddress(cart & ~3);
+            if (cpu.fault_.type != FaultType::None) {
+                // Not a real DMA source, src is only a few bytes of scratch space
+                return;
+            }
+            bus.copy_guest_bytes(bus.rdram_.data(), bus.pi_dram_addr_, src, cart & 3, data + 1);
+            cpu.invalidate_code(bus.pi_dram_addr_, data + 1);
+        }),
+        reg_w(PI_STATUS, pi_status_, [](CPU& cpu, uint64_t& data) {
+            cpu.cpubus_.pi_status_ = 0;
+            data = 0;
+        }),
+        reg(PI_BSD_DOM1_LAT, pi_bsd_dom1_lat_),
+        reg(PI_BSD_DOM1_PWD, pi_bsd_dom1_pwd_),
+        reg(PI_BSD_DOM1_PGS, pi_bsd_dom1_pgs_),
+        reg(PI_BSD_DOM1_RLS, pi_bsd_dom1_rls_),
+        reg(PI_BSD_DOM2_LAT, pi_bsd_dom2_lat_),
+        reg(PI_BSD_DOM2_PWD, pi_bsd_dom2_pwd_),
+        reg(PI_BSD_DOM2_PGS, pi_bsd_dom2_pgs_),
+        reg(PI_BSD_DOM2_RLS, pi_bsd_dom2_rls_),
+
+        // RDRAM Interface
+        reg(RI_MODE, ri_mode_),
+        reg(RI_CONFIG, ri_config_),
+        reg(RI_CURRENT_LOAD, ri_current_load_),
+        reg(RI_SELECT, ri_select_),
+
+        // Serial Interface
+        reg(SI_DRAM_ADDR, si_dram_addr_),
+        reg(SI_PIF_AD_WR64B, si_pif_ad_wr64b_),
+        reg(SI_STATUS, si_status_),
+
+        // PIF RAM, the rest of it is plain memory
+        MMIORegister { PIF_COMMAND, [](CPUBus& bus) {
+            N64_LOG(SI, "Read from PIF RAM: %x", PIF_COMMAND - 0x1FC0'07C0u);
+            bus.pif_ram_[swizzle_address(0x26, 1)] = 0x3F;
+            bus.pif_ram_[swizzle_address(0x27, 1)] = 0x3F;
+            return &bus.pif_ram_[PIF_COMMAND - 0x1FC0'07C0u];
+        }, [](CPU& cpu, uint64_t& data) {
+            N64_LOG(SI, "PIF_COMMAND: %b", data);
+            auto& pif_ram = cpu.cpubus_.pif_ram_;
+            if (data & 0x20) {
+                data = 0x80;
+                for (uint32_t i = 0x32; i < 0x38; i++) {
+                    pif_ram[swizzle_address(i, 1)] = 0;
+                }
+            }
+            if (data & 0x40) {
+                pif_ram.fill(0);
+                data = 0;
+            }
+        }},
+    });
+
+    #undef reg_wz
+    #undef reg_w
+    #undef reg
+    #undef storage
+
+    void CPU::invalidate_hwio(uint32_t addr, uint64_t& data) {
+        // The handlers of the SP and DPC registers run before redirect_paddress syncs
+        if (addr - 0x0400'0000u < 0x20'0000u) {
+            rsp_.Sync();
+            if (addr - 0x0400'1000u < 0x1000u) {
+                rsp_.InvalidateIMEM();
+            }
+        }
+        const MMIORegister* reg = find_mmio(mmio_table_, addr);
+        // Storing 0 has no side effects on most registers
+        if (reg && reg->write && (data != 0 || reg->write_zero)) {
+            reg->write(*this, data);
+        }
+    }
+}
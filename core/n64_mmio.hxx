@@ -0,0 +1,62 @@
+#pragma once
+#ifndef TKP_N64_MMIO_H
+#define TKP_N64_MMIO_H
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <initializer_list>
+
+namespace TKPEmu::N64::Devices {
+    class CPU;
+    class CPUBus;
+
+    /**
+        A memory mapped register.
+
+        read returns the storage that loads and stores of the register go to,
+        write runs the side effects of a store before it lands there and may
+        change the value that is stored. Either can be null.
+    */
+    struct MMIORegister {
+        uint32_t paddr = 0;
+        uint8_t* (*read)(CPUBus& bus) = nullptr;
+        void (*write)(CPU& cpu, uint64_t& data) = nullptr;
+        // Stores of 0 skip write unless this is set
+        bool write_zero = false;
+    };
+
+    constexpr size_t MMIO_ROWS = 64;
+    constexpr size_t MMIO_COLUMNS = 64;
+    template<class Entry>
+    using MMIOTable = std::array<std::array<Entry, MMIO_COLUMNS>, MMIO_ROWS>;
+
+    // One row per device, (paddr >> 18) keeps the RSP PC at 0x0408'0000 apart from the RSP DMA registers
+    constexpr size_t mmio_row(uint32_t paddr) {
+        return (paddr >> 18) & (MMIO_ROWS - 1);
+    }
+    constexpr size_t mmio_column(uint32_t paddr) {
+        return (paddr & 0xFF) >> 2;
+    }
+
+    // Built at compile time, two registers sharing a slot fail the build
+    template<class Entry>
+    consteval MMIOTable<Entry> make_mmio_table(std::initializer_list<Entry> registers) {
+        MMIOTable<Entry> table {};
+        for (const Entry& reg : registers) {
+            Entry& slot = table[mmio_row(reg.paddr)][mmio_column(reg.paddr)];
+            if (slot.paddr != 0) {
+                throw "Memory mapped registers collide in the MMIO table";
+            }
+            slot = reg;
+        }
+        return table;
+    }
+
+    // Slots are tagged with their address, so only exact matches are registers. Empty slots hold 0, which is RDRAM
+    template<class Entry>
+    constexpr const Entry* find_mmio(const MMIOTable<Entry>& table, uint32_t paddr) {
+        const Entry& entry = table[mmio_row(paddr)][mmio_column(paddr)];
+        return (entry.paddr == paddr && paddr != 0) ? &entry : nullptr;
+    }
+}
+#endif
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <iterator>
+#include "n64_profiler.hxx"
+
+namespace TKPEmu::N64::Devices {
+    Profiler::Profiler() : pc_table_(PC_TABLE_SIZE) {
+        Reset();
+    }
+
+    void Profiler::Reset() {
+        opcode_counts_.fill(0);
+        std::fill(pc_table_.begin(), pc_table_.end(), PCEntry { EMPTY_PC, 0 });
+        pc_table_used_ = 0;
+        pc_overflow_ = 0;
+        instructions_ = 0;
+        call_depth_ = 0;
+        folded_stacks_.clear();
+        event_stats_.fill({});
+        event_gaps_.fill(0);
+        last_event_time_ = 0;
+    }
+
+    std::string Profiler::opcode_name(size_t index) {
+        if (index < 64) {
+            return OperationCodes[index];
+        } else if (index < 128) {
+            return SpecialCodes[index - 64];
+        } else if (index < 160) {
+            return RegImmCodes[index - 128];
+        }
+        return "cop1." + std::to_string(index - 160);
+    }
+
+    void Profiler::sample_stack(uint32_t pc) {
+        std::string stack;
+        char frame[16];
+        size_t depth = std::min(call_depth_, MAX_CALL_DEPTH);
+        for (size_t i = 0; i < depth; i++) {
+            std::snprintf(frame, sizeof(frame), "%08x;", call_stack_[i]);
+            stack += frame;
+        }
+        std::snprintf(frame, sizeof(frame), "%08x", pc);
+        stack += frame;
+        ++folded_stacks_[stack];
+    }
+
+    void Profiler::RecordEvent(SchedulerEventType type, uint64_t time) {
+        uint64_t gap = time - last_event_time_;
+        last_event_time_ = time;
+        auto& stats = event_stats_[static_cast<size_t>(type)];
+        ++stats.count;
+        stats.cycles += gap;
+        ++event_gaps_[std::bit_width(gap)];
+    }
+
+    void Profiler::WriteReport(std::ostream& os) const {
+        constexpr size_t MAX_ROWS = 50;
+        char line[128];
+        uint64_t total = 0;
+        for (uint64_t count : opcode_counts_) {
+            total += count;
+        }
+        os << "Instructions: " << total << "\n\nOpcodes:\n";
+        std::vector<size_t> opcodes;
+        for (size_t i = 0; i < OPCODE_COUNT; i++) {
+            if (opcode_counts_[i] != 0) {
+                opcodes.push_back(i);
+            }
+        }
+        std::sort(opcodes.begin(), opcodes.end(), [this](size_t a, size_t b) {
+            return opcode_counts_[a] > opcode_counts_[b];
+        });
+        for (size_t index : opcodes) {
+            std::snprintf(line, sizeof(line), "  %-10s %14llu %6.2f%%\n", opcode_name(index).c_str(),
+                static_cast<unsigned long long>(opcode_counts_[index]), 100.0 * opcode_counts_[index] / total);
+            os << line;
+        }
+
+        os << "\nHottest PCs:\n";
+        std::vector<PCEntry> pcs;
+        std::copy_if(pc_table_.begin(), pc_table_.end(), std::back_inserter(pcs), [](const PCEntry& entry) {
+            return entry.pc != EMPTY_PC;
+        });
+        std::sort(pcs.begin(), pcs.end(), [](const PCEntry& a, const PCEntry& b) {
+            return a.count > b.count;
+        });
+        for (size_t i = 0; i < pcs.size() && i < MAX_ROWS; i++) {
+            std::snprintf(line, sizeof(line), "  %08x %14llu %6.2f%%\n", pcs[i].pc,
+                static_cast<unsigned long long>(pcs[i].count), 100.0 * pcs[i].count / total);
+            os << line;
+        }
+        if (pc_overflow_ != 0) {
+            os << "  (" << pc_overflow_ << " hits on PCs that didn't fit in the table)\n";
+        }
+
+        const char* event_names[EVENT_TYPES] = { "SP", "SI", "AI", "VI", "PI", "DP", "Count", "Interrupt", "RSP" };
+        os << "\nScheduler events (cycles since the previous event):\n";
+        for (size_t i = 0; i < EVENT_TYPES; i++) {
+            const auto& stats = event_stats_[i];
+            if (stats.count == 0) {
+                continue;
+            }
+            std::snprintf(line, sizeof(line), "  %-10s %10llu events %14.1f cycles on average\n", event_names[i],
+                static_cast<unsigned long long>(stats.count), static_cast<double>(stats.cycles) / stats.count);
+            os << line;
+        }
+        os << "\nGaps between events:\n";
+        for (size_t i = 0; i < event_gaps_.size(); i++) {
+            if (event_gaps_[i] == 0) {
+                continue;
+            }
+            uint64_t low = i == 0 ? 0 : uint64_t(1) << (i - 1);
+            std::snprintf(line, sizeof(line), "  >= %-12llu %10llu\n", static_cast<unsigned long long>(low),
+                static_cast<unsigned long long>(event_gaps_[i]));
+            os << line;
+        }
+    }
+
+    void Profiler::WriteFoldedStacks(std::ostream& os) const {
+        for (const auto& [stack, count] : folded_stacks_) {
+            os << stack << ' ' << count << '\n';
+        }
+    }
+}
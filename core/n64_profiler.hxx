@@ -0,0 +1,131 @@
+#pragma once
+#ifndef TKP_N64_PROFILER_H
+#define TKP_N64_PROFILER_H
+#include <cstdint>
+#include <array>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "n64_types.hxx"
+#include "n64_scheduler.hxx"
+
+// Off by default, every executed instruction goes through RecordInstruction
+#ifdef N64TKP_PROFILER
+#define N64TKP_HAS_PROFILER 1
+#else
+#define N64TKP_HAS_PROFILER 0
+#endif
+
+namespace TKPEmu::N64::Devices {
+    /**
+        Profile of the guest code, as opposed to the emulator itself.
+
+        Counts executed instructions per opcode and per PC, and the cycles
+        that pass between scheduler events. A shadow call stack follows
+        JAL/JALR and JR ra, and is sampled every SAMPLE_PERIOD instructions
+        into folded stacks that flamegraph.pl reads directly.
+
+        Only instructions that go through EX are seen, so blocks run by the
+        recompiler are missing apart from the opcodes it falls back on
+    */
+    class Profiler {
+    public:
+        static constexpr size_t PC_TABLE_SIZE = 0x10000;
+        static constexpr uint64_t SAMPLE_PERIOD = 1024;
+        static constexpr size_t MAX_CALL_DEPTH = 64;
+        // SPECIAL at 64, REGIMM at 128, COP1 at 160, like the threaded dispatch table
+        static constexpr size_t OPCODE_COUNT = 224;
+
+        Profiler();
+        void Reset();
+        /**
+         * Called once per executed instruction, rs is the value of the rs
+         * register, which JALR jumps to
+         */
+        void RecordInstruction(Instruction instr, uint32_t pc, uint64_t rs) {
+            ++opcode_counts_[opcode_index(instr)];
+            record_pc(pc);
+            if (instr.IType.op == 0b000011) [[unlikely]] {
+                // JAL
+                push_call((pc & 0xF000'0000) | (instr.JType.target << 2));
+            } else if (instr.IType.op == 0b000000 && (instr.RType.func & 0b111110) == 0b001000) [[unlikely]] {
+                if (instr.RType.func == 0b001001) {
+                    // JALR
+                    push_call(static_cast<uint32_t>(rs));
+                } else if (instr.RType.rs == 31 && call_depth_ != 0) {
+                    // JR ra
+                    --call_depth_;
+                }
+            }
+            if (++instructions_ % SAMPLE_PERIOD == 0) [[unlikely]] {
+                sample_stack(pc);
+            }
+        }
+        void RecordEvent(SchedulerEventType type, uint64_t time);
+        // Sorted opcode, PC and event tables
+        void WriteReport(std::ostream& os) const;
+        // One "frame;frame;frame count" line per distinct sampled stack
+        void WriteFoldedStacks(std::ostream& os) const;
+    private:
+        static constexpr uint32_t EMPTY_PC = 0xFFFF'FFFF;
+        static constexpr size_t EVENT_TYPES = 9;
+        static size_t opcode_index(Instruction instr) {
+            switch (instr.IType.op) {
+                case 0b000000: return 64 + instr.RType.func;
+                case 0b000001: return 128 + instr.RType.rt;
+                case 0b010001: return 160 + instr.RType.func;
+                default:       return instr.IType.op;
+            }
+        }
+        static std::string opcode_name(size_t index);
+        void record_pc(uint32_t pc) {
+            // Open addressing with linear probing, full once a quarter of the slots are free
+            size_t slot = ((pc >> 2) * 0x9E37'79B1u) & (PC_TABLE_SIZE - 1);
+            while (pc_table_[slot].pc != pc) {
+                if (pc_table_[slot].pc == EMPTY_PC) {
+                    if (pc_table_used_ >= PC_TABLE_SIZE / 4 * 3) [[unlikely]] {
+                        ++pc_overflow_;
+                        return;
+                    }
+                    pc_table_[slot].pc = pc;
+                    ++pc_table_used_;
+                    break;
+                }
+                slot = (slot + 1) & (PC_TABLE_SIZE - 1);
+            }
+            ++pc_table_[slot].count;
+        }
+        void push_call(uint32_t target) {
+            // Deeper calls still pop, so the frames that are kept stay right
+            if (call_depth_ < MAX_CALL_DEPTH) {
+                call_stack_[call_depth_] = target;
+            }
+            ++call_depth_;
+        }
+        void sample_stack(uint32_t pc);
+
+        struct PCEntry {
+            uint32_t pc;
+            uint64_t count;
+        };
+        struct EventStats {
+            uint64_t count;
+            uint64_t cycles;
+        };
+        std::array<uint64_t, OPCODE_COUNT> opcode_counts_ {};
+        std::vector<PCEntry> pc_table_;
+        size_t pc_table_used_ = 0;
+        uint64_t pc_overflow_ = 0;
+        uint64_t instructions_ = 0;
+        std::array<uint32_t, MAX_CALL_DEPTH> call_stack_ {};
+        size_t call_depth_ = 0;
+        std::unordered_map<std::string, uint64_t> folded_stacks_;
+        // Cycles since the previous event, per type of the event that ended the gap
+        std::array<EventStats, EVENT_TYPES> event_stats_ {};
+        // Gaps between consecutive events, bucketed by log2 of their length
+        std::array<uint64_t, 65> event_gaps_ {};
+        uint64_t last_event_time_ = 0;
+    };
+}
+#endif
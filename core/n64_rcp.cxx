@@ -1,12 +1,27 @@
 #include "n64_rcp.hxx"
+#include "n64_rsp.hxx"
 
 namespace TKPEmu::N64::Devices {
     void RCP::Reset() {
-        // These default values are in little endian
-        rsp_status_ = 0x01000000;
+        // Halted
+        rsp_status_ = 0x00000001;
+        rsp_mem_addr_ = 0;
+        rsp_dram_addr_ = 0;
+        rsp_rd_len_ = 0;
+        rsp_wr_len_ = 0;
+        rsp_dma_full_ = 0;
         rsp_dma_busy_ = 0;
+        rsp_semaphore_ = 0;
+        rsp_semaphore_stored_ = false;
+        rsp_pc_ = 0;
+        dpc_start_ = 0;
+        dpc_end_ = 0;
+        dpc_current_ = 0;
+        // Commands are consumed as soon as they arrive
+        dpc_status_ = DPC_STATUS_CBUF_READY;
+        dpc_clock_ = 0;
         vi_v_intr_ = 0x3FF;
         num_halflines_ = 262;
-        bitdepth_ = GL_UNSIGNED_BYTE_;
+        bitdepth_ = GL_UNSIGNED_INT_8_8_8_8_;
     }
 }
\ No newline at end of file
@@ -9,10 +9,12 @@ namespace TKPEmu::N64 {
     namespace Devices {
         class CPUBus;
         class CPU;
+        class RSPCore;
     }
 }
 
-constexpr auto GL_UNSIGNED_BYTE_ = 0x1401;
+// RDRAM holds host endian words, so 32-bit pixels are read as packed integers
+constexpr auto GL_UNSIGNED_INT_8_8_8_8_ = 0x8035;
 constexpr auto GL_UNSIGNED_SHORT_5_5_5_1_ = 0x8034;
 
 namespace TKPEmu::N64::Devices {
@@ -21,12 +23,31 @@ namespace TKPEmu::N64::Devices {
         void Reset();
     private:
         int width_ = 320, height_ = 240;
-        int bitdepth_ = GL_UNSIGNED_BYTE_;
+        int bitdepth_ = GL_UNSIGNED_INT_8_8_8_8_;
 		uint8_t* framebuffer_ptr_ = nullptr;
         // RSP internal registers
+        uint32_t rsp_mem_addr_ = 0;
+        uint32_t rsp_dram_addr_ = 0;
+        uint32_t rsp_rd_len_ = 0;
+        uint32_t rsp_wr_len_ = 0;
         uint32_t rsp_status_ = 0;
+        uint32_t rsp_dma_full_ = 0;
         uint32_t rsp_dma_busy_ = 0;
+        uint32_t rsp_semaphore_ = 0;
+        // What a CPU load of the semaphore returns, the load itself sets it
+        uint32_t rsp_semaphore_read_ = 0;
+        // Set by a store to the semaphore so the access that follows doesn't count as a load
+        bool rsp_semaphore_stored_ = false;
         uint32_t rsp_pc_ = 0;
+        // RDP command registers
+        uint32_t dpc_start_ = 0;
+        uint32_t dpc_end_ = 0;
+        uint32_t dpc_current_ = 0;
+        uint32_t dpc_status_ = 0;
+        uint32_t dpc_clock_ = 0;
+        uint32_t dpc_bufbusy_ = 0;
+        uint32_t dpc_pipebusy_ = 0;
+        uint32_t dpc_tmem_ = 0;
         // Video Interface
         uint32_t vi_ctrl_ = 0;
         uint32_t vi_origin_ = 0;
@@ -49,6 +70,7 @@ namespace TKPEmu::N64::Devices {
         friend class TKPEmu::N64::N64;
         friend class TKPEmu::N64::Devices::CPUBus;
         friend class TKPEmu::N64::Devices::CPU;
+        friend class TKPEmu::N64::Devices::RSPCore;
     };
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,765 @@
+#include <cstring>
+#include <exception>
+#include <utility>
+#include <limits>
+#include <cstddef>
+#include "n64_recompiler.hxx"
+#include "n64_cpu.hxx"
+#include "error_factory.hxx"
+#if N64TKP_HAS_RECOMPILER
+#include <sys/mman.h>
+#endif
+
+namespace TKPEmu::N64::Devices {
+    // Stack slots, allocated by the prologue
+    constexpr int32_t BRANCH_COND_SLOT = 0;
+    constexpr int32_t BRANCH_TARGET_SLOT = 8;
+    constexpr int32_t STACK_SIZE = 24; // keeps rsp 16 byte aligned for calls
+
+    static int32_t state_offset(const void* base, const void* member) {
+        auto offset = reinterpret_cast<const uint8_t*>(member) - reinterpret_cast<const uint8_t*>(base);
+        if (offset < std::numeric_limits<int32_t>::min() || offset > std::numeric_limits<int32_t>::max()) {
+            throw ErrorFactory::generate_exception("Recompiler state is out of displacement range");
+        }
+        return static_cast<int32_t>(offset);
+    }
+
+    Recompiler::Recompiler(CPU& cpu) : cpu_(cpu) {
+        #if N64TKP_HAS_RECOMPILER
+        void* code = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED) {
+            throw ErrorFactory::generate_exception("Could not allocate recompiler code buffer");
+        }
+        code_ = static_cast<uint8_t*>(code);
+        #else
+        throw ErrorFactory::generate_exception("Recompiler is not supported on this platform");
+        #endif
+        const void* base = cpu_.gpr_regs_.data();
+        pc_offset_ = state_offset(base, &cpu_.pc_);
+        hi_offset_ = state_offset(base, &cpu_.hi_);
+        lo_offset_ = state_offset(base, &cpu_.lo_);
+        skip_delay_slot_offset_ = state_offset(base, &cpu_.skip_delay_slot_);
+        auto page_table = reinterpret_cast<const uint8_t*>(cpu_.cpubus_.page_table_.data()) - reinterpret_cast<const uint8_t*>(base);
+        // The page table lives in CPUBus, which is normally right next to the CPU
+        fastmem_ = page_table >= std::numeric_limits<int32_t>::min() && page_table <= std::numeric_limits<int32_t>::max();
+        page_table_offset_ = fastmem_ ? static_cast<int32_t>(page_table) : 0;
+        if (cpu_.cpubus_.fastmem_.IsEnabled()) {
+            arena_ = cpu_.cpubus_.fastmem_.GetBase();
+            cpu_.cpubus_.fastmem_.SetFaultHandler(&Recompiler::handle_fault, this);
+            fastmem_ = true;
+        }
+    }
+
+    Recompiler::~Recompiler() {
+        if (arena_) {
+            cpu_.cpubus_.fastmem_.SetFaultHandler(nullptr, nullptr);
+        }
+        #if N64TKP_HAS_RECOMPILER
+        if (code_) {
+            munmap(code_, CODE_BUFFER_SIZE);
+        }
+        #endif
+    }
+
+    void Recompiler::Flush() {
+        code_used_ = 0;
+        fault_sites_.clear();
+    }
+
+    void Recompiler::add_fault_site(const uint8_t* access, const uint8_t* slow_path) {
+        if (arena_) {
+            fault_sites_[reinterpret_cast<uintptr_t>(access)] = reinterpret_cast<uintptr_t>(slow_path);
+        }
+    }
+
+    uintptr_t Recompiler::handle_fault(void* context, uintptr_t host_pc) {
+        auto* recompiler = static_cast<Recompiler*>(context);
+        auto it = recompiler->fault_sites_.find(host_pc);
+        if (it == recompiler->fault_sites_.end()) {
+            return 0;
+        }
+        // An access that hit a register once most likely always does, send it
+        // straight to the slow path from now on instead of faulting every time
+        X64Emitter::patch_jmp(reinterpret_cast<uint8_t*>(host_pc) - 5, reinterpret_cast<const uint8_t*>(it->second));
+        return it->second;
+    }
+
+    CompiledBlock Recompiler::Compile(const DecodedBlock& block, uint32_t vaddr) {
+        size_t count = block.instructions.size();
+        if (code_used_ + (count + 1) * MAX_INSTRUCTION_SIZE > CODE_BUFFER_SIZE) {
+            return nullptr;
+        }
+        X64Emitter emitter(code_ + code_used_);
+        emitter_ = &emitter;
+        allocate_registers(block);
+        emit_prologue();
+        bool ended = false;
+        for (size_t i = 0; i < count; i++) {
+            const DecodedInstruction& instr = block.instructions[i];
+            uint32_t pc = vaddr + i * 4;
+            if (instr.is_branch && i + 1 < count) {
+                compile_branch(block, i, pc);
+                ended = true;
+                break;
+            }
+            if (!compile_instruction(instr, pc, i, false)) {
+                compile_fallback(instr, pc, i, false);
+            }
+        }
+        if (!ended) {
+            emit_exit(vaddr + count * 4, count);
+        }
+        emitter_ = nullptr;
+        code_used_ += (emitter.GetSize() + 15) & ~size_t(15);
+        return reinterpret_cast<CompiledBlock>(emitter.GetStart());
+    }
+
+    void Recompiler::allocate_registers(const DecodedBlock& block) {
+        std::array<int, 32> uses {};
+        for (const auto& instr : block.instructions) {
+            uses[instr.rs]++;
+            uses[instr.rt]++;
+            if (instr.instruction.IType.op == 0) {
+                uses[instr.rd]++;
+            }
+        }
+        uses[0] = 0;
+        host_regs_.fill(NOREG);
+        dirty_ = 0;
+        for (X64Reg host : ALLOCATABLE_REGS) {
+            int best = 0;
+            for (int guest = 1; guest < 32; guest++) {
+                if (host_regs_[guest] == NOREG && uses[guest] > uses[best]) {
+                    best = guest;
+                }
+            }
+            // Not worth a load and a store
+            if (uses[best] < 2) {
+                break;
+            }
+            host_regs_[best] = host;
+        }
+    }
+
+    X64Mem Recompiler::gpr_mem(int guest) {
+        return { STATE_REG, NOREG, 0, guest * 8 };
+    }
+
+    void Recompiler::writeback() {
+        for (int guest = 1; guest < 32; guest++) {
+            if (dirty_ & (1u << guest)) {
+                emitter_->store(true, gpr_mem(guest), host_regs_[guest]);
+            }
+        }
+    }
+
+    void Recompiler::flush() {
+        writeback();
+        dirty_ = 0;
+    }
+
+    void Recompiler::reload() {
+        for (int guest = 1; guest < 32; guest++) {
+            if (host_regs_[guest] != NOREG) {
+                emitter_->load(true, host_regs_[guest], gpr_mem(guest));
+            }
+        }
+    }
+
+    X64Reg Recompiler::read(int guest, X64Reg scratch) {
+        if (guest == 0) {
+            emitter_->alu(ALU_XOR, false, scratch, scratch);
+            return scratch;
+        }
+        if (host_regs_[guest] != NOREG) {
+            return host_regs_[guest];
+        }
+        emitter_->load(true, scratch, gpr_mem(guest));
+        return scratch;
+    }
+
+    void Recompiler::read_into(X64Reg dst, int guest) {
+        X64Reg src = read(guest, dst);
+        if (src != dst) {
+            emitter_->mov(true, dst, src);
+        }
+    }
+
+    void Recompiler::write(int guest, X64Reg src) {
+        // r0 is hardwired to 0
+        if (guest == 0) {
+            return;
+        }
+        if (host_regs_[guest] != NOREG) {
+            if (host_regs_[guest] != src) {
+                emitter_->mov(true, host_regs_[guest], src);
+            }
+            dirty_ |= 1u << guest;
+        } else {
+            emitter_->store(true, gpr_mem(guest), src);
+        }
+    }
+
+    void Recompiler::emit_call(const void* func) {
+        emitter_->mov_imm64(RAX, reinterpret_cast<uintptr_t>(func));
+        emitter_->call(RAX);
+    }
+
+    void Recompiler::emit_prologue() {
+        emitter_->push(RBX);
+        emitter_->push(RBP);
+        emitter_->push(R12);
+        emitter_->push(R13);
+        emitter_->push(R14);
+        emitter_->push(R15);
+        emitter_->alu_imm(ALU_SUB, true, RSP, STACK_SIZE);
+        emitter_->mov_imm64(STATE_REG, reinterpret_cast<uintptr_t>(cpu_.gpr_regs_.data()));
+        reload();
+    }
+
+    void Recompiler::emit_epilogue(int executed) {
+        writeback();
+        emitter_->mov_imm32(RAX, executed);
+        emitter_->alu_imm(ALU_ADD, true, RSP, STACK_SIZE);
+        emitter_->pop(R15);
+        emitter_->pop(R14);
+        emitter_->pop(R13);
+        emitter_->pop(R12);
+        emitter_->pop(RBP);
+        emitter_->pop(RBX);
+        emitter_->ret();
+    }
+
+    void Recompiler::emit_exit(uint64_t next_pc, int executed) {
+        emitter_->mov_imm64(RAX, next_pc);
+        emitter_->store(true, { STATE_REG, NOREG, 0, pc_offset_ }, RAX);
+        emit_epilogue(executed);
+    }
+
+    bool Recompiler::compile_instruction(const DecodedInstruction& instr, uint32_t pc, int index, bool delay_slot) {
+        X64Emitter& e = *emitter_;
+        int32_t imm = static_cast<int32_t>(instr.seimm);
+        int32_t uimm = instr.instruction.IType.immediate;
+        switch (instr.instruction.IType.op) {
+            case 0b000000: {
+                return compile_special(instr, pc, index, delay_slot);
+            }
+            // ADDI, ADDIU
+            case 0b001000:
+            case 0b001001: {
+                read_into(RAX, instr.rs);
+                e.alu_imm(ALU_ADD, false, RAX, imm);
+                bool trap = instr.instruction.IType.op == 0b001000;
+                size_t overflow = trap ? e.jcc(CC_O) : 0;
+                e.movsxd(RAX, RAX);
+                write(instr.rt, RAX);
+                if (trap) {
+                    compile_overflow(overflow, instr, pc, index, delay_slot);
+                }
+                return true;
+            }
+            // SLTI, SLTIU
+            case 0b001010:
+            case 0b001011: {
+                X64Reg rs = read(instr.rs, RCX);
+                e.alu_imm(ALU_CMP, true, rs, imm);
+                e.setcc(instr.instruction.IType.op == 0b001010 ? CC_L : CC_B, RAX);
+                e.movzx8(RAX, RAX);
+                write(instr.rt, RAX);
+                return true;
+            }
+            // ANDI, ORI, XORI
+            case 0b001100:
+            case 0b001101:
+            case 0b001110: {
+                constexpr X64AluOp ops[] = { ALU_AND, ALU_OR, ALU_XOR };
+                read_into(RAX, instr.rs);
+                e.alu_imm(ops[instr.instruction.IType.op - 0b001100], true, RAX, uimm);
+                write(instr.rt, RAX);
+                return true;
+            }
+            // LUI
+            case 0b001111: {
+                e.mov_simm32(RAX, static_cast<int32_t>(uimm << 16));
+                write(instr.rt, RAX);
+                return true;
+            }
+            // DADDI, DADDIU
+            case 0b011000:
+            case 0b011001: {
+                read_into(RAX, instr.rs);
+                e.alu_imm(ALU_ADD, true, RAX, imm);
+                bool trap = instr.instruction.IType.op == 0b011000;
+                size_t overflow = trap ? e.jcc(CC_O) : 0;
+                write(instr.rt, RAX);
+                if (trap) {
+                    compile_overflow(overflow, instr, pc, index, delay_slot);
+                }
+                return true;
+            }
+            // LB, LH, LW, LBU, LHU, LWU, LD
+            case 0b100000: case 0b100001: case 0b100011: case 0b100100:
+            case 0b100101: case 0b100111: case 0b110111: {
+                if (!fastmem_) {
+                    return false;
+                }
+                compile_load(instr, pc, index, delay_slot);
+                return true;
+            }
+            // SB, SH, SW, SD
+            case 0b101000: case 0b101001: case 0b101011: case 0b111111: {
+                if (!fastmem_) {
+                    return false;
+                }
+                compile_store(instr, pc, index, delay_slot);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Recompiler::compile_special(const DecodedInstruction& instr, uint32_t pc, int index, bool delay_slot) {
+        X64Emitter& e = *emitter_;
+        uint8_t sa = instr.instruction.RType.sa;
+        switch (instr.instruction.RType.func) {
+            // SLL, SRL
+            case 0b000000:
+            case 0b000010: {
+                read_into(RAX, instr.rt);
+                e.shift(instr.instruction.RType.func == 0 ? SHIFT_SHL : SHIFT_SHR, false, RAX, sa);
+                e.movsxd(RAX, RAX);
+                write(instr.rd, RAX);
+                return true;
+            }
+            // SRA shifts the whole doubleword, then keeps the low word
+            case 0b000011: {
+                read_into(RAX, instr.rt);
+                e.shift(SHIFT_SAR, true, RAX, sa);
+                e.movsxd(RAX, RAX);
+                write(instr.rd, RAX);
+                return true;
+            }
+            // SLLV, SRLV, SRAV
+            case 0b000100:
+            case 0b000110:
+            case 0b000111: {
+                read_into(RCX, instr.rs);
+                read_into(RAX, instr.rt);
+                switch (instr.instruction.RType.func) {
+                    case 0b000100: e.shift_cl(SHIFT_SHL, false, RAX); break;
+                    case 0b000110: e.shift_cl(SHIFT_SHR, false, RAX); break;
+                    case 0b000111: {
+                        e.alu_imm(ALU_AND, false, RCX, 0b11111);
+                        e.shift_cl(SHIFT_SAR, true, RAX);
+                        break;
+                    }
+                }
+                e.movsxd(RAX, RAX);
+                write(instr.rd, RAX);
+                return true;
+            }
+            // MFHI, MFLO
+            case 0b010000:
+            case 0b010010: {
+                int32_t offset = instr.instruction.RType.func == 0b010000 ? hi_offset_ : lo_offset_;
+                e.load(true, RAX, { STATE_REG, NOREG, 0, offset });
+                write(instr.rd, RAX);
+                return true;
+            }
+            // MTHI, MTLO
+            case 0b010001:
+            case 0b010011: {
+                int32_t offset = instr.instruction.RType.func == 0b010001 ? hi_offset_ : lo_offset_;
+                X64Reg rs = read(instr.rs, RAX);
+                e.store(true, { STATE_REG, NOREG, 0, offset }, rs);
+                return true;
+            }
+            // DSLLV
+            case 0b010100: {
+                read_into(RCX, instr.rs);
+                read_into(RAX, instr.rt);
+                e.shift_cl(SHIFT_SHL, true, RAX);
+                write(instr.rd, RAX);
+                return true;
+            }
+            // ADD, ADDU, SUB, SUBU
+            case 0b100000:
+            case 0b100001:
+            case 0b100010:
+            case 0b100011: {
+                bool sub = instr.instruction.RType.func & 0b10;
+                bool trap = !(instr.instruction.RType.func & 0b01);
+                read_into(RAX, instr.rs);
+                X64Reg rt = read(instr.rt, RCX);
+                e.alu(sub ? ALU_SUB : ALU_ADD, false, RAX, rt);
+                size_t overflow = trap ? e.jcc(CC_O) : 0;
+                e.movsxd(RAX, RAX);
+                write(instr.rd, RAX);
+                if (trap) {
+                    compile_overflow(overflow, instr, pc, index, delay_slot);
+                }
+                return true;
+            }
+            // AND, OR, XOR, NOR
+            case 0b100100:
+            case 0b100101:
+            case 0b100110:
+            case 0b100111: {
+                constexpr X64AluOp ops[] = { ALU_AND, ALU_OR, ALU_XOR, ALU_OR };
+                read_into(RAX, instr.rs);
+                X64Reg rt = read(instr.rt, RCX);
+                e.alu(ops[instr.instruction.RType.func & 0b11], true, RAX, rt);
+                if (instr.instruction.RType.func == 0b100111) {
+                    e.not_(true, RAX);
+                }
+                write(instr.rd, RAX);
+                return true;
+            }
+            // SLT, SLTU
+            case 0b101010:
+            case 0b101011: {
+                X64Reg rs = read(instr.rs, RCX);
+                X64Reg rt = read(instr.rt, RDX);
+                e.alu(ALU_CMP, true, rs, rt);
+                e.setcc(instr.instruction.RType.func == 0b101010 ? CC_L : CC_B, RAX);
+                e.movzx8(RAX, RAX);
+                write(instr.rd, RAX);
+                return true;
+            }
+            // DSLL, DSLL32
+            case 0b111000:
+            case 0b111100: {
+                read_into(RAX, instr.rt);
+                e.shift(SHIFT_SHL, true, RAX, sa + (instr.instruction.RType.func == 0b111100 ? 32 : 0));
+                write(instr.rd, RAX);
+                return true;
+            }
+            // DSRA32
+            case 0b111111: {
+                read_into(RAX, instr.rt);
+                e.shift(SHIFT_SAR, true, RAX, sa + 32);
+                write(instr.rd, RAX);
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    void Recompiler::compile_fastmem_lookup(const DecodedInstruction& instr, bool write, std::vector<size_t>& slow) {
+        X64Emitter& e = *emitter_;
+        read_into(RAX, instr.rs);
+        e.alu_imm(ALU_ADD, false, RAX, static_cast<int32_t>(instr.seimm));
+        // Misaligned accesses raise address errors in the interpreter. The low bits
+        // of a load or store opcode give the size, doublewords have bit 4 set
+        uint8_t op = instr.instruction.IType.op;
+        int32_t align = (op & 0b010000) ? 0b111 : (op & 0b11);
+        if (align != 0) {
+            e.test_imm(false, RAX, align);
+            slow.push_back(e.jcc(CC_NE));
+        }
+        e.mov(false, RDX, RAX);
+        e.alu_imm(ALU_SUB, false, RDX, static_cast<int32_t>(KSEG0_START));
+        e.alu_imm(ALU_CMP, false, RDX, 0x4000'0000);
+        size_t direct = e.jcc(CC_B);
+        // TLB mapped, only pages already in the translation cache are handled here
+        e.mov(false, RDX, RAX);
+        e.shift(SHIFT_SHR, false, RDX, 12);
+        e.mov(false, RCX, RDX);
+        e.alu_imm(ALU_AND, false, RCX, CPU::TLB_CACHE_SIZE - 1);
+        e.shift(SHIFT_SHL, false, RCX, 4);
+        static_assert(sizeof(TLBCacheEntry) == 16);
+        e.mov_imm64(RSI, reinterpret_cast<uintptr_t>(cpu_.tlb_cache_.data()));
+        e.lea(RSI, { RSI, RCX, 0, 0 });
+        e.load(false, RCX, { RSI, NOREG, 0, offsetof(TLBCacheEntry, tag) });
+        e.alu(ALU_CMP, false, RCX, RDX);
+        slow.push_back(e.jcc(CC_NE));
+        if (write) {
+            e.cmp_imm8({ RSI, NOREG, 0, offsetof(TLBCacheEntry, writable) }, 0);
+            slow.push_back(e.jcc(CC_E));
+        }
+        e.load(false, RCX, { RSI, NOREG, 0, offsetof(TLBCacheEntry, paddr) });
+        e.alu_imm(ALU_AND, false, RAX, 0xFFF);
+        e.alu(ALU_OR, false, RAX, RCX);
+        size_t translated = e.jmp();
+        // kseg0 and kseg1 translate directly
+        e.bind(direct);
+        e.alu_imm(ALU_AND, false, RAX, 0x1FFF'FFFF);
+        e.bind(translated);
+        if (arena_) {
+            // Memory mapped registers fault and resume at the slow path, see handle_fault
+            e.mov(false, RDX, RAX);
+            e.mov_imm64(RCX, reinterpret_cast<uintptr_t>(arena_));
+            return;
+        }
+        e.mov(false, RDX, RAX);
+        e.shift(SHIFT_SHR, false, RDX, 20);
+        e.load(true, RCX, { STATE_REG, RDX, 3, page_table_offset_ });
+        // Unmapped pages hold memory mapped registers
+        e.test(true, RCX, RCX);
+        slow.push_back(e.jcc(CC_E));
+        e.mov(false, RDX, RAX);
+        e.alu_imm(ALU_AND, false, RDX, 0xF'FFFF);
+    }
+
+    void Recompiler::compile_load(const DecodedInstruction& instr, uint32_t pc, int index, bool delay_slot) {
+        X64Emitter& e = *emitter_;
+        std::vector<size_t> slow;
+        compile_fastmem_lookup(instr, false, slow);
+        X64Mem mem { RCX, RDX, 0, 0 };
+        uint8_t op = instr.instruction.IType.op;
+        // Guest memory is stored as host endian words, see swizzle_address
+        if (op == 0b100000 || op == 0b100100) {
+            e.alu_imm(ALU_XOR, false, RDX, 3);
+        } else if (op == 0b100001 || op == 0b100101) {
+            e.alu_imm(ALU_XOR, false, RDX, 2);
+        }
+        if (arena_) {
+            e.nop5();
+        }
+        uint8_t* access = e.GetPtr();
+        switch (op) {
+            case 0b100000: e.movzx8(RAX, mem); e.movsx8(RAX, RAX); break;                       // LB
+            case 0b100100: e.movzx8(RAX, mem); break;                                           // LBU
+            case 0b100001: e.movzx16(RAX, mem); e.movsx16(RAX, RAX); break;                     // LH
+            case 0b100101: e.movzx16(RAX, mem); break;                                          // LHU
+            case 0b100011: e.load(false, RAX, mem); e.movsxd(RAX, RAX); break;                  // LW
+            case 0b100111: e.load(false, RAX, mem); break;                                      // LWU
+            case 0b110111: e.load(true, RAX, mem); e.shift(SHIFT_ROL, true, RAX, 32); break;    // LD
+        }
+        write(instr.rt, RAX);
+        size_t done = e.jmp();
+        for (size_t fixup : slow) {
+            e.bind(fixup);
+        }
+        add_fault_site(access, e.GetPtr());
+        compile_fallback_call(instr, pc, index, delay_slot);
+        e.bind(done);
+    }
+
+    void Recompiler::compile_store(const DecodedInstruction& instr, uint32_t pc, int index, bool delay_slot) {
+        X64Emitter& e = *emitter_;
+        std::vector<size_t> slow;
+        compile_fastmem_lookup(instr, true, slow);
+        X64Mem mem { RCX, RDX, 0, 0 };
+        read_into(RSI, instr.rt);
+        uint32_t size = 0;
+        // Guest memory is stored as host endian words, see swizzle_address
+        switch (instr.instruction.IType.op) {
+            case 0b101000: e.alu_imm(ALU_XOR, false, RDX, 3); size = 1; break;    // SB
+            case 0b101001: e.alu_imm(ALU_XOR, false, RDX, 2); size = 2; break;    // SH
+            case 0b101011: size = 4; break;                                       // SW
+            case 0b111111: e.shift(SHIFT_ROL, true, RSI, 32); size = 8; break;    // SD
+        }
+        if (arena_) {
+            e.nop5();
+        }
+        uint8_t* access = e.GetPtr();
+        switch (size) {
+            case 1: e.store8(mem, RSI); break;
+            case 2: e.store16(mem, RSI); break;
+            case 4: e.store(false, mem, RSI); break;
+            case 8: e.store(true, mem, RSI); break;
+        }
+        // Self modifying code, drop the blocks of the page
+        e.mov(false, RDX, RAX);
+        e.shift(SHIFT_SHR, false, RDX, 12);
+        e.mov_imm64(RSI, reinterpret_cast<uintptr_t>(cpu_.block_cache_.GetCodePageTable()));
+        e.cmp_imm8({ RSI, RDX, 0, 0 }, 0);
+        size_t no_code = e.jcc(CC_E);
+        writeback();
+        e.mov(false, RSI, RAX);
+        e.mov_imm64(RDI, reinterpret_cast<uintptr_t>(&cpu_));
+        e.mov_imm32(RDX, size);
+        emit_call(reinterpret_cast<const void*>(&Recompiler::invalidate));
+        if (!delay_slot) {
+            // The rest of this block might be stale
+            emit_exit(pc + 4, index + 1);
+        }
+        e.bind(no_code);
+        size_t done = e.jmp();
+        for (size_t fixup : slow) {
+            e.bind(fixup);
+        }
+        add_fault_site(access, e.GetPtr());
+        compile_fallback_call(instr, pc, index, delay_slot);
+        e.bind(done);
+    }
+
+    void Recompiler::compile_overflow(size_t overflow, const DecodedInstruction& instr, uint32_t pc, int index, bool delay_slot) {
+        X64Emitter& e = *emitter_;
+        size_t done = e.jmp();
+        e.bind(overflow);
+        compile_fallback_call(instr, pc, index, delay_slot);
+        e.bind(done);
+    }
+
+    void Recompiler::compile_fallback(const DecodedInstruction& instr, uint32_t pc, int index, bool delay_slot) {
+        flush();
+        compile_fallback_call(instr, pc, index, delay_slot);
+    }
+
+    void Recompiler::compile_fallback_call(const DecodedInstruction& instr, uint32_t pc, int index, bool delay_slot) {
+        X64Emitter& e = *emitter_;
+        writeback();
+        e.mov_imm64(RDI, reinterpret_cast<uintptr_t>(&cpu_));
+        e.mov_imm32(RSI, instr.instruction.Full);
+        e.mov_imm32(RDX, pc);
+        // A delay slot only leaves early on an exception, otherwise its branch still needs to happen
+        emit_call(reinterpret_cast<const void*>(delay_slot ? &Recompiler::interpret_delay_slot : &Recompiler::interpret));
+        reload();
+        e.test(false, RAX, RAX);
+        size_t resume = e.jcc(CC_E);
+        emit_epilogue(index + 1);
+        e.bind(resume);
+    }
+
+    void Recompiler::compile_delay_slot(const DecodedInstruction& instr, uint32_t pc, int index) {
+        // A branch in a delay slot is undefined behavior, let the interpreter do whatever it does
+        if (instr.is_branch || !compile_instruction(instr, pc, index, true)) {
+            compile_fallback(instr, pc, index, true);
+        }
+    }
+
+    void Recompiler::compile_branch(const DecodedBlock& block, size_t index, uint32_t pc) {
+        X64Emitter& e = *emitter_;
+        const DecodedInstruction& instr = block.instructions[index];
+        const DecodedInstruction& delay = block.instructions[index + 1];
+        int executed = index + 2;
+        // By the time a branch executes pc already points past its delay slot
+        uint64_t next_pc = static_cast<uint64_t>(pc) + 8;
+        uint64_t target = static_cast<uint64_t>(pc) + 4 + (instr.seimm << 2);
+        X64Mem cond_slot { RSP, NOREG, 0, BRANCH_COND_SLOT };
+        X64Mem target_slot { RSP, NOREG, 0, BRANCH_TARGET_SLOT };
+        X64Mem pc_mem { STATE_REG, NOREG, 0, pc_offset_ };
+        uint8_t op = instr.instruction.IType.op;
+        uint8_t func = instr.instruction.RType.func;
+        switch (op) {
+            // J, JAL
+            case 0b000010:
+            case 0b000011: {
+                if (op == 0b000011) {
+                    e.mov_imm64(RAX, next_pc);
+                    write(31, RAX);
+                }
+                compile_delay_slot(delay, pc + 4, index + 1);
+                emit_exit((next_pc & 0xF000'0000) | (instr.instruction.JType.target << 2), executed);
+                return;
+            }
+            // BEQ, BNE, BLEZ, BGTZ, BEQL, BNEL, BLEZL
+            case 0b000100: case 0b000101: case 0b000110: case 0b000111:
+            case 0b010100: case 0b010101: case 0b010110: {
+                X64Reg rs = read(instr.rs, RCX);
+                X64Cond cc;
+                switch (op & 0b11) {
+                    case 0b00: e.alu(ALU_CMP, true, rs, read(instr.rt, RDX)); cc = CC_E; break;
+                    case 0b01: e.alu(ALU_CMP, true, rs, read(instr.rt, RDX)); cc = CC_NE; break;
+                    case 0b10: e.alu_imm(ALU_CMP, true, rs, 0); cc = CC_LE; break;
+                    default:   e.alu_imm(ALU_CMP, true, rs, 0); cc = CC_G; break;
+                }
+                e.setcc(cc, RAX);
+                e.store8(cond_slot, RAX);
+                bool likely = op & 0b010000;
+                size_t skip_delay = 0;
+                uint32_t dirty = dirty_;
+                if (likely) {
+                    // Untaken likely branches discard their delay slot
+                    e.cmp_imm8(cond_slot, 0);
+                    skip_delay = e.jcc(CC_E);
+                }
+                compile_delay_slot(delay, pc + 4, index + 1);
+                if (likely) {
+                    dirty_ |= dirty;
+                    e.bind(skip_delay);
+                }
+                e.cmp_imm8(cond_slot, 0);
+                size_t not_taken = e.jcc(CC_E);
+                emit_exit(target, executed);
+                e.bind(not_taken);
+                emit_exit(next_pc, executed);
+                return;
+            }
+            case 0b000000: {
+                // JR, JALR
+                if (func == 0b001000 || func == 0b001001) {
+                    X64Reg rs = read(instr.rs, RAX);
+                    e.store(true, target_slot, rs);
+                    if (func == 0b001001) {
+                        e.mov_imm64(RAX, next_pc);
+                        write(instr.rd == 0 ? 31 : instr.rd, RAX);
+                    }
+                    compile_delay_slot(delay, pc + 4, index + 1);
+                    e.load(true, RAX, target_slot);
+                    e.store(true, pc_mem, RAX);
+                    emit_epilogue(executed);
+                    return;
+                }
+                break;
+            }
+        }
+        // Everything else asks the interpreter where to go
+        flush();
+        e.mov_imm64(RDI, reinterpret_cast<uintptr_t>(&cpu_));
+        e.mov_imm32(RSI, instr.instruction.Full);
+        e.mov_imm32(RDX, pc);
+        e.mov_imm32(RCX, delay.instruction.Full);
+        emit_call(reinterpret_cast<const void*>(&Recompiler::interpret_branch));
+        reload();
+        e.store(true, target_slot, RAX);
+        e.cmp_imm8({ STATE_REG, NOREG, 0, skip_delay_slot_offset_ }, 0);
+        size_t skip_delay = e.jcc(CC_NE);
+        compile_delay_slot(delay, pc + 4, index + 1);
+        e.bind(skip_delay);
+        e.load(true, RAX, target_slot);
+        e.store(true, pc_mem, RAX);
+        emit_epilogue(executed);
+    }
+
+    // Faults leave the block with pc_ on the faulting instruction, the batch ends right after
+    int Recompiler::interpret(CPU* cpu, uint32_t word, uint32_t pc) noexcept {
+        cpu->execute_isolated(word, pc);
+        if (cpu->fault_.type != FaultType::None) [[unlikely]] {
+            cpu->pc_ = pc;
+            return 1;
+        }
+        bool invalidated = std::exchange(cpu->code_invalidated_, false);
+        if (cpu->pc_ != static_cast<uint64_t>(pc) + 8) {
+            return 1;
+        }
+        cpu->pc_ = static_cast<uint64_t>(pc) + 4;
+        return invalidated;
+    }
+
+    int Recompiler::interpret_delay_slot(CPU* cpu, uint32_t word, uint32_t pc) noexcept {
+        cpu->execute_isolated(word, pc, true);
+        if (cpu->fault_.type != FaultType::None) [[unlikely]] {
+            cpu->pc_ = pc;
+            return 1;
+        }
+        cpu->code_invalidated_ = false;
+        // Only an exception moves pc_ here, EPC already points to the branch
+        if (cpu->pc_ != static_cast<uint64_t>(pc) + 8) {
+            return 1;
+        }
+        cpu->pc_ = static_cast<uint64_t>(pc) + 4;
+        return 0;
+    }
+
+    uint64_t Recompiler::interpret_branch(CPU* cpu, uint32_t word, uint32_t pc, uint32_t delay_word) noexcept {
+        // Likely branches discard the delay slot by clearing it in IC/RF
+        cpu->icrf_latch_.instruction.Full = delay_word;
+        cpu->execute_isolated(word, pc);
+        if (cpu->fault_.type != FaultType::None) [[unlikely]] {
+            cpu->skip_delay_slot_ = true;
+            return pc;
+        }
+        cpu->skip_delay_slot_ = delay_word != 0 && cpu->icrf_latch_.instruction.Full == 0;
+        return cpu->pc_;
+    }
+
+    void Recompiler::invalidate(CPU* cpu, uint32_t paddr, uint32_t size) noexcept {
+        cpu->invalidate_code(paddr, size);
+        // The generated code exits on its own
+        cpu->code_invalidated_ = false;
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+#ifndef TKP_N64_RECOMPILER_H
+#define TKP_N64_RECOMPILER_H
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <unordered_map>
+#include "n64_blockcache.hxx"
+#include "n64_x64emitter.hxx"
+
+// Generated code follows the System V calling convention
+#if defined(__x86_64__) && defined(__linux__)
+#define N64TKP_HAS_RECOMPILER 1
+#else
+#define N64TKP_HAS_RECOMPILER 0
+#endif
+
+namespace TKPEmu::N64::Devices {
+    /**
+        Translates decoded blocks to x86-64 code.
+
+        Blocks run atomically: a compiled block executes every instruction up to
+        and including the delay slot of its final branch, stores the address of
+        the next instruction in pc_ and returns how many instructions it ran.
+        Opcodes without a native translation call back into the interpreter
+        handlers, so coverage can grow one instruction at a time.
+    */
+    class Recompiler {
+    public:
+        Recompiler(CPU& cpu);
+        ~Recompiler();
+        Recompiler(const Recompiler&) = delete;
+        Recompiler& operator=(const Recompiler&) = delete;
+        // Returns nullptr when the code buffer is full, Flush() and try again
+        CompiledBlock Compile(const DecodedBlock& block, uint32_t vaddr);
+        // Forgets all generated code, blocks that point into it must be dropped too
+        void Flush();
+    private:
+        static constexpr size_t CODE_BUFFER_SIZE = 32 * 1024 * 1024;
+        // Worst case code size of a single guest instruction, including its slow path
+        static constexpr size_t MAX_INSTRUCTION_SIZE = 512;
+        // Guest registers that get a host register for the whole block
+        static constexpr std::array<X64Reg, 5> ALLOCATABLE_REGS = { RBX, RBP, R12, R13, R14 };
+        // Holds &gpr_regs_[0], every other piece of CPU state is addressed relative to it
+        static constexpr X64Reg STATE_REG = R15;
+
+        void allocate_registers(const DecodedBlock& block);
+        X64Mem gpr_mem(int guest);
+        // Stores every dirty allocated register without changing the compile time state
+        void writeback();
+        void flush();
+        void reload();
+        // Returns the host register that holds a guest register, loading it into scratch if needed
+        X64Reg read(int guest, X64Reg scratch);
+        void read_into(X64Reg dst, int guest);
+        void write(int guest, X64Reg src);
+        void emit_call(const void* func);
+        void emit_prologue();
+        void emit_epilogue(int executed);
+        void emit_exit(uint64_t next_pc, int executed);
+
+        bool compile_instruction(const DecodedInstruction& instr, uint32_t pc, int index, bool delay_slot);
+        bool compile_special(const DecodedInstruction& instr, uint32_t pc, int index, bool delay_slot);
+        void compile_load(const DecodedInstruction& instr, uint32_t pc, int index, bool delay_slot);
+        void compile_store(const DecodedInstruction& instr, uint32_t pc, int index, bool delay_slot);
+        /**
+         * Leaves the physical address in RAX, the host page in RCX and the offset
+         * into it in RDX. Addresses without a direct mapping, or TLB mapped
+         * addresses missing from the translation cache, jump to one of slow.
+         * With a fastmem arena RCX is the arena base and RDX the physical
+         * address, memory mapped registers are left to fault instead.
+         */
+        void compile_fastmem_lookup(const DecodedInstruction& instr, bool write, std::vector<size_t>& slow);
+        /**
+         * Binds overflow, a jump taken when ADD, SUB, ADDI or DADDI overflow, to a
+         * fallback that lets the interpreter raise the exception. Emitted after the
+         * destination is written, the fallback never reaches that write
+         */
+        void compile_overflow(size_t overflow, const DecodedInstruction& instr, uint32_t pc, int index, bool delay_slot);
+        void compile_fallback(const DecodedInstruction& instr, uint32_t pc, int index, bool delay_slot);
+        void compile_fallback_call(const DecodedInstruction& instr, uint32_t pc, int index, bool delay_slot);
+        void compile_delay_slot(const DecodedInstruction& instr, uint32_t pc, int index);
+        void compile_branch(const DecodedBlock& block, size_t index, uint32_t pc);
+        /**
+         * Remembers where a faulting arena access continues, the slow path then
+         * redoes it through the bus. Accesses are preceded by a nop5 that the
+         * first fault turns into a jump to the slow path
+         */
+        void add_fault_site(const uint8_t* access, const uint8_t* slow_path);
+        static uintptr_t handle_fault(void* context, uintptr_t host_pc);
+
+        /**
+         * Runs a single instruction through the interpreter handlers.
+         * Returns non zero when the block needs to exit, pc_ then holds the
+         * address to resume from.
+         */
+        static int interpret(CPU* cpu, uint32_t word, uint32_t pc) noexcept;
+        // Same as interpret for a delay slot, only returns non zero on an exception
+        static int interpret_delay_slot(CPU* cpu, uint32_t word, uint32_t pc) noexcept;
+        /**
+         * Same as interpret but for branches, returns the address that follows
+         * the delay slot and sets skip_delay_slot_ for untaken likely branches.
+         */
+        static uint64_t interpret_branch(CPU* cpu, uint32_t word, uint32_t pc, uint32_t delay_word) noexcept;
+        static void invalidate(CPU* cpu, uint32_t paddr, uint32_t size) noexcept;
+
+        CPU& cpu_;
+        uint8_t* code_ = nullptr;
+        size_t code_used_ = 0;
+        int32_t pc_offset_ = 0;
+        int32_t hi_offset_ = 0;
+        int32_t lo_offset_ = 0;
+        int32_t page_table_offset_ = 0;
+        int32_t skip_delay_slot_offset_ = 0;
+        bool fastmem_ = false;
+        uint8_t* arena_ = nullptr;
+        // Host address of every arena access -> its slow path
+        std::unordered_map<uintptr_t, uintptr_t> fault_sites_;
+
+        // State of the block being compiled
+        X64Emitter* emitter_ = nullptr;
+        std::array<X64Reg, 32> host_regs_ {};
+        uint32_t dirty_ = 0;
+    };
+}
+#endif
@@ -0,0 +1,993 @@
+#include "n64_rsp.hxx"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include "n64_cpu.hxx"
+
+namespace TKPEmu::N64::Devices {
+    namespace {
+        constexpr uint32_t DMEM_MASK = 0xFFF;
+
+        int32_t s16(uint32_t value) {
+            return static_cast<int16_t>(value);
+        }
+    }
+
+    RSPCore::RSPCore(CPU& cpu) : cpu_(cpu) {}
+
+    RSPCore::~RSPCore() {
+        stop_worker();
+    }
+
+    void RSPCore::Reset() {
+        Sync();
+        gpr_.fill(0);
+        vu_ = {};
+        SetPC(0);
+        imem_dirty_ = true;
+    }
+
+    bool RSPCore::IsRunning() const {
+        return !(cpu_.rcp_.rsp_status_ & SP_STATUS_HALT);
+    }
+
+    void RSPCore::SetPC(uint32_t pc) {
+        pc_ = pc & 0xFFC;
+        next_pc_ = (pc_ + 4) & 0xFFC;
+    }
+
+    void RSPCore::SetMode(RSPMode mode) {
+        bool threaded = mode == RSPMode::Threaded;
+        if (threaded == threaded_) {
+            return;
+        }
+        if (threaded) {
+            budget_.store(0, std::memory_order_relaxed);
+            done_.store(0, std::memory_order_relaxed);
+            quit_.store(false, std::memory_order_relaxed);
+            worker_ = std::thread(&RSPCore::worker_loop, this);
+            threaded_ = true;
+        } else {
+            stop_worker();
+        }
+    }
+
+    bool RSPCore::RunSlice() {
+        if (!threaded_) {
+            Run(SLICE_CYCLES);
+            return IsRunning();
+        }
+        // The previous slice has to end before this one starts, or the RSP would run ahead of the CPU
+        wait_idle();
+        if (!IsRunning()) {
+            return false;
+        }
+        budget_.fetch_add(SLICE_CYCLES, std::memory_order_release);
+        budget_.notify_one();
+        return true;
+    }
+
+    void RSPCore::worker_loop() {
+        uint64_t done = 0;
+        while (true) {
+            budget_.wait(done, std::memory_order_acquire);
+            if (quit_.load(std::memory_order_acquire)) {
+                break;
+            }
+            uint64_t budget = budget_.load(std::memory_order_acquire);
+            deferred_ = true;
+            // Halting early gives up the rest of the budget
+            Run(budget - done);
+            deferred_ = false;
+            done = budget;
+            done_.store(done, std::memory_order_release);
+            done_.notify_one();
+        }
+    }
+
+    void RSPCore::wait_idle() {
+        // Only the CPU thread grants budget
+        uint64_t budget = budget_.load(std::memory_order_relaxed);
+        uint64_t done = done_.load(std::memory_order_acquire);
+        // Slices are short, spin for a bit before sleeping
+        for (int spins = 0; done != budget; spins++) {
+            if (spins >= 256) {
+                done_.wait(done, std::memory_order_acquire);
+            }
+            done = done_.load(std::memory_order_acquire);
+        }
+        apply_deferred();
+    }
+
+    void RSPCore::stop_worker() {
+        if (!threaded_) {
+            return;
+        }
+        wait_idle();
+        quit_.store(true, std::memory_order_release);
+        budget_.fetch_add(1, std::memory_order_release);
+        budget_.notify_one();
+        worker_.join();
+        threaded_ = false;
+    }
+
+    void RSPCore::raise_interrupt(SchedulerEventType interrupt) {
+        if (deferred_) {
+            pending_interrupts_ |= 1u << static_cast<int>(interrupt);
+            return;
+        }
+        cpu_.queue_event(interrupt, 0);
+    }
+
+    void RSPCore::clear_sp_interrupt() {
+        if (deferred_) {
+            // Cancels a raise earlier in the same slice
+            pending_interrupts_ &= ~(1u << static_cast<int>(SchedulerEventType::Sp));
+            pending_sp_clear_ = true;
+            return;
+        }
+        cpu_.cpubus_.set_interrupt(Interrupt::SP, false);
+    }
+
+    void RSPCore::invalidate_rdram(uint32_t paddr, uint32_t size) {
+        if (deferred_) {
+            invalid_start_ = std::min(invalid_start_, paddr);
+            invalid_end_ = std::max(invalid_end_, paddr + size);
+            return;
+        }
+        cpu_.invalidate_code(paddr, size);
+    }
+
+    void RSPCore::apply_deferred() {
+        if (pending_sp_clear_) {
+            cpu_.cpubus_.set_interrupt(Interrupt::SP, false);
+            pending_sp_clear_ = false;
+        }
+        for (uint32_t pending = pending_interrupts_; pending; pending &= pending - 1) {
+            cpu_.queue_event(static_cast<SchedulerEventType>(std::countr_zero(pending)), 0);
+        }
+        pending_interrupts_ = 0;
+        if (invalid_start_ < invalid_end_) {
+            cpu_.invalidate_code(invalid_start_, invalid_end_ - invalid_start_);
+            invalid_start_ = std::numeric_limits<uint32_t>::max();
+            invalid_end_ = 0;
+        }
+    }
+
+    uint32_t RSPCore::Run(uint32_t cycles) {
+        const uint32_t& status = cpu_.rcp_.rsp_status_;
+        if (task_started_) [[unlikely]] {
+            task_started_ = false;
+            if (!(status & SP_STATUS_HALT) && run_hle_task()) {
+                cpu_.rcp_.rsp_pc_ = pc_;
+                return 0;
+            }
+        }
+        uint32_t ran = 0;
+        while (ran < cycles && !(status & SP_STATUS_HALT)) {
+            // Overlays get DMAed over IMEM in the middle of a task
+            if (imem_dirty_) [[unlikely]] {
+                load_program();
+            }
+            const RSPInstruction& instr = program_->instructions[pc_ >> 2];
+            uint32_t pc = pc_;
+            pc_ = next_pc_;
+            next_pc_ = (next_pc_ + 4) & 0xFFC;
+            instr.handler(*this, instr, pc);
+            gpr_[0] = 0;
+            ++ran;
+            if (status & SP_STATUS_SSTEP) [[unlikely]] {
+                cpu_.rcp_.rsp_status_ |= SP_STATUS_HALT;
+            }
+        }
+        cpu_.rcp_.rsp_pc_ = pc_;
+        return ran;
+    }
+
+    bool RSPCore::run_hle_task() {
+        auto& bus = cpu_.cpubus_;
+        if (graphics_hle_enabled_ && graphics_hle_.Run(bus.rsp_dmem_.data(), bus.rdram_)) {
+            if (graphics_hle_.GetOutput().full_sync) {
+                raise_interrupt(SchedulerEventType::Dp);
+            }
+        } else if (audio_hle_enabled_ && audio_hle_.Run(bus.rsp_dmem_.data(), bus.rdram_)) {
+            for (const RDRAMRange& range : audio_hle_.GetWrittenRanges()) {
+                invalidate_rdram(range.start, range.size);
+            }
+        } else {
+            return false;
+        }
+        // Same ending as the microcode's
+        cpu_.rcp_.rsp_status_ |= SP_STATUS_SIG2;
+        do_break();
+        return true;
+    }
+
+    void RSPCore::load_program() {
+        program_ = RSPProgramCache::Get().Find(cpu_.cpubus_.rsp_imem_.data());
+        imem_dirty_ = false;
+    }
+
+    struct RSPCore::Ops {
+        using Instr = const RSPInstruction&;
+
+        static void J(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.next_pc_ = (instr.instruction << 2) & 0xFFC;
+        }
+        static void JAL(RSPCore& rsp, Instr instr, uint32_t pc) {
+            rsp.gpr_[31] = (pc + 8) & 0xFFC;
+            J(rsp, instr, pc);
+        }
+        static void BEQ(RSPCore& rsp, Instr instr, uint32_t pc) {
+            rsp.branch(rsp.gpr_[instr.rs] == rsp.gpr_[instr.rt], pc, instr.instruction);
+        }
+        static void BNE(RSPCore& rsp, Instr instr, uint32_t pc) {
+            rsp.branch(rsp.gpr_[instr.rs] != rsp.gpr_[instr.rt], pc, instr.instruction);
+        }
+        static void BLEZ(RSPCore& rsp, Instr instr, uint32_t pc) {
+            rsp.branch(static_cast<int32_t>(rsp.gpr_[instr.rs]) <= 0, pc, instr.instruction);
+        }
+        static void BGTZ(RSPCore& rsp, Instr instr, uint32_t pc) {
+            rsp.branch(static_cast<int32_t>(rsp.gpr_[instr.rs]) > 0, pc, instr.instruction);
+        }
+        // No overflow exceptions on the RSP, ADDI is ADDIU
+        static void ADDIU(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rt] = rsp.gpr_[instr.rs] + instr.seimm;
+        }
+        static void SLTI(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rt] = static_cast<int32_t>(rsp.gpr_[instr.rs]) < instr.seimm;
+        }
+        static void SLTIU(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rt] = rsp.gpr_[instr.rs] < static_cast<uint32_t>(instr.seimm);
+        }
+        static void ANDI(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rt] = rsp.gpr_[instr.rs] & (instr.instruction & 0xFFFF);
+        }
+        static void ORI(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rt] = rsp.gpr_[instr.rs] | (instr.instruction & 0xFFFF);
+        }
+        static void XORI(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rt] = rsp.gpr_[instr.rs] ^ (instr.instruction & 0xFFFF);
+        }
+        static void LUI(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rt] = instr.instruction << 16;
+        }
+        static void MFC0(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rt] = rsp.read_cop0(instr.rd);
+        }
+        static void MTC0(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.write_cop0(instr.rd, rsp.gpr_[instr.rt]);
+        }
+        static void COP2(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.execute_cop2(instr.instruction);
+        }
+        static void VU(RSPCore& rsp, Instr instr, uint32_t) {
+            instr.vector_op(rsp.vu_, instr.sa, instr.rd, instr.rt, (instr.instruction >> 21) & 15);
+        }
+        static void LB(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rt] = static_cast<int8_t>(rsp.read8(rsp.gpr_[instr.rs] + instr.seimm));
+        }
+        static void LH(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rt] = static_cast<int16_t>(rsp.read16(rsp.gpr_[instr.rs] + instr.seimm));
+        }
+        // LWU is LW, registers are 32 bits wide
+        static void LW(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rt] = rsp.read32(rsp.gpr_[instr.rs] + instr.seimm);
+        }
+        static void LBU(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rt] = rsp.read8(rsp.gpr_[instr.rs] + instr.seimm);
+        }
+        static void LHU(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rt] = rsp.read16(rsp.gpr_[instr.rs] + instr.seimm);
+        }
+        static void SB(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.write8(rsp.gpr_[instr.rs] + instr.seimm, rsp.gpr_[instr.rt]);
+        }
+        static void SH(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.write16(rsp.gpr_[instr.rs] + instr.seimm, rsp.gpr_[instr.rt]);
+        }
+        static void SW(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.write32(rsp.gpr_[instr.rs] + instr.seimm, rsp.gpr_[instr.rt]);
+        }
+        static void LWC2(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.load_vector(instr.instruction);
+        }
+        static void SWC2(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.store_vector(instr.instruction);
+        }
+
+        static void SLL(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rd] = rsp.gpr_[instr.rt] << instr.sa;
+        }
+        static void SRL(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rd] = rsp.gpr_[instr.rt] >> instr.sa;
+        }
+        static void SRA(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rd] = static_cast<int32_t>(rsp.gpr_[instr.rt]) >> instr.sa;
+        }
+        static void SLLV(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rd] = rsp.gpr_[instr.rt] << (rsp.gpr_[instr.rs] & 31);
+        }
+        static void SRLV(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rd] = rsp.gpr_[instr.rt] >> (rsp.gpr_[instr.rs] & 31);
+        }
+        static void SRAV(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rd] = static_cast<int32_t>(rsp.gpr_[instr.rt]) >> (rsp.gpr_[instr.rs] & 31);
+        }
+        static void JR(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.next_pc_ = rsp.gpr_[instr.rs] & 0xFFC;
+        }
+        static void JALR(RSPCore& rsp, Instr instr, uint32_t pc) {
+            uint32_t target = rsp.gpr_[instr.rs] & 0xFFC;
+            rsp.gpr_[instr.rd] = (pc + 8) & 0xFFC;
+            rsp.next_pc_ = target;
+        }
+        static void BREAK(RSPCore& rsp, Instr, uint32_t) {
+            rsp.do_break();
+        }
+        static void ADDU(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rd] = rsp.gpr_[instr.rs] + rsp.gpr_[instr.rt];
+        }
+        static void SUBU(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rd] = rsp.gpr_[instr.rs] - rsp.gpr_[instr.rt];
+        }
+        static void AND(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rd] = rsp.gpr_[instr.rs] & rsp.gpr_[instr.rt];
+        }
+        static void OR(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rd] = rsp.gpr_[instr.rs] | rsp.gpr_[instr.rt];
+        }
+        static void XOR(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rd] = rsp.gpr_[instr.rs] ^ rsp.gpr_[instr.rt];
+        }
+        static void NOR(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rd] = ~(rsp.gpr_[instr.rs] | rsp.gpr_[instr.rt]);
+        }
+        static void SLT(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rd] = static_cast<int32_t>(rsp.gpr_[instr.rs]) < static_cast<int32_t>(rsp.gpr_[instr.rt]);
+        }
+        static void SLTU(RSPCore& rsp, Instr instr, uint32_t) {
+            rsp.gpr_[instr.rd] = rsp.gpr_[instr.rs] < rsp.gpr_[instr.rt];
+        }
+
+        static void BLTZ(RSPCore& rsp, Instr instr, uint32_t pc) {
+            rsp.branch(static_cast<int32_t>(rsp.gpr_[instr.rs]) < 0, pc, instr.instruction);
+        }
+        static void BGEZ(RSPCore& rsp, Instr instr, uint32_t pc) {
+            rsp.branch(static_cast<int32_t>(rsp.gpr_[instr.rs]) >= 0, pc, instr.instruction);
+        }
+        // The link happens whether or not the branch is taken, after the condition is read
+        static void BLTZAL(RSPCore& rsp, Instr instr, uint32_t pc) {
+            bool taken = static_cast<int32_t>(rsp.gpr_[instr.rs]) < 0;
+            rsp.gpr_[31] = (pc + 8) & 0xFFC;
+            rsp.branch(taken, pc, instr.instruction);
+        }
+        static void BGEZAL(RSPCore& rsp, Instr instr, uint32_t pc) {
+            bool taken = static_cast<int32_t>(rsp.gpr_[instr.rs]) >= 0;
+            rsp.gpr_[31] = (pc + 8) & 0xFFC;
+            rsp.branch(taken, pc, instr.instruction);
+        }
+
+        static void NOP(RSPCore&, Instr, uint32_t) {}
+        static void INVALID(RSPCore&, Instr instr, uint32_t pc) {
+            N64_LOG(RSP, "Unimplemented RSP opcode %08x at %03x", instr.instruction, pc);
+        }
+    };
+
+    RSPInstruction RSPCore::Decode(uint32_t instruction) {
+        RSPInstruction instr {
+            .handler = &Ops::INVALID,
+            .vector_op = nullptr,
+            .instruction = instruction,
+            .seimm = s16(instruction),
+            .rs = static_cast<uint8_t>((instruction >> 21) & 31),
+            .rt = static_cast<uint8_t>((instruction >> 16) & 31),
+            .rd = static_cast<uint8_t>((instruction >> 11) & 31),
+            .sa = static_cast<uint8_t>((instruction >> 6) & 31),
+        };
+        auto& handler = instr.handler;
+        switch (instruction >> 26) {
+            case 0x00: {
+                switch (instruction & 63) {
+                    case 0x00: handler = &Ops::SLL; break;
+                    case 0x02: handler = &Ops::SRL; break;
+                    case 0x03: handler = &Ops::SRA; break;
+                    case 0x04: handler = &Ops::SLLV; break;
+                    case 0x06: handler = &Ops::SRLV; break;
+                    case 0x07: handler = &Ops::SRAV; break;
+                    case 0x08: handler = &Ops::JR; break;
+                    case 0x09: handler = &Ops::JALR; break;
+                    case 0x0D: handler = &Ops::BREAK; break;
+                    case 0x20:
+                    case 0x21: handler = &Ops::ADDU; break;
+                    case 0x22:
+                    case 0x23: handler = &Ops::SUBU; break;
+                    case 0x24: handler = &Ops::AND; break;
+                    case 0x25: handler = &Ops::OR; break;
+                    case 0x26: handler = &Ops::XOR; break;
+                    case 0x27: handler = &Ops::NOR; break;
+                    case 0x2A: handler = &Ops::SLT; break;
+                    case 0x2B: handler = &Ops::SLTU; break;
+                }
+                break;
+            }
+            case 0x01: {
+                switch (instr.rt) {
+                    case 0x00: handler = &Ops::BLTZ; break;
+                    case 0x01: handler = &Ops::BGEZ; break;
+                    case 0x10: handler = &Ops::BLTZAL; break;
+                    case 0x11: handler = &Ops::BGEZAL; break;
+                }
+                break;
+            }
+            case 0x02: handler = &Ops::J; break;
+            case 0x03: handler = &Ops::JAL; break;
+            case 0x04: handler = &Ops::BEQ; break;
+            case 0x05: handler = &Ops::BNE; break;
+            case 0x06: handler = &Ops::BLEZ; break;
+            case 0x07: handler = &Ops::BGTZ; break;
+            case 0x08:
+            case 0x09: handler = &Ops::ADDIU; break;
+            case 0x0A: handler = &Ops::SLTI; break;
+            case 0x0B: handler = &Ops::SLTIU; break;
+            case 0x0C: handler = &Ops::ANDI; break;
+            case 0x0D: handler = &Ops::ORI; break;
+            case 0x0E: handler = &Ops::XORI; break;
+            case 0x0F: handler = &Ops::LUI; break;
+            case 0x10: {
+                handler = instr.rs == 0x00 ? &Ops::MFC0 : instr.rs == 0x04 ? &Ops::MTC0 : &Ops::NOP;
+                break;
+            }
+            case 0x12: {
+                if (instruction & (1 << 25)) {
+                    handler = &Ops::VU;
+                    instr.vector_op = vector_ops()[instruction & 63];
+                } else {
+                    handler = &Ops::COP2;
+                }
+                break;
+            }
+            case 0x20: handler = &Ops::LB; break;
+            case 0x21: handler = &Ops::LH; break;
+            case 0x23:
+            case 0x27: handler = &Ops::LW; break;
+            case 0x24: handler = &Ops::LBU; break;
+            case 0x25: handler = &Ops::LHU; break;
+            case 0x28: handler = &Ops::SB; break;
+            case 0x29: handler = &Ops::SH; break;
+            case 0x2B: handler = &Ops::SW; break;
+            case 0x32: handler = &Ops::LWC2; break;
+            case 0x3A: handler = &Ops::SWC2; break;
+        }
+        return instr;
+    }
+
+    void RSPCore::branch(bool taken, uint32_t pc, uint32_t instr) {
+        if (taken) {
+            next_pc_ = (pc + 4 + (s16(instr) << 2)) & 0xFFC;
+        }
+    }
+
+    void RSPCore::do_break() {
+        auto& status = cpu_.rcp_.rsp_status_;
+        status |= SP_STATUS_HALT | SP_STATUS_BROKE;
+        if (status & SP_STATUS_INTBREAK) {
+            raise_interrupt(SchedulerEventType::Sp);
+        }
+    }
+
+    void RSPCore::execute_cop2(uint32_t instr) {
+        uint32_t rt = (instr >> 16) & 31;
+        uint32_t rd = (instr >> 11) & 31;
+        uint32_t e = (instr >> 7) & 15;
+        VectorRegister& reg = vu_.regs[rd];
+        switch ((instr >> 21) & 31) {
+            case 0x00: {
+                gpr_[rt] = s16((reg.GetByte(e) << 8) | reg.GetByte(e + 1));
+                break;
+            }
+            case 0x02: {
+                uint16_t value;
+                switch (rd & 3) {
+                    case 0: value = pack_flags(vu_.vco_lo, vu_.vco_hi); break;
+                    case 1: value = pack_flags(vu_.vcc_lo, vu_.vcc_hi); break;
+                    default: value = pack_flags(vu_.vce, {}) & 0xFF; break;
+                }
+                gpr_[rt] = s16(value);
+                break;
+            }
+            case 0x04: {
+                reg.SetByte(e, gpr_[rt] >> 8);
+                if (e != 15) {
+                    reg.SetByte(e + 1, gpr_[rt]);
+                }
+                break;
+            }
+            case 0x06: {
+                switch (rd & 3) {
+                    case 0: unpack_flags(gpr_[rt], vu_.vco_lo, vu_.vco_hi); break;
+                    case 1: unpack_flags(gpr_[rt], vu_.vcc_lo, vu_.vcc_hi); break;
+                    default: {
+                        VectorRegister unused;
+                        unpack_flags(gpr_[rt] & 0xFF, vu_.vce, unused);
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+    // LWC2 and SWC2 follow the byte by byte behavior documented by ares, element
+    // and address misalignment included. Quad accesses get a fast path for the common aligned case
+    void RSPCore::load_vector(uint32_t instr) {
+        uint32_t base = (instr >> 21) & 31;
+        VectorRegister& vt = vu_.regs[(instr >> 16) & 31];
+        uint32_t funct = (instr >> 11) & 31;
+        uint32_t e = (instr >> 7) & 15;
+        int32_t offset = static_cast<int32_t>(instr << 25) >> 25;
+        switch (funct) {
+            // LBV, LSV, LLV, LDV
+            case 0x00:
+            case 0x01:
+            case 0x02:
+            case 0x03: {
+                uint32_t size = 1 << funct;
+                uint32_t address = gpr_[base] + offset * size;
+                uint32_t end = std::min(e + size, 16u);
+                for (uint32_t i = e; i < end; i++) {
+                    vt.SetByte(i, read8(address++));
+                }
+                break;
+            }
+            // LQV
+            case 0x04: {
+                uint32_t address = gpr_[base] + offset * 16;
+                if (e == 0 && (address & 15) == 0) [[likely]] {
+                    const uint8_t* dmem = &cpu_.cpubus_.rsp_dmem_[address & DMEM_MASK];
+                    for (int i = 0; i < 4; i++) {
+                        uint32_t word;
+                        std::memcpy(&word, dmem + i * 4, sizeof(word));
+                        word = std::rotl(word, 16);
+                        std::memcpy(&vt.elements[i * 2], &word, sizeof(word));
+                    }
+                    break;
+                }
+                uint32_t end = std::min(16 + e - (address & 15), 16u);
+                for (uint32_t i = e; i < end; i++) {
+                    vt.SetByte(i, read8(address++));
+                }
+                break;
+            }
+            // LRV
+            case 0x05: {
+                uint32_t address = gpr_[base] + offset * 16;
+                uint32_t start = 16 - (address & 15) + e;
+                address &= ~15u;
+                for (uint32_t i = start; i < 16; i++) {
+                    vt.SetByte(i, read8(address++));
+                }
+                break;
+            }
+            // LPV and LUV, signed and unsigned bytes to the top of each element
+            case 0x06:
+            case 0x07: {
+                uint32_t address = gpr_[base] + offset * 8;
+                uint32_t index = (address & 7) - e;
+                uint32_t shift = funct == 0x06 ? 8 : 7;
+                address &= ~7u;
+                for (uint32_t i = 0; i < 8; i++) {
+                    vt.elements[i] = read8(address + ((index + i) & 15)) << shift;
+                }
+                break;
+            }
+            // LHV
+            case 0x08: {
+                uint32_t address = gpr_[base] + offset * 16;
+                uint32_t index = (address & 7) - e;
+                address &= ~7u;
+                for (uint32_t i = 0; i < 8; i++) {
+                    vt.elements[i] = read8(address + ((index + i * 2) & 15)) << 7;
+                }
+                break;
+            }
+            // LFV
+            case 0x09: {
+                uint32_t address = gpr_[base] + offset * 16;
+                uint32_t index = (address & 7) - e;
+                address &= ~7u;
+                VectorRegister fourths;
+                for (uint32_t i = 0; i < 4; i++) {
+                    fourths.elements[i] = read8(address + ((index + i * 4) & 15)) << 7;
+                    fourths.elements[i + 4] = read8(address + ((index + i * 4 + 8) & 15)) << 7;
+                }
+                uint32_t end = std::min(e + 8, 16u);
+                for (uint32_t i = e; i < end; i++) {
+                    vt.SetByte(i, fourths.GetByte(i));
+                }
+                break;
+            }
+            // LTV, one element into each register of a group of 8
+            case 0x0B: {
+                uint32_t address = gpr_[base] + offset * 16;
+                uint32_t begin = address & ~7u;
+                address = begin + ((e + (address & 8)) & 15);
+                uint32_t group = ((instr >> 16) & 31) & ~7u;
+                uint32_t reg = e >> 1;
+                for (uint32_t i = 0; i < 8; i++) {
+                    VectorRegister& target = vu_.regs[group + reg];
+                    for (uint32_t byte = 0; byte < 2; byte++) {
+                        target.SetByte(i * 2 + byte, read8(address++));
+                        if (address == begin + 16) {
+                            address = begin;
+                        }
+                    }
+                    reg = (reg + 1) & 7;
+                }
+                break;
+            }
+            default: {
+                N64_LOG(RSP, "Unimplemented RSP vector load %08x", instr);
+                break;
+            }
+        }
+    }
+
+    void RSPCore::store_vector(uint32_t instr) {
+        uint32_t base = (instr >> 21) & 31;
+        const VectorRegister& vt = vu_.regs[(instr >> 16) & 31];
+        uint32_t funct = (instr >> 11) & 31;
+        uint32_t e = (instr >> 7) & 15;
+        int32_t offset = static_cast<int32_t>(instr << 25) >> 25;
+        switch (funct) {
+            // SBV, SSV, SLV, SDV
+            case 0x00:
+            case 0x01:
+            case 0x02:
+            case 0x03: {
+                uint32_t size = 1 << funct;
+                uint32_t address = gpr_[base] + offset * size;
+                for (uint32_t i = e; i < e + size; i++) {
+                    write8(address++, vt.GetByte(i));
+                }
+                break;
+            }
+            // SQV
+            case 0x04: {
+                uint32_t address = gpr_[base] + offset * 16;
+                if (e == 0 && (address & 15) == 0) [[likely]] {
+                    uint8_t* dmem = &cpu_.cpubus_.rsp_dmem_[address & DMEM_MASK];
+                    for (int i = 0; i < 4; i++) {
+                        uint32_t word;
+                        std::memcpy(&word, &vt.elements[i * 2], sizeof(word));
+                        word = std::rotl(word, 16);
+                        std::memcpy(dmem + i * 4, &word, sizeof(word));
+                    }
+                    break;
+                }
+                uint32_t end = e + 16 - (address & 15);
+                for (uint32_t i = e; i < end; i++) {
+                    write8(address++, vt.GetByte(i));
+                }
+                break;
+            }
+            // SRV
+            case 0x05: {
+                uint32_t address = gpr_[base] + offset * 16;
+                uint32_t end = e + (address & 15);
+                uint32_t rotation = 16 - (address & 15);
+                address &= ~15u;
+                for (uint32_t i = e; i < end; i++) {
+                    write8(address++, vt.GetByte(i + rotation));
+                }
+                break;
+            }
+            // SPV and SUV, the two halves of the register store packed and unpacked bytes
+            case 0x06:
+            case 0x07: {
+                uint32_t address = gpr_[base] + offset * 8;
+                for (uint32_t i = e; i < e + 8; i++) {
+                    bool packed = ((i & 15) < 8) == (funct == 0x06);
+                    if (packed) {
+                        write8(address++, vt.GetByte((i & 7) << 1));
+                    } else {
+                        write8(address++, vt.elements[i & 7] >> 7);
+                    }
+                }
+                break;
+            }
+            // SHV
+            case 0x08: {
+                uint32_t address = gpr_[base] + offset * 16;
+                uint32_t index = address & 7;
+                address &= ~7u;
+                for (uint32_t i = 0; i < 8; i++) {
+                    uint32_t byte = e + i * 2;
+                    uint8_t value = (vt.GetByte(byte) << 1) | (vt.GetByte(byte + 1) >> 7);
+                    write8(address + ((index + i * 2) & 15), value);
+                }
+                break;
+            }
+            // SFV, only some element fields pick elements, the rest store zeroes
+            case 0x09: {
+                uint32_t address = gpr_[base] + offset * 16;
+                uint32_t index = address & 7;
+                address &= ~7u;
+                static constexpr std::array<std::array<int8_t, 4>, 16> ELEMENTS = {{
+                    {0, 1, 2, 3}, {6, 7, 4, 5}, {-1}, {-1}, {1, 2, 3, 0}, {7, 4, 5, 6}, {-1}, {-1},
+                    {4, 5, 6, 7}, {-1}, {-1}, {3, 0, 1, 2}, {5, 6, 7, 4}, {-1}, {-1}, {0, 1, 2, 3},
+                }};
+                const auto& elements = ELEMENTS[e];
+                for (uint32_t i = 0; i < 4; i++) {
+                    uint8_t value = elements[0] < 0 ? 0 : vt.elements[elements[i]] >> 7;
+                    write8(address + ((index + i * 4) & 15), value);
+                }
+                break;
+            }
+            // SWV
+            case 0x0A: {
+                uint32_t address = gpr_[base] + offset * 16;
+                uint32_t index = address & 7;
+                address &= ~7u;
+                for (uint32_t i = e; i < e + 16; i++) {
+                    write8(address + (index++ & 15), vt.GetByte(i));
+                }
+                break;
+            }
+            // STV, one element from each register of a group of 8
+            case 0x0B: {
+                uint32_t address = gpr_[base] + offset * 16;
+                uint32_t group = ((instr >> 16) & 31) & ~7u;
+                uint32_t element = 16 - (e & ~1u);
+                uint32_t index = (address & 7) - (e & ~1u);
+                address &= ~7u;
+                for (uint32_t reg = group; reg < group + 8; reg++) {
+                    write8(address + (index++ & 15), vu_.regs[reg].GetByte(element++));
+                    write8(address + (index++ & 15), vu_.regs[reg].GetByte(element++));
+                }
+                break;
+            }
+            default: {
+                N64_LOG(RSP, "Unimplemented RSP vector store %08x", instr);
+                break;
+            }
+        }
+    }
+
+    uint32_t RSPCore::read_cop0(uint32_t reg) {
+        auto& rcp = cpu_.rcp_;
+        switch (reg & 15) {
+            case 0: return rcp.rsp_mem_addr_;
+            case 1: return rcp.rsp_dram_addr_;
+            case 2: return rcp.rsp_rd_len_;
+            case 3: return rcp.rsp_wr_len_;
+            case 4: return rcp.rsp_status_;
+            case 5: return rcp.rsp_dma_full_;
+            case 6: return rcp.rsp_dma_busy_;
+            case 7: {
+                // Reading acquires the semaphore
+                uint32_t value = rcp.rsp_semaphore_;
+                rcp.rsp_semaphore_ = 1;
+                return value;
+            }
+            case 8: return rcp.dpc_start_;
+            case 9: return rcp.dpc_end_;
+            case 10: return rcp.dpc_current_;
+            case 11: return rcp.dpc_status_;
+            case 12: return rcp.dpc_clock_;
+            case 13: return rcp.dpc_bufbusy_;
+            case 14: return rcp.dpc_pipebusy_;
+            default: return rcp.dpc_tmem_;
+        }
+    }
+
+    void RSPCore::write_cop0(uint32_t reg, uint32_t value) {
+        auto& rcp = cpu_.rcp_;
+        switch (reg & 15) {
+            case 0: rcp.rsp_mem_addr_ = value & 0x1FF8; break;
+            case 1: rcp.rsp_dram_addr_ = value & 0xFF'FFF8; break;
+            case 2: StartDMA(value, false); break;
+            case 3: StartDMA(value, true); break;
+            // The RSP is running, so this can't be the store that wakes it up
+            case 4: WriteStatus(value); break;
+            case 7: rcp.rsp_semaphore_ = 0; break;
+            case 8: WriteDPCStart(value); break;
+            case 9: WriteDPCEnd(value); break;
+            case 11: WriteDPCStatus(value); break;
+            default: break;
+        }
+    }
+
+    bool RSPCore::WriteStatus(uint32_t data) {
+        auto& status = cpu_.rcp_.rsp_status_;
+        bool was_halted = status & SP_STATUS_HALT;
+        // Each flag has a clear bit followed by a set bit, writing both leaves it alone
+        auto update = [&](int clear_bit, uint32_t flag) {
+            bool clear = data & (1u << clear_bit);
+            bool set = data & (2u << clear_bit);
+            if (clear && !set) {
+                status &= ~flag;
+            } else if (set && !clear) {
+                status |= flag;
+            }
+        };
+        update(0, SP_STATUS_HALT);
+        if (data & (1 << 2)) {
+            status &= ~SP_STATUS_BROKE;
+        }
+        bool clear_interrupt = data & (1 << 3);
+        bool set_interrupt = data & (1 << 4);
+        if (clear_interrupt && !set_interrupt) {
+            clear_sp_interrupt();
+        } else if (set_interrupt && !clear_interrupt) {
+            raise_interrupt(SchedulerEventType::Sp);
+        }
+        update(5, SP_STATUS_SSTEP);
+        update(7, SP_STATUS_INTBREAK);
+        for (int i = 0; i < 8; i++) {
+            update(9 + i * 2, 1u << (7 + i));
+        }
+        bool woke = was_halted && !(status & SP_STATUS_HALT);
+        task_started_ |= woke;
+        return woke;
+    }
+
+    void RSPCore::StartDMA(uint32_t length, bool to_rdram) {
+        auto& rcp = cpu_.rcp_;
+        auto& bus = cpu_.cpubus_;
+        // Rows are rounded up to 8 bytes, skip is added to the RDRAM address after each one
+        uint32_t row_length = (length & 0xFF8) + 8;
+        uint32_t rows = ((length >> 12) & 0xFF) + 1;
+        uint32_t skip = (length >> 20) & 0xFF8;
+        uint32_t bank = rcp.rsp_mem_addr_ & 0x1000;
+        uint8_t* mem = bank ? bus.rsp_imem_.data() : bus.rsp_dmem_.data();
+        uint32_t mem_addr = rcp.rsp_mem_addr_ & 0xFF8;
+        uint32_t dram_addr = rcp.rsp_dram_addr_ & 0xFF'FFF8;
+        for (uint32_t row = 0; row < rows; row++) {
+            uint32_t row_start = dram_addr;
+            // Both sides hold host endian words, 8 byte aligned chunks copy as is
+            for (uint32_t i = 0; i < row_length; i += 8) {
+                uint8_t* rdram = &bus.rdram_[dram_addr & (CPUBus::RDRAM_SIZE - 1)];
+                if (to_rdram) {
+                    std::memcpy(rdram, mem + mem_addr, 8);
+                } else {
+                    std::memcpy(mem + mem_addr, rdram, 8);
+                }
+                mem_addr = (mem_addr + 8) & DMEM_MASK;
+                dram_addr = (dram_addr + 8) & 0xFF'FFF8;
+            }
+            if (to_rdram) {
+                invalidate_rdram(row_start & (CPUBus::RDRAM_SIZE - 1), row_length);
+            }
+            dram_addr = (dram_addr + skip) & 0xFF'FFF8;
+        }
+        if (bank && !to_rdram) {
+            imem_dirty_ = true;
+        }
+        rcp.rsp_mem_addr_ = bank | mem_addr;
+        rcp.rsp_dram_addr_ = dram_addr;
+        // Both length registers read back with the count run down
+        rcp.rsp_rd_len_ = rcp.rsp_wr_len_ = (skip << 20) | 0xFF8;
+    }
+
+    void RSPCore::WriteDPCStart(uint32_t data) {
+        auto& rcp = cpu_.rcp_;
+        rcp.dpc_start_ = data & 0xFF'FFF8;
+        rcp.dpc_status_ |= DPC_STATUS_START_VALID;
+    }
+
+    void RSPCore::WriteDPCEnd(uint32_t data) {
+        auto& rcp = cpu_.rcp_;
+        rcp.dpc_end_ = data & 0xFF'FFF8;
+        if (rcp.dpc_status_ & DPC_STATUS_START_VALID) {
+            rcp.dpc_current_ = rcp.dpc_start_;
+            rcp.dpc_status_ &= ~DPC_STATUS_START_VALID;
+        }
+        if (!(rcp.dpc_status_ & DPC_STATUS_FREEZE)) {
+            run_rdp();
+        }
+    }
+
+    void RSPCore::WriteDPCStatus(uint32_t data) {
+        auto& rcp = cpu_.rcp_;
+        bool was_frozen = rcp.dpc_status_ & DPC_STATUS_FREEZE;
+        constexpr uint32_t FLAGS[] = { DPC_STATUS_XBUS, DPC_STATUS_FREEZE, DPC_STATUS_FLUSH };
+        for (int i = 0; i < 3; i++) {
+            bool clear = data & (1u << (i * 2));
+            bool set = data & (2u << (i * 2));
+            if (clear && !set) {
+                rcp.dpc_status_ &= ~FLAGS[i];
+            } else if (set && !clear) {
+                rcp.dpc_status_ |= FLAGS[i];
+            }
+        }
+        if (data & (1 << 9)) {
+            rcp.dpc_clock_ = 0;
+        }
+        if (was_frozen && !(rcp.dpc_status_ & DPC_STATUS_FREEZE)) {
+            run_rdp();
+        }
+    }
+
+    void RSPCore::run_rdp() {
+        auto& rcp = cpu_.rcp_;
+        uint32_t current = rcp.dpc_current_;
+        while (current < rcp.dpc_end_) {
+            uint32_t id = (read_rdp_command(current) >> 56) & 0x3F;
+            uint32_t length = 8;
+            if (id >= 0x08 && id <= 0x0F) {
+                // Edge coefficients, then optional shade, texture and depth coefficients
+                length = 32 + ((id & 4) ? 64 : 0) + ((id & 2) ? 64 : 0) + ((id & 1) ? 16 : 0);
+            } else if (id == 0x24 || id == 0x25) {
+                length = 16;
+            }
+            if (current + length > rcp.dpc_end_) {
+                // The rest of the command hasn't been sent yet
+                break;
+            }
+            if (id == 0x29) {
+                // SYNC_FULL
+                raise_interrupt(SchedulerEventType::Dp);
+            }
+            current += length;
+        }
+        rcp.dpc_current_ = current;
+    }
+
+    uint64_t RSPCore::read_rdp_command(uint32_t address) {
+        if (cpu_.rcp_.dpc_status_ & DPC_STATUS_XBUS) {
+            return (static_cast<uint64_t>(read32(address)) << 32) | read32(address + 4);
+        }
+        const uint8_t* rdram = &cpu_.cpubus_.rdram_[address & (CPUBus::RDRAM_SIZE - 1) & ~7u];
+        uint32_t high, low;
+        std::memcpy(&high, rdram, sizeof(high));
+        std::memcpy(&low, rdram + 4, sizeof(low));
+        return (static_cast<uint64_t>(high) << 32) | low;
+    }
+
+    uint8_t RSPCore::read8(uint32_t address) {
+        return cpu_.cpubus_.rsp_dmem_[swizzle_address(address & DMEM_MASK, 1)];
+    }
+
+    uint16_t RSPCore::read16(uint32_t address) {
+        if ((address & 1) == 0) [[likely]] {
+            uint16_t value;
+            std::memcpy(&value, &cpu_.cpubus_.rsp_dmem_[swizzle_address(address & DMEM_MASK, 2)], sizeof(value));
+            return value;
+        }
+        return (read8(address) << 8) | read8(address + 1);
+    }
+
+    uint32_t RSPCore::read32(uint32_t address) {
+        if ((address & 3) == 0) [[likely]] {
+            uint32_t value;
+            std::memcpy(&value, &cpu_.cpubus_.rsp_dmem_[address & DMEM_MASK], sizeof(value));
+            return value;
+        }
+        return (read8(address) << 24) | (read8(address + 1) << 16) | (read8(address + 2) << 8) | read8(address + 3);
+    }
+
+    void RSPCore::write8(uint32_t address, uint8_t value) {
+        cpu_.cpubus_.rsp_dmem_[swizzle_address(address & DMEM_MASK, 1)] = value;
+    }
+
+    void RSPCore::write16(uint32_t address, uint16_t value) {
+        if ((address & 1) == 0) [[likely]] {
+            std::memcpy(&cpu_.cpubus_.rsp_dmem_[swizzle_address(address & DMEM_MASK, 2)], &value, sizeof(value));
+            return;
+        }
+        write8(address, value >> 8);
+        write8(address + 1, value);
+    }
+
+    void RSPCore::write32(uint32_t address, uint32_t value) {
+        if ((address & 3) == 0) [[likely]] {
+            std::memcpy(&cpu_.cpubus_.rsp_dmem_[address & DMEM_MASK], &value, sizeof(value));
+            return;
+        }
+        write8(address, value >> 24);
+        write8(address + 1, value >> 16);
+        write8(address + 2, value >> 8);
+        write8(address + 3, value);
+    }
+}
@@ -0,0 +1,188 @@
+#pragma once
+#ifndef TKP_N64_RSP_H
+#define TKP_N64_RSP_H
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <thread>
+#include "n64_audio_hle.hxx"
+#include "n64_gfx_hle.hxx"
+#include "n64_rsp_program.hxx"
+#include "n64_rsp_vu.hxx"
+#include "n64_scheduler.hxx"
+
+namespace TKPEmu::N64::Devices {
+    class CPU;
+
+    // SP_STATUS as read
+    constexpr uint32_t SP_STATUS_HALT = 1 << 0;
+    constexpr uint32_t SP_STATUS_BROKE = 1 << 1;
+    constexpr uint32_t SP_STATUS_SSTEP = 1 << 5;
+    constexpr uint32_t SP_STATUS_INTBREAK = 1 << 6;
+    // Signal 2, set by the graphics and audio microcode when a task is done
+    constexpr uint32_t SP_STATUS_SIG2 = 1 << 9;
+    // DPC_STATUS as read
+    constexpr uint32_t DPC_STATUS_XBUS = 1 << 0;
+    constexpr uint32_t DPC_STATUS_FREEZE = 1 << 1;
+    constexpr uint32_t DPC_STATUS_FLUSH = 1 << 2;
+    constexpr uint32_t DPC_STATUS_CBUF_READY = 1 << 7;
+    constexpr uint32_t DPC_STATUS_START_VALID = 1 << 10;
+
+    enum class RSPMode {
+        // Slices run on the emulation thread when their scheduler event fires, runs are reproducible
+        Synchronous,
+        /**
+         * Slices run on a host thread while the CPU keeps going. The CPU waits
+         * for the slice in flight before it touches DMEM, IMEM or the SP and
+         * DPC registers, so only RDRAM is accessed by both at once
+         */
+        Threaded,
+    };
+
+    /**
+        The RCP's scalar unit and its vector unit, running the microcode in IMEM.
+
+        Registers shared with the VR4300 (SP_STATUS, the DMA registers, the
+        semaphore and the DPC registers) live in RCP, both sides go through the
+        methods below so a store from either one has the same side effects.
+        DMAs finish instantly. There is no rasterizer yet, command lists sent
+        to the RDP are only scanned for SYNC_FULL so games waiting on the DP
+        interrupt keep going
+    */
+    class RSPCore {
+    public:
+        // RSP instructions run per scheduler event, the RSP runs at 2/3 of the CPU clock
+        static constexpr uint32_t SLICE_CYCLES = 1000;
+        static constexpr uint32_t SLICE_CPU_CYCLES = SLICE_CYCLES * 3 / 2;
+
+        explicit RSPCore(CPU& cpu);
+        ~RSPCore();
+        void Reset();
+        // Starts or stops the RSP thread, the slice in flight finishes first
+        void SetMode(RSPMode mode);
+        /**
+         * Graphics tasks for known microcode run on the host when the RSP is
+         * started, and finish right away. Other tasks still run on the RSP
+         */
+        void SetGraphicsHLE(bool enabled) {
+            Sync();
+            graphics_hle_enabled_ = enabled;
+        }
+        // Same for audio tasks for the standard audio microcode
+        void SetAudioHLE(bool enabled) {
+            Sync();
+            audio_hle_enabled_ = enabled;
+        }
+        const GraphicsTaskOutput& GetGraphicsTaskOutput() const {
+            return graphics_hle_.GetOutput();
+        }
+        RSPMode GetMode() const {
+            return threaded_ ? RSPMode::Threaded : RSPMode::Synchronous;
+        }
+        /**
+         * Runs the slice of the current Rsp scheduler event, or hands it to the
+         * RSP thread. Returns true if there should be another one
+         */
+        bool RunSlice();
+        /**
+         * Waits until the RSP thread is done with its slice, then applies the
+         * interrupts and RDRAM writes of that slice. Called before the CPU
+         * accesses anything the RSP can change, free in RSPMode::Synchronous
+         */
+        void Sync() {
+            if (threaded_) [[unlikely]] {
+                wait_idle();
+            }
+        }
+        /**
+         * Runs until cycles instructions have run or the RSP halts, returns
+         * the number of instructions run. Does nothing while halted
+         */
+        uint32_t Run(uint32_t cycles);
+        bool IsRunning() const;
+        // Moves execution to pc, the way an SP_PC store does
+        void SetPC(uint32_t pc);
+        // IMEM was written behind the RSP's back, the program is looked up again before the next instruction
+        void InvalidateIMEM() {
+            imem_dirty_ = true;
+        }
+        static RSPInstruction Decode(uint32_t instruction);
+        /**
+         * Applies a SP_STATUS store, each flag is cleared by the lower bit of its pair
+         * and set by the one above it, so bit 0 clears halt and bit 1 sets it.
+         * Returns true if the store woke up a halted RSP
+         */
+        bool WriteStatus(uint32_t data);
+        // Starts a DMA with an SP_RD_LEN (to_rdram false) or SP_WR_LEN store
+        void StartDMA(uint32_t length, bool to_rdram);
+        void WriteDPCStart(uint32_t data);
+        void WriteDPCEnd(uint32_t data);
+        void WriteDPCStatus(uint32_t data);
+    private:
+        void worker_loop();
+        void wait_idle();
+        void stop_worker();
+        // Effects on the rest of the machine, the RSP thread leaves them for the next Sync
+        void raise_interrupt(SchedulerEventType interrupt);
+        void clear_sp_interrupt();
+        void invalidate_rdram(uint32_t paddr, uint32_t size);
+        void apply_deferred();
+
+        // Runs the task the RSP was just started with on the host, if it can
+        bool run_hle_task();
+        // Instruction handlers, picked by Decode
+        struct Ops;
+        void load_program();
+        // MFC2, CFC2, MTC2 and CTC2
+        void execute_cop2(uint32_t instr);
+        void load_vector(uint32_t instr);
+        void store_vector(uint32_t instr);
+        void branch(bool taken, uint32_t pc, uint32_t instr);
+        void do_break();
+        uint32_t read_cop0(uint32_t reg);
+        void write_cop0(uint32_t reg, uint32_t value);
+        // Scans the command list between DPC_CURRENT and DPC_END
+        void run_rdp();
+        uint64_t read_rdp_command(uint32_t address);
+
+        // DMEM accesses wrap around at 4KB and don't need to be aligned
+        uint8_t read8(uint32_t address);
+        uint16_t read16(uint32_t address);
+        uint32_t read32(uint32_t address);
+        void write8(uint32_t address, uint8_t value);
+        void write16(uint32_t address, uint16_t value);
+        void write32(uint32_t address, uint32_t value);
+
+        CPU& cpu_;
+        std::array<uint32_t, 32> gpr_ {};
+        // Both 12-bit IMEM offsets, next_pc_ is where a branch in the delay slot leaves
+        uint32_t pc_ = 0;
+        uint32_t next_pc_ = 4;
+        VectorUnit vu_ {};
+        // Decoded IMEM, shared with every RSP that ran the same microcode
+        std::shared_ptr<const RSPProgram> program_;
+        bool imem_dirty_ = true;
+        GraphicsHLE graphics_hle_;
+        bool graphics_hle_enabled_ = false;
+        AudioHLE audio_hle_;
+        bool audio_hle_enabled_ = false;
+        // Set by the SP_STATUS store that clears the halt flag
+        bool task_started_ = false;
+
+        // RSP thread, budget_ is the number of RSP cycles granted so far and done_ the number finished
+        std::thread worker_;
+        bool threaded_ = false;
+        std::atomic<uint64_t> budget_ = 0;
+        std::atomic<uint64_t> done_ = 0;
+        std::atomic<bool> quit_ = false;
+        // Only touched by whichever thread runs the RSP, the budget handshake orders the accesses
+        bool deferred_ = false;
+        uint32_t pending_interrupts_ = 0;
+        bool pending_sp_clear_ = false;
+        uint32_t invalid_start_ = std::numeric_limits<uint32_t>::max();
+        uint32_t invalid_end_ = 0;
+    };
+}
+#endif
@@ -0,0 +1,119 @@
+#include "n64_rsp_program.hxx"
+#include <cstdio>
+#include <cstring>
+#include "n64_rsp.hxx"
+
+namespace TKPEmu::N64::Devices {
+    namespace {
+        // Start of a file written by RSPProgramCache::Save, followed by count IMEM images in big endian
+        struct CacheHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t count;
+        };
+        constexpr CacheHeader CACHE_HEADER { { 'N', '6', '4', 'R', 'S', 'P', 'U', 'C' }, 1, 0 };
+    }
+
+    RSPProgramCache& RSPProgramCache::Get() {
+        static RSPProgramCache cache;
+        return cache;
+    }
+
+    uint64_t RSPProgramCache::Hash(const uint8_t* imem) {
+        uint64_t hash = 0xcbf2'9ce4'8422'2325;
+        for (size_t i = 0; i < 0x1000; i += 8) {
+            uint64_t value;
+            std::memcpy(&value, imem + i, sizeof(value));
+            hash ^= value;
+            hash *= 0x100'0000'01b3;
+            hash ^= hash >> 29;
+        }
+        return hash;
+    }
+
+    std::shared_ptr<const RSPProgram> RSPProgramCache::Find(const uint8_t* imem) {
+        uint64_t hash = Hash(imem);
+        std::lock_guard lock(mutex_);
+        return find_locked(hash, imem);
+    }
+
+    std::shared_ptr<const RSPProgram> RSPProgramCache::find_locked(uint64_t hash, const uint8_t* imem) {
+        auto bucket = programs_.find(hash);
+        if (bucket != programs_.end()) {
+            for (const auto& program : bucket->second) {
+                if (std::memcmp(program->words.data(), imem, 0x1000) == 0) [[likely]] {
+                    return program;
+                }
+            }
+        }
+        auto program = decode(hash, imem);
+        // Past the cap nothing is added, not even an empty bucket
+        if (size_ < MAX_PROGRAMS) {
+            programs_[hash].push_back(program);
+            size_++;
+        }
+        return program;
+    }
+
+    std::shared_ptr<const RSPProgram> RSPProgramCache::decode(uint64_t hash, const uint8_t* imem) {
+        auto program = std::make_shared<RSPProgram>();
+        program->hash = hash;
+        std::memcpy(program->words.data(), imem, 0x1000);
+        for (size_t i = 0; i < RSPProgram::SIZE; i++) {
+            program->instructions[i] = RSPCore::Decode(program->words[i]);
+        }
+        return program;
+    }
+
+    size_t RSPProgramCache::GetSize() {
+        std::lock_guard lock(mutex_);
+        return size_;
+    }
+
+    bool RSPProgramCache::Save(const std::string& path) {
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        std::lock_guard lock(mutex_);
+        CacheHeader header = CACHE_HEADER;
+        header.count = size_;
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+        for (const auto& [hash, bucket] : programs_) {
+            for (const auto& program : bucket) {
+                std::array<uint32_t, RSPProgram::SIZE> words;
+                for (size_t i = 0; i < words.size(); i++) {
+                    words[i] = __builtin_bswap32(program->words[i]);
+                }
+                ok = ok && std::fwrite(words.data(), sizeof(words), 1, file) == 1;
+            }
+        }
+        return std::fclose(file) == 0 && ok;
+    }
+
+    bool RSPProgramCache::Load(const std::string& path) {
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) {
+            return false;
+        }
+        CacheHeader header;
+        bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+            std::memcmp(header.magic, CACHE_HEADER.magic, sizeof(header.magic)) == 0 &&
+            header.version == CACHE_HEADER.version;
+        for (uint32_t i = 0; ok && i < header.count; i++) {
+            std::array<uint32_t, RSPProgram::SIZE> words;
+            ok = std::fread(words.data(), sizeof(words), 1, file) == 1;
+            if (ok) {
+                for (auto& word : words) {
+                    word = __builtin_bswap32(word);
+                }
+                const uint8_t* imem = reinterpret_cast<const uint8_t*>(words.data());
+                uint64_t hash = Hash(imem);
+                std::lock_guard lock(mutex_);
+                find_locked(hash, imem);
+            }
+        }
+        std::fclose(file);
+        return ok;
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+#ifndef TKP_N64_RSP_PROGRAM_H
+#define TKP_N64_RSP_PROGRAM_H
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "n64_rsp_vu.hxx"
+
+namespace TKPEmu::N64::Devices {
+    class RSPCore;
+    struct RSPInstruction;
+    // pc is the IMEM offset of the instruction
+    using RSPHandler = void (*)(RSPCore& rsp, const RSPInstruction& instr, uint32_t pc);
+    /**
+        An RSP instruction decoded once, with the SPECIAL/REGIMM/COP0 hop and
+        the vector unit op already resolved
+    */
+    struct RSPInstruction {
+        RSPHandler handler;
+        VectorOp   vector_op; // COP2 vector instructions only
+        uint32_t   instruction;
+        int32_t    seimm;     // sign extended immediate
+        uint8_t    rs;
+        uint8_t    rt;
+        uint8_t    rd;
+        uint8_t    sa;
+    };
+    /**
+        All of IMEM decoded. The words it was decoded from are kept, so a hash
+        collision can't hand out the wrong program
+    */
+    struct RSPProgram {
+        static constexpr size_t SIZE = 0x1000 / 4;
+        uint64_t hash;
+        std::array<uint32_t, SIZE> words;
+        std::array<RSPInstruction, SIZE> instructions;
+    };
+    /**
+        Decoded microcode keyed by a hash of the IMEM contents, shared by every
+        RSP in the process. Games keep loading the same few microcodes (and the
+        same overlays on top of them), so after the first task each load costs
+        a hash of IMEM instead of a decode.
+
+        Programs are never dropped, RSPs hold on to the one they run. Past
+        MAX_PROGRAMS new programs are still decoded but not kept, so a game that
+        patches IMEM word by word doesn't grow the cache without bound
+    */
+    class RSPProgramCache {
+    public:
+        static constexpr size_t MAX_PROGRAMS = 512;
+        static RSPProgramCache& Get();
+        // imem is in host endian words like the rest of guest memory, thread safe
+        std::shared_ptr<const RSPProgram> Find(const uint8_t* imem);
+        size_t GetSize();
+        /**
+         * Writes the microcode of every cached program to path. Handlers are
+         * host pointers, so only IMEM images are stored and Load decodes them again
+         */
+        bool Save(const std::string& path);
+        // Adds the programs in a file written by Save, returns false if it can't be read
+        bool Load(const std::string& path);
+        static uint64_t Hash(const uint8_t* imem);
+    private:
+        RSPProgramCache() = default;
+        std::shared_ptr<const RSPProgram> find_locked(uint64_t hash, const uint8_t* imem);
+        static std::shared_ptr<const RSPProgram> decode(uint64_t hash, const uint8_t* imem);
+
+        std::mutex mutex_;
+        // Programs whose hashes collide share a bucket
+        std::unordered_map<uint64_t, std::vector<std::shared_ptr<const RSPProgram>>> programs_;
+        size_t size_ = 0;
+    };
+}
+#endif
@@ -0,0 +1,428 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include "n64_rsp_vu.hxx"
+
+namespace TKPEmu::N64::Devices {
+    namespace {
+        using Lanes = std::array<uint16_t, 8>;
+        constexpr uint16_t MASK = 0xFFFF;
+
+        Lanes broadcast(const VectorRegister& vt, uint32_t e) {
+            Lanes lanes;
+            for (uint32_t i = 0; i < 8; i++) {
+                lanes[i] = vt.elements[vector_element(e, i)];
+            }
+            return lanes;
+        }
+
+        int64_t get_acc(const VectorUnit& vu, int i) {
+            uint64_t acc = (static_cast<uint64_t>(vu.acc_h.elements[i]) << 32) |
+                (static_cast<uint64_t>(vu.acc_m.elements[i]) << 16) | vu.acc_l.elements[i];
+            // Sign extended from 48 bits
+            return static_cast<int64_t>(acc << 16) >> 16;
+        }
+
+        void set_acc(VectorUnit& vu, int i, int64_t acc) {
+            vu.acc_h.elements[i] = static_cast<uint16_t>(acc >> 32);
+            vu.acc_m.elements[i] = static_cast<uint16_t>(acc >> 16);
+            vu.acc_l.elements[i] = static_cast<uint16_t>(acc);
+        }
+
+        uint16_t sclamp(int64_t value) {
+            if (value < -32768) {
+                return 0x8000;
+            } else if (value > 32767) {
+                return 0x7FFF;
+            }
+            return static_cast<uint16_t>(value);
+        }
+
+        // Bits 47..16 clamped to a signed 16-bit value
+        uint16_t saturate_high(const VectorUnit& vu, int i) {
+            return sclamp(get_acc(vu, i) >> 16);
+        }
+
+        // The low 16 bits if bits 47..16 are their sign extension, 0 or 0xFFFF otherwise
+        uint16_t saturate_low(const VectorUnit& vu, int i) {
+            int64_t high = get_acc(vu, i) >> 16;
+            if (high < -32768 || high > 32767) {
+                return high < 0 ? 0 : MASK;
+            }
+            return vu.acc_l.elements[i];
+        }
+
+        uint16_t saturate_unsigned(const VectorUnit& vu, int i) {
+            int64_t high = get_acc(vu, i) >> 16;
+            if (high < 0) {
+                return 0;
+            } else if (high > 32767) {
+                return MASK;
+            }
+            return static_cast<uint16_t>(high);
+        }
+
+        uint16_t flag(bool set) {
+            return set ? MASK : 0;
+        }
+
+        // Runs lane(i, s, t) for every lane and writes the results to vd
+        template<class Lane>
+        void for_lanes(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e, Lane lane) {
+            Lanes s = vu.regs[vs].elements;
+            Lanes t = broadcast(vu.regs[vt], e);
+            Lanes d;
+            for (int i = 0; i < 8; i++) {
+                d[i] = lane(i, s[i], t[i]);
+            }
+            vu.regs[vd].elements = d;
+        }
+
+        #define LANE_OP(name, ...) \
+            void name(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) { \
+                for_lanes(vu, vd, vs, vt, e, [&](int i, uint16_t s, uint16_t t) -> uint16_t __VA_ARGS__); \
+            }
+
+        // Multiplies, s16 and u16 are the signed and unsigned views of an operand
+        #define s16(x) static_cast<int64_t>(static_cast<int16_t>(x))
+        #define u16(x) static_cast<int64_t>(x)
+        LANE_OP(v_mulf, { set_acc(vu, i, s16(s) * s16(t) * 2 + 0x8000); return saturate_high(vu, i); })
+        LANE_OP(v_mulu, { set_acc(vu, i, s16(s) * s16(t) * 2 + 0x8000); return saturate_unsigned(vu, i); })
+        LANE_OP(v_mulq, {
+            int32_t product = static_cast<int32_t>(s16(s) * s16(t));
+            if (product < 0) {
+                product += 31;
+            }
+            set_acc(vu, i, static_cast<int64_t>(product) << 16);
+            return sclamp(product >> 1) & ~15;
+        })
+        LANE_OP(v_mudl, { set_acc(vu, i, (u16(s) * u16(t)) >> 16); return vu.acc_l.elements[i]; })
+        LANE_OP(v_mudm, { set_acc(vu, i, s16(s) * u16(t)); return vu.acc_m.elements[i]; })
+        LANE_OP(v_mudn, { set_acc(vu, i, u16(s) * s16(t)); return vu.acc_l.elements[i]; })
+        LANE_OP(v_mudh, { set_acc(vu, i, (s16(s) * s16(t)) << 16); return saturate_high(vu, i); })
+        LANE_OP(v_macf, { set_acc(vu, i, get_acc(vu, i) + s16(s) * s16(t) * 2); return saturate_high(vu, i); })
+        LANE_OP(v_macu, { set_acc(vu, i, get_acc(vu, i) + s16(s) * s16(t) * 2); return saturate_unsigned(vu, i); })
+        LANE_OP(v_madl, { set_acc(vu, i, get_acc(vu, i) + ((u16(s) * u16(t)) >> 16)); return saturate_low(vu, i); })
+        LANE_OP(v_madm, { set_acc(vu, i, get_acc(vu, i) + s16(s) * u16(t)); return saturate_high(vu, i); })
+        LANE_OP(v_madn, { set_acc(vu, i, get_acc(vu, i) + u16(s) * s16(t)); return saturate_low(vu, i); })
+        LANE_OP(v_madh, { set_acc(vu, i, get_acc(vu, i) + ((s16(s) * s16(t)) << 16)); return saturate_high(vu, i); })
+        // Ignores its operands, only used by MPEG decoding microcode
+        void v_macq(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            for_lanes(vu, vd, vs, vt, e, [&](int i, uint16_t, uint16_t) -> uint16_t {
+                int32_t product = static_cast<int32_t>(get_acc(vu, i) >> 16);
+                if (product < 0 && !(product & (1 << 5))) {
+                    product += 32;
+                } else if (product >= 32 && !(product & (1 << 5))) {
+                    product -= 32;
+                }
+                vu.acc_h.elements[i] = static_cast<uint16_t>(product >> 16);
+                vu.acc_m.elements[i] = static_cast<uint16_t>(product);
+                return sclamp(product >> 1) & ~15;
+            });
+        }
+
+        // vs is not a register here, its low bit shifts the rounding value
+        template<bool Negative>
+        void v_rnd(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            for_lanes(vu, vd, vs, vt, e, [&](int i, uint16_t, uint16_t t) -> uint16_t {
+                int64_t product = s16(t) << ((vs & 1) ? 16 : 0);
+                int64_t acc = get_acc(vu, i);
+                if ((acc < 0) == Negative) {
+                    set_acc(vu, i, acc + product);
+                }
+                return saturate_high(vu, i);
+            });
+        }
+
+        // Adds and subtracts
+        void v_add(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            for_lanes(vu, vd, vs, vt, e, [&](int i, uint16_t s, uint16_t t) -> uint16_t {
+                int64_t result = s16(s) + s16(t) + (vu.vco_lo.elements[i] & 1);
+                vu.acc_l.elements[i] = static_cast<uint16_t>(result);
+                return sclamp(result);
+            });
+            vu.vco_lo = {};
+            vu.vco_hi = {};
+        }
+        void v_sub(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            for_lanes(vu, vd, vs, vt, e, [&](int i, uint16_t s, uint16_t t) -> uint16_t {
+                int64_t result = s16(s) - s16(t) - (vu.vco_lo.elements[i] & 1);
+                vu.acc_l.elements[i] = static_cast<uint16_t>(result);
+                return sclamp(result);
+            });
+            vu.vco_lo = {};
+            vu.vco_hi = {};
+        }
+        LANE_OP(v_abs, {
+            if (s16(s) < 0) {
+                // -(-32768) only saturates in vd
+                vu.acc_l.elements[i] = static_cast<uint16_t>(-s16(t));
+                return t == 0x8000 ? 0x7FFF : vu.acc_l.elements[i];
+            }
+            vu.acc_l.elements[i] = s == 0 ? 0 : t;
+            return vu.acc_l.elements[i];
+        })
+        LANE_OP(v_addc, {
+            int64_t result = u16(s) + u16(t);
+            vu.acc_l.elements[i] = static_cast<uint16_t>(result);
+            vu.vco_lo.elements[i] = flag(result > 0xFFFF);
+            vu.vco_hi.elements[i] = 0;
+            return vu.acc_l.elements[i];
+        })
+        LANE_OP(v_subc, {
+            int64_t result = u16(s) - u16(t);
+            vu.acc_l.elements[i] = static_cast<uint16_t>(result);
+            vu.vco_lo.elements[i] = flag(result < 0);
+            vu.vco_hi.elements[i] = flag(result != 0);
+            return vu.acc_l.elements[i];
+        })
+        void v_sar(VectorUnit& vu, uint32_t vd, uint32_t, uint32_t, uint32_t e) {
+            switch (e) {
+                case 8: vu.regs[vd] = vu.acc_h; break;
+                case 9: vu.regs[vd] = vu.acc_m; break;
+                case 10: vu.regs[vd] = vu.acc_l; break;
+                default: vu.regs[vd] = {}; break;
+            }
+        }
+        // The reserved opcodes add into the accumulator and write zeroes
+        LANE_OP(v_zero, { vu.acc_l.elements[i] = static_cast<uint16_t>(s + t); return 0; })
+
+        // Selects, every one of them leaves its choice in the low accumulator too
+        template<class Compare>
+        void v_compare(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e, Compare compare) {
+            for_lanes(vu, vd, vs, vt, e, [&](int i, uint16_t s, uint16_t t) -> uint16_t {
+                bool carry = vu.vco_lo.elements[i], not_equal = vu.vco_hi.elements[i];
+                bool result = compare(s16(s), s16(t), carry, not_equal);
+                vu.vcc_lo.elements[i] = flag(result);
+                vu.acc_l.elements[i] = result ? s : t;
+                return vu.acc_l.elements[i];
+            });
+            vu.vcc_hi = {};
+            vu.vco_lo = {};
+            vu.vco_hi = {};
+        }
+        void v_lt(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            v_compare(vu, vd, vs, vt, e, [](int64_t s, int64_t t, bool carry, bool not_equal) {
+                return s < t || (s == t && carry && not_equal);
+            });
+        }
+        void v_eq(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            v_compare(vu, vd, vs, vt, e, [](int64_t s, int64_t t, bool, bool not_equal) {
+                return s == t && !not_equal;
+            });
+        }
+        void v_ne(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            v_compare(vu, vd, vs, vt, e, [](int64_t s, int64_t t, bool, bool not_equal) {
+                return s != t || not_equal;
+            });
+        }
+        void v_ge(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            v_compare(vu, vd, vs, vt, e, [](int64_t s, int64_t t, bool carry, bool not_equal) {
+                return s > t || (s == t && !(carry && not_equal));
+            });
+        }
+        void v_cl(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            for_lanes(vu, vd, vs, vt, e, [&](int i, uint16_t s, uint16_t t) -> uint16_t {
+                uint16_t& compare = vu.vcc_lo.elements[i];
+                uint16_t& clip = vu.vcc_hi.elements[i];
+                if (vu.vco_lo.elements[i]) {
+                    if (!vu.vco_hi.elements[i]) {
+                        uint32_t sum = u16(s) + u16(t);
+                        bool zero = (sum & 0xFFFF) == 0, carry = sum > 0xFFFF;
+                        compare = flag(vu.vce.elements[i] ? (zero || !carry) : (zero && !carry));
+                    }
+                    vu.acc_l.elements[i] = compare ? static_cast<uint16_t>(-t) : s;
+                } else {
+                    if (!vu.vco_hi.elements[i]) {
+                        clip = flag(s >= t);
+                    }
+                    vu.acc_l.elements[i] = clip ? t : s;
+                }
+                return vu.acc_l.elements[i];
+            });
+            vu.vco_lo = {};
+            vu.vco_hi = {};
+            vu.vce = {};
+        }
+        LANE_OP(v_ch, {
+            int64_t ss = s16(s), st = s16(t);
+            bool sign = (ss < 0) != (st < 0);
+            int64_t result = sign ? ss + st : ss - st;
+            if (sign) {
+                vu.vcc_lo.elements[i] = flag(result <= 0);
+                vu.vcc_hi.elements[i] = flag(st < 0);
+                vu.acc_l.elements[i] = result <= 0 ? static_cast<uint16_t>(-st) : s;
+            } else {
+                vu.vcc_lo.elements[i] = flag(st < 0);
+                vu.vcc_hi.elements[i] = flag(result >= 0);
+                vu.acc_l.elements[i] = result >= 0 ? t : s;
+            }
+            vu.vco_lo.elements[i] = flag(sign);
+            vu.vco_hi.elements[i] = flag(result != 0 && s != static_cast<uint16_t>(~t));
+            vu.vce.elements[i] = flag(sign && result == -1);
+            return vu.acc_l.elements[i];
+        })
+        void v_cr(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            for_lanes(vu, vd, vs, vt, e, [&](int i, uint16_t s, uint16_t t) -> uint16_t {
+                int64_t ss = s16(s), st = s16(t);
+                if ((ss < 0) != (st < 0)) {
+                    bool le = ss + st + 1 <= 0;
+                    vu.vcc_lo.elements[i] = flag(le);
+                    vu.vcc_hi.elements[i] = flag(st < 0);
+                    vu.acc_l.elements[i] = le ? static_cast<uint16_t>(~t) : s;
+                } else {
+                    bool ge = ss - st >= 0;
+                    vu.vcc_lo.elements[i] = flag(st < 0);
+                    vu.vcc_hi.elements[i] = flag(ge);
+                    vu.acc_l.elements[i] = ge ? t : s;
+                }
+                return vu.acc_l.elements[i];
+            });
+            vu.vco_lo = {};
+            vu.vco_hi = {};
+            vu.vce = {};
+        }
+        void v_mrg(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            for_lanes(vu, vd, vs, vt, e, [&](int i, uint16_t s, uint16_t t) -> uint16_t {
+                vu.acc_l.elements[i] = vu.vcc_lo.elements[i] ? s : t;
+                return vu.acc_l.elements[i];
+            });
+            vu.vco_lo = {};
+            vu.vco_hi = {};
+        }
+        LANE_OP(v_and, { return vu.acc_l.elements[i] = s & t; })
+        LANE_OP(v_nand, { return vu.acc_l.elements[i] = ~(s & t); })
+        LANE_OP(v_or, { return vu.acc_l.elements[i] = s | t; })
+        LANE_OP(v_nor, { return vu.acc_l.elements[i] = ~(s | t); })
+        LANE_OP(v_xor, { return vu.acc_l.elements[i] = s ^ t; })
+        LANE_OP(v_nxor, { return vu.acc_l.elements[i] = ~(s ^ t); })
+        #undef s16
+        #undef u16
+        #undef LANE_OP
+
+        // Divide unit, the 512 entry ROMs the hardware looks up
+        const std::array<uint16_t, 512>& reciprocals() {
+            static const std::array<uint16_t, 512> table = [] {
+                std::array<uint16_t, 512> table;
+                for (uint64_t i = 0; i < 512; i++) {
+                    uint64_t b = (uint64_t { 1 } << 34) / (i + 512);
+                    table[i] = static_cast<uint16_t>((b + 1) >> 8);
+                }
+                return table;
+            }();
+            return table;
+        }
+        const std::array<uint16_t, 512>& inverse_square_roots() {
+            static const std::array<uint16_t, 512> table = [] {
+                constexpr uint64_t ONE = uint64_t { 1 } << 44;
+                std::array<uint16_t, 512> table;
+                for (uint64_t i = 0; i < 512; i++) {
+                    uint64_t a = (i + 512) >> (i & 1);
+                    // The largest b with a * b * b < ONE, starting from just below the estimate
+                    uint64_t estimate = static_cast<uint64_t>(std::sqrt(static_cast<double>(ONE) / a));
+                    uint64_t b = std::max<uint64_t>(uint64_t { 1 } << 17, estimate - 2);
+                    while (a * (b + 1) * (b + 1) < ONE) {
+                        b++;
+                    }
+                    table[i] = static_cast<uint16_t>(b >> 1);
+                }
+                return table;
+            }();
+            return table;
+        }
+
+        // VRCP, VRCPL, VRSQ and VRSQL, de is the destination element
+        template<bool SquareRoot, bool Low>
+        void v_divide(VectorUnit& vu, uint32_t vd, uint32_t de, uint32_t vt, uint32_t e) {
+            Lanes source = broadcast(vu.regs[vt], e);
+            uint16_t element = vu.regs[vt].elements[e & 7];
+            int32_t input = (Low && vu.div_dp) ? static_cast<int32_t>((static_cast<uint32_t>(vu.div_in) << 16) | element)
+                : static_cast<int16_t>(element);
+            int32_t mask = input >> 31;
+            int32_t data = input ^ mask;
+            if (input > -32768) {
+                data -= mask;
+            }
+            int32_t result;
+            if (data == 0) {
+                result = 0x7FFF'FFFF;
+            } else if (input == -32768) {
+                result = static_cast<int32_t>(0xFFFF'0000);
+            } else {
+                uint32_t shift = std::countl_zero(static_cast<uint32_t>(data));
+                uint32_t index = static_cast<uint32_t>((static_cast<uint64_t>(static_cast<uint32_t>(data)) << shift) & 0x7FC0'0000) >> 22;
+                if constexpr (SquareRoot) {
+                    result = inverse_square_roots()[(index & 0x1FE) | (shift & 1)];
+                    result = (0x10000 | result) << 14;
+                    result = (result >> ((31 - shift) >> 1)) ^ mask;
+                } else {
+                    result = reciprocals()[index];
+                    result = (0x10000 | result) << 14;
+                    result = (result >> (31 - shift)) ^ mask;
+                }
+            }
+            vu.div_dp = false;
+            vu.div_out = static_cast<uint16_t>(result >> 16);
+            vu.acc_l.elements = source;
+            vu.regs[vd].elements[de & 7] = static_cast<uint16_t>(result);
+        }
+        // VRCPH and VRSQH, latch the high half of the next input and return the last result's
+        void v_divide_high(VectorUnit& vu, uint32_t vd, uint32_t de, uint32_t vt, uint32_t e) {
+            Lanes source = broadcast(vu.regs[vt], e);
+            vu.div_dp = true;
+            vu.div_in = vu.regs[vt].elements[e & 7];
+            vu.acc_l.elements = source;
+            vu.regs[vd].elements[de & 7] = vu.div_out;
+        }
+        void v_mov(VectorUnit& vu, uint32_t vd, uint32_t de, uint32_t vt, uint32_t e) {
+            Lanes source = broadcast(vu.regs[vt], e);
+            vu.acc_l.elements = source;
+            vu.regs[vd].elements[de & 7] = source[de & 7];
+        }
+        void v_nop(VectorUnit&, uint32_t, uint32_t, uint32_t, uint32_t) {}
+    }
+
+    const VectorOpTable& scalar_vector_ops() {
+        static const VectorOpTable table = [] {
+            VectorOpTable table;
+            table.fill(&v_zero);
+            table[0x00] = &v_mulf;  table[0x01] = &v_mulu;  table[0x02] = &v_rnd<false>; table[0x03] = &v_mulq;
+            table[0x04] = &v_mudl;  table[0x05] = &v_mudm;  table[0x06] = &v_mudn;  table[0x07] = &v_mudh;
+            table[0x08] = &v_macf;  table[0x09] = &v_macu;  table[0x0A] = &v_rnd<true>; table[0x0B] = &v_macq;
+            table[0x0C] = &v_madl;  table[0x0D] = &v_madm;  table[0x0E] = &v_madn;  table[0x0F] = &v_madh;
+            table[0x10] = &v_add;   table[0x11] = &v_sub;   table[0x13] = &v_abs;
+            table[0x14] = &v_addc;  table[0x15] = &v_subc;  table[0x1D] = &v_sar;
+            table[0x20] = &v_lt;    table[0x21] = &v_eq;    table[0x22] = &v_ne;    table[0x23] = &v_ge;
+            table[0x24] = &v_cl;    table[0x25] = &v_ch;    table[0x26] = &v_cr;    table[0x27] = &v_mrg;
+            table[0x28] = &v_and;   table[0x29] = &v_nand;  table[0x2A] = &v_or;    table[0x2B] = &v_nor;
+            table[0x2C] = &v_xor;   table[0x2D] = &v_nxor;
+            table[0x30] = &v_divide<false, false>; table[0x31] = &v_divide<false, true>;
+            table[0x32] = &v_divide_high; table[0x33] = &v_mov;
+            table[0x34] = &v_divide<true, false>; table[0x35] = &v_divide<true, true>;
+            table[0x36] = &v_divide_high; table[0x37] = &v_nop; table[0x3F] = &v_nop;
+            return table;
+        }();
+        return table;
+    }
+
+    const VectorOpTable& vector_ops() {
+        static const VectorOpTable& table = simd_vector_ops() ? *simd_vector_ops() : scalar_vector_ops();
+        return table;
+    }
+
+    uint16_t pack_flags(const VectorRegister& lo, const VectorRegister& hi) {
+        uint16_t value = 0;
+        for (int i = 0; i < 8; i++) {
+            value |= (lo.elements[i] ? 1 : 0) << i;
+            value |= (hi.elements[i] ? 1 : 0) << (i + 8);
+        }
+        return value;
+    }
+
+    void unpack_flags(uint16_t value, VectorRegister& lo, VectorRegister& hi) {
+        for (int i = 0; i < 8; i++) {
+            lo.elements[i] = flag(value & (1 << i));
+            hi.elements[i] = flag(value & (1 << (i + 8)));
+        }
+    }
+}
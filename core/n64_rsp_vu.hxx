@@ -0,0 +1,75 @@
+#pragma once
+#ifndef TKP_N64_RSP_VU_H
+#define TKP_N64_RSP_VU_H
+#include <cstdint>
+#include <array>
+
+// SSE4.1 kernels are compiled for every x86-64 GCC/Clang build and picked at runtime
+#if defined(__x86_64__) && defined(__GNUC__)
+#define N64TKP_HAS_SIMD_VU 1
+#else
+#define N64TKP_HAS_SIMD_VU 0
+#endif
+
+namespace TKPEmu::N64::Devices {
+    /**
+        One 128-bit RSP vector register. elements[0] is element 0, the one at
+        the lowest DMEM address, so bytes are numbered in big endian order
+    */
+    struct alignas(16) VectorRegister {
+        std::array<uint16_t, 8> elements;
+        uint8_t GetByte(uint32_t index) const {
+            return reinterpret_cast<const uint8_t*>(elements.data())[(index & 15) ^ 1];
+        }
+        void SetByte(uint32_t index, uint8_t value) {
+            reinterpret_cast<uint8_t*>(elements.data())[(index & 15) ^ 1] = value;
+        }
+        bool operator==(const VectorRegister&) const = default;
+    };
+    /**
+        The RSP's COP2. Flags are kept as lane masks (0xFFFF when set) so the
+        kernels can use them as blend masks, CFC2 and CTC2 pack and unpack them
+    */
+    struct VectorUnit {
+        std::array<VectorRegister, 32> regs {};
+        // 48-bit accumulators, high, middle and low 16 bits of each lane
+        VectorRegister acc_h {}, acc_m {}, acc_l {};
+        VectorRegister vco_lo {}, vco_hi {}; // carry, not equal
+        VectorRegister vcc_lo {}, vcc_hi {}; // compare, clip
+        VectorRegister vce {};
+        // Divide unit, VRCPH/VRSQH latch the high half of a double precision input
+        uint16_t div_in = 0;
+        uint16_t div_out = 0;
+        bool div_dp = false;
+        bool operator==(const VectorUnit&) const = default;
+    };
+    /**
+        Runs one COP2 computational instruction. vd, vs and vt are register
+        numbers, e is the element field. The divide instructions take the
+        destination element in vs
+    */
+    using VectorOp = void (*)(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e);
+    using VectorOpTable = std::array<VectorOp, 64>;
+    // Lane by lane implementation of every op, the reference the SIMD kernels are checked against
+    const VectorOpTable& scalar_vector_ops();
+    // The SSE4.1 kernels, nullptr if they weren't built or the host lacks SSE4.1
+    const VectorOpTable* simd_vector_ops();
+    // The fastest table the host can run
+    const VectorOpTable& vector_ops();
+    // VCO and VCC layout for CFC2/CTC2, bit n of each byte is element n
+    uint16_t pack_flags(const VectorRegister& lo, const VectorRegister& hi);
+    void unpack_flags(uint16_t value, VectorRegister& lo, VectorRegister& hi);
+    // Source element of lane for element field e, the 0q/1q, 0h-3h and 0-7 broadcasts
+    constexpr uint32_t vector_element(uint32_t e, uint32_t lane) {
+        e &= 15;
+        if (e < 2) {
+            return lane;
+        } else if (e < 4) {
+            return (lane & ~1u) | (e & 1);
+        } else if (e < 8) {
+            return (lane & ~3u) | (e & 3);
+        }
+        return e & 7;
+    }
+}
+#endif
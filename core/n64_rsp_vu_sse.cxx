@@ -0,0 +1,386 @@
+#include "n64_rsp_vu.hxx"
+#if N64TKP_HAS_SIMD_VU
+#include <immintrin.h>
+
+// Every function here is compiled for SSE4.1 and only reached after checking the host has it
+#define SSE41 [[gnu::target("sse4.1")]]
+
+namespace TKPEmu::N64::Devices {
+    namespace {
+        // pshufb masks for the element field, see vector_element
+        struct alignas(16) ShuffleMask {
+            std::array<uint8_t, 16> bytes;
+        };
+        constexpr std::array<ShuffleMask, 16> SHUFFLES = [] {
+            std::array<ShuffleMask, 16> shuffles {};
+            for (uint32_t e = 0; e < 16; e++) {
+                for (uint32_t lane = 0; lane < 8; lane++) {
+                    uint32_t element = vector_element(e, lane);
+                    shuffles[e].bytes[lane * 2] = static_cast<uint8_t>(element * 2);
+                    shuffles[e].bytes[lane * 2 + 1] = static_cast<uint8_t>(element * 2 + 1);
+                }
+            }
+            return shuffles;
+        }();
+
+        struct Accumulator {
+            __m128i h, m, l;
+        };
+
+        SSE41 inline __m128i load(const VectorRegister& reg) {
+            return _mm_load_si128(reinterpret_cast<const __m128i*>(reg.elements.data()));
+        }
+        SSE41 inline void store(VectorRegister& reg, __m128i value) {
+            _mm_store_si128(reinterpret_cast<__m128i*>(reg.elements.data()), value);
+        }
+        SSE41 inline __m128i broadcast(const VectorRegister& reg, uint32_t e) {
+            return _mm_shuffle_epi8(load(reg), _mm_load_si128(reinterpret_cast<const __m128i*>(SHUFFLES[e & 15].bytes.data())));
+        }
+        SSE41 inline Accumulator load_acc(const VectorUnit& vu) {
+            return { load(vu.acc_h), load(vu.acc_m), load(vu.acc_l) };
+        }
+        SSE41 inline void store_acc(VectorUnit& vu, const Accumulator& acc) {
+            store(vu.acc_h, acc.h);
+            store(vu.acc_m, acc.m);
+            store(vu.acc_l, acc.l);
+        }
+        SSE41 inline __m128i ones() {
+            return _mm_set1_epi32(-1);
+        }
+
+        // 1 in the lanes where a + b = sum carried out of 16 bits
+        SSE41 inline __m128i carry_out(__m128i a, __m128i b, __m128i sum) {
+            __m128i carry = _mm_or_si128(_mm_and_si128(a, b), _mm_andnot_si128(sum, _mm_or_si128(a, b)));
+            return _mm_srli_epi16(carry, 15);
+        }
+        // Adds a 48-bit value, given as three 16-bit slices, to every lane of the accumulator
+        SSE41 inline void acc_add(Accumulator& acc, __m128i l, __m128i m, __m128i h) {
+            __m128i sum_l = _mm_add_epi16(acc.l, l);
+            __m128i carry_l = carry_out(acc.l, l, sum_l);
+            __m128i sum_m = _mm_add_epi16(acc.m, m);
+            __m128i carry_m = carry_out(acc.m, m, sum_m);
+            __m128i sum_m_carry = _mm_add_epi16(sum_m, carry_l);
+            // The low carry wraps a middle slice of 0xFFFF around to 0
+            carry_m = _mm_add_epi16(carry_m, _mm_and_si128(carry_l, _mm_cmpeq_epi16(sum_m_carry, _mm_setzero_si128())));
+            acc.l = sum_l;
+            acc.m = sum_m_carry;
+            acc.h = _mm_add_epi16(_mm_add_epi16(acc.h, h), carry_m);
+        }
+
+        // Bits 47..16 clamped to a signed 16-bit value
+        SSE41 inline __m128i saturate_high(const Accumulator& acc) {
+            return _mm_packs_epi32(_mm_unpacklo_epi16(acc.m, acc.h), _mm_unpackhi_epi16(acc.m, acc.h));
+        }
+        // The low slice if bits 47..16 are its sign extension, 0 or 0xFFFF otherwise
+        SSE41 inline __m128i saturate_low(const Accumulator& acc) {
+            __m128i fits = _mm_cmpeq_epi16(acc.h, _mm_srai_epi16(acc.m, 15));
+            __m128i clamped = _mm_xor_si128(_mm_srai_epi16(acc.h, 15), ones());
+            return _mm_blendv_epi8(clamped, acc.l, fits);
+        }
+        SSE41 inline __m128i saturate_unsigned(const Accumulator& acc) {
+            __m128i negative = _mm_srai_epi16(acc.h, 15);
+            __m128i over = _mm_or_si128(_mm_cmpgt_epi16(acc.h, _mm_setzero_si128()), _mm_srai_epi16(acc.m, 15));
+            return _mm_andnot_si128(negative, _mm_or_si128(acc.m, over));
+        }
+
+        // Low four lanes of s - t - carry in 32 bits
+        SSE41 inline __m128i widen_sub(__m128i s, __m128i t, __m128i carry) {
+            return _mm_sub_epi32(_mm_sub_epi32(_mm_cvtepi16_epi32(s), _mm_cvtepi16_epi32(t)), _mm_cvtepi16_epi32(carry));
+        }
+
+        // High halves of signed by unsigned and unsigned by signed products
+        SSE41 inline __m128i mulhi_su(__m128i s, __m128i u) {
+            return _mm_sub_epi16(_mm_mulhi_epu16(s, u), _mm_and_si128(_mm_srai_epi16(s, 15), u));
+        }
+
+        enum class Multiply { F, U, DL, DM, DN, DH };
+        // The VMUL, VMUD, VMAC and VMAD groups, Accumulate adds the product instead of replacing the accumulator
+        template<Multiply Type, bool Accumulate>
+        SSE41 void v_multiply(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            __m128i s = load(vu.regs[vs]);
+            __m128i t = broadcast(vu.regs[vt], e);
+            __m128i zero = _mm_setzero_si128();
+            __m128i l, m, h;
+            if constexpr (Type == Multiply::F || Type == Multiply::U) {
+                // Twice the signed product
+                __m128i lo = _mm_mullo_epi16(s, t);
+                __m128i hi = _mm_mulhi_epi16(s, t);
+                l = _mm_slli_epi16(lo, 1);
+                m = _mm_or_si128(_mm_slli_epi16(hi, 1), _mm_srli_epi16(lo, 15));
+                h = _mm_srai_epi16(hi, 15);
+            } else if constexpr (Type == Multiply::DL) {
+                l = _mm_mulhi_epu16(s, t);
+                m = zero;
+                h = zero;
+            } else if constexpr (Type == Multiply::DM) {
+                l = _mm_mullo_epi16(s, t);
+                m = mulhi_su(s, t);
+                h = _mm_srai_epi16(m, 15);
+            } else if constexpr (Type == Multiply::DN) {
+                l = _mm_mullo_epi16(s, t);
+                m = mulhi_su(t, s);
+                h = _mm_srai_epi16(m, 15);
+            } else {
+                l = zero;
+                m = _mm_mullo_epi16(s, t);
+                h = _mm_mulhi_epi16(s, t);
+            }
+            Accumulator acc;
+            if constexpr (Accumulate) {
+                acc = load_acc(vu);
+                acc_add(acc, l, m, h);
+            } else if constexpr (Type == Multiply::F || Type == Multiply::U) {
+                // Rounding, adding 0x8000 carries into the middle slice when bit 15 is set
+                __m128i carry = _mm_srli_epi16(l, 15);
+                __m128i middle = _mm_add_epi16(m, carry);
+                __m128i high_carry = _mm_and_si128(carry, _mm_cmpeq_epi16(middle, zero));
+                acc = { _mm_add_epi16(h, high_carry), middle, _mm_xor_si128(l, _mm_set1_epi16(static_cast<int16_t>(0x8000))) };
+            } else {
+                acc = { h, m, l };
+            }
+            store_acc(vu, acc);
+            __m128i result;
+            if constexpr (Type == Multiply::U) {
+                result = saturate_unsigned(acc);
+            } else if constexpr (Type == Multiply::F || Type == Multiply::DH || (Accumulate && Type == Multiply::DM)) {
+                result = saturate_high(acc);
+            } else if constexpr (Accumulate) {
+                result = saturate_low(acc);
+            } else if constexpr (Type == Multiply::DM) {
+                result = acc.m;
+            } else {
+                result = acc.l;
+            }
+            store(vu.regs[vd], result);
+        }
+
+        SSE41 void v_add(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            __m128i s = load(vu.regs[vs]);
+            __m128i t = broadcast(vu.regs[vt], e);
+            __m128i carry = _mm_srli_epi16(load(vu.vco_lo), 15);
+            // The carry can't saturate the smaller operand unless the sum saturates anyway
+            __m128i result = _mm_adds_epi16(_mm_adds_epi16(_mm_min_epi16(s, t), carry), _mm_max_epi16(s, t));
+            store(vu.acc_l, _mm_add_epi16(_mm_add_epi16(s, t), carry));
+            store(vu.regs[vd], result);
+            vu.vco_lo = {};
+            vu.vco_hi = {};
+        }
+        SSE41 void v_sub(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            __m128i s = load(vu.regs[vs]);
+            __m128i t = broadcast(vu.regs[vt], e);
+            __m128i carry = _mm_srli_epi16(load(vu.vco_lo), 15);
+            // s - t - carry can be out of 16 bit range twice over, saturate once in 32 bits
+            __m128i low = widen_sub(s, t, carry);
+            __m128i high = widen_sub(_mm_srli_si128(s, 8), _mm_srli_si128(t, 8), _mm_srli_si128(carry, 8));
+            store(vu.acc_l, _mm_sub_epi16(_mm_sub_epi16(s, t), carry));
+            store(vu.regs[vd], _mm_packs_epi32(low, high));
+            vu.vco_lo = {};
+            vu.vco_hi = {};
+        }
+        SSE41 void v_abs(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            __m128i s = load(vu.regs[vs]);
+            __m128i t = broadcast(vu.regs[vt], e);
+            __m128i negative = _mm_srai_epi16(s, 15);
+            // ~t - (-1) is -t, the saturating version keeps -(-32768) at 32767
+            __m128i value = _mm_xor_si128(_mm_andnot_si128(_mm_cmpeq_epi16(s, _mm_setzero_si128()), t), negative);
+            store(vu.acc_l, _mm_sub_epi16(value, negative));
+            store(vu.regs[vd], _mm_subs_epi16(value, negative));
+        }
+        SSE41 void v_addc(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            __m128i s = load(vu.regs[vs]);
+            __m128i t = broadcast(vu.regs[vt], e);
+            __m128i sum = _mm_add_epi16(s, t);
+            __m128i carry = _mm_xor_si128(_mm_cmpeq_epi16(_mm_adds_epu16(s, t), sum), ones());
+            store(vu.acc_l, sum);
+            store(vu.regs[vd], sum);
+            store(vu.vco_lo, carry);
+            vu.vco_hi = {};
+        }
+        SSE41 void v_subc(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            __m128i s = load(vu.regs[vs]);
+            __m128i t = broadcast(vu.regs[vt], e);
+            __m128i zero = _mm_setzero_si128();
+            __m128i difference = _mm_sub_epi16(s, t);
+            __m128i borrow = _mm_xor_si128(_mm_cmpeq_epi16(_mm_subs_epu16(t, s), zero), ones());
+            __m128i not_equal = _mm_xor_si128(_mm_cmpeq_epi16(s, t), ones());
+            store(vu.acc_l, difference);
+            store(vu.regs[vd], difference);
+            store(vu.vco_lo, borrow);
+            store(vu.vco_hi, not_equal);
+        }
+
+        enum class Compare { LT, EQ, NE, GE };
+        template<Compare Type>
+        SSE41 void v_compare(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            __m128i s = load(vu.regs[vs]);
+            __m128i t = broadcast(vu.regs[vt], e);
+            __m128i carry = load(vu.vco_lo);
+            __m128i not_equal = load(vu.vco_hi);
+            __m128i equal = _mm_cmpeq_epi16(s, t);
+            __m128i result;
+            if constexpr (Type == Compare::LT) {
+                result = _mm_or_si128(_mm_cmplt_epi16(s, t), _mm_and_si128(equal, _mm_and_si128(carry, not_equal)));
+            } else if constexpr (Type == Compare::EQ) {
+                result = _mm_andnot_si128(not_equal, equal);
+            } else if constexpr (Type == Compare::NE) {
+                result = _mm_or_si128(_mm_xor_si128(equal, ones()), not_equal);
+            } else {
+                result = _mm_or_si128(_mm_cmpgt_epi16(s, t), _mm_andnot_si128(_mm_and_si128(carry, not_equal), equal));
+            }
+            __m128i selected = _mm_blendv_epi8(t, s, result);
+            store(vu.vcc_lo, result);
+            store(vu.acc_l, selected);
+            store(vu.regs[vd], selected);
+            vu.vcc_hi = {};
+            vu.vco_lo = {};
+            vu.vco_hi = {};
+        }
+        SSE41 void v_cl(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            __m128i s = load(vu.regs[vs]);
+            __m128i t = broadcast(vu.regs[vt], e);
+            __m128i zero = _mm_setzero_si128();
+            __m128i carry = load(vu.vco_lo);
+            __m128i not_equal = load(vu.vco_hi);
+            __m128i extension = load(vu.vce);
+            __m128i sum = _mm_add_epi16(s, t);
+            __m128i no_carry = _mm_cmpeq_epi16(_mm_adds_epu16(s, t), sum);
+            __m128i sum_zero = _mm_cmpeq_epi16(sum, zero);
+            __m128i low = _mm_blendv_epi8(_mm_and_si128(sum_zero, no_carry), _mm_or_si128(sum_zero, no_carry), extension);
+            __m128i compare = _mm_blendv_epi8(load(vu.vcc_lo), low, _mm_andnot_si128(not_equal, carry));
+            // Unsigned s >= t
+            __m128i high = _mm_cmpeq_epi16(_mm_subs_epu16(t, s), zero);
+            __m128i clip = _mm_blendv_epi8(load(vu.vcc_hi), high, _mm_xor_si128(_mm_or_si128(carry, not_equal), ones()));
+            __m128i low_pick = _mm_blendv_epi8(s, _mm_sub_epi16(zero, t), compare);
+            __m128i high_pick = _mm_blendv_epi8(s, t, clip);
+            __m128i result = _mm_blendv_epi8(high_pick, low_pick, carry);
+            store(vu.vcc_lo, compare);
+            store(vu.vcc_hi, clip);
+            store(vu.acc_l, result);
+            store(vu.regs[vd], result);
+            vu.vco_lo = {};
+            vu.vco_hi = {};
+            vu.vce = {};
+        }
+        SSE41 void v_ch(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            __m128i s = load(vu.regs[vs]);
+            __m128i t = broadcast(vu.regs[vt], e);
+            __m128i zero = _mm_setzero_si128();
+            // Neither the sum of different signs nor the difference of equal signs overflows
+            __m128i sign = _mm_srai_epi16(_mm_xor_si128(s, t), 15);
+            __m128i value = _mm_blendv_epi8(_mm_sub_epi16(s, t), _mm_add_epi16(s, t), sign);
+            __m128i less_equal = _mm_xor_si128(_mm_cmpgt_epi16(value, zero), ones());
+            __m128i greater_equal = _mm_cmpgt_epi16(value, ones());
+            __m128i t_negative = _mm_srai_epi16(t, 15);
+            __m128i compare = _mm_blendv_epi8(t_negative, less_equal, sign);
+            __m128i clip = _mm_blendv_epi8(greater_equal, t_negative, sign);
+            __m128i pick = _mm_blendv_epi8(greater_equal, less_equal, sign);
+            __m128i result = _mm_blendv_epi8(s, _mm_blendv_epi8(t, _mm_sub_epi16(zero, t), sign), pick);
+            __m128i not_equal = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi16(value, zero),
+                _mm_cmpeq_epi16(s, _mm_xor_si128(t, ones()))), ones());
+            store(vu.vcc_lo, compare);
+            store(vu.vcc_hi, clip);
+            store(vu.vco_lo, sign);
+            store(vu.vco_hi, not_equal);
+            store(vu.vce, _mm_and_si128(sign, _mm_cmpeq_epi16(value, ones())));
+            store(vu.acc_l, result);
+            store(vu.regs[vd], result);
+        }
+        SSE41 void v_cr(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            __m128i s = load(vu.regs[vs]);
+            __m128i t = broadcast(vu.regs[vt], e);
+            __m128i sign = _mm_srai_epi16(_mm_xor_si128(s, t), 15);
+            // s + t + 1 <= 0 is s + t < 0
+            __m128i less_equal = _mm_srai_epi16(_mm_add_epi16(s, t), 15);
+            __m128i greater_equal = _mm_xor_si128(_mm_srai_epi16(_mm_sub_epi16(s, t), 15), ones());
+            __m128i t_negative = _mm_srai_epi16(t, 15);
+            __m128i pick = _mm_blendv_epi8(greater_equal, less_equal, sign);
+            __m128i result = _mm_blendv_epi8(s, _mm_xor_si128(t, sign), pick);
+            store(vu.vcc_lo, _mm_blendv_epi8(t_negative, less_equal, sign));
+            store(vu.vcc_hi, _mm_blendv_epi8(greater_equal, t_negative, sign));
+            store(vu.acc_l, result);
+            store(vu.regs[vd], result);
+            vu.vco_lo = {};
+            vu.vco_hi = {};
+            vu.vce = {};
+        }
+        SSE41 void v_mrg(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            __m128i result = _mm_blendv_epi8(broadcast(vu.regs[vt], e), load(vu.regs[vs]), load(vu.vcc_lo));
+            store(vu.acc_l, result);
+            store(vu.regs[vd], result);
+            vu.vco_lo = {};
+            vu.vco_hi = {};
+        }
+
+        enum class Logic { AND, NAND, OR, NOR, XOR, NXOR };
+        template<Logic Type>
+        SSE41 void v_logic(VectorUnit& vu, uint32_t vd, uint32_t vs, uint32_t vt, uint32_t e) {
+            __m128i s = load(vu.regs[vs]);
+            __m128i t = broadcast(vu.regs[vt], e);
+            __m128i result;
+            if constexpr (Type == Logic::AND || Type == Logic::NAND) {
+                result = _mm_and_si128(s, t);
+            } else if constexpr (Type == Logic::OR || Type == Logic::NOR) {
+                result = _mm_or_si128(s, t);
+            } else {
+                result = _mm_xor_si128(s, t);
+            }
+            if constexpr (Type == Logic::NAND || Type == Logic::NOR || Type == Logic::NXOR) {
+                result = _mm_xor_si128(result, ones());
+            }
+            store(vu.acc_l, result);
+            store(vu.regs[vd], result);
+        }
+    }
+
+    const VectorOpTable* simd_vector_ops() {
+        static const VectorOpTable* table = []() -> const VectorOpTable* {
+            if (!__builtin_cpu_supports("sse4.1")) {
+                return nullptr;
+            }
+            // The divide unit works on one element, and VMULQ, VMACQ and VRNDP/N are only
+            // used by MPEG microcode, those keep the reference implementation
+            static VectorOpTable ops = scalar_vector_ops();
+            ops[0x00] = &v_multiply<Multiply::F, false>;
+            ops[0x01] = &v_multiply<Multiply::U, false>;
+            ops[0x04] = &v_multiply<Multiply::DL, false>;
+            ops[0x05] = &v_multiply<Multiply::DM, false>;
+            ops[0x06] = &v_multiply<Multiply::DN, false>;
+            ops[0x07] = &v_multiply<Multiply::DH, false>;
+            ops[0x08] = &v_multiply<Multiply::F, true>;
+            ops[0x09] = &v_multiply<Multiply::U, true>;
+            ops[0x0C] = &v_multiply<Multiply::DL, true>;
+            ops[0x0D] = &v_multiply<Multiply::DM, true>;
+            ops[0x0E] = &v_multiply<Multiply::DN, true>;
+            ops[0x0F] = &v_multiply<Multiply::DH, true>;
+            ops[0x10] = &v_add;
+            ops[0x11] = &v_sub;
+            ops[0x13] = &v_abs;
+            ops[0x14] = &v_addc;
+            ops[0x15] = &v_subc;
+            ops[0x20] = &v_compare<Compare::LT>;
+            ops[0x21] = &v_compare<Compare::EQ>;
+            ops[0x22] = &v_compare<Compare::NE>;
+            ops[0x23] = &v_compare<Compare::GE>;
+            ops[0x24] = &v_cl;
+            ops[0x25] = &v_ch;
+            ops[0x26] = &v_cr;
+            ops[0x27] = &v_mrg;
+            ops[0x28] = &v_logic<Logic::AND>;
+            ops[0x29] = &v_logic<Logic::NAND>;
+            ops[0x2A] = &v_logic<Logic::OR>;
+            ops[0x2B] = &v_logic<Logic::NOR>;
+            ops[0x2C] = &v_logic<Logic::XOR>;
+            ops[0x2D] = &v_logic<Logic::NXOR>;
+            return &ops;
+        }();
+        return table;
+    }
+}
+#undef SSE41
+#else
+namespace TKPEmu::N64::Devices {
+    const VectorOpTable* simd_vector_ops() {
+        return nullptr;
+    }
+}
+#endif
@@ -0,0 +1,107 @@
+#pragma once
+#ifndef TKP_N64_SCHEDULER_H
+#define TKP_N64_SCHEDULER_H
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <limits>
+
+// The first six match the MI interrupt bits
+enum class SchedulerEventType {
+    Sp = 0,
+    Si = 1,
+    Ai = 2,
+    Vi = 3,
+    Pi = 4,
+    Dp = 5,
+    Count = 6,
+    Interrupt = 7,
+    // Runs the next slice of RSP instructions
+    Rsp = 8,
+};
+
+struct SchedulerEvent {
+    SchedulerEventType type;
+    uint64_t time;
+};
+
+namespace TKPEmu::N64::Devices {
+    /**
+        Holds at most one pending event per SchedulerEventType.
+
+        Scheduling an event that is already pending moves it instead of adding
+        a duplicate, so there are never stale entries to skip. The earliest
+        deadline is cached, every operation touches at most SLOT_COUNT slots.
+    */
+    class Scheduler {
+    public:
+        static constexpr size_t SLOT_COUNT = 9;
+        static constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+        Scheduler() {
+            Clear();
+        }
+        // Schedules or reschedules an event at an absolute time
+        void Schedule(SchedulerEventType type, uint64_t time) {
+            size_t slot = static_cast<size_t>(type);
+            slots_[slot] = time;
+            if (time <= next_deadline_) {
+                next_deadline_ = time;
+                next_slot_ = slot;
+            } else if (slot == next_slot_) {
+                update_next();
+            }
+        }
+        void Cancel(SchedulerEventType type) {
+            size_t slot = static_cast<size_t>(type);
+            slots_[slot] = NEVER;
+            if (slot == next_slot_) {
+                update_next();
+            }
+        }
+        bool IsPending(SchedulerEventType type) const {
+            return slots_[static_cast<size_t>(type)] != NEVER;
+        }
+        uint64_t GetTime(SchedulerEventType type) const {
+            return slots_[static_cast<size_t>(type)];
+        }
+        // NEVER when nothing is pending
+        uint64_t GetNextDeadline() const {
+            return next_deadline_;
+        }
+        bool Empty() const {
+            return next_deadline_ == NEVER;
+        }
+        // Removes and returns the earliest event, must not be called when Empty()
+        SchedulerEvent Pop() {
+            SchedulerEvent event { static_cast<SchedulerEventType>(next_slot_), next_deadline_ };
+            slots_[next_slot_] = NEVER;
+            update_next();
+            return event;
+        }
+        void Clear() {
+            slots_.fill(NEVER);
+            next_deadline_ = NEVER;
+            next_slot_ = 0;
+        }
+        // Pending time of every event type, NEVER for the idle ones
+        const std::array<uint64_t, SLOT_COUNT>& GetSlots() const {
+            return slots_;
+        }
+    private:
+        void update_next() {
+            next_deadline_ = NEVER;
+            next_slot_ = 0;
+            for (size_t i = 0; i < SLOT_COUNT; i++) {
+                if (slots_[i] < next_deadline_) {
+                    next_deadline_ = slots_[i];
+                    next_slot_ = i;
+                }
+            }
+        }
+        std::array<uint64_t, SLOT_COUNT> slots_;
+        uint64_t next_deadline_;
+        size_t next_slot_;
+    };
+}
+#endif
@@ -5,5 +5,11 @@
 
 struct N64Args {
     std::string IPLPath;
+    // Comma separated log categories to enable, see Logger::SetCategories
+    std::string LogCategories;
+    // "threaded" runs the RSP on its own host thread, anything else keeps it on the emulation thread
+    std::string RSPMode;
+    // Comma separated tasks to run with HLE instead of on the RSP, "gfx", "audio" or "gfx,audio"
+    std::string HLE;
 };
 #endif
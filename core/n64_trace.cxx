@@ -0,0 +1,78 @@
+#include "n64_trace.hxx"
+#if N64TKP_HAS_TRACE
+
+namespace TKPEmu::N64::Devices {
+    Tracer::~Tracer() {
+        Stop();
+    }
+
+    bool Tracer::Start(const std::string& path) {
+        Stop();
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_) {
+            return false;
+        }
+        std::fwrite(&TRACE_HEADER, sizeof(TRACE_HEADER), 1, file_);
+        chunks_.resize(CHUNK_COUNT);
+        free_chunks_.clear();
+        for (size_t i = 0; i < CHUNK_COUNT; i++) {
+            chunks_[i].resize(CHUNK_RECORDS);
+            if (i != 0) {
+                free_chunks_.push_back(i);
+            }
+        }
+        current_ = 0;
+        used_ = 0;
+        open_ = false;
+        stopping_ = false;
+        writer_ = std::thread(&Tracer::writer_loop, this);
+        return true;
+    }
+
+    void Tracer::Stop() {
+        if (!file_) {
+            return;
+        }
+        {
+            std::lock_guard lock(mutex_);
+            pending_.push_back({ current_, used_ });
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        writer_.join();
+        std::fclose(file_);
+        file_ = nullptr;
+        open_ = false;
+        // No need to hold on to the chunks between traces
+        chunks_.clear();
+        chunks_.shrink_to_fit();
+    }
+
+    void Tracer::next_chunk() {
+        std::unique_lock lock(mutex_);
+        pending_.push_back({ current_, used_ });
+        cv_.notify_all();
+        cv_.wait(lock, [this] { return !free_chunks_.empty(); });
+        current_ = free_chunks_.back();
+        free_chunks_.pop_back();
+        used_ = 0;
+    }
+
+    void Tracer::writer_loop() {
+        std::unique_lock lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this] { return !pending_.empty() || stopping_; });
+            if (pending_.empty()) {
+                return;
+            }
+            PendingChunk chunk = pending_.front();
+            pending_.pop_front();
+            lock.unlock();
+            std::fwrite(chunks_[chunk.index].data(), sizeof(TraceRecord), chunk.used, file_);
+            lock.lock();
+            free_chunks_.push_back(chunk.index);
+            cv_.notify_all();
+        }
+    }
+}
+#endif
@@ -0,0 +1,138 @@
+#pragma once
+#ifndef TKP_N64_TRACE_H
+#define TKP_N64_TRACE_H
+#include <cstdint>
+#include <cstdio>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Off by default, when off the CPU doesn't even check whether a trace is running
+#ifdef N64TKP_TRACE
+#define N64TKP_HAS_TRACE 1
+#else
+#define N64TKP_HAS_TRACE 0
+#endif
+
+namespace TKPEmu::N64::Devices {
+    // Start of every trace file, followed by TraceRecords until the end of the file
+    struct TraceHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t record_size;
+    };
+    /**
+        One retired instruction. Instructions that raised an exception, load
+        interlock bubbles and discarded delay slots aren't recorded
+    */
+    struct TraceRecord {
+        enum : uint8_t {
+            REGISTER = 1 << 0, // reg was written with value
+            LOAD     = 1 << 1, // address was read
+            STORE    = 1 << 2, // value was written to address
+        };
+        static constexpr uint8_t NO_REGISTER = 0xFF;
+        uint32_t pc;
+        uint32_t instruction;
+        uint64_t value;
+        uint32_t address; // physical
+        uint8_t  reg;
+        uint8_t  flags;
+        uint16_t reserved;
+    };
+    static_assert(sizeof(TraceRecord) == 24, "TraceRecord is written to files as is");
+    constexpr TraceHeader TRACE_HEADER { { 'N', '6', '4', 'T', 'R', 'A', 'C', 'E' }, 1, sizeof(TraceRecord) };
+
+    /**
+        Records retired instructions to a binary trace file.
+
+        Records go into one of a few preallocated chunks. A full chunk is handed
+        to a writer thread and recording continues in a free one, so the CPU
+        only waits on the disk when every chunk is waiting to be written.
+        Each CPU owns its Tracer and is only run from one thread at a time, so
+        recording itself takes no locks
+    */
+    class Tracer {
+    public:
+        static constexpr size_t CHUNK_RECORDS = 0x10000;
+        static constexpr size_t CHUNK_COUNT = 4;
+        Tracer() = default;
+        ~Tracer();
+        Tracer(const Tracer&) = delete;
+        Tracer& operator=(const Tracer&) = delete;
+        // Stops the current trace, if any, and starts writing a new one to path
+        bool Start(const std::string& path);
+        // Writes out everything recorded so far and closes the file
+        void Stop();
+        bool Active() const {
+            return file_ != nullptr;
+        }
+        // Opens a record for the instruction entering EX, only valid while Active
+        TraceRecord& Begin(uint32_t pc, uint32_t instruction) {
+            if (used_ == CHUNK_RECORDS) [[unlikely]] {
+                // Switched lazily so SetLoadValue can still patch the last record of a full chunk
+                next_chunk();
+            }
+            TraceRecord& record = chunks_[current_][used_];
+            record = { pc, instruction, 0, 0, TraceRecord::NO_REGISTER, 0, 0 };
+            open_ = true;
+            return record;
+        }
+        // Keeps the record opened by Begin
+        void Commit() {
+            if (open_) {
+                open_ = false;
+                last_pc_ = chunks_[current_][used_].pc;
+                ++used_;
+            }
+        }
+        // Drops the record opened by Begin, the instruction didn't retire
+        void Cancel() {
+            open_ = false;
+        }
+        bool Open() const {
+            return open_;
+        }
+        // Address of the last committed instruction
+        uint32_t LastPC() const {
+            return last_pc_;
+        }
+        // The record opened by Begin
+        TraceRecord& Current() {
+            return chunks_[current_][used_];
+        }
+        // Fills in the value of the last committed load once DC reads it
+        void SetLoadValue(uint64_t value) {
+            if (used_ != 0) {
+                TraceRecord& record = chunks_[current_][used_ - 1];
+                if (record.flags & TraceRecord::LOAD) {
+                    record.value = value;
+                }
+            }
+        }
+    private:
+        struct PendingChunk {
+            size_t index;
+            size_t used;
+        };
+        void next_chunk();
+        void writer_loop();
+
+        std::vector<std::vector<TraceRecord>> chunks_;
+        size_t current_ = 0;
+        size_t used_ = 0;
+        bool open_ = false;
+        uint32_t last_pc_ = 0;
+        std::FILE* file_ = nullptr;
+        std::thread writer_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<PendingChunk> pending_;
+        std::vector<size_t> free_chunks_;
+        bool stopping_ = false;
+    };
+}
+#endif
@@ -7,6 +7,7 @@
 #include <array>
 #include <string>
 #include <bit>
+#include <type_traits>
 #ifndef __cpp_lib_endian
 static_assert(false && "std::endian not found");
 #endif
@@ -14,30 +15,17 @@ static_assert(false && "std::endian not found");
 namespace TKPEmu::N64 {
     constexpr uint32_t EMPTY_INSTRUCTION = 0xFFFFFFFF;
     // Note: manual here refers to vr4300 manual
-    union TLBEntry32 {
-        struct {
-            uint32_t _0_unused1 : 1;
-            uint32_t _0_V       : 1;
-            uint32_t _0_D       : 1;
-            uint32_t _0_C       : 3;
-            uint32_t _0_PFN     : 20;
-            uint32_t _0_unused2 : 6;
-            uint32_t _1_unused1 : 1;
-            uint32_t _1_V       : 1;
-            uint32_t _1_D       : 1;
-            uint32_t _1_C       : 3;
-            uint32_t _1_PFN     : 20;
-            uint32_t _1_unused2 : 6;
-            uint32_t _2_ASID    : 8;
-            uint32_t _2_unused1 : 8;
-            uint32_t _2_G       : 8;
-            uint32_t _2_VPN2    : 8;
-            uint32_t _3_unused1 : 13;
-            uint32_t _3_MASK    : 12;
-            uint32_t _3_unused2 : 7;
-            
-        } Data;
-        __m128 Full;
+    /**
+        A VR4300 TLB entry, each one maps an even/odd pair of pages
+
+        @see manual 5.2.1
+    */
+    struct TLBEntry {
+        uint32_t entry_hi;  // VPN2 and ASID, as written from EntryHi
+        uint32_t entry_lo0; // PFN, C, D and V of the even page
+        uint32_t entry_lo1; // PFN, C, D and V of the odd page
+        uint32_t page_mask;
+        bool     global;    // G bit of both EntryLo registers ANDed together
     };
     /**
         This class represents the ordering of an instruction cache line
@@ -163,6 +151,12 @@ namespace TKPEmu::N64 {
         "tge", "tgeu", "tlt", "tltu", "teq", "s65err", "tne", "s67err",
         "dsll", "s71err", "dsrl", "dsra", "dsll32", "s75err", "dsrl32", "dsra32",
     };
+    const static std::array<std::string, 32> RegImmCodes = {
+        "bltz", "bgez", "bltzl", "bgezl", "r4err", "r5err", "r6err", "r7err",
+        "tgei", "tgeiu", "tlti", "tltiu", "teqi", "r15err", "tnei", "r17err",
+        "bltzal", "bgezal", "bltzall", "bgezall", "r24err", "r25err", "r26err", "r27err",
+        "r30err", "r31err", "r32err", "r33err", "r34err", "r35err", "r36err", "r37err",
+    };
     enum class InstructionType {
         SPECIAL, REGIMM, J, JAL, BEQ, BNE, BLEZ, BGTZ,
         ADDI, ADDIU, SLTI, STLIU, ANDI, ORI, XORI, LUI,
@@ -201,6 +195,19 @@ namespace TKPEmu::N64 {
         DOUBLEWORD  = 8,
         NONE
     };
+    // The unsigned integer an access of this size moves
+    template<AccessType Size>
+    using AccessData = std::conditional_t<Size == UBYTE, uint8_t,
+                       std::conditional_t<Size == UHALFWORD, uint16_t,
+                       std::conditional_t<Size == UWORD, uint32_t, uint64_t>>>;
+    /**
+     * Guest memory is kept as host endian 32-bit words, so a word access is a
+     * single native load. Bytes and halfwords are found by flipping the low
+     * address bits, doublewords are two words with the high one first
+     */
+    constexpr uint32_t swizzle_address(uint32_t paddr, int size) {
+        return paddr ^ (size == 1 ? 3 : size == 2 ? 2 : 0);
+    }
     enum class WriteType {
         REGISTER,     // for writing to register on EX
         LATEREGISTER, // for writing to register on WB
@@ -0,0 +1,307 @@
+#pragma once
+#ifndef TKP_N64_X64EMITTER_H
+#define TKP_N64_X64EMITTER_H
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+namespace TKPEmu::N64::Devices {
+    enum X64Reg : uint8_t {
+        RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+        R8, R9, R10, R11, R12, R13, R14, R15,
+        NOREG = 0xFF
+    };
+    enum X64Cond : uint8_t {
+        CC_O  = 0x0,
+        CC_B  = 0x2,
+        CC_AE = 0x3,
+        CC_E  = 0x4,
+        CC_NE = 0x5,
+        CC_L  = 0xC,
+        CC_GE = 0xD,
+        CC_LE = 0xE,
+        CC_G  = 0xF,
+    };
+    // Extension field (ModRM.reg) of the group 1 ALU opcodes
+    enum X64AluOp : uint8_t {
+        ALU_ADD = 0,
+        ALU_OR  = 1,
+        ALU_AND = 4,
+        ALU_SUB = 5,
+        ALU_XOR = 6,
+        ALU_CMP = 7,
+    };
+    // Extension field (ModRM.reg) of the group 2 shift opcodes
+    enum X64ShiftOp : uint8_t {
+        SHIFT_ROL = 0,
+        SHIFT_SHL = 4,
+        SHIFT_SHR = 5,
+        SHIFT_SAR = 7,
+    };
+    /**
+        [base + index * scale + disp], always encoded with a 32-bit displacement
+    */
+    struct X64Mem {
+        X64Reg  base;
+        X64Reg  index = NOREG;
+        uint8_t scale = 0; // log2 of the index scale
+        int32_t disp = 0;
+    };
+    /**
+        Minimal x86-64 machine code emitter, only knows the encodings the
+        recompiler needs. Bounds are checked by the caller before each block.
+    */
+    class X64Emitter {
+    public:
+        X64Emitter(uint8_t* code) : start_(code), ptr_(code) {}
+        uint8_t* GetStart() { return start_; }
+        uint8_t* GetPtr() { return ptr_; }
+        size_t GetSize() { return ptr_ - start_; }
+
+        void mov(bool w, X64Reg dst, X64Reg src) {
+            rex(w, src, NOREG, dst);
+            emit8(0x89);
+            modrm_reg(src, dst);
+        }
+        void load(bool w, X64Reg dst, X64Mem mem) {
+            rex(w, dst, mem.index, mem.base);
+            emit8(0x8B);
+            modrm_mem(dst, mem);
+        }
+        void store(bool w, X64Mem mem, X64Reg src) {
+            rex(w, src, mem.index, mem.base);
+            emit8(0x89);
+            modrm_mem(src, mem);
+        }
+        void store8(X64Mem mem, X64Reg src) {
+            // spl/bpl/sil/dil are only reachable with a REX prefix
+            rex(false, src, mem.index, mem.base, src >= RSP);
+            emit8(0x88);
+            modrm_mem(src, mem);
+        }
+        void store16(X64Mem mem, X64Reg src) {
+            emit8(0x66);
+            rex(false, src, mem.index, mem.base);
+            emit8(0x89);
+            modrm_mem(src, mem);
+        }
+        void movzx8(X64Reg dst, X64Mem mem) {
+            rex(false, dst, mem.index, mem.base);
+            emit8(0x0F);
+            emit8(0xB6);
+            modrm_mem(dst, mem);
+        }
+        void movzx16(X64Reg dst, X64Mem mem) {
+            rex(false, dst, mem.index, mem.base);
+            emit8(0x0F);
+            emit8(0xB7);
+            modrm_mem(dst, mem);
+        }
+        void movzx8(X64Reg dst, X64Reg src) {
+            rex(false, dst, NOREG, src, src >= RSP);
+            emit8(0x0F);
+            emit8(0xB6);
+            modrm_reg(dst, src);
+        }
+        void movzx16(X64Reg dst, X64Reg src) {
+            rex(false, dst, NOREG, src);
+            emit8(0x0F);
+            emit8(0xB7);
+            modrm_reg(dst, src);
+        }
+        void movsx8(X64Reg dst, X64Reg src) {
+            rex(true, dst, NOREG, src);
+            emit8(0x0F);
+            emit8(0xBE);
+            modrm_reg(dst, src);
+        }
+        void movsx16(X64Reg dst, X64Reg src) {
+            rex(true, dst, NOREG, src);
+            emit8(0x0F);
+            emit8(0xBF);
+            modrm_reg(dst, src);
+        }
+        // Sign extends the low 32 bits of src into dst
+        void movsxd(X64Reg dst, X64Reg src) {
+            rex(true, dst, NOREG, src);
+            emit8(0x63);
+            modrm_reg(dst, src);
+        }
+        // Zero extends to 64 bits
+        void mov_imm32(X64Reg dst, uint32_t imm) {
+            rex(false, NOREG, NOREG, dst);
+            emit8(0xB8 + (dst & 7));
+            emit32(imm);
+        }
+        void mov_imm64(X64Reg dst, uint64_t imm) {
+            if (imm <= 0xFFFF'FFFF) {
+                mov_imm32(dst, imm);
+                return;
+            }
+            rex(true, NOREG, NOREG, dst);
+            emit8(0xB8 + (dst & 7));
+            emit64(imm);
+        }
+        // Sign extends imm to 64 bits
+        void mov_simm32(X64Reg dst, int32_t imm) {
+            rex(true, NOREG, NOREG, dst);
+            emit8(0xC7);
+            modrm_reg(0, dst);
+            emit32(imm);
+        }
+        void alu(X64AluOp op, bool w, X64Reg dst, X64Reg src) {
+            rex(w, src, NOREG, dst);
+            emit8((op << 3) | 0x01);
+            modrm_reg(src, dst);
+        }
+        void alu_imm(X64AluOp op, bool w, X64Reg dst, int32_t imm) {
+            rex(w, NOREG, NOREG, dst);
+            emit8(0x81);
+            modrm_reg(op, dst);
+            emit32(imm);
+        }
+        void cmp_imm8(X64Mem mem, uint8_t imm) {
+            rex(false, NOREG, mem.index, mem.base);
+            emit8(0x80);
+            modrm_mem(ALU_CMP, mem);
+            emit8(imm);
+        }
+        void shift(X64ShiftOp op, bool w, X64Reg dst, uint8_t imm) {
+            rex(w, NOREG, NOREG, dst);
+            emit8(0xC1);
+            modrm_reg(op, dst);
+            emit8(imm);
+        }
+        void shift_cl(X64ShiftOp op, bool w, X64Reg dst) {
+            rex(w, NOREG, NOREG, dst);
+            emit8(0xD3);
+            modrm_reg(op, dst);
+        }
+        // Swaps the two low bytes of a 16-bit register
+        void rol16(X64Reg dst, uint8_t imm) {
+            emit8(0x66);
+            rex(false, NOREG, NOREG, dst);
+            emit8(0xC1);
+            modrm_reg(SHIFT_ROL, dst);
+            emit8(imm);
+        }
+        void not_(bool w, X64Reg dst) {
+            rex(w, NOREG, NOREG, dst);
+            emit8(0xF7);
+            modrm_reg(2, dst);
+        }
+        void bswap(bool w, X64Reg dst) {
+            rex(w, NOREG, NOREG, dst);
+            emit8(0x0F);
+            emit8(0xC8 + (dst & 7));
+        }
+        void setcc(X64Cond cc, X64Reg dst) {
+            rex(false, NOREG, NOREG, dst, dst >= RSP);
+            emit8(0x0F);
+            emit8(0x90 + cc);
+            modrm_reg(0, dst);
+        }
+        void test(bool w, X64Reg a, X64Reg b) {
+            rex(w, b, NOREG, a);
+            emit8(0x85);
+            modrm_reg(b, a);
+        }
+        void test_imm(bool w, X64Reg dst, int32_t imm) {
+            rex(w, NOREG, NOREG, dst);
+            emit8(0xF7);
+            modrm_reg(0, dst);
+            emit32(imm);
+        }
+        void lea(X64Reg dst, X64Mem mem) {
+            rex(true, dst, mem.index, mem.base);
+            emit8(0x8D);
+            modrm_mem(dst, mem);
+        }
+        void push(X64Reg reg) {
+            rex(false, NOREG, NOREG, reg);
+            emit8(0x50 + (reg & 7));
+        }
+        void pop(X64Reg reg) {
+            rex(false, NOREG, NOREG, reg);
+            emit8(0x58 + (reg & 7));
+        }
+        void call(X64Reg reg) {
+            rex(false, NOREG, NOREG, reg);
+            emit8(0xFF);
+            modrm_reg(2, reg);
+        }
+        void ret() {
+            emit8(0xC3);
+        }
+        // Jumps return the location of their rel32 operand, to be resolved with bind()
+        size_t jcc(X64Cond cc) {
+            emit8(0x0F);
+            emit8(0x80 + cc);
+            emit32(0);
+            return GetSize() - 4;
+        }
+        size_t jmp() {
+            emit8(0xE9);
+            emit32(0);
+            return GetSize() - 4;
+        }
+        // Points a jump emitted earlier to the current location
+        void bind(size_t fixup) {
+            int32_t rel = static_cast<int32_t>(GetSize() - (fixup + 4));
+            std::memcpy(start_ + fixup, &rel, sizeof(rel));
+        }
+        // A single 5 byte instruction, leaves room for patch_jmp
+        void nop5() {
+            emit8(0x0F);
+            emit8(0x1F);
+            emit8(0x44);
+            emit8(0x00);
+            emit8(0x00);
+        }
+        // Overwrites the 5 bytes at code with a jmp to target
+        static void patch_jmp(uint8_t* code, const uint8_t* target) {
+            int32_t rel = static_cast<int32_t>(target - (code + 5));
+            code[0] = 0xE9;
+            std::memcpy(code + 1, &rel, sizeof(rel));
+        }
+    private:
+        void emit8(uint8_t value) {
+            *ptr_++ = value;
+        }
+        void emit32(uint32_t value) {
+            std::memcpy(ptr_, &value, sizeof(value));
+            ptr_ += sizeof(value);
+        }
+        void emit64(uint64_t value) {
+            std::memcpy(ptr_, &value, sizeof(value));
+            ptr_ += sizeof(value);
+        }
+        static uint8_t high_bit(X64Reg reg) {
+            return reg == NOREG ? 0 : (reg >> 3) & 1;
+        }
+        void rex(bool w, X64Reg reg, X64Reg index, X64Reg base, bool force = false) {
+            uint8_t prefix = 0x40 | (w << 3) | (high_bit(reg) << 2) | (high_bit(index) << 1) | high_bit(base);
+            if (prefix != 0x40 || force) {
+                emit8(prefix);
+            }
+        }
+        void modrm_reg(uint8_t reg, X64Reg rm) {
+            emit8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+        }
+        void modrm_mem(uint8_t reg, X64Mem mem) {
+            if (mem.index != NOREG) {
+                emit8(0x80 | ((reg & 7) << 3) | 0b100);
+                emit8((mem.scale << 6) | ((mem.index & 7) << 3) | (mem.base & 7));
+            } else if ((mem.base & 7) == RSP) {
+                emit8(0x80 | ((reg & 7) << 3) | 0b100);
+                emit8(0x24);
+            } else {
+                emit8(0x80 | ((reg & 7) << 3) | (mem.base & 7));
+            }
+            emit32(mem.disp);
+        }
+        uint8_t* start_;
+        uint8_t* ptr_;
+    };
+}
+#endif
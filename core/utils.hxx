@@ -9,7 +9,7 @@ static void SetBit(T& num, int bit, bool value) {
     num ^= (-value ^ num) & (1UL << static_cast<int>(bit));
 }
 
-static std::string CP0String(int reg) {
+static const char* CP0String(int reg) {
     switch (reg) {
         #define X(name, reg) case reg: return "CP0_"#name;
         #include "cp0_regs.def"
@@ -1,8 +1,9 @@
 #include "n64_tkpwrapper.hxx"
 #include "core/n64_tkpargs.hxx"
 #include <include/emulator_factory.h>
+#include <algorithm>
 #include <iostream>
-#include <boost/stacktrace.hpp>
+#include <string_view>
 // #include <valgrind/callgrind.h>
 
 #ifndef CALLGRIND_START_INSTRUMENTATION
@@ -25,15 +26,38 @@ namespace TKPEmu::N64 {
 	
 	bool N64_TKPWrapper::load_file(std::string path) {
 		bool ipl_loaded = ipl_loaded_;
+		const EmulatorUserData& user_data = EmulatorFactory::GetEmulatorUserData()[static_cast<int>(EmuType::N64)];
 		if (!ipl_loaded) {
-			const EmulatorUserData& user_data = EmulatorFactory::GetEmulatorUserData()[static_cast<int>(EmuType::N64)];
 			auto ipl_path = user_data.Get("IPLPath");
 			if (!std::filesystem::exists(ipl_path)) {
 				throw std::runtime_error("Missing IPL path!");
 			}
 			bool ipl_status = n64_impl_.LoadIPL(ipl_path);
 			ipl_loaded = ipl_status;
+			if (!Logger::SetCategories(user_data.Get("LogCategories"))) {
+				std::cout << "Unknown log category in " << user_data.Get("LogCategories") << std::endl;
+			}
+		}
+		n64_impl_.SetRSPMode(user_data.Get("RSPMode") == "threaded" ? Devices::RSPMode::Threaded : Devices::RSPMode::Synchronous);
+		// Comma separated, like gfx,audio
+		auto hle_setting = user_data.Get("HLE");
+		std::string_view hle = hle_setting;
+		bool graphics_hle = false;
+		bool audio_hle = false;
+		while (!hle.empty()) {
+			size_t comma = hle.find(',');
+			std::string_view name = hle.substr(0, comma);
+			hle = comma == std::string_view::npos ? std::string_view() : hle.substr(comma + 1);
+			if (name == "gfx") {
+				graphics_hle = true;
+			} else if (name == "audio") {
+				audio_hle = true;
+			} else if (!name.empty()) {
+				std::cout << "Unknown HLE task " << name << std::endl;
+			}
 		}
+		n64_impl_.SetGraphicsHLE(graphics_hle);
+		n64_impl_.SetAudioHLE(audio_hle);
 		bool opened = n64_impl_.LoadCartridge(path);
 		Loaded = opened && ipl_loaded;
 		return Loaded;
@@ -54,12 +78,12 @@ namespace TKPEmu::N64 {
 		CALLGRIND_START_INSTRUMENTATION;
 		frame_start = std::chrono::system_clock::now();
 		while (true) {
-			for (cur_instr_ = 0; cur_instr_ < INSTRS_PER_SECOND; cur_instr_++)
-				update();
+			for (cur_instr_ = 0; cur_instr_ < INSTRS_PER_SECOND;)
+				cur_instr_ += update(INSTRS_PER_SECOND - cur_instr_);
 			auto end = std::chrono::system_clock::now();
 			auto dur = std::chrono::duration_cast<std::chrono::milliseconds>(end - frame_start).count();
 			LastFrameTime = dur;
-			std::cout << std::dec << LastFrameTime << std::endl;
+			N64_LOG(Sched, "Frame took %u ms, average batch of %u cycles", LastFrameTime, static_cast<uint64_t>(n64_impl_.GetAverageBatchLength()));
 			if (Stopped.load()) {
 				return;
 			}
@@ -86,15 +110,16 @@ namespace TKPEmu::N64 {
 		}
 	}
 
-	void N64_TKPWrapper::update() {
-		try {
-			n64_impl_.Update();
-		} catch (std::exception& ex) {
-			std::cout << ex.what() << "\n" << boost::stacktrace::stacktrace() << std::endl;
-        	std::cout << "Current pc: " << n64_impl_.cpu_.pc_ << std::endl;
+	uint64_t N64_TKPWrapper::update(uint64_t max_cycles) {
+		// A frame at a time, so closing doesn't wait for a whole second of emulation
+		auto result = n64_impl_.RunUntilVBlank(std::min(max_cycles, N64::CYCLES_PER_FRAME));
+		if (result.reason == StopReason::Exception || result.reason == StopReason::Fault) [[unlikely]] {
+			std::cout << n64_impl_.GetLastError() << std::endl;
+			std::cout << "Current pc: " << n64_impl_.cpu_.pc_ << std::endl;
 			Stopped.store(true);
-			cur_instr_ = INSTRS_PER_SECOND - 1;
+			cur_instr_ = INSTRS_PER_SECOND;
 		}
+		return result.cycles;
 	}
 
 	void N64_TKPWrapper::HandleKeyDown(uint32_t key) {
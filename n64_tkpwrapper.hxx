@@ -17,7 +17,7 @@ namespace TKPEmu::N64 {
 		bool should_draw_ = false;
 		static bool ipl_loaded_;
 		int cur_instr_ = 0;
-		void update();
+		uint64_t update(uint64_t max_cycles = 1);
 		void v_extra_close() override;
 		bool& IsResized() override { return n64_impl_.cpu_.should_resize_; }
 		int GetBitdepth() override { return n64_impl_.GetBitdepth(); }
@@ -0,0 +1,179 @@
+// Runs a program that raises address errors, integer overflows and bus errors
+// in every CPU mode and checks what the exception handler saw each time:
+// ExCode, EPC and BadVAddr, and that the faulting instructions didn't write
+// their destination. Exits with 1 on a mismatch.
+// Usage: n64tkp_cpu_exception_check
+#include <cstring>
+#include "bench/bench_program.hxx"
+
+namespace TKPEmu::N64 {
+    class QA {
+    public:
+        bool Run() {
+            using namespace Bench;
+            using Devices::CPUMode;
+            Program program = build_program();
+            const char* names[] = { "interpreter", "cached", "recompiler", "functional" };
+            CPUMode modes[] = { CPUMode::Interpreter, CPUMode::CachedInterpreter, CPUMode::Recompiler, CPUMode::Functional };
+            bool passed = true;
+            for (int i = 0; i < 4; i++) {
+                auto n64 = std::make_unique<N64>();
+                if (!load_program(*n64, program)) {
+                    return false;
+                }
+                n64->SetCPUMode(modes[i]);
+                n64->Reset();
+                install_handler(*n64);
+                n64->RunCycles(20'000);
+                if (check(*n64)) {
+                    std::printf("%-12s ok\n", names[i]);
+                } else {
+                    std::printf("%-12s FAILED\n", names[i]);
+                    passed = false;
+                }
+            }
+            return passed;
+        }
+    private:
+        enum { k0 = 26, k1 = 27 };
+        // CP0 registers
+        enum { BadVAddr = 8, Cause = 13, EPC = 14 };
+        struct Record {
+            uint32_t excode;
+            uint32_t epc;
+            uint32_t badvaddr; // 0 if not checked
+        };
+        static constexpr uint32_t IPL = 0xBFC0'0000;
+        // The handler appends EPC, Cause and BadVAddr to a list, the pointer to its end lives at RECORDS
+        static constexpr uint32_t RECORDS = 0x400;
+        static constexpr uint32_t FIRST_RECORD = 0x410;
+
+        static void mfc0(Bench::Program& p, int rt, int rd) { p.r_type(0b10000 << 5, rt, rd, 0, 0); }
+        static void mtc0(Bench::Program& p, int rt, int rd) { p.r_type(0b10000 << 5 | 0b00100, rt, rd, 0, 0); }
+
+        Bench::Program build_program() {
+            using namespace Bench;
+            Program p;
+            p.lui(t0, 0x8000);
+            p.lui(t1, 0x8000);
+            p.addiu(t1, t1, FIRST_RECORD);
+            p.sw(t1, RECORDS, t0);
+            p.addiu(t2, zero, 0x77);
+            expect(p, 4, 0x8000'0101);
+            p.lw(t2, 0x101, t0);
+            expect(p, 5, 0x8000'0103);
+            p.i_type(0b101001, t0, t2, 0x103); // sh
+            expect(p, 5, 0x8000'0106);
+            p.sw(t2, 0x106, t0);
+            p.lui(t3, 0x7FFF);
+            p.i_type(0b001101, t3, t3, 0xFFFF); // ori
+            p.addiu(t4, zero, 0x44);
+            expect(p, 12, 0);
+            p.r_type(t3, t3, t4, 0, 0b100000); // add
+            expect(p, 12, 0);
+            p.i_type(0b001000, t3, t4, 1); // addi
+            // Nothing is mapped past the 8MB of RDRAM
+            p.lui(t5, 0xA080);
+            p.addiu(t6, zero, 0x66);
+            expect(p, 7, 0);
+            p.lw(t6, 0, t5);
+            // The handler resumes at the word after EPC, the nop after the target
+            size_t target = p.here() + 4;
+            p.lui(t7, IPL >> 16);
+            p.addiu(t7, t7, static_cast<int>(target * 4 + 2));
+            p.r_type(t7, 0, 0, 0, 0b001000); // jr
+            p.nop();
+            expected_.push_back({ 4, static_cast<uint32_t>(IPL + target * 4 + 2), static_cast<uint32_t>(IPL + target * 4 + 2) });
+            p.nop();
+            p.nop();
+            size_t spin = p.here();
+            p.j(spin);
+            p.nop();
+            return p;
+        }
+
+        // The next instruction p gets raises excode
+        void expect(Bench::Program& p, uint32_t excode, uint32_t badvaddr) {
+            expected_.push_back({ excode, static_cast<uint32_t>(IPL + p.here() * 4), badvaddr });
+        }
+
+        // Written straight to the general exception vector, Status.BEV is clear after Reset
+        void install_handler(N64& n64) {
+            using namespace Bench;
+            Program p;
+            p.lui(k0, 0x8000);
+            p.lw(k1, RECORDS, k0);
+            mfc0(p, k0, EPC);
+            p.sw(k0, 0, k1);
+            mfc0(p, k0, Cause);
+            p.sw(k0, 4, k1);
+            mfc0(p, k0, BadVAddr);
+            p.sw(k0, 8, k1);
+            p.addiu(k1, k1, 16);
+            p.lui(k0, 0x8000);
+            p.sw(k1, RECORDS, k0);
+            // Return to the next word, which also realigns a bad jump target
+            mfc0(p, k0, EPC);
+            p.addiu(k0, k0, 4);
+            p.r_type(0, k0, k0, 2, 0b000010); // srl
+            p.r_type(0, k0, k0, 2, 0b000000); // sll
+            mtc0(p, k0, EPC);
+            p.nop();
+            p.i_type(0b010000, 0b10000, 0, 0b011000); // eret
+            // RDRAM holds host endian words
+            auto rdram = n64.cpubus_.rdram_;
+            std::memcpy(&rdram[0x180], p.words().data(), p.words().size() * 4);
+        }
+
+        bool check(N64& n64) {
+            auto rdram = n64.cpubus_.rdram_;
+            auto read = [&](uint32_t address) {
+                uint32_t word;
+                std::memcpy(&word, &rdram[address], sizeof(word));
+                return word;
+            };
+            bool passed = true;
+            if (n64.cpu_.fault_.type != Devices::FaultType::None) {
+                std::printf("  faulted at 0x%08x\n", n64.cpu_.fault_.pc);
+                passed = false;
+            }
+            uint32_t end = read(RECORDS) - 0x8000'0000;
+            uint32_t count = end >= FIRST_RECORD ? (end - FIRST_RECORD) / 16 : 0;
+            if (count != expected_.size()) {
+                std::printf("  %u exceptions, expected %zu\n", count, expected_.size());
+                passed = false;
+            }
+            for (size_t i = 0; i < std::min<size_t>(count, expected_.size()); i++) {
+                uint32_t record = FIRST_RECORD + i * 16;
+                const Record& expected = expected_[i];
+                uint32_t excode = (read(record + 4) >> 2) & 0x1F;
+                uint32_t epc = read(record);
+                uint32_t badvaddr = read(record + 8);
+                if (excode != expected.excode || epc != expected.epc || (expected.badvaddr && badvaddr != expected.badvaddr)) {
+                    std::printf("  exception %zu: ExCode %u EPC 0x%08x BadVAddr 0x%08x, expected ExCode %u EPC 0x%08x BadVAddr 0x%08x\n",
+                        i, excode, epc, badvaddr, expected.excode, expected.epc, expected.badvaddr);
+                    passed = false;
+                }
+            }
+            // The faulting instructions leave their destinations alone
+            const auto& gpr = n64.cpu_.gpr_regs_;
+            uint64_t values[] = { gpr[Bench::t2].UD, gpr[Bench::t4].UD, gpr[Bench::t6].UD };
+            uint64_t untouched[] = { 0x77, 0x44, 0x66 };
+            for (int i = 0; i < 3; i++) {
+                if (values[i] != untouched[i]) {
+                    std::printf("  destination written: 0x%016llx, expected 0x%llx\n",
+                        static_cast<unsigned long long>(values[i]), static_cast<unsigned long long>(untouched[i]));
+                    passed = false;
+                }
+            }
+            return passed;
+        }
+
+        std::vector<Record> expected_;
+    };
+}
+
+int main() {
+    TKPEmu::N64::QA qa;
+    return qa.Run() ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+// Runs every vector unit op through both the SIMD kernels and the scalar
+// reference with random registers, flags and accumulators and reports the
+// first state that differs. Exits with 1 on a mismatch.
+// Usage: n64tkp_rsp_vu_check [iterations per op] [seed]
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "core/n64_rsp_vu.hxx"
+
+using namespace TKPEmu::N64::Devices;
+
+namespace {
+    // Edge values show up far more often than a uniform draw would pick them
+    constexpr uint16_t EDGES[] = { 0x0000, 0x0001, 0x7FFF, 0x8000, 0x8001, 0xFFFF, 0xFFFE, 0x0002 };
+
+    uint16_t random_element(std::mt19937& rng) {
+        if (rng() % 4 == 0) {
+            return EDGES[rng() % std::size(EDGES)];
+        }
+        return static_cast<uint16_t>(rng());
+    }
+
+    void randomize(VectorRegister& reg, std::mt19937& rng) {
+        for (auto& element : reg.elements) {
+            element = random_element(rng);
+        }
+    }
+
+    void randomize_flags(VectorRegister& reg, std::mt19937& rng) {
+        for (auto& element : reg.elements) {
+            element = (rng() & 1) ? 0xFFFF : 0;
+        }
+    }
+
+    VectorUnit random_state(std::mt19937& rng) {
+        VectorUnit vu;
+        for (auto& reg : vu.regs) {
+            randomize(reg, rng);
+        }
+        randomize(vu.acc_h, rng);
+        randomize(vu.acc_m, rng);
+        randomize(vu.acc_l, rng);
+        randomize_flags(vu.vco_lo, rng);
+        randomize_flags(vu.vco_hi, rng);
+        randomize_flags(vu.vcc_lo, rng);
+        randomize_flags(vu.vcc_hi, rng);
+        randomize_flags(vu.vce, rng);
+        vu.div_in = random_element(rng);
+        vu.div_out = random_element(rng);
+        vu.div_dp = rng() & 1;
+        return vu;
+    }
+
+    void print_register(const char* name, const VectorRegister& expected, const VectorRegister& actual) {
+        if (expected == actual) {
+            return;
+        }
+        std::printf("  %-6s expected", name);
+        for (auto element : expected.elements) {
+            std::printf(" %04x", element);
+        }
+        std::printf("\n  %-6s got     ", "");
+        for (auto element : actual.elements) {
+            std::printf(" %04x", element);
+        }
+        std::printf("\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 0) : 100000;
+    uint32_t seed = argc > 2 ? std::strtoul(argv[2], nullptr, 0) : 1;
+    const VectorOpTable* simd = simd_vector_ops();
+    if (!simd) {
+        std::printf("No SIMD vector unit on this host, nothing to check\n");
+        return 0;
+    }
+    const VectorOpTable& scalar = scalar_vector_ops();
+    std::mt19937 rng(seed);
+    for (uint32_t op = 0; op < 64; op++) {
+        if ((*simd)[op] == scalar[op]) {
+            continue;
+        }
+        for (uint32_t i = 0; i < iterations; i++) {
+            VectorUnit expected = random_state(rng);
+            // Operands alias the destination now and then, the kernels have to read before writing
+            uint32_t vd = rng() % 32, vs = rng() % 32, vt = rng() % 32, e = rng() % 16;
+            if (rng() % 8 == 0) {
+                vs = vd;
+            }
+            if (rng() % 8 == 0) {
+                vt = vd;
+            }
+            VectorUnit actual = expected;
+            VectorUnit before = expected;
+            scalar[op](expected, vd, vs, vt, e);
+            (*simd)[op](actual, vd, vs, vt, e);
+            if (expected == actual) {
+                continue;
+            }
+            std::printf("Mismatch in op 0x%02x (vd %u, vs %u, vt %u, e %u)\n", op, vd, vs, vt, e);
+            std::printf("  vs      ");
+            for (auto element : before.regs[vs].elements) {
+                std::printf(" %04x", element);
+            }
+            std::printf("\n  vt      ");
+            for (auto element : before.regs[vt].elements) {
+                std::printf(" %04x", element);
+            }
+            std::printf("\n");
+            for (uint32_t reg = 0; reg < 32; reg++) {
+                char name[8];
+                std::snprintf(name, sizeof(name), "v%u", reg);
+                print_register(name, expected.regs[reg], actual.regs[reg]);
+            }
+            print_register("acc_h", expected.acc_h, actual.acc_h);
+            print_register("acc_m", expected.acc_m, actual.acc_m);
+            print_register("acc_l", expected.acc_l, actual.acc_l);
+            print_register("vco_lo", expected.vco_lo, actual.vco_lo);
+            print_register("vco_hi", expected.vco_hi, actual.vco_hi);
+            print_register("vcc_lo", expected.vcc_lo, actual.vcc_lo);
+            print_register("vcc_hi", expected.vcc_hi, actual.vcc_hi);
+            print_register("vce", expected.vce, actual.vce);
+            return 1;
+        }
+    }
+    std::printf("SIMD vector unit matches the reference\n");
+    return 0;
+}
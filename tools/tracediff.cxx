@@ -0,0 +1,133 @@
+// Prints a trace recorded with N64::StartTrace, or compares two of them and
+// prints where they first diverge.
+// Usage: n64tkp_tracediff <trace> [other trace]
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <string>
+#include "core/n64_trace.hxx"
+#include "core/n64_types.hxx"
+
+using namespace TKPEmu::N64;
+using namespace TKPEmu::N64::Devices;
+
+namespace {
+    constexpr size_t CONTEXT = 8;
+
+    class TraceReader {
+    public:
+        explicit TraceReader(const char* path) : ifs_(path, std::ios::binary) {
+            TraceHeader header {};
+            ifs_.read(reinterpret_cast<char*>(&header), sizeof(header));
+            valid_ = ifs_ && std::memcmp(header.magic, TRACE_HEADER.magic, sizeof(header.magic)) == 0 &&
+                     header.version == TRACE_HEADER.version && header.record_size == sizeof(TraceRecord);
+            if (!valid_) {
+                std::fprintf(stderr, "%s is not a trace file\n", path);
+            }
+        }
+        bool Valid() const {
+            return valid_;
+        }
+        bool Next(TraceRecord& record) {
+            return static_cast<bool>(ifs_.read(reinterpret_cast<char*>(&record), sizeof(record)));
+        }
+    private:
+        std::ifstream ifs_;
+        bool valid_ = false;
+    };
+
+    std::string mnemonic(uint32_t word) {
+        Instruction instr;
+        instr.Full = word;
+        switch (instr.IType.op) {
+            case 0b000000: return SpecialCodes[instr.RType.func];
+            case 0b000001: return RegImmCodes[instr.RType.rt];
+            default:       return OperationCodes[instr.IType.op];
+        }
+    }
+
+    void print(const char* prefix, uint64_t index, const TraceRecord& record) {
+        std::printf("%s%10llu  %08x  %08x %-8s", prefix, static_cast<unsigned long long>(index),
+            record.pc, record.instruction, mnemonic(record.instruction).c_str());
+        if (record.flags & TraceRecord::REGISTER) {
+            std::printf("  r%-2d = %016llx", record.reg, static_cast<unsigned long long>(record.value));
+        }
+        if (record.flags & TraceRecord::LOAD) {
+            std::printf("  load [%08x]", record.address);
+        }
+        if (record.flags & TraceRecord::STORE) {
+            std::printf("  store [%08x] = %016llx", record.address, static_cast<unsigned long long>(record.value));
+        }
+        std::printf("\n");
+    }
+
+    bool same(const TraceRecord& a, const TraceRecord& b) {
+        return a.pc == b.pc && a.instruction == b.instruction && a.value == b.value &&
+               a.address == b.address && a.reg == b.reg && a.flags == b.flags;
+    }
+
+    int dump(TraceReader& reader) {
+        TraceRecord record;
+        for (uint64_t index = 0; reader.Next(record); index++) {
+            print("", index, record);
+        }
+        return 0;
+    }
+
+    int diff(TraceReader& a, TraceReader& b) {
+        std::deque<TraceRecord> history;
+        TraceRecord ra, rb;
+        uint64_t index = 0;
+        while (true) {
+            bool has_a = a.Next(ra);
+            bool has_b = b.Next(rb);
+            if (!has_a && !has_b) {
+                std::printf("Traces match, %llu instructions\n", static_cast<unsigned long long>(index));
+                return 0;
+            }
+            if (has_a != has_b || !same(ra, rb)) {
+                std::printf("First divergence at instruction %llu\n", static_cast<unsigned long long>(index));
+                uint64_t first = index - history.size();
+                for (size_t i = 0; i < history.size(); i++) {
+                    print("  ", first + i, history[i]);
+                }
+                if (has_a) {
+                    print("< ", index, ra);
+                } else {
+                    std::printf("< end of trace\n");
+                }
+                if (has_b) {
+                    print("> ", index, rb);
+                } else {
+                    std::printf("> end of trace\n");
+                }
+                return 1;
+            }
+            history.push_back(ra);
+            if (history.size() > CONTEXT) {
+                history.pop_front();
+            }
+            index++;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <trace> [other trace]\n", argv[0]);
+        return 2;
+    }
+    TraceReader a(argv[1]);
+    if (!a.Valid()) {
+        return 2;
+    }
+    if (argc < 3) {
+        return dump(a);
+    }
+    TraceReader b(argv[2]);
+    if (!b.Valid()) {
+        return 2;
+    }
+    return diff(a, b);
+}